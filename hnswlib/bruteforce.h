@@ -2,6 +2,9 @@
 #include <unordered_map>
 #include <fstream>
 #include <mutex>
+#include <thread>
+#include <atomic>
+#include <exception>
 #include <algorithm>
 #include <assert.h>
 
@@ -9,6 +12,11 @@ namespace hnswlib {
 template<typename dist_t>
 class BruteforceSearch : public AlgorithmInterface<dist_t> {
  public:
+    // queries of searchKnnBatch scored against a block of rows while the block is in cache
+    static const size_t QUERY_TILE = 8;
+    // bytes of stored elements per block
+    static const size_t BLOCK_BYTES = 256 * 1024;
+
     char *data_;
     size_t maxelements_;
     size_t cur_element_count;
@@ -16,6 +24,7 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
 
     size_t data_size_;
     DISTFUNC <dist_t> fstdistfunc_;
+    DISTFUNC_BATCH<dist_t> fstdistfunc_batch_{nullptr};
     void *dist_func_param_;
     std::mutex index_lock;
 
@@ -47,6 +56,7 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
         maxelements_ = maxElements;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        fstdistfunc_batch_ = s->get_dist_func_batch();
         dist_func_param_ = s->get_dist_func_param();
         size_per_element_ = data_size_ + sizeof(labeltype);
         data_ = (char *) malloc(maxElements * size_per_element_);
@@ -91,9 +101,9 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
             return;
         }
 
+        size_t cur_c = found->second;
         dict_external_to_internal.erase(found);
 
-        size_t cur_c = found->second;
         labeltype label = *((labeltype*)(data_ + size_per_element_ * (cur_element_count-1) + data_size_));
         dict_external_to_internal[label] = cur_c;
         memcpy(data_ + size_per_element_ * cur_c,
@@ -105,33 +115,73 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
 
     std::priority_queue<std::pair<dist_t, labeltype >>
     searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
-        assert(k <= cur_element_count);
-        std::priority_queue<std::pair<dist_t, labeltype >> topResults;
-        if (cur_element_count == 0) return topResults;
-        for (int i = 0; i < k; i++) {
-            dist_t dist = fstdistfunc_(query_data, data_ + size_per_element_ * i, dist_func_param_);
-            labeltype label = *((labeltype*) (data_ + size_per_element_ * i + data_size_));
-            if ((!isIdAllowed) || (*isIdAllowed)(label)) {
-                topResults.emplace(dist, label);
-            }
-        }
-        dist_t lastdist = topResults.empty() ? std::numeric_limits<dist_t>::max() : topResults.top().first;
-        for (int i = k; i < cur_element_count; i++) {
-            dist_t dist = fstdistfunc_(query_data, data_ + size_per_element_ * i, dist_func_param_);
-            if (dist <= lastdist) {
-                labeltype label = *((labeltype *) (data_ + size_per_element_ * i + data_size_));
-                if ((!isIdAllowed) || (*isIdAllowed)(label)) {
-                    topResults.emplace(dist, label);
-                }
-                if (topResults.size() > k)
-                    topResults.pop();
+        std::vector<std::pair<dist_t, labeltype>> topResults;
+        if (k > 0)
+            scanRows(query_data, 1, 0, cur_element_count, k, isIdAllowed, &topResults);
+        return std::priority_queue<std::pair<dist_t, labeltype >>(std::less<std::pair<dist_t, labeltype>>(),
+                                                                 std::move(topResults));
+    }
+
 
-                if (!topResults.empty()) {
-                    lastdist = topResults.top().first;
+    /*
+     * Searches nq queries stored one after another (data_size_ bytes each) and writes the k nearest
+     * neighbors of query i, closer first, to labels[i * k ...] and distances[i * k ...].
+     * Rows with fewer than k results are padded with label (labeltype)-1 and the largest dist_t.
+     * Returns the smallest number of results found for a query.
+     *
+     * Queries are scored in tiles of QUERY_TILE against blocks of rows, so each block is read from
+     * memory once per tile. With at least one tile per thread the threads take whole tiles; otherwise
+     * every thread scans a slice of the rows and the top k of the slices are merged.
+     */
+    size_t searchKnnBatch(
+        const void *queries,
+        size_t nq,
+        size_t k,
+        labeltype *labels,
+        dist_t *distances,
+        BaseFilterFunctor* isIdAllowed = nullptr,
+        size_t num_threads = 1) const {
+        if (k == 0 || nq == 0)
+            return k;
+        num_threads = std::max(num_threads, (size_t) 1);
+        size_t num_rows = cur_element_count;
+        size_t num_tiles = (nq + QUERY_TILE - 1) / QUERY_TILE;
+        std::vector<size_t> found(nq);
+
+        if (num_tiles >= num_threads) {
+            std::atomic<size_t> next_tile(0);
+            runThreads(num_threads, [&](size_t) {
+                std::vector<std::vector<std::pair<dist_t, labeltype>>> heaps(QUERY_TILE);
+                for (size_t tile = next_tile++; tile < num_tiles; tile = next_tile++) {
+                    size_t q_begin = tile * QUERY_TILE;
+                    size_t q_end = std::min(nq, q_begin + QUERY_TILE);
+                    for (size_t q = q_begin; q < q_end; q++)
+                        heaps[q - q_begin].clear();
+                    scanRows((const char *) queries + q_begin * data_size_, q_end - q_begin, 0, num_rows, k,
+                             isIdAllowed, heaps.data());
+                    for (size_t q = q_begin; q < q_end; q++)
+                        found[q] = writeResults(heaps[q - q_begin], k, labels + q * k, distances + q * k);
                 }
+            });
+        } else {
+            // fewer than QUERY_TILE * num_threads queries, so they are all scored together
+            std::vector<std::vector<std::vector<std::pair<dist_t, labeltype>>>> heaps(num_threads);
+            runThreads(num_threads, [&](size_t thread_id) {
+                heaps[thread_id].resize(nq);
+                size_t row_begin = num_rows * thread_id / num_threads;
+                size_t row_end = num_rows * (thread_id + 1) / num_threads;
+                scanRows(queries, nq, row_begin, row_end, k, isIdAllowed, heaps[thread_id].data());
+            });
+            for (size_t q = 0; q < nq; q++) {
+                std::vector<std::pair<dist_t, labeltype>> &merged = heaps[0][q];
+                for (size_t t = 1; t < num_threads; t++) {
+                    for (const std::pair<dist_t, labeltype> &result : heaps[t][q])
+                        pushBounded(merged, k, result.first, result.second);
+                }
+                found[q] = writeResults(merged, k, labels + q * k, distances + q * k);
             }
         }
-        return topResults;
+        return *std::min_element(found.begin(), found.end());
     }
 
 
@@ -159,6 +209,7 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
 
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        fstdistfunc_batch_ = s->get_dist_func_batch();
         dist_func_param_ = s->get_dist_func_param();
         size_per_element_ = data_size_ + sizeof(labeltype);
         data_ = (char *) malloc(maxelements_ * size_per_element_);
@@ -169,5 +220,113 @@ class BruteforceSearch : public AlgorithmInterface<dist_t> {
 
         input.close();
     }
+
+ private:
+    // Keeps the k smallest (distance, label) pairs in the max-heap heap, so ties are broken the same
+    // way however the rows are split between threads
+    static void pushBounded(std::vector<std::pair<dist_t, labeltype>> &heap, size_t k, dist_t dist, labeltype label) {
+        if (heap.size() < k) {
+            heap.emplace_back(dist, label);
+            std::push_heap(heap.begin(), heap.end());
+        } else if (std::make_pair(dist, label) < heap.front()) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = std::make_pair(dist, label);
+            std::push_heap(heap.begin(), heap.end());
+        }
+    }
+
+
+    /*
+     * Scores the nq queries stored from queries on against rows [row_begin, row_end), keeping the
+     * k closest allowed rows of query q in heaps[q]. Rows are scored a block at a time with the
+     * batch kernel of the space when it has one.
+     */
+    void scanRows(
+        const void *queries,
+        size_t nq,
+        size_t row_begin,
+        size_t row_end,
+        size_t k,
+        BaseFilterFunctor* isIdAllowed,
+        std::vector<std::pair<dist_t, labeltype>> *heaps) const {
+        size_t block_rows = std::max((size_t) 16, BLOCK_BYTES / size_per_element_);
+        std::vector<const void *> block_data(block_rows);
+        std::vector<labeltype> block_labels(block_rows);
+        std::vector<dist_t> block_dists(block_rows);
+
+        for (size_t block = row_begin; block < row_end; block += block_rows) {
+            // rows the filter rejects are left out of the block
+            size_t n = 0;
+            size_t block_end = std::min(row_end, block + block_rows);
+            for (size_t i = block; i < block_end; i++) {
+                labeltype label = *((labeltype *) (data_ + size_per_element_ * i + data_size_));
+                if (isIdAllowed && !(*isIdAllowed)(label))
+                    continue;
+                block_data[n] = data_ + size_per_element_ * i;
+                block_labels[n] = label;
+                n++;
+            }
+            if (n == 0)
+                continue;
+
+            for (size_t q = 0; q < nq; q++) {
+                const void *query_data = (const char *) queries + q * data_size_;
+                if (fstdistfunc_batch_ != nullptr) {
+                    fstdistfunc_batch_(query_data, block_data.data(), n, dist_func_param_, block_dists.data());
+                } else {
+                    for (size_t j = 0; j < n; j++)
+                        block_dists[j] = fstdistfunc_(query_data, block_data[j], dist_func_param_);
+                }
+                std::vector<std::pair<dist_t, labeltype>> &heap = heaps[q];
+                for (size_t j = 0; j < n; j++) {
+                    if (heap.size() < k || block_dists[j] <= heap.front().first)
+                        pushBounded(heap, k, block_dists[j], block_labels[j]);
+                }
+            }
+        }
+    }
+
+
+    // Sorts a heap of pushBounded into a result row of searchKnnBatch, returns the number of results
+    static size_t writeResults(std::vector<std::pair<dist_t, labeltype>> &heap, size_t k,
+                               labeltype *row_labels, dist_t *row_distances) {
+        std::sort_heap(heap.begin(), heap.end());
+        for (size_t i = 0; i < heap.size(); i++) {
+            row_distances[i] = heap[i].first;
+            row_labels[i] = heap[i].second;
+        }
+        for (size_t i = heap.size(); i < k; i++) {
+            row_labels[i] = (labeltype) -1;
+            row_distances[i] = std::numeric_limits<dist_t>::max();
+        }
+        return heap.size();
+    }
+
+
+    // Runs fn(thread_id) on num_threads threads and rethrows the last exception one of them threw
+    template<class Function>
+    static void runThreads(size_t num_threads, Function fn) {
+        if (num_threads == 1) {
+            fn(0);
+            return;
+        }
+        std::vector<std::thread> threads;
+        std::exception_ptr lastException = nullptr;
+        std::mutex lastExceptMutex;
+        for (size_t thread_id = 0; thread_id < num_threads; thread_id++) {
+            threads.push_back(std::thread([&, thread_id] {
+                try {
+                    fn(thread_id);
+                } catch (...) {
+                    std::unique_lock<std::mutex> lastExcepLock(lastExceptMutex);
+                    lastException = std::current_exception();
+                }
+            }));
+        }
+        for (auto &thread : threads)
+            thread.join();
+        if (lastException)
+            std::rethrow_exception(lastException);
+    }
 };
 }  // namespace hnswlib
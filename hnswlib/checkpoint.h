@@ -0,0 +1,273 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "hnswlib.h"
+#include "mmap_file.h"
+
+namespace hnswlib {
+
+/*
+ * One bit per internal id, set by the writers of an element's lists, vector, label or deleted mark
+ * since the last checkpoint. mark() may run concurrently with itself; resize, clear and ids must not
+ * run concurrently with updates.
+ */
+class DirtyElements {
+    std::unique_ptr<std::atomic<uint64_t>[]> words_;
+    size_t num_words_{0};
+
+ public:
+    // Keeps the bits of the ids below both sizes
+    void resize(size_t num_elements) {
+        size_t num_words = (num_elements + 63) / 64;
+        std::unique_ptr<std::atomic<uint64_t>[]> words(new std::atomic<uint64_t>[num_words]);
+        for (size_t w = 0; w < num_words; w++)
+            words[w].store(w < num_words_ ? words_[w].load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+        words_.swap(words);
+        num_words_ = num_words;
+    }
+
+    void mark(tableint id) {
+        std::atomic<uint64_t> &word = words_[id >> 6];
+        uint64_t bit = (uint64_t) 1 << (id & 63);
+        // most writes hit elements that are dirty already, reading first keeps the line shared
+        if ((word.load(std::memory_order_relaxed) & bit) == 0)
+            word.fetch_or(bit, std::memory_order_relaxed);
+    }
+
+    void clear() {
+        for (size_t w = 0; w < num_words_; w++)
+            words_[w].store(0, std::memory_order_relaxed);
+    }
+
+    bool empty() const {
+        for (size_t w = 0; w < num_words_; w++) {
+            if (words_[w].load(std::memory_order_relaxed) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    // The marked ids below num_elements in increasing order
+    std::vector<tableint> ids(size_t num_elements) const {
+        std::vector<tableint> result;
+        for (size_t w = 0; w < num_words_ && w * 64 < num_elements; w++) {
+            uint64_t word = words_[w].load(std::memory_order_relaxed);
+            for (size_t bit = 0; word != 0; bit++, word >>= 1) {
+                if ((word & 1) && w * 64 + bit < num_elements)
+                    result.push_back((tableint) (w * 64 + bit));
+            }
+        }
+        return result;
+    }
+};
+
+
+/*
+ * Append-only log of the updates of an index since its last checkpoint (see
+ * HierarchicalNSW::openWriteAheadLog).
+ *
+ * header: magic | version | base id | sequence | vector size
+ * record: body size | checksum of the body | body = operation | flags | label | vector (ADD only)
+ *
+ * The base id and the sequence name the checkpoint the log continues: the snapshot saveIndex wrote
+ * and the number of deltas applied on top of it. Each record is flushed to the operating system as
+ * it is appended, sync() also flushes it to the storage. A record cut short or damaged by a crash
+ * ends the log; it and everything after it are dropped.
+ */
+class WriteAheadLog {
+ public:
+    enum Operation : uint8_t {
+        ADD = 1,
+        MARK_DELETE = 2,
+        UNMARK_DELETE = 3
+    };
+    static const uint8_t REPLACE_DELETED = 0x01;
+
+    struct Header {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t base_id;
+        uint64_t sequence;
+        uint64_t vector_size;
+    };
+
+    struct Record {
+        Operation operation;
+        uint8_t flags;
+        labeltype label;
+        const char *data;  // the vector of an ADD, valid during the callback
+    };
+
+    static uint64_t logMagic() { return 0x314c415757534e48ULL; }  // "HNSWWAL1" in file byte order
+    static uint32_t logVersion() { return 1; }
+
+ private:
+    static const size_t RECORD_HEADER_SIZE = 2 * sizeof(uint32_t);
+    static const size_t BODY_HEADER_SIZE = 2 * sizeof(uint8_t) + sizeof(labeltype);
+
+    std::string location_;
+    FILE *file_{nullptr};
+    size_t vector_size_{0};
+    std::mutex lock_;
+    std::vector<char> buffer_;
+
+    static uint32_t checksum(const char *data, size_t size) {
+        uint32_t hash = 2166136261u;  // FNV-1a
+        for (size_t i = 0; i < size; i++)
+            hash = (hash ^ (unsigned char) data[i]) * 16777619u;
+        return hash;
+    }
+
+    static bool readHeader(std::ifstream &input, Header &header) {
+        input.read((char *) &header, sizeof(header));
+        return input && header.magic == logMagic() && header.version == logVersion();
+    }
+
+    void writeHeader(uint32_t base_id, uint64_t sequence) {
+        Header header = {logMagic(), logVersion(), base_id, sequence, vector_size_};
+        if (fwrite(&header, sizeof(header), 1, file_) != 1 || fflush(file_) != 0)
+            throw std::runtime_error("Cannot write the write-ahead log");
+    }
+
+    void closeFile() {
+        if (file_ != nullptr)
+            fclose(file_);
+        file_ = nullptr;
+    }
+
+    // Cuts the file to its first size bytes
+    static void truncateFile(const std::string &location, uint64_t size) {
+#if defined(HNSWLIB_HAVE_MMAP)
+        if (truncate(location.c_str(), (off_t) size) != 0)
+            throw std::runtime_error("Cannot truncate the write-ahead log");
+#else
+        std::vector<char> bytes(size);
+        {
+            std::ifstream input(location, std::ios::binary);
+            input.read(bytes.data(), size);
+            if (!input)
+                throw std::runtime_error("Cannot read the write-ahead log");
+        }
+        std::ofstream output(location, std::ios::binary | std::ios::trunc);
+        output.write(bytes.data(), size);
+        if (!output)
+            throw std::runtime_error("Cannot truncate the write-ahead log");
+#endif
+    }
+
+ public:
+    /*
+     * Opens the log at location to append the updates that follow the checkpoint (base_id, sequence).
+     * A log of the same checkpoint is continued after its last whole record, any other file is
+     * replaced by an empty log.
+     */
+    WriteAheadLog(const std::string &location, uint32_t base_id, uint64_t sequence, size_t vector_size)
+        : location_(location), vector_size_(vector_size) {
+        Header header;
+        uint64_t end = scan(location, header, [](const Record &) {});
+        if (end != 0 && header.base_id == base_id && header.sequence == sequence && header.vector_size == vector_size) {
+            truncateFile(location, end);
+            file_ = fopen(location.c_str(), "ab");
+            if (file_ == nullptr)
+                throw std::runtime_error("Cannot open the write-ahead log");
+            return;
+        }
+        restart(base_id, sequence);
+    }
+
+    ~WriteAheadLog() {
+        closeFile();
+    }
+
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    // Drops all records, the log continues the checkpoint (base_id, sequence)
+    void restart(uint32_t base_id, uint64_t sequence) {
+        std::unique_lock <std::mutex> lock(lock_);
+        closeFile();
+        file_ = fopen(location_.c_str(), "wb");
+        if (file_ == nullptr)
+            throw std::runtime_error("Cannot open the write-ahead log");
+        writeHeader(base_id, sequence);
+    }
+
+    // data is the vector of an ADD (vector_size bytes), ignored otherwise
+    void append(Operation operation, labeltype label, const void *data = nullptr, uint8_t flags = 0) {
+        std::unique_lock <std::mutex> lock(lock_);
+        uint32_t body_size = (uint32_t) (BODY_HEADER_SIZE + (operation == ADD ? vector_size_ : 0));
+        buffer_.resize(RECORD_HEADER_SIZE + body_size);
+        char *body = buffer_.data() + RECORD_HEADER_SIZE;
+        body[0] = (char) operation;
+        body[1] = (char) flags;
+        memcpy(body + 2, &label, sizeof(labeltype));
+        if (operation == ADD)
+            memcpy(body + BODY_HEADER_SIZE, data, vector_size_);
+        uint32_t sum = checksum(body, body_size);
+        memcpy(buffer_.data(), &body_size, sizeof(uint32_t));
+        memcpy(buffer_.data() + sizeof(uint32_t), &sum, sizeof(uint32_t));
+        if (fwrite(buffer_.data(), buffer_.size(), 1, file_) != 1 || fflush(file_) != 0)
+            throw std::runtime_error("Cannot write the write-ahead log");
+    }
+
+    // Waits until the appended records are on the storage
+    void sync() {
+        std::unique_lock <std::mutex> lock(lock_);
+        if (fflush(file_) != 0)
+            throw std::runtime_error("Cannot write the write-ahead log");
+#if defined(HNSWLIB_HAVE_MMAP)
+        if (fsync(fileno(file_)) != 0)
+            throw std::runtime_error("Cannot sync the write-ahead log");
+#endif
+    }
+
+    /*
+     * Reads the header of the log at location and calls fn(record) for its whole records in order.
+     * Returns the size of the valid part of the file, 0 if there is no log with a valid header there.
+     */
+    template<typename Function>
+    static uint64_t scan(const std::string &location, Header &header, Function fn) {
+        std::ifstream input(location, std::ios::binary);
+        if (!input.is_open() || !readHeader(input, header))
+            return 0;
+        uint64_t end = sizeof(Header);
+        std::vector<char> body;
+        while (true) {
+            uint32_t record_header[2];
+            input.read((char *) record_header, sizeof(record_header));
+            if (!input)
+                break;
+            uint32_t body_size = record_header[0];
+            if (body_size != BODY_HEADER_SIZE && body_size != BODY_HEADER_SIZE + header.vector_size)
+                break;
+            body.resize(body_size);
+            input.read(body.data(), body_size);
+            if (!input || checksum(body.data(), body_size) != record_header[1])
+                break;
+
+            Record record;
+            record.operation = (Operation) body[0];
+            record.flags = (uint8_t) body[1];
+            memcpy(&record.label, body.data() + 2, sizeof(labeltype));
+            record.data = body.data() + BODY_HEADER_SIZE;
+            bool is_add = record.operation == ADD;
+            if ((is_add && body_size == BODY_HEADER_SIZE) || (!is_add && body_size != BODY_HEADER_SIZE) ||
+                (!is_add && record.operation != MARK_DELETE && record.operation != UNMARK_DELETE))
+                break;
+            fn(record);
+            end += RECORD_HEADER_SIZE + body_size;
+        }
+        return end;
+    }
+};
+
+}  // namespace hnswlib
@@ -0,0 +1,764 @@
+#pragma once
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "hnswalg.h"
+#include "file_reader.h"
+#include "resumable_search.h"
+
+#if defined(__linux__)
+#include <linux/aio_abi.h>
+#include <sys/syscall.h>
+#endif
+
+namespace hnswlib {
+
+/*
+ * The file of a DiskIndex:
+ * header | codes | labels | upper layer offsets | upper layers | nodes
+ *
+ * Everything up to the nodes is read into memory when the index is opened: the vectors as the
+ * space of the index stores them (SQ / PQ codes, or the vectors of a space that does not encode
+ * them), the labels and the upper layers. The nodes stay on disk. A node is the base-layer link
+ * list of an element followed by its exact vector; nodes never straddle a sector, several small
+ * ones share a sector and a large one takes whole sectors, so that one node is one aligned read.
+ */
+struct DiskIndexHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t sector_size;
+    uint64_t num_elements;
+    uint64_t code_size;    // bytes of an element in the space of the index
+    uint64_t vector_size;  // bytes of an exact vector
+    uint64_t max_m;
+    uint64_t max_m0;
+    int32_t maxlevel;
+    uint32_t enterpoint_node;
+    uint64_t node_size;
+    uint64_t nodes_per_sector;
+    uint64_t sectors_per_node;  // one of the two is 1
+    uint64_t codes_offset;
+    uint64_t labels_offset;
+    uint64_t upper_offsets_offset;
+    uint64_t upper_offset;
+    uint64_t nodes_offset;
+    uint64_t file_size;
+};
+
+static const uint64_t DISK_INDEX_MAGIC = 0x314b534457534e48ULL;  // "HNSWDSK1" in file byte order
+static const uint32_t DISK_INDEX_VERSION = 1;
+static const size_t DISK_INDEX_SECTOR = 4096;
+
+
+/*
+ * Writes index as the file of a DiskIndex. The exact vectors are those of the re-rank store if
+ * the index has one (see enableRerank), otherwise the vectors of its space, which must not
+ * encode them. Deleted elements keep their marks. The index must not change during the call.
+ */
+template<typename dist_t>
+void saveDiskIndex(const HierarchicalNSW<dist_t> &index, const std::string &location) {
+    if (index.rerank_data_ == nullptr && index.vector_size_ != index.data_size_)
+        throw std::runtime_error("A disk index of an encoding space needs the exact vectors of the re-rank store");
+    typedef HierarchicalNSW<dist_t> Index;
+    size_t num_elements = index.cur_element_count;
+    size_t vector_size = index.rerank_data_ != nullptr ? index.rerank_data_size_ : index.data_size_;
+
+    DiskIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = DISK_INDEX_MAGIC;
+    header.version = DISK_INDEX_VERSION;
+    header.sector_size = DISK_INDEX_SECTOR;
+    header.num_elements = num_elements;
+    header.code_size = index.data_size_;
+    header.vector_size = vector_size;
+    header.max_m = index.maxM_;
+    header.max_m0 = index.maxM0_;
+    header.maxlevel = index.maxlevel_;
+    header.enterpoint_node = index.enterpoint_node_;
+    header.node_size = index.size_links_level0_ + vector_size;
+    header.nodes_per_sector = std::max<size_t>(1, DISK_INDEX_SECTOR / header.node_size);
+    header.sectors_per_node = (header.node_size + DISK_INDEX_SECTOR - 1) / DISK_INDEX_SECTOR;
+
+    uint64_t upper_size = 0;
+    for (size_t i = 0; i < num_elements; i++)
+        upper_size += index.element_levels_[i] * index.size_links_per_element_;
+    size_t num_sectors = (num_elements + header.nodes_per_sector - 1) / header.nodes_per_sector * header.sectors_per_node;
+    header.codes_offset = Index::alignUp(sizeof(header), Index::INDEX_SECTION_ALIGNMENT);
+    header.labels_offset = Index::alignUp(header.codes_offset + num_elements * index.data_size_, Index::INDEX_SECTION_ALIGNMENT);
+    header.upper_offsets_offset = Index::alignUp(header.labels_offset + num_elements * sizeof(labeltype), Index::INDEX_SECTION_ALIGNMENT);
+    header.upper_offset = Index::alignUp(header.upper_offsets_offset + (num_elements + 1) * sizeof(uint64_t), Index::INDEX_SECTION_ALIGNMENT);
+    header.nodes_offset = Index::alignUp(header.upper_offset + upper_size, DISK_INDEX_SECTOR);
+    header.file_size = header.nodes_offset + num_sectors * DISK_INDEX_SECTOR;
+
+    std::ofstream output(location, std::ios::binary);
+    if (!output.is_open())
+        throw std::runtime_error("Cannot open file");
+    writeBinaryPOD(output, header);
+
+    Index::writePadding(output, header.codes_offset);
+    for (tableint i = 0; i < num_elements; i++)
+        output.write(index.getDataByInternalId(i), index.data_size_);
+
+    Index::writePadding(output, header.labels_offset);
+    for (tableint i = 0; i < num_elements; i++)
+        writeBinaryPOD(output, index.getExternalLabel(i));
+
+    Index::writePadding(output, header.upper_offsets_offset);
+    uint64_t offset = 0;
+    for (size_t i = 0; i < num_elements; i++) {
+        writeBinaryPOD(output, offset);
+        offset += index.element_levels_[i] * index.size_links_per_element_;
+    }
+    writeBinaryPOD(output, offset);
+
+    Index::writePadding(output, header.upper_offset);
+    for (tableint i = 0; i < num_elements; i++) {
+        if (index.element_levels_[i] > 0)
+            output.write((char *) index.get_linklist(i, 1), index.size_links_per_element_ * index.element_levels_[i]);
+    }
+
+    std::vector<char> sector(header.sectors_per_node * DISK_INDEX_SECTOR);
+    for (size_t first = 0; first < num_elements; first += header.nodes_per_sector) {
+        std::fill(sector.begin(), sector.end(), 0);
+        for (size_t i = first; i < num_elements && i < first + header.nodes_per_sector; i++) {
+            char *node = sector.data() + (i - first) * header.node_size;
+            memcpy(node, index.get_linklist0(i), index.size_links_level0_);
+            const char *exact = index.rerank_data_ != nullptr ?
+                index.rerank_data_ + i * index.rerank_data_size_ : index.getDataByInternalId(i);
+            memcpy(node + index.size_links_level0_, exact, vector_size);
+        }
+        Index::writePadding(output, header.nodes_offset + first / header.nodes_per_sector * sector.size());
+        output.write(sector.data(), sector.size());
+    }
+    Index::writePadding(output, header.file_size);
+    output.close();
+    if (!output)
+        throw std::runtime_error("Cannot write file");
+}
+
+
+/*
+ * A least recently used cache of the nodes of a DiskIndex, split into shards by id so that
+ * concurrent searches rarely wait for each other. Each shard holds its share of the capacity.
+ */
+class DiskNodeCache {
+    static const size_t NUM_SHARDS = 16;
+
+    struct Shard {
+        std::mutex lock;
+        size_t capacity{0};
+        std::vector<char> nodes;                  // capacity slots of node_size bytes
+        std::vector<tableint> ids;                // the node in each slot
+        std::list<size_t> order;                  // used slots, most recently used first
+        std::unordered_map<tableint, std::list<size_t>::iterator> slot_of;
+    };
+
+    size_t node_size_;
+    std::unique_ptr<Shard[]> shards_;
+
+    Shard &shardOf(tableint id) const {
+        return shards_[id % NUM_SHARDS];
+    }
+
+ public:
+    DiskNodeCache(size_t capacity, size_t node_size) : node_size_(node_size), shards_(new Shard[NUM_SHARDS]) {
+        for (size_t s = 0; s < NUM_SHARDS; s++) {
+            Shard &shard = shards_[s];
+            shard.capacity = capacity / NUM_SHARDS + (s < capacity % NUM_SHARDS ? 1 : 0);
+            shard.nodes.resize(shard.capacity * node_size_);
+            shard.ids.resize(shard.capacity);
+        }
+    }
+
+    // Copies the node to dst if it is cached
+    bool get(tableint id, char *dst) const {
+        Shard &shard = shardOf(id);
+        std::lock_guard<std::mutex> lock(shard.lock);
+        auto it = shard.slot_of.find(id);
+        if (it == shard.slot_of.end())
+            return false;
+        shard.order.splice(shard.order.begin(), shard.order, it->second);
+        memcpy(dst, shard.nodes.data() + *it->second * node_size_, node_size_);
+        return true;
+    }
+
+    // Caches the node, evicting the least recently used one of its shard if it is full
+    void put(tableint id, const char *node) const {
+        Shard &shard = shardOf(id);
+        if (shard.capacity == 0)
+            return;
+        std::lock_guard<std::mutex> lock(shard.lock);
+        if (shard.slot_of.count(id))
+            return;
+        if (shard.order.size() < shard.capacity) {
+            shard.order.push_front(shard.order.size());
+        } else {
+            shard.slot_of.erase(shard.ids[shard.order.back()]);
+            shard.order.splice(shard.order.begin(), shard.order, std::prev(shard.order.end()));
+        }
+        size_t slot = shard.order.front();
+        shard.ids[slot] = id;
+        shard.slot_of[id] = shard.order.begin();
+        memcpy(shard.nodes.data() + slot * node_size_, node, node_size_);
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (size_t s = 0; s < NUM_SHARDS; s++) {
+            std::lock_guard<std::mutex> lock(shards_[s].lock);
+            total += shards_[s].order.size();
+        }
+        return total;
+    }
+};
+
+
+// The work of one DiskIndex search: SearchStats and the reads it took
+struct DiskSearchStats : SearchStats {
+    size_t node_reads{0};   // nodes read from the file
+    size_t cache_hits{0};   // nodes found in the cache
+    size_t round_trips{0};  // beams that waited for the file, the reads of a beam are issued together
+
+    void clear() {
+        SearchStats::clear();
+        node_reads = 0;
+        cache_hits = 0;
+        round_trips = 0;
+    }
+};
+
+
+/*
+ * An index that keeps only the vectors as its space stores them and the upper layers in memory,
+ * and reads the base layer and the exact vectors from an SSD as it searches (see saveDiskIndex).
+ * With an SQ / PQ space the memory is a fraction of that of the HierarchicalNSW it was saved from.
+ *
+ * The search descends the upper layers in memory, then runs a beam search on the base layer:
+ * it keeps the ef closest candidates by their distance in the space of the index and, per round,
+ * reads the nodes of the beam_width closest ones not expanded yet, together. The exact vectors
+ * that come with the nodes re-rank the expanded elements, the k closest of them are the results.
+ * A wider beam takes fewer round trips to the disk for a few more reads.
+ *
+ * On Linux the nodes are read with O_DIRECT, bypassing the page cache, and the reads of a beam are
+ * submitted as one batch of native asynchronous I/O; elsewhere, or where the file system does not
+ * take O_DIRECT, they are positional reads one after another. Nodes read are kept in an LRU cache
+ * of cache_nodes nodes, which soon holds those near the entry point that most searches go through.
+ *
+ * space must be the space the index was built with (trained the same way), exact_space the space
+ * of the exact vectors. The index is read-only; searches may run from any number of threads.
+ */
+template<typename dist_t>
+class DiskIndex {
+ public:
+    static const size_t MAX_BEAM_WIDTH = 64;
+
+ private:
+    // The buffers of one search, kept for the next one
+    struct SearchContext {
+        struct Candidate {
+            dist_t dist;
+            tableint id;
+            bool expanded;
+        };
+
+        SearchVisitedSet visited;
+        std::vector<Candidate> candidates;  // closer first
+        std::vector<std::pair<dist_t, tableint>> exact;
+        std::vector<tableint> beam;
+        std::vector<const char *> nodes;
+        std::vector<size_t> misses;
+        std::vector<tableint> links;
+        std::vector<const void *> batch_data;
+        std::vector<dist_t> batch_dists;
+        std::vector<char> hits;  // the nodes of the beam found in the cache
+        char *sectors{nullptr};  // MAX_BEAM_WIDTH sector-aligned reads
+        std::vector<char> prepared_query;
+#if defined(__linux__)
+        aio_context_t aio{0};
+        bool has_aio{false};
+#endif
+
+        // io_destroy cancels and waits for the reads in flight, only then are their buffers freed
+        ~SearchContext() {
+#if defined(__linux__)
+            if (has_aio)
+                syscall(SYS_io_destroy, aio);
+#endif
+#if defined(HNSWLIB_HAVE_MMAP)
+            free(sectors);
+#else
+            delete[] sectors;
+#endif
+        }
+    };
+
+    DiskIndexHeader header_;
+    size_t size_links_level0_{0};
+    size_t size_links_per_element_{0};
+    size_t node_span_{0};  // bytes of one read
+
+    std::vector<char> codes_;
+    std::vector<labeltype> labels_;
+    std::vector<uint64_t> upper_offsets_;
+    std::vector<char> upper_;
+
+    // the codes are compared with the query as the space prepares it
+    SpaceInterface<dist_t> *space_{nullptr};
+    size_t prepared_query_size_{0};
+    DISTFUNC<dist_t> fstdistfunc_;
+    DISTFUNC_BATCH<dist_t> fstdistfunc_batch_{nullptr};
+    void *dist_func_param_{nullptr};
+    DISTFUNC<dist_t> exact_distfunc_;
+    void *exact_dist_func_param_{nullptr};
+
+    int fd_{-1};
+    bool direct_io_{false};
+#if !defined(HNSWLIB_HAVE_MMAP)
+    mutable std::ifstream input_;
+    mutable std::mutex input_lock_;
+#endif
+
+    std::unique_ptr<DiskNodeCache> cache_;
+    mutable std::mutex contexts_lock_;
+    mutable std::vector<std::unique_ptr<SearchContext>> contexts_;
+
+    size_t ef_{10};
+    size_t beam_width_{4};
+
+    const char *getCode(tableint id) const {
+        return codes_.data() + id * header_.code_size;
+    }
+
+    linklistsizeint *getUpperLinks(tableint id, int level) const {
+        return (linklistsizeint *) (upper_.data() + upper_offsets_[id] + (level - 1) * size_links_per_element_);
+    }
+
+    int getLevel(tableint id) const {
+        return (int) ((upper_offsets_[id + 1] - upper_offsets_[id]) / size_links_per_element_);
+    }
+
+    uint64_t nodeOffset(tableint id) const {
+        return header_.nodes_offset + id / header_.nodes_per_sector * node_span_;
+    }
+
+    const char *nodeInSpan(const char *span, tableint id) const {
+        return span + id % header_.nodes_per_sector * header_.node_size;
+    }
+
+    std::unique_ptr<SearchContext> acquireContext() const {
+        {
+            std::lock_guard<std::mutex> lock(contexts_lock_);
+            if (!contexts_.empty()) {
+                std::unique_ptr<SearchContext> context = std::move(contexts_.back());
+                contexts_.pop_back();
+                return context;
+            }
+        }
+        std::unique_ptr<SearchContext> context(new SearchContext());
+        size_t size = MAX_BEAM_WIDTH * node_span_;
+#if defined(HNSWLIB_HAVE_MMAP)
+        void *p = nullptr;
+        if (posix_memalign(&p, DISK_INDEX_SECTOR, size) != 0)
+            throw std::runtime_error("Not enough memory: failed to allocate the read buffers of a disk search");
+        context->sectors = (char *) p;
+#else
+        context->sectors = new char[size];
+#endif
+        context->hits.resize(MAX_BEAM_WIDTH * header_.node_size);
+#if defined(__linux__)
+        // without native AIO, e.g. past the aio-max-nr limit, the reads are made one by one
+        context->has_aio = syscall(SYS_io_setup, MAX_BEAM_WIDTH, &context->aio) == 0;
+#endif
+        return context;
+    }
+
+    void releaseContext(std::unique_ptr<SearchContext> context) const {
+        std::lock_guard<std::mutex> lock(contexts_lock_);
+        contexts_.push_back(std::move(context));
+    }
+
+    void readSpan(char *dst, uint64_t offset) const {
+#if defined(HNSWLIB_HAVE_MMAP)
+        size_t size = node_span_;
+        while (size > 0) {
+            ssize_t n = pread(fd_, dst, size, (off_t) offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                throw std::runtime_error("Cannot read the nodes of the disk index");
+            dst += n;
+            size -= n;
+            offset += n;
+        }
+#else
+        std::lock_guard<std::mutex> lock(input_lock_);
+        input_.seekg(offset, input_.beg);
+        input_.read(dst, node_span_);
+        if (!input_)
+            throw std::runtime_error("Cannot read the nodes of the disk index");
+#endif
+    }
+
+    // Reads the spans of the nodes context.misses of the beam into context.sectors
+    void readMisses(SearchContext &context) const {
+        size_t num_reads = context.misses.size();
+        size_t first = 0;
+#if defined(__linux__)
+        if (context.has_aio) {
+            struct iocb requests[MAX_BEAM_WIDTH];
+            struct iocb *pointers[MAX_BEAM_WIDTH];
+            for (size_t r = 0; r < num_reads; r++) {
+                memset(&requests[r], 0, sizeof(requests[r]));
+                requests[r].aio_fildes = fd_;
+                requests[r].aio_lio_opcode = IOCB_CMD_PREAD;
+                requests[r].aio_buf = (uint64_t) (uintptr_t) (context.sectors + r * node_span_);
+                requests[r].aio_nbytes = node_span_;
+                requests[r].aio_offset = nodeOffset(context.beam[context.misses[r]]);
+                pointers[r] = &requests[r];
+            }
+            size_t submitted = 0;
+            while (submitted < num_reads) {
+                long n = syscall(SYS_io_submit, context.aio, (long) (num_reads - submitted), pointers + submitted);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    break;  // the rest is read one by one below
+                submitted += n;
+            }
+            struct io_event events[MAX_BEAM_WIDTH];
+            size_t completed = 0;
+            bool failed = false;
+            while (completed < submitted) {
+                long n = syscall(SYS_io_getevents, context.aio, 1, (long) (submitted - completed), events, nullptr);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0)
+                    throw std::runtime_error("Cannot read the nodes of the disk index");
+                for (long e = 0; e < n; e++)
+                    failed = failed || events[e].res != (int64_t) node_span_;
+                completed += n;
+            }
+            if (failed)
+                throw std::runtime_error("Cannot read the nodes of the disk index");
+            first = submitted;
+        }
+#endif
+        for (size_t r = first; r < num_reads; r++)
+            readSpan(context.sectors + r * node_span_, nodeOffset(context.beam[context.misses[r]]));
+    }
+
+    // Sets context.nodes to the nodes of context.beam, from the cache or the file
+    void fetchBeam(SearchContext &context, DiskSearchStats &stats) const {
+        size_t beam_size = context.beam.size();
+        context.nodes.resize(beam_size);
+        context.misses.clear();
+        for (size_t b = 0; b < beam_size; b++) {
+            char *hit = context.hits.data() + b * header_.node_size;
+            if (cache_ && cache_->get(context.beam[b], hit))
+                context.nodes[b] = hit;
+            else
+                context.misses.push_back(b);
+        }
+        stats.cache_hits += beam_size - context.misses.size();
+        if (context.misses.empty())
+            return;
+        readMisses(context);
+        for (size_t r = 0; r < context.misses.size(); r++) {
+            size_t b = context.misses[r];
+            context.nodes[b] = nodeInSpan(context.sectors + r * node_span_, context.beam[b]);
+            if (cache_)
+                cache_->put(context.beam[b], context.nodes[b]);
+        }
+        stats.node_reads += context.misses.size();
+        stats.round_trips++;
+    }
+
+    void scoreBatch(const void *query_data, const void *const *batch_data, size_t batch_size, dist_t *batch_dists) const {
+        if (fstdistfunc_batch_ != nullptr) {
+            fstdistfunc_batch_(query_data, batch_data, batch_size, dist_func_param_, batch_dists);
+        } else {
+            for (size_t b = 0; b < batch_size; b++)
+                batch_dists[b] = fstdistfunc_(query_data, batch_data[b], dist_func_param_);
+        }
+    }
+
+    // Greedy descent of the upper layers, as in HierarchicalNSW::searchKnn
+    tableint searchUpperLayers(const void *query_data, dist_t &cur_dist, DiskSearchStats &stats) const {
+        tableint cur_obj = header_.enterpoint_node;
+        cur_dist = fstdistfunc_(query_data, getCode(cur_obj), dist_func_param_);
+        stats.distance_computations++;
+        for (int level = header_.maxlevel; level > 0; level--) {
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                linklistsizeint *ll = getUpperLinks(cur_obj, level);
+                size_t size = *(unsigned short int *) ll;
+                tableint *links = (tableint *) (ll + 1);
+                stats.hops[level]++;
+                stats.distance_computations += size;
+                for (size_t i = 0; i < size; i++) {
+                    if (links[i] >= header_.num_elements)
+                        throw std::runtime_error("cand error");
+                    dist_t d = fstdistfunc_(query_data, getCode(links[i]), dist_func_param_);
+                    if (d < cur_dist) {
+                        cur_dist = d;
+                        cur_obj = links[i];
+                        changed = true;
+                    }
+                }
+            }
+        }
+        return cur_obj;
+    }
+
+    // Adds the neighbors in context.links to the candidates, keeping the ef closest
+    void addCandidates(SearchContext &context, const void *query_data, size_t ef, DiskSearchStats &stats) const {
+        size_t num_links = context.links.size();
+        context.batch_data.resize(num_links);
+        context.batch_dists.resize(num_links);
+        for (size_t i = 0; i < num_links; i++)
+            context.batch_data[i] = getCode(context.links[i]);
+        const size_t batch_limit = HierarchicalNSW<dist_t>::DISTANCE_BATCH_SIZE;
+        for (size_t i = 0; i < num_links; i += batch_limit) {
+            size_t batch_size = std::min(num_links - i, batch_limit);
+            scoreBatch(query_data, context.batch_data.data() + i, batch_size, context.batch_dists.data() + i);
+        }
+        stats.distance_computations += num_links;
+
+        auto &candidates = context.candidates;
+        for (size_t i = 0; i < num_links; i++) {
+            dist_t dist = context.batch_dists[i];
+            if (candidates.size() >= ef && !(dist < candidates.back().dist))
+                continue;
+            typename SearchContext::Candidate candidate = {dist, context.links[i], false};
+            auto pos = std::upper_bound(candidates.begin(), candidates.end(), candidate,
+                [](const typename SearchContext::Candidate &a, const typename SearchContext::Candidate &b) {
+                    return a.dist < b.dist;
+                });
+            candidates.insert(pos, candidate);
+            if (candidates.size() > ef)
+                candidates.pop_back();
+        }
+    }
+
+    void search(SearchContext &context, const void *query_data, size_t k, BaseFilterFunctor *isIdAllowed,
+                DiskSearchStats &stats, std::vector<std::pair<dist_t, labeltype>> &result) const {
+        size_t ef = std::max(ef_, k);
+        stats.hops.assign(header_.maxlevel + 1, 0);
+        const void *query = query_data;
+        if (prepared_query_size_ != 0) {
+            context.prepared_query.resize(prepared_query_size_);
+            space_->prepare_query(query_data, context.prepared_query.data());
+            query = context.prepared_query.data();
+        }
+        dist_t cur_dist;
+        tableint entry = searchUpperLayers(query, cur_dist, stats);
+
+        context.visited.clear();
+        context.visited.insert(entry);
+        stats.visited++;
+        context.candidates.clear();
+        context.candidates.push_back({cur_dist, entry, false});
+        context.exact.clear();
+        while (true) {
+            context.beam.clear();
+            for (auto &candidate : context.candidates) {
+                if (candidate.expanded)
+                    continue;
+                candidate.expanded = true;
+                context.beam.push_back(candidate.id);
+                if (context.beam.size() == beam_width_)
+                    break;
+            }
+            if (context.beam.empty())
+                break;
+            fetchBeam(context, stats);
+            stats.hops[0] += context.beam.size();
+
+            context.links.clear();
+            for (size_t b = 0; b < context.beam.size(); b++) {
+                const char *node = context.nodes[b];
+                tableint id = context.beam[b];
+                unsigned char flags = ((const unsigned char *) node)[2];
+                if ((flags & HierarchicalNSW<dist_t>::DELETE_MARK) || (isIdAllowed && !(*isIdAllowed)(labels_[id]))) {
+                    stats.filtered_out++;
+                } else {
+                    dist_t dist = exact_distfunc_(query_data, node + size_links_level0_, exact_dist_func_param_);
+                    context.exact.emplace_back(dist, id);
+                    stats.distance_computations++;
+                }
+                size_t size = *(const unsigned short int *) node;
+                const tableint *links = (const tableint *) (node + sizeof(linklistsizeint));
+                for (size_t j = 0; j < size; j++) {
+                    if (links[j] >= header_.num_elements)
+                        throw std::runtime_error("cand error");
+                    if (context.visited.insert(links[j]))
+                        context.links.push_back(links[j]);
+                }
+            }
+            stats.visited += context.links.size();
+            addCandidates(context, query, ef, stats);
+        }
+
+        size_t num_results = std::min(k, context.exact.size());
+        std::partial_sort(context.exact.begin(), context.exact.begin() + num_results, context.exact.end());
+        result.clear();
+        for (size_t i = 0; i < num_results; i++)
+            result.emplace_back(context.exact[i].first, labels_[context.exact[i].second]);
+    }
+
+ public:
+    /*
+     * Opens the file written by saveDiskIndex and reads its in-memory sections, with the threads of
+     * pool if given. cache_nodes is the capacity of the node cache, 0 for none; direct_io = false
+     * reads the nodes through the page cache.
+     */
+    DiskIndex(SpaceInterface<dist_t> *s, SpaceInterface<dist_t> *exact_space, const std::string &location,
+              size_t cache_nodes = 0, bool direct_io = true, ThreadPool *pool = nullptr) {
+        {
+            std::ifstream input(location, std::ios::binary);
+            if (!input.is_open())
+                throw std::runtime_error("Cannot open file");
+            readBinaryPOD(input, header_);
+            if (!input || header_.magic != DISK_INDEX_MAGIC)
+                throw std::runtime_error("Not a disk index file");
+            if (header_.version != DISK_INDEX_VERSION || header_.sector_size != DISK_INDEX_SECTOR)
+                throw std::runtime_error("Unsupported disk index format version");
+            input.seekg(0, input.end);
+            if ((uint64_t) input.tellg() < header_.file_size)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+        }
+        if (s->get_data_size() != header_.code_size)
+            throw std::runtime_error("The space does not match the codes of the disk index");
+        if (exact_space->get_data_size() != header_.vector_size || exact_space->get_vector_size() != s->get_vector_size())
+            throw std::runtime_error("The exact space does not match the vectors of the disk index");
+        space_ = s;
+        prepared_query_size_ = s->get_prepared_query_size();
+        fstdistfunc_ = s->get_prepared_dist_func();
+        fstdistfunc_batch_ = s->get_prepared_dist_func_batch();
+        dist_func_param_ = s->get_dist_func_param();
+        exact_distfunc_ = exact_space->get_dist_func();
+        exact_dist_func_param_ = exact_space->get_dist_func_param();
+
+        size_links_level0_ = header_.max_m0 * sizeof(tableint) + sizeof(linklistsizeint);
+        size_links_per_element_ = header_.max_m * sizeof(tableint) + sizeof(linklistsizeint);
+        node_span_ = header_.sectors_per_node * DISK_INDEX_SECTOR;
+        if (header_.node_size != size_links_level0_ + header_.vector_size)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        size_t n = header_.num_elements;
+        FileReader reader(location);
+        codes_.resize(n * header_.code_size);
+        reader.read(codes_.data(), codes_.size(), header_.codes_offset, pool);
+        labels_.resize(n);
+        reader.read((char *) labels_.data(), n * sizeof(labeltype), header_.labels_offset, pool);
+        upper_offsets_.resize(n + 1);
+        reader.read((char *) upper_offsets_.data(), (n + 1) * sizeof(uint64_t), header_.upper_offsets_offset, pool);
+        upper_.resize(upper_offsets_[n]);
+        reader.read(upper_.data(), upper_offsets_[n], header_.upper_offset, pool);
+        if (n > 0 && (header_.enterpoint_node >= n || getLevel(header_.enterpoint_node) != header_.maxlevel))
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+#if defined(HNSWLIB_HAVE_MMAP)
+#if defined(__linux__) && defined(O_DIRECT)
+        if (direct_io) {
+            fd_ = open(location.c_str(), O_RDONLY | O_DIRECT);
+            direct_io_ = fd_ >= 0;  // not every file system takes O_DIRECT
+        }
+#else
+        (void) direct_io;
+#endif
+        if (fd_ < 0)
+            fd_ = open(location.c_str(), O_RDONLY);
+        if (fd_ < 0)
+            throw std::runtime_error("Cannot open file");
+#else
+        (void) direct_io;
+        input_.open(location, std::ios::binary);
+        if (!input_.is_open())
+            throw std::runtime_error("Cannot open file");
+#endif
+        if (cache_nodes > 0)
+            cache_.reset(new DiskNodeCache(cache_nodes, header_.node_size));
+    }
+
+    ~DiskIndex() {
+        contexts_.clear();
+#if defined(HNSWLIB_HAVE_MMAP)
+        if (fd_ >= 0)
+            close(fd_);
+#endif
+    }
+
+    DiskIndex(const DiskIndex &) = delete;
+    DiskIndex &operator=(const DiskIndex &) = delete;
+
+    void setEf(size_t ef) {
+        ef_ = ef;
+    }
+
+    // Nodes read per round trip, 1 to MAX_BEAM_WIDTH
+    void setBeamWidth(size_t beam_width) {
+        if (beam_width == 0 || beam_width > MAX_BEAM_WIDTH)
+            throw std::runtime_error("The beam width must be between 1 and DiskIndex::MAX_BEAM_WIDTH");
+        beam_width_ = beam_width;
+    }
+
+    size_t getCurrentElementCount() const {
+        return header_.num_elements;
+    }
+
+    // Whether the nodes are read with O_DIRECT
+    bool directIo() const {
+        return direct_io_;
+    }
+
+    size_t cachedNodes() const {
+        return cache_ ? cache_->size() : 0;
+    }
+
+    // Bytes held in memory for the elements: codes, labels and upper layers, without the node cache
+    size_t memoryUsage() const {
+        return codes_.size() + labels_.size() * sizeof(labeltype)
+            + upper_offsets_.size() * sizeof(uint64_t) + upper_.size();
+    }
+
+    /*
+     * The k nearest neighbors of query_data by their exact distance, closer first. Deleted
+     * elements and elements that isIdAllowed rejects are expanded but not returned.
+     * The work is added to the SearchCounters and reported in stats if given.
+     */
+    std::vector<std::pair<dist_t, labeltype>>
+    searchKnnCloserFirst(const void *query_data, size_t k, BaseFilterFunctor *isIdAllowed = nullptr,
+                         DiskSearchStats *stats = nullptr) const {
+        DiskSearchStats scratch;
+        DiskSearchStats &disk_stats = stats != nullptr ? *stats : scratch;
+        disk_stats.clear();
+        SearchStatsScope stats_scope(stats);
+        std::vector<std::pair<dist_t, labeltype>> result;
+        if (header_.num_elements == 0 || k == 0)
+            return result;
+
+        std::unique_ptr<SearchContext> context = acquireContext();
+        search(*context, query_data, k, isIdAllowed, disk_stats, result);
+        releaseContext(std::move(context));
+        if (stats == nullptr)
+            *stats_scope.get() = disk_stats;
+        return result;
+    }
+};
+
+}  // namespace hnswlib
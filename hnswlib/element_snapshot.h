@@ -0,0 +1,186 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <streambuf>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "hnswlib.h"
+
+namespace hnswlib {
+
+/*
+ * The elements of an index as they were when a snapshot began, so that the index can be saved
+ * while it is updated (see HierarchicalNSW::saveSnapshot).
+ *
+ * Every writer of an element calls preserve() before it changes the element; the first one after
+ * the snapshot began copies the element aside. The saving thread calls take() for the elements in
+ * turn, which hands out the copy or, for an element nobody changed, copies it from the index.
+ * After take() the element is written freely again. Only the elements changed before they were
+ * taken are copied, and each at most once.
+ */
+class ElementSnapshot {
+    static const uint8_t UNTOUCHED = 0;
+    static const uint8_t COPYING = 1;
+    static const uint8_t DONE = 2;
+    static const size_t NUM_STRIPES = 64;
+
+    struct Stripe {
+        std::mutex lock;
+        std::unordered_map<tableint, char *> copies;
+    };
+
+    std::atomic<bool> active_{false};
+    std::atomic<size_t> users_{0};  // writers inside preserve()
+    std::atomic<bool> failed_{false};
+    size_t num_elements_{0};
+    std::unique_ptr<std::atomic<uint8_t>[]> states_;
+    Stripe stripes_[NUM_STRIPES];
+
+    static void wait(const std::atomic<uint8_t> &state) {
+        while (state.load(std::memory_order_acquire) != DONE)
+            std::this_thread::yield();
+    }
+
+ public:
+    ~ElementSnapshot() {
+        end();
+    }
+
+    // Starts a snapshot of the elements [0, num_elements), no element may change meanwhile
+    void begin(size_t num_elements) {
+        num_elements_ = num_elements;
+        states_.reset(new std::atomic<uint8_t>[num_elements]);
+        for (size_t i = 0; i < num_elements; i++)
+            states_[i].store(UNTOUCHED, std::memory_order_relaxed);
+        failed_ = false;
+        active_ = true;
+    }
+
+    // Waits for the writers inside preserve() and drops the copies that were not taken
+    void end() {
+        active_ = false;
+        while (users_.load() != 0)
+            std::this_thread::yield();
+        for (Stripe &stripe : stripes_) {
+            for (auto &copy : stripe.copies)
+                free(copy.second);
+            stripe.copies.clear();
+        }
+        states_.reset(nullptr);
+        num_elements_ = 0;
+    }
+
+    bool active() const {
+        return active_.load();
+    }
+
+    // Whether a copy could not be allocated, the snapshot is not consistent then
+    bool failed() const {
+        return failed_;
+    }
+
+    // copy(dst) copies the size bytes of the element to dst
+    template<typename Copy>
+    void preserve(tableint id, size_t size, Copy copy) {
+        if (!active_.load())
+            return;
+        users_.fetch_add(1);
+        if (active_.load() && id < num_elements_) {
+            std::atomic<uint8_t> &state = states_[id];
+            uint8_t expected = UNTOUCHED;
+            if (state.load(std::memory_order_acquire) == UNTOUCHED && state.compare_exchange_strong(expected, COPYING)) {
+                char *data = (char *) malloc(size);
+                if (data != nullptr) {
+                    copy(data);
+                    Stripe &stripe = stripes_[id % NUM_STRIPES];
+                    std::unique_lock <std::mutex> lock(stripe.lock);
+                    stripe.copies[id] = data;
+                } else {
+                    failed_ = true;
+                }
+                state.store(DONE, std::memory_order_release);
+            } else {
+                wait(state);
+            }
+        }
+        users_.fetch_sub(1);
+    }
+
+    // Copies the element as it was when the snapshot began to dst
+    template<typename Copy>
+    void take(tableint id, size_t size, char *dst, Copy copy) {
+        std::atomic<uint8_t> &state = states_[id];
+        uint8_t expected = UNTOUCHED;
+        if (state.compare_exchange_strong(expected, COPYING)) {
+            copy(dst);
+            state.store(DONE, std::memory_order_release);
+            return;
+        }
+        wait(state);
+        Stripe &stripe = stripes_[id % NUM_STRIPES];
+        std::unique_lock <std::mutex> lock(stripe.lock);
+        auto it = stripe.copies.find(id);
+        if (it == stripe.copies.end())
+            return;  // failed() tells
+        memcpy(dst, it->second, size);
+        free(it->second);
+        stripe.copies.erase(it);
+    }
+};
+
+
+// A stream buffer handing the output to a callback in pieces of up to BUFFER_SIZE bytes
+class CallbackStreamBuf : public std::streambuf {
+    static const size_t BUFFER_SIZE = (size_t) 1 << 20;
+
+    std::function<void(const char *, size_t)> write_;
+    std::vector<char> buffer_;
+    uint64_t written_{0};
+
+    void flushBuffer() {
+        size_t size = pptr() - pbase();
+        if (size != 0) {
+            write_(pbase(), size);
+            written_ += size;
+        }
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+
+ protected:
+    int_type overflow(int_type c) override {
+        flushBuffer();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override {
+        flushBuffer();
+        return 0;
+    }
+
+    // only tellp is supported
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+        if (off == 0 && dir == std::ios_base::cur && (which & std::ios_base::out))
+            return pos_type((off_type) (written_ + (pptr() - pbase())));
+        return pos_type(off_type(-1));
+    }
+
+ public:
+    explicit CallbackStreamBuf(std::function<void(const char *, size_t)> write)
+        : write_(write), buffer_(BUFFER_SIZE) {
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+};
+
+}  // namespace hnswlib
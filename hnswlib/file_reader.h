@@ -0,0 +1,86 @@
+#pragma once
+
+#include <errno.h>
+#include <stdint.h>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include "mmap_file.h"
+#include "thread_pool.h"
+
+namespace hnswlib {
+
+/*
+ * Reads byte ranges of a file with large positional reads.
+ *
+ * With a pool, a range is cut into READ_CHUNK pieces that the threads read at the same time, which
+ * keeps several requests in flight on storage that serves them in parallel (NVMe, network volumes).
+ * Without a pool, or where positional reads are not available, a range is one sequential read.
+ */
+class FileReader {
+    static const size_t READ_CHUNK = (size_t) 64 << 20;
+
+#if defined(HNSWLIB_HAVE_MMAP)
+    int fd_{-1};
+
+    void readChunk(char *dst, size_t size, uint64_t offset) const {
+        while (size > 0) {
+            ssize_t n = pread(fd_, dst, size, (off_t) offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                throw std::runtime_error("Cannot read file");
+            dst += n;
+            size -= n;
+            offset += n;
+        }
+    }
+#else
+    std::ifstream input_;
+#endif
+
+ public:
+    explicit FileReader(const std::string &location) {
+#if defined(HNSWLIB_HAVE_MMAP)
+        fd_ = open(location.c_str(), O_RDONLY);
+        if (fd_ < 0)
+            throw std::runtime_error("Cannot open file");
+#else
+        input_.open(location, std::ios::binary);
+        if (!input_.is_open())
+            throw std::runtime_error("Cannot open file");
+#endif
+    }
+
+    ~FileReader() {
+#if defined(HNSWLIB_HAVE_MMAP)
+        close(fd_);
+#endif
+    }
+
+    FileReader(const FileReader &) = delete;
+    FileReader &operator=(const FileReader &) = delete;
+
+    // Reads size bytes at offset into dst, throws if the file ends before
+    void read(char *dst, size_t size, uint64_t offset, ThreadPool *pool = nullptr) {
+#if defined(HNSWLIB_HAVE_MMAP)
+        size_t num_chunks = (size + READ_CHUNK - 1) / READ_CHUNK;
+        if (pool == nullptr || num_chunks < 2) {
+            readChunk(dst, size, offset);
+            return;
+        }
+        pool->parallelFor(0, num_chunks, [&](size_t chunk, size_t) {
+            size_t begin = chunk * READ_CHUNK;
+            readChunk(dst + begin, size - begin < READ_CHUNK ? size - begin : READ_CHUNK, offset + begin);
+        }, 1);
+#else
+        (void) pool;
+        input_.seekg(offset, input_.beg);
+        input_.read(dst, size);
+        if (!input_)
+            throw std::runtime_error("Cannot read file");
+#endif
+    }
+};
+
+}  // namespace hnswlib
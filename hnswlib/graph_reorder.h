@@ -0,0 +1,208 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+namespace hnswlib {
+
+// Orderings of the elements for HierarchicalNSW::reorder
+enum class GraphReorder {
+    BFS,     // breadth-first from the entry point
+    RCM,     // reverse Cuthill-McKee, keeps the bandwidth of the link matrix small
+    Gorder,  // greedy, places next the element sharing the most links with the last few placed
+};
+
+/*
+ * A directed graph on vertices 0 .. size() - 1 in compressed sparse row form: the neighbors of
+ * v are adj[offsets[v]] .. adj[offsets[v + 1] - 1].
+ *
+ * The orderings below return new_to_old, the vertex placed at each position. Every vertex is
+ * placed once; vertices the traversal cannot reach are placed after the ones it reaches.
+ */
+struct CSRGraph {
+    std::vector<size_t> offsets{0};
+    std::vector<uint32_t> adj;
+
+    size_t size() const {
+        return offsets.size() - 1;
+    }
+
+    size_t degree(uint32_t v) const {
+        return offsets[v + 1] - offsets[v];
+    }
+
+    CSRGraph transposed() const {
+        CSRGraph t;
+        t.offsets.assign(size() + 1, 0);
+        for (uint32_t u : adj)
+            t.offsets[u + 1]++;
+        for (size_t v = 0; v < size(); v++)
+            t.offsets[v + 1] += t.offsets[v];
+        t.adj.resize(adj.size());
+        std::vector<size_t> pos(t.offsets.begin(), t.offsets.end() - 1);
+        for (uint32_t v = 0; v < size(); v++) {
+            for (size_t j = offsets[v]; j < offsets[v + 1]; j++)
+                t.adj[pos[adj[j]]++] = v;
+        }
+        return t;
+    }
+};
+
+
+inline std::vector<uint32_t> reorderBFS(const CSRGraph &g, uint32_t start) {
+    size_t n = g.size();
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    std::vector<bool> placed(n, false);
+    for (size_t s = 0; s <= n; s++) {
+        // the start vertex first, then the first vertex of each unreached component
+        uint32_t root = s == 0 ? start : (uint32_t) (s - 1);
+        if (root >= n || placed[root])
+            continue;
+        size_t head = order.size();
+        order.push_back(root);
+        placed[root] = true;
+        for (; head < order.size(); head++) {
+            uint32_t v = order[head];
+            for (size_t j = g.offsets[v]; j < g.offsets[v + 1]; j++) {
+                if (!placed[g.adj[j]]) {
+                    placed[g.adj[j]] = true;
+                    order.push_back(g.adj[j]);
+                }
+            }
+        }
+    }
+    return order;
+}
+
+
+inline std::vector<uint32_t> reorderRCM(const CSRGraph &g) {
+    size_t n = g.size();
+    std::vector<uint32_t> by_degree(n);
+    for (uint32_t v = 0; v < n; v++)
+        by_degree[v] = v;
+    std::stable_sort(by_degree.begin(), by_degree.end(), [&](uint32_t a, uint32_t b) {
+        return g.degree(a) < g.degree(b);
+    });
+
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    std::vector<bool> placed(n, false);
+    std::vector<uint32_t> next;
+    for (uint32_t root : by_degree) {
+        // each component starts from its vertex of lowest degree
+        if (placed[root])
+            continue;
+        size_t head = order.size();
+        order.push_back(root);
+        placed[root] = true;
+        for (; head < order.size(); head++) {
+            uint32_t v = order[head];
+            next.clear();
+            for (size_t j = g.offsets[v]; j < g.offsets[v + 1]; j++) {
+                if (!placed[g.adj[j]]) {
+                    placed[g.adj[j]] = true;
+                    next.push_back(g.adj[j]);
+                }
+            }
+            std::stable_sort(next.begin(), next.end(), [&](uint32_t a, uint32_t b) {
+                return g.degree(a) < g.degree(b);
+            });
+            order.insert(order.end(), next.begin(), next.end());
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+
+/*
+ * Gorder (Wei et al., "Speedup Graph Processing by Graph Ordering", SIGMOD 2016). The score of
+ * an unplaced vertex is the number of links between it and the last window placed vertices,
+ * plus the number of in-neighbors it shares with them. Scores change by one at a time, so they
+ * are kept in buckets of equal score (the paper's unit heap) and the best vertex is found by
+ * walking down from the highest bucket.
+ */
+inline std::vector<uint32_t> reorderGorder(const CSRGraph &g, size_t window = 5) {
+    size_t n = g.size();
+    std::vector<uint32_t> order;
+    if (n == 0)
+        return order;
+    order.reserve(n);
+    CSRGraph in = g.transposed();
+
+    const uint32_t NONE = (uint32_t) -1;
+    std::vector<uint32_t> score(n, 0), prev(n), next(n);
+    std::vector<uint32_t> bucket_head(1, NONE);
+    std::vector<bool> placed(n, false);
+    size_t top = 0;
+
+    auto unlink = [&](uint32_t v) {
+        if (prev[v] != NONE)
+            next[prev[v]] = next[v];
+        else
+            bucket_head[score[v]] = next[v];
+        if (next[v] != NONE)
+            prev[next[v]] = prev[v];
+    };
+    auto link = [&](uint32_t v) {
+        if (score[v] >= bucket_head.size())
+            bucket_head.resize(score[v] + 1, NONE);
+        prev[v] = NONE;
+        next[v] = bucket_head[score[v]];
+        if (next[v] != NONE)
+            prev[next[v]] = v;
+        bucket_head[score[v]] = v;
+        top = std::max(top, (size_t) score[v]);
+    };
+    for (uint32_t v = (uint32_t) n; v > 0; v--)
+        link(v - 1);
+
+    // adds delta to the scores the vertex u contributes to
+    auto update = [&](uint32_t u, int delta) {
+        auto bump = [&](uint32_t v) {
+            if (placed[v])
+                return;
+            unlink(v);
+            score[v] += delta;
+            link(v);
+        };
+        for (size_t j = g.offsets[u]; j < g.offsets[u + 1]; j++)
+            bump(g.adj[j]);
+        for (size_t j = in.offsets[u]; j < in.offsets[u + 1]; j++) {
+            uint32_t x = in.adj[j];
+            bump(x);
+            for (size_t i = g.offsets[x]; i < g.offsets[x + 1]; i++) {
+                if (g.adj[i] != u)
+                    bump(g.adj[i]);
+            }
+        }
+    };
+
+    // starts from the vertex with the most in-neighbors
+    uint32_t v = 0;
+    for (uint32_t u = 1; u < n; u++) {
+        if (in.degree(u) > in.degree(v))
+            v = u;
+    }
+    while (true) {
+        unlink(v);
+        placed[v] = true;
+        order.push_back(v);
+        if (order.size() == n)
+            break;
+        update(v, 1);
+        if (order.size() > window)
+            update(order[order.size() - 1 - window], -1);
+
+        while (bucket_head[top] == NONE)
+            top--;
+        v = bucket_head[top];
+    }
+    return order;
+}
+
+}  // namespace hnswlib
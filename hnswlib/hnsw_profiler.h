@@ -1,179 +1,401 @@
 #pragma once
-#include <chrono>
+#include <stdint.h>
 #include <atomic>
+#include <chrono>
 #include <thread>
 #include <string>
 #include <mutex>
 #include <vector>
+#include <fstream>
 #include <iostream>
-#include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+
+/*
+ * Scoped timers for profiling the index internals.
+ *
+ * The profiler is compiled out unless HNSWLIB_ENABLE_PROFILER is defined before including hnswlib.h:
+ * HNSW_PROFILE_SCOPE then expands to nothing and the reporting functions are no-ops.
+ *
+ * When enabled, every call site registers its tag once (function-local static) and gets an integer id.
+ * Each thread accumulates calls, total/min/max time and a log2 histogram per tag into its own
+ * fixed-size slot, so recording a sample never takes a lock or allocates.
+ * Time is taken from std::chrono::steady_clock, or from the TSC if HNSWLIB_PROFILER_USE_TSC is defined.
+ *
+ * Tags may carry a phase and a graph level, so per-level timings can be grouped by phase
+ * (see HNSWProfileTags, which registers the per-level tags of the index once at construction).
+ */
+#if defined(HNSWLIB_ENABLE_PROFILER) && defined(HNSWLIB_PROFILER_USE_TSC)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
 
 namespace hnswlib {
 
 class HNSWLightProfiler {
-public:
-    struct Event {
+ public:
+    static const size_t MAX_TAGS = 256;
+    static const size_t HISTOGRAM_BUCKETS = 40;  // bucket b counts samples in [2^b, 2^(b+1)) ns
+
+    // Aggregated statistics of one tag (optionally of one thread), times in nanoseconds
+    struct TagSummary {
         std::string tag;
+        std::string phase;  // equals tag for tags registered without a phase
+        int level{-1};      // graph level, -1 if the tag is not per level
         std::thread::id tid;
-        uint64_t duration_us;
-        Event(const std::string& t, std::thread::id id, uint64_t d) : tag(t), tid(id), duration_us(d) {}
+        uint64_t calls{0};
+        double total_ns{0};
+        double min_ns{0};
+        double max_ns{0};
+        std::vector<uint64_t> histogram;
+
+        double percentile_ns(double q) const {
+            if (calls == 0) return 0;
+            uint64_t rank = (uint64_t)(q * (calls - 1));
+            uint64_t seen = 0;
+            for (size_t b = 0; b < histogram.size(); b++) {
+                seen += histogram[b];
+                if (seen > rank) return std::min(max_ns, (double)(2ULL << b));
+            }
+            return max_ns;
+        }
     };
 
-    static std::mutex events_mutex_;
-    static std::vector<Event> events_;
-    static std::unordered_map<std::thread::id, uint64_t> thread_start_times_;
-    static std::unordered_map<std::thread::id, uint64_t> thread_end_times_;
-    static thread_local std::vector<Event> thread_local_events_;
+#if defined(HNSWLIB_ENABLE_PROFILER)
+    static bool enabled() { return true; }
 
-    class Timer {
-        std::string tag_;
-        uint64_t start_;
-    public:
-        Timer(const std::string& tag) : tag_(tag) {
-            start_ = now();
+    struct TagStats {
+        std::atomic<uint64_t> calls;
+        std::atomic<uint64_t> total;
+        std::atomic<uint64_t> min;
+        std::atomic<uint64_t> max;
+        std::atomic<uint64_t> histogram[HISTOGRAM_BUCKETS];
+    };
+
+    // Written only by its owning thread; read by report functions
+    struct ThreadSlot {
+        std::thread::id tid;
+        TagStats stats[MAX_TAGS];
+
+        ThreadSlot() : tid(std::this_thread::get_id()) {
+            reset();
         }
-        ~Timer() {
-            uint64_t end = now();
-            uint64_t duration = end - start_;
-            auto tid = std::this_thread::get_id();
-            
-            thread_local_events_.emplace_back(tag_, tid, duration);
-        
-            // Record start/end times
-            {
-                std::lock_guard<std::mutex> lock(events_mutex_);
-                if (HNSWLightProfiler::thread_start_times_.find(tid) == HNSWLightProfiler::thread_start_times_.end()) {
-                    HNSWLightProfiler::thread_start_times_[tid] = start_;
-                }
-                HNSWLightProfiler::thread_end_times_[tid] = end;
+
+        void reset() {
+            for (size_t t = 0; t < MAX_TAGS; t++) {
+                stats[t].calls.store(0, std::memory_order_relaxed);
+                stats[t].total.store(0, std::memory_order_relaxed);
+                stats[t].min.store(UINT64_MAX, std::memory_order_relaxed);
+                stats[t].max.store(0, std::memory_order_relaxed);
+                for (size_t b = 0; b < HISTOGRAM_BUCKETS; b++)
+                    stats[t].histogram[b].store(0, std::memory_order_relaxed);
             }
         }
-        
-    private:
-        static uint64_t now() {
-            return std::chrono::duration_cast<std::chrono::microseconds>(
-                std::chrono::high_resolution_clock::now().time_since_epoch()
-            ).count();
+
+        // single writer: plain load + store, no locked instructions
+        void record(uint32_t tag, uint64_t ticks) {
+            TagStats &s = stats[tag];
+            s.calls.store(s.calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            s.total.store(s.total.load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+            if (ticks < s.min.load(std::memory_order_relaxed))
+                s.min.store(ticks, std::memory_order_relaxed);
+            if (ticks > s.max.load(std::memory_order_relaxed))
+                s.max.store(ticks, std::memory_order_relaxed);
+            size_t bucket = std::min(log2Floor(ticks), HISTOGRAM_BUCKETS - 1);
+            s.histogram[bucket].store(s.histogram[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    };
+
+    class Timer {
+        uint32_t tag_;
+        uint64_t start_;
+
+     public:
+        explicit Timer(uint32_t tag) : tag_(tag), start_(now()) {}
+
+        ~Timer() {
+            localSlot().record(tag_, now() - start_);
         }
     };
 
-    // Function to flush thread-local data to global storage
-    static void flush_thread_local() {
-        if (!thread_local_events_.empty()) {
-            std::lock_guard<std::mutex> lock(events_mutex_);
-            events_.insert(events_.end(), thread_local_events_.begin(), thread_local_events_.end());
-            thread_local_events_.clear();
+    // Returns the id of the tag, registering it on first use. Takes a lock: call once per call site.
+    static uint32_t registerTag(const std::string &tag, const std::string &phase = "", int level = -1) {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (size_t i = 0; i < r.tags.size(); i++) {
+            if (r.tags[i].name == tag) return (uint32_t)i;
+        }
+        if (r.tags.size() >= MAX_TAGS)
+            throw std::runtime_error("HNSWLightProfiler: too many tags registered");
+        TagInfo info;
+        info.name = tag;
+        info.phase = phase.empty() ? tag : phase;
+        info.level = level;
+        r.tags.push_back(info);
+        return (uint32_t)(r.tags.size() - 1);
+    }
+
+    static uint64_t now() {
+#if defined(HNSWLIB_PROFILER_USE_TSC)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // Samples are kept per thread; nothing has to be flushed. Kept for compatibility.
+    static void flush_thread_local() {}
+
+    static std::vector<TagSummary> summarize(bool per_thread = false) {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        double scale = nsPerTick(r);
+
+        std::vector<TagSummary> result;
+        for (size_t t = 0; t < r.tags.size(); t++) {
+            TagSummary total;
+            total.tag = r.tags[t].name;
+            total.phase = r.tags[t].phase;
+            total.level = r.tags[t].level;
+            total.histogram.assign(HISTOGRAM_BUCKETS, 0);
+            bool has_min = false;
+            for (ThreadSlot *slot : r.slots) {
+                const TagStats &s = slot->stats[t];
+                uint64_t calls = s.calls.load(std::memory_order_relaxed);
+                if (calls == 0) continue;
+
+                TagSummary cur;
+                cur.tag = r.tags[t].name;
+                cur.phase = r.tags[t].phase;
+                cur.level = r.tags[t].level;
+                cur.tid = slot->tid;
+                cur.calls = calls;
+                cur.total_ns = s.total.load(std::memory_order_relaxed) * scale;
+                cur.min_ns = s.min.load(std::memory_order_relaxed) * scale;
+                cur.max_ns = s.max.load(std::memory_order_relaxed) * scale;
+                cur.histogram.assign(HISTOGRAM_BUCKETS, 0);
+                for (size_t b = 0; b < HISTOGRAM_BUCKETS; b++) {
+                    uint64_t cnt = s.histogram[b].load(std::memory_order_relaxed);
+                    if (cnt == 0) continue;
+                    size_t bucket = std::min(log2Floor((uint64_t)((1ULL << b) * scale)), HISTOGRAM_BUCKETS - 1);
+                    cur.histogram[bucket] += cnt;
+                }
+
+                total.calls += cur.calls;
+                total.total_ns += cur.total_ns;
+                total.min_ns = has_min ? std::min(total.min_ns, cur.min_ns) : cur.min_ns;
+                total.max_ns = std::max(total.max_ns, cur.max_ns);
+                has_min = true;
+                for (size_t b = 0; b < HISTOGRAM_BUCKETS; b++)
+                    total.histogram[b] += cur.histogram[b];
+
+                if (per_thread) result.push_back(cur);
+            }
+            if (!per_thread && total.calls > 0) result.push_back(total);
         }
+        return result;
     }
 
     static void export_to_csv(const std::string& filename) {
-        flush_thread_local();
-        std::lock_guard<std::mutex> lock(events_mutex_);
-        
+        std::vector<TagSummary> rows = summarize(true);
+
         std::ofstream outfile(filename);
         if (!outfile.is_open()) {
             std::cerr << "Failed to open file for writing: " << filename << "\n";
             return;
         }
-    
-        // CSV Header
-        outfile << "Tag,ThreadID,Calls,TotalTime_ms,AverageTime_us,MinTime_us,MaxTime_us\n";
-    
-        // Aggregate data by tag and thread
-        std::unordered_map<std::string, std::unordered_map<std::thread::id, std::vector<uint64_t>>> thread_tag_times;
-        for (const auto& e : events_) {
-            thread_tag_times[e.tag][e.tid].push_back(e.duration_us);
-        }
-    
-        // Write data rows
-        for (const auto& [tag, thread_map] : thread_tag_times) {
-            for (const auto& [tid, times] : thread_map) {
-                uint64_t total = 0;
-                uint64_t min_time = UINT64_MAX;
-                uint64_t max_time = 0;
-                for (auto t : times) {
-                    total += t;
-                    if (t > max_time) max_time = t;
-                    if (t < min_time) min_time = t;
-                }
-                double avg = static_cast<double>(total) / times.size();
-                outfile << "\"" << tag << "\","
-                        << tid << ","
-                        << times.size() << ","
-                        << total / 1000.0 << ","
-                        << avg << ","
-                        << min_time << ","
-                        << max_time << "\n";
-            }
+
+        outfile << "Tag,ThreadID,Calls,TotalTime_ms,AverageTime_us,MinTime_us,MaxTime_us,P50_us,P99_us,Phase,Level\n";
+        for (const TagSummary &row : rows) {
+            outfile << "\"" << row.tag << "\","
+                    << row.tid << ","
+                    << row.calls << ","
+                    << row.total_ns / 1e6 << ","
+                    << row.total_ns / 1e3 / row.calls << ","
+                    << row.min_ns / 1e3 << ","
+                    << row.max_ns / 1e3 << ","
+                    << row.percentile_ns(0.5) / 1e3 << ","
+                    << row.percentile_ns(0.99) / 1e3 << ","
+                    << "\"" << row.phase << "\","
+                    << row.level << "\n";
         }
-    
         outfile.close();
         std::cout << "Profiler data exported to CSV: " << filename << "\n";
     }
 
     static void report() {
-        // First flush current thread's data
-        flush_thread_local();
-        
-        std::lock_guard<std::mutex> lock(events_mutex_);
-        
-        // Aggregate data by thread and tag
-        std::unordered_map<std::string, std::unordered_map<std::thread::id, std::vector<uint64_t>>> thread_tag_times;
-        for (const auto& e : events_) {
-            thread_tag_times[e.tag][e.tid].push_back(e.duration_us);
-        }
-    
+        std::vector<TagSummary> rows = summarize(true);
+
         std::cout << "\n=== Fine-Grained HNSW Timing (Per Thread) ===\n";
-        
-        // Create a summary by thread ID
-        std::unordered_map<std::thread::id, uint64_t> thread_totals;
-        
-        for (const auto& [tag, thread_map] : thread_tag_times) {
-            std::cout << "\n--- " << tag << " ---\n";
-            for (const auto& [tid, times] : thread_map) {
-                uint64_t total = 0;
-                uint64_t min_time = UINT64_MAX;
-                uint64_t max_time = 0;
-                for (auto t : times) {
-                    total += t;
-                    if (t > max_time) max_time = t;
-                    if (t < min_time) min_time = t;
-                }
-                thread_totals[tid] += total;
-                
-                double avg = static_cast<double>(total) / times.size();
-                std::cout << "  Thread " << tid
-                          << " | calls: " << times.size()
-                          << " | total(ms): " << total / 1000.0
-                          << " | avg(us): " << avg
-                          << " | min(us): " << min_time
-                          << " | max(us): " << max_time << "\n";
+        std::vector<std::thread::id> threads;
+        std::string cur_tag;
+        for (const TagSummary &row : rows) {
+            if (row.tag != cur_tag) {
+                cur_tag = row.tag;
+                std::cout << "\n--- " << row.tag << " ---\n";
             }
+            if (std::find(threads.begin(), threads.end(), row.tid) == threads.end())
+                threads.push_back(row.tid);
+            std::cout << "  Thread " << row.tid
+                      << " | calls: " << row.calls
+                      << " | total(ms): " << row.total_ns / 1e6
+                      << " | avg(us): " << row.total_ns / 1e3 / row.calls
+                      << " | min(us): " << row.min_ns / 1e3
+                      << " | max(us): " << row.max_ns / 1e3
+                      << " | p99(us): " << row.percentile_ns(0.99) / 1e3 << "\n";
         }
-        
-        // Summary by thread
-        // std::cout << "\n=== Thread Summary ===\n";
-        // for (const auto& [tid, total] : thread_totals) {
-        //     std::cout << "Thread " << tid << " | total time(ms): " << total / 1000.0 << "\n";
-        // }
-        
-        std::cout << "\nTotal threads used: " << thread_totals.size() << "\n";
+        std::cout << "\nTotal threads used: " << threads.size() << "\n";
     }
-    
+
     static void clear() {
-        std::lock_guard<std::mutex> lock(events_mutex_);
-        events_.clear();
-        thread_local_events_.clear();
-        thread_start_times_.clear();
-        thread_end_times_.clear();
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (ThreadSlot *slot : r.slots)
+            slot->reset();
+    }
+
+ private:
+    struct TagInfo {
+        std::string name;
+        std::string phase;
+        int level;
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<TagInfo> tags;
+        std::vector<ThreadSlot *> slots;  // slots outlive their threads, so samples are kept after join()
+        uint64_t start_ticks;
+        std::chrono::steady_clock::time_point start_time;
+
+        Registry() : start_ticks(now()), start_time(std::chrono::steady_clock::now()) {}
+    };
+
+    // Intentionally leaked: threads may record samples during static destruction
+    static Registry &registry() {
+        static Registry *r = new Registry();
+        return *r;
+    }
+
+    static ThreadSlot &localSlot() {
+        static thread_local ThreadSlot *slot = nullptr;
+        if (slot == nullptr) {
+            slot = new ThreadSlot();
+            Registry &r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.slots.push_back(slot);
+        }
+        return *slot;
+    }
+
+    static double nsPerTick(Registry &r) {
+#if defined(HNSWLIB_PROFILER_USE_TSC)
+        // calibrate the TSC against steady_clock over the lifetime of the registry
+        while (std::chrono::steady_clock::now() - r.start_time < std::chrono::milliseconds(10)) {}
+        double elapsed_ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - r.start_time).count();
+        return elapsed_ns / (double)(now() - r.start_ticks);
+#else
+        return 1.0;
+#endif
+    }
+
+    static size_t log2Floor(uint64_t x) {
+        size_t r = 0;
+        while (x >>= 1) r++;
+        return r;
     }
+
+#else  // HNSWLIB_ENABLE_PROFILER
+    static bool enabled() { return false; }
+    static uint32_t registerTag(const std::string &tag, const std::string &phase = "", int level = -1) { return 0; }
+    static void flush_thread_local() {}
+    static std::vector<TagSummary> summarize(bool per_thread = false) { return std::vector<TagSummary>(); }
+    static void export_to_csv(const std::string& filename) {}
+    static void report() {}
+    static void clear() {}
+#endif  // HNSWLIB_ENABLE_PROFILER
+};
+
+
+/*
+ * Tag ids of the per-level phases of search and insertion.
+ * Registered once when an index is constructed, so timing a level in the hot loops is an array lookup.
+ */
+class HNSWProfileTags {
+ public:
+    enum Phase {
+        SEARCH_UPPER_LAYER,   // greedy descent of searchKnn, per level
+        SEARCH_BASE_LAYER,    // searchBaseLayerST called from searchKnn
+        INSERT_UPPER_LAYER,   // greedy descent of addPoint, per level
+        INSERT_LAYER_SEARCH,  // candidate search of addPoint, per level
+        INSERT_CONNECT,       // mutuallyConnectNewElement, per level
+        NUM_PHASES
+    };
+    static const int MAX_LEVELS = 16;  // deeper levels are accounted to the last one
+
+    HNSWProfileTags() {
+        for (int p = 0; p < NUM_PHASES; p++) {
+            for (int level = 0; level < MAX_LEVELS; level++) {
+                ids_[p][level] = 0;
+            }
+        }
+        if (!HNSWLightProfiler::enabled()) return;
+
+        for (int p = 0; p < NUM_PHASES; p++) {
+            Phase phase = (Phase)p;
+            if (phase == SEARCH_BASE_LAYER) {
+                uint32_t id = HNSWLightProfiler::registerTag(phaseName(phase), phaseName(phase), 0);
+                for (int level = 0; level < MAX_LEVELS; level++)
+                    ids_[p][level] = id;
+                continue;
+            }
+            for (int level = 0; level < MAX_LEVELS; level++) {
+                ids_[p][level] = HNSWLightProfiler::registerTag(
+                    std::string(phaseName(phase)) + "_level_" + std::to_string(level), phaseName(phase), level);
+            }
+        }
+    }
+
+    uint32_t id(Phase phase, int level) const {
+        return ids_[phase][level < MAX_LEVELS ? level : MAX_LEVELS - 1];
+    }
+
+    static const char *phaseName(Phase phase) {
+        switch (phase) {
+            case SEARCH_UPPER_LAYER: return "searchKnn_upper_layer";
+            case SEARCH_BASE_LAYER: return "searchKnn_base_layer";
+            case INSERT_UPPER_LAYER: return "addPoint_upper_layer";
+            case INSERT_LAYER_SEARCH: return "addPoint_layer_search";
+            case INSERT_CONNECT: return "addPoint_connect";
+            default: return "unknown";
+        }
+    }
+
+ private:
+    uint32_t ids_[NUM_PHASES][MAX_LEVELS];
 };
 
-// Static member definitions
-std::mutex HNSWLightProfiler::events_mutex_;
-std::vector<HNSWLightProfiler::Event> HNSWLightProfiler::events_;
-std::unordered_map<std::thread::id, uint64_t> HNSWLightProfiler::thread_start_times_;
-std::unordered_map<std::thread::id, uint64_t> HNSWLightProfiler::thread_end_times_;
-thread_local std::vector<hnswlib::HNSWLightProfiler::Event> hnswlib::HNSWLightProfiler::thread_local_events_;
+}  // namespace hnswlib
+
+#define HNSW_PROFILE_CONCAT_INNER(a, b) a##b
+#define HNSW_PROFILE_CONCAT(a, b) HNSW_PROFILE_CONCAT_INNER(a, b)
 
-}  // namespace hnswlib
\ No newline at end of file
+#if defined(HNSWLIB_ENABLE_PROFILER)
+// Times the enclosing scope under a tag registered once per call site
+#define HNSW_PROFILE_SCOPE(name) \
+    static const uint32_t HNSW_PROFILE_CONCAT(hnsw_profile_tag_, __LINE__) = \
+        ::hnswlib::HNSWLightProfiler::registerTag(name); \
+    ::hnswlib::HNSWLightProfiler::Timer HNSW_PROFILE_CONCAT(hnsw_profile_timer_, __LINE__)( \
+        HNSW_PROFILE_CONCAT(hnsw_profile_tag_, __LINE__))
+// Times the enclosing scope under an already registered tag id
+#define HNSW_PROFILE_SCOPE_ID(tag_id) \
+    ::hnswlib::HNSWLightProfiler::Timer HNSW_PROFILE_CONCAT(hnsw_profile_timer_, __LINE__)(tag_id)
+#else
+#define HNSW_PROFILE_SCOPE(name)
+#define HNSW_PROFILE_SCOPE_ID(tag_id)
+#endif
@@ -4,6 +4,19 @@
 #include "hnswlib.h"
 #include "hnsw_profiler.h"
 #include "shard_label.h"
+#include "mmap_file.h"
+#include "file_reader.h"
+#include "link_list_arena.h"
+#include "reader_gate.h"
+#include "graph_reorder.h"
+#include "memory_policy.h"
+#include "link_list_lock.h"
+#include "thread_pool.h"
+#include "id_filter.h"
+#include "checkpoint.h"
+#include "element_snapshot.h"
+#include "search_stats.h"
+#include <algorithm>
 #include <atomic>
 #include <random>
 #include <stdlib.h>
@@ -14,7 +27,6 @@
 
 
 namespace hnswlib {
-typedef unsigned int tableint;
 typedef unsigned int linklistsizeint;
 
 template<typename dist_t>
@@ -23,8 +35,22 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     static const tableint MAX_LABEL_OPERATION_LOCKS = 65536;
     static const unsigned char DELETE_MARK = 0x01;
 
+    // v2 index files start with this magic; v1 files start with offsetLevel0_, which is always 0
+    static uint64_t indexMagicV2() { return 0x3242494c57534e48ULL; }  // "HNSWLIB2" in file byte order
+    static uint32_t indexFormatVersion() { return 2; }
+    // delta files of saveIndexDelta, they share the version of the v2 format
+    static uint64_t indexMagicDeltaV2() { return 0x32544c4457534e48ULL; }  // "HNSWDLT2" in file byte order
+    static const size_t INDEX_PAGE_ALIGNMENT = 4096;
+    static const size_t INDEX_SECTION_ALIGNMENT = 64;
+    // neighbors scored per batch distance call in searchBaseLayerST
+    static const size_t DISTANCE_BATCH_SIZE = 16;
+    // addPointsBulk adds elements one by one until the graph has as many, batches need a graph to search
+    static const size_t BULK_MIN_GRAPH_SIZE = 1024;
+
     size_t max_elements_{0};
     mutable std::atomic<size_t> cur_element_count{0};  // current number of elements
+    // ids below it are initialized; addPoint claims ids before it initializes them and raises it in id order
+    std::atomic<size_t> initialized_count_{0};
     size_t size_data_per_element_{0};
     size_t size_links_per_element_{0};
     mutable std::atomic<size_t> num_deleted_{0};  // number of deleted elements
@@ -43,7 +69,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     mutable std::vector<std::mutex> label_op_locks_;
 
     std::mutex global;
-    std::vector<std::mutex> link_list_locks_;
+    std::vector<LinkListLock> link_list_locks_;  // writers of the lists of each element, readers use readLinks
 
     tableint enterpoint_node_{0};
 
@@ -51,13 +77,34 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     size_t offsetData_{0}, offsetLevel0_{0}, label_offset_{ 0 };
 
     char *data_level0_memory_{nullptr};
-    char **linkLists_{nullptr};
+    MemoryPolicy memory_policy_{MemoryPolicy::Default};  // how data_level0_memory_ is allocated
+    LinkListArena link_list_arena_;  // upper-layer link lists of all elements
+    std::vector<uint32_t> link_list_offsets_;  // first arena block of each element with level > 0
     std::vector<int> element_levels_;  // keeps level of each element
 
+    std::unique_ptr<MappedFile> mapped_file_;  // set if the index was loaded with an mmap IndexLoadMode
+    bool read_only_{false};
+
     size_t data_size_{0};
+    size_t vector_size_{0};  // size of the vectors passed in, differs from data_size_ if the space encodes them
+    SpaceInterface<dist_t> *space_{nullptr};
 
-    DISTFUNC<dist_t> fstdistfunc_;
+    DISTFUNC<dist_t> fstdistfunc_;  // vector passed in vs stored element
+    DISTFUNC<dist_t> fstdistfunc_stored_;  // stored element vs stored element
+    DISTFUNC_BATCH<dist_t> fstdistfunc_batch_{nullptr};  // optional, scores the neighbors of a node in one call
     void *dist_func_param_{nullptr};
+    // The searches compare the query as prepareQuery() leaves it with the stored elements;
+    // these are fstdistfunc_ and fstdistfunc_batch_ unless the space prepares its queries
+    size_t prepared_query_size_{0};
+    DISTFUNC<dist_t> fstdistfunc_query_;
+    DISTFUNC_BATCH<dist_t> fstdistfunc_query_batch_{nullptr};
+
+    // Optional full-precision copies of the vectors, used to re-rank the results of searches
+    // when the space stores a lossy encoding
+    char *rerank_data_{nullptr};
+    size_t rerank_data_size_{0};
+    DISTFUNC<dist_t> rerank_distfunc_{nullptr};
+    void *rerank_dist_func_param_{nullptr};
 
     ShardedLabelLookup label_lookup_;
     // mutable std::mutex label_lookup_lock;  // lock for label_lookup_
@@ -66,6 +113,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     std::default_random_engine level_generator_;
     std::default_random_engine update_probability_generator_;
 
+    // Deprecated, use SearchStats or SearchCounters: hops and distance computations of the searches
+    // of this index, added once per search
     mutable std::atomic<long> metric_distance_computations{0};
     mutable std::atomic<long> metric_hops{0};
 
@@ -74,6 +123,28 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     std::mutex deleted_elements_lock;  // lock for deleted_elements
     std::unordered_set<tableint> deleted_elements;  // contains internal ids of deleted elements
 
+    HNSWProfileTags profile_tags_;  // per-level profiler tags, all zero if the profiler is compiled out
+
+    // Searches hold it while they read the index, compact() closes it to swap the storage
+    mutable ReaderGate search_gate_;
+    std::mutex compact_lock_;
+    uint64_t renumber_count_{0};  // runs of compact() and reorder(), a ResumableSearch in flight checks it
+
+    // Changes since the last checkpoint (see saveIndexDelta) and the log of the updates since
+    DirtyElements dirty_elements_;
+    std::unique_ptr<WriteAheadLog> write_ahead_log_;
+    bool has_checkpoint_{false};  // set by saveIndex and loadIndex
+    uint32_t checkpoint_base_id_{0};  // names the snapshot of the checkpoint
+    uint64_t checkpoint_sequence_{0};  // deltas written or applied on top of the snapshot
+    size_t checkpoint_element_count_{0};
+    bool renumbered_since_checkpoint_{false};  // compact or reorder ran, the next checkpoint is a full one
+
+    // Keeps what saveSnapshot writes as it was when the snapshot began
+    ElementSnapshot element_snapshot_;
+    // Insertions and deletions hold it while they change the element count, saveSnapshot closes it to begin
+    ReaderGate update_gate_;
+    std::mutex snapshot_lock_;
+
 
     HierarchicalNSW(SpaceInterface<dist_t> *s) {
     }
@@ -84,9 +155,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         const std::string &location,
         bool nmslib = false,
         size_t max_elements = 0,
-        bool allow_replace_deleted = false)
+        bool allow_replace_deleted = false,
+        IndexLoadMode load_mode = IndexLoadMode::Copy,
+        ThreadPool *pool = nullptr)
         : allow_replace_deleted_(allow_replace_deleted) {
-        loadIndex(location, s, max_elements);
+        loadIndex(location, s, max_elements, load_mode, pool);
     }
 
 
@@ -100,12 +173,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         : label_op_locks_(MAX_LABEL_OPERATION_LOCKS),
             link_list_locks_(max_elements),
             element_levels_(max_elements),
+            label_lookup_(max_elements),
             allow_replace_deleted_(allow_replace_deleted) {
         max_elements_ = max_elements;
         num_deleted_ = 0;
-        data_size_ = s->get_data_size();
-        fstdistfunc_ = s->get_dist_func();
-        dist_func_param_ = s->get_dist_func_param();
+        setSpace(s);
         if ( M <= 10000 ) {
             M_ = M;
         } else {
@@ -127,11 +199,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         label_offset_ = size_links_level0_ + data_size_;
         offsetLevel0_ = 0;
 
-        data_level0_memory_ = (char *) malloc(max_elements_ * size_data_per_element_);
+        data_level0_memory_ = allocateBaseLayer(max_elements_);
         if (data_level0_memory_ == nullptr)
             throw std::runtime_error("Not enough memory");
 
         cur_element_count = 0;
+        initialized_count_ = 0;
 
         visited_list_pool_ = std::unique_ptr<VisitedListPool>(new VisitedListPool(1, max_elements));
 
@@ -139,10 +212,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         enterpoint_node_ = -1;
         maxlevel_ = -1;
 
-        linkLists_ = (char **) malloc(sizeof(void *) * max_elements_);
-        if (linkLists_ == nullptr)
-            throw std::runtime_error("Not enough memory: HierarchicalNSW failed to allocate linklists");
         size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+        link_list_arena_.init(size_links_per_element_);
+        link_list_offsets_.assign(max_elements_, LinkListArena::NO_BLOCK);
+        dirty_elements_.resize(max_elements_);
         mult_ = 1 / log(1.0 * M_);
         revSize_ = 1.0 / mult_;
     }
@@ -153,16 +226,146 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
     void clear() {
-        free(data_level0_memory_);
+        freeBaseLayer(data_level0_memory_, max_elements_);
         data_level0_memory_ = nullptr;
-        for (tableint i = 0; i < cur_element_count; i++) {
-            if (element_levels_[i] > 0)
-                free(linkLists_[i]);
-        }
-        free(linkLists_);
-        linkLists_ = nullptr;
+        link_list_arena_.clear();
+        std::vector<uint32_t>().swap(link_list_offsets_);
         cur_element_count = 0;
+        initialized_count_ = 0;
+        num_deleted_ = 0;
+        deleted_elements.clear();
         visited_list_pool_.reset(nullptr);
+        mapped_file_.reset(nullptr);
+        read_only_ = false;
+        free(rerank_data_);
+        rerank_data_ = nullptr;
+    }
+
+
+    void setSpace(SpaceInterface<dist_t> *s) {
+        space_ = s;
+        data_size_ = s->get_data_size();
+        vector_size_ = s->get_vector_size();
+        fstdistfunc_ = s->get_dist_func();
+        fstdistfunc_stored_ = s->get_stored_dist_func();
+        fstdistfunc_batch_ = s->get_dist_func_batch();
+        dist_func_param_ = s->get_dist_func_param();
+        prepared_query_size_ = s->get_prepared_query_size();
+        fstdistfunc_query_ = s->get_prepared_dist_func();
+        fstdistfunc_query_batch_ = s->get_prepared_dist_func_batch();
+    }
+
+
+    /*
+     * The query as the searches compare it with the stored elements (fstdistfunc_query_): the
+     * vector itself, or what the space prepared from it in buffer, once per search.
+     */
+    const void *prepareQuery(const void *query_data, std::vector<char> &buffer) const {
+        if (prepared_query_size_ == 0)
+            return query_data;
+        buffer.resize(prepared_query_size_);
+        space_->prepare_query(query_data, buffer.data());
+        return buffer.data();
+    }
+
+
+    // Called by every writer of an element before it changes the element, outside of a WriteSection
+    void elementChanging(tableint internal_id) {
+        dirty_elements_.mark(internal_id);
+        if (element_snapshot_.active()) {
+            element_snapshot_.preserve(internal_id, elementSize(internal_id),
+                [&](char *dst) { copyElement(internal_id, dst); });
+        }
+    }
+
+
+    // Bytes of the level 0 block and the upper-layer lists of an element
+    size_t elementSize(tableint internal_id) const {
+        return size_data_per_element_ + element_levels_[internal_id] * size_links_per_element_;
+    }
+
+
+    // Copies the level 0 block and the upper-layer lists of an element, retried while its lists change
+    void copyElement(tableint internal_id, char *dst) const {
+        const LinkListLock &lock = link_list_locks_[internal_id];
+        size_t upper_size = element_levels_[internal_id] * size_links_per_element_;
+        while (true) {
+            uint32_t version = lock.readBegin();
+            memcpy(dst, data_level0_memory_ + internal_id * size_data_per_element_, size_data_per_element_);
+            if (upper_size != 0)
+                memcpy(dst + size_data_per_element_, get_linklist(internal_id, 1), upper_size);
+            if (lock.readValid(version))
+                return;
+        }
+    }
+
+
+    // Stores the vector of an element, encoded if the space encodes vectors
+    void setData(tableint internal_id, const void *data_point) {
+        elementChanging(internal_id);
+        if (vector_size_ == data_size_)
+            memcpy(getDataByInternalId(internal_id), data_point, data_size_);
+        else
+            space_->encode(data_point, getDataByInternalId(internal_id));
+        if (rerank_data_ != nullptr)
+            memcpy(rerank_data_ + internal_id * rerank_data_size_, data_point, rerank_data_size_);
+    }
+
+
+    void allocateRerankStore(SpaceInterface<dist_t> *exact_space) {
+        size_t size = exact_space->get_data_size();
+        char *rerank_data = (char *) realloc(rerank_data_, max_elements_ * size);
+        if (rerank_data == nullptr && max_elements_ != 0)
+            throw std::runtime_error("Not enough memory: failed to allocate the re-rank store");
+        rerank_data_ = rerank_data;
+        rerank_data_size_ = size;
+        rerank_distfunc_ = exact_space->get_dist_func();
+        rerank_dist_func_param_ = exact_space->get_dist_func_param();
+    }
+
+
+    bool isMapped(const void *p) const {
+        return mapped_file_ && mapped_file_->contains(p);
+    }
+
+
+    // Base layer memory for num_elements under memory_policy_, nullptr if it cannot be allocated
+    char *allocateBaseLayer(size_t num_elements) const {
+        return allocateMemory(num_elements * size_data_per_element_, memory_policy_);
+    }
+
+
+    void freeBaseLayer(char *p, size_t num_elements) const {
+        if (!isMapped(p))
+            freeMemory(p, num_elements * size_data_per_element_, memory_policy_);
+    }
+
+
+    /*
+     * Moves the base layer to memory allocated under the policy; later allocations of the base
+     * layer (resizeIndex, compact, reorder) use it too. Must not run concurrently with other
+     * operations on the index.
+     */
+    void setMemoryPolicy(MemoryPolicy policy) {
+        checkWritable();
+        char *data_level0_memory_new = allocateMemory(max_elements_ * size_data_per_element_, policy);
+        if (data_level0_memory_new == nullptr)
+            throw std::runtime_error("Not enough memory: setMemoryPolicy failed to allocate base layer");
+        memcpy(data_level0_memory_new, data_level0_memory_, cur_element_count * size_data_per_element_);
+        freeBaseLayer(data_level0_memory_, max_elements_);
+        data_level0_memory_ = data_level0_memory_new;
+        memory_policy_ = policy;
+    }
+
+
+    MemoryPolicy getMemoryPolicy() const {
+        return memory_policy_;
+    }
+
+
+    void checkWritable() const {
+        if (read_only_)
+            throw std::runtime_error("The index is mapped read-only");
     }
 
 
@@ -231,12 +434,18 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         VisitedList *vl = visited_list_pool_->getFreeVisitedList();
         vl_type *visited_array = vl->mass;
         vl_type visited_array_tag = vl->curV;
+        NeighborPool<dist_t, tableint> &pool = vl->getNeighborPool<dist_t, tableint>();
 
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidateSet;
+        // without deletions every candidate is a result, so the sorted pool is the whole search state
+        bool use_pool = num_deleted_ == 0;
+        ReusableHeap<std::pair<dist_t, tableint>, CompareByFirst> top_candidates(pool.results());
+        ReusableHeap<std::pair<dist_t, tableint>, CompareByFirst> candidateSet(pool.candidateStorage());
 
         dist_t lowerBound;
-        if (!isMarkedDeleted(ep_id)) {
+        if (use_pool) {
+            pool.reset(ef_construction_);
+            pool.insert(ep_id, fstdistfunc_(data_point, getDataByInternalId(ep_id), dist_func_param_));
+        } else if (!isMarkedDeleted(ep_id)) {
             dist_t dist = fstdistfunc_(data_point, getDataByInternalId(ep_id), dist_func_param_);
             top_candidates.emplace(dist, ep_id);
             lowerBound = dist;
@@ -247,29 +456,25 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         }
         visited_array[ep_id] = visited_array_tag;
 
-        while (!candidateSet.empty()) {
-            std::pair<dist_t, tableint> curr_el_pair = candidateSet.top();
-            if ((-curr_el_pair.first) > lowerBound && top_candidates.size() == ef_construction_) {
-                break;
-            }
-            candidateSet.pop();
-
-            tableint curNodeNum = curr_el_pair.second;
-
-            std::unique_lock <std::mutex> lock(link_list_locks_[curNodeNum]);
-
-            int *data;  // = (int *)(linkList0_ + curNodeNum * size_links_per_element0_);
-            if (layer == 0) {
-                data = (int*)get_linklist0(curNodeNum);
+        tableint *links = pool.links(maxM0_ + 1);
+        while (use_pool ? pool.hasNext() : !candidateSet.empty()) {
+            tableint curNodeNum;
+            if (use_pool) {
+                curNodeNum = pool.next();
             } else {
-                data = (int*)get_linklist(curNodeNum, layer);
-//                    data = (int *) (linkLists_[curNodeNum] + (layer - 1) * size_links_per_element_);
+                std::pair<dist_t, tableint> curr_el_pair = candidateSet.top();
+                if ((-curr_el_pair.first) > lowerBound && top_candidates.size() == ef_construction_) {
+                    break;
+                }
+                candidateSet.pop();
+                curNodeNum = curr_el_pair.second;
             }
-            size_t size = getListCount((linklistsizeint*)data);
-            tableint *datal = (tableint *) (data + 1);
+
+            size_t size = readLinks(curNodeNum, layer, links);
+            tableint *datal = links;
 #ifdef USE_SSE
-            _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
-            _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
+            _mm_prefetch((char *) (visited_array + *datal), _MM_HINT_T0);
+            _mm_prefetch((char *) (visited_array + *datal + 64), _MM_HINT_T0);
             _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
             _mm_prefetch(getDataByInternalId(*(datal + 1)), _MM_HINT_T0);
 #endif
@@ -286,7 +491,9 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 char *currObj1 = (getDataByInternalId(candidate_id));
 
                 dist_t dist1 = fstdistfunc_(data_point, currObj1, dist_func_param_);
-                if (top_candidates.size() < ef_construction_ || lowerBound > dist1) {
+                if (use_pool) {
+                    pool.insert(candidate_id, dist1);
+                } else if (top_candidates.size() < ef_construction_ || lowerBound > dist1) {
                     candidateSet.emplace(-dist1, candidate_id);
 #ifdef USE_SSE
                     _mm_prefetch(getDataByInternalId(candidateSet.top().second), _MM_HINT_T0);
@@ -303,78 +510,183 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 }
             }
         }
-        visited_list_pool_->releaseVisitedList(vl);
+        if (use_pool)
+            pool.exportResults();
 
-        return top_candidates;
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+            result(CompareByFirst(), pool.results());
+        visited_list_pool_->releaseVisitedList(vl);
+        return result;
     }
 
 
     // bare_bone_search means there is no check for deletions and stop condition is ignored in return of extra performance
-    template <bool bare_bone_search = true, bool collect_metrics = false>
+    template <bool bare_bone_search = true, bool collect_metrics = false,
+              typename StopCondition = BaseSearchStopCondition<dist_t>>
     std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
     searchBaseLayerST(
         tableint ep_id,
         const void *data_point,
         size_t ef,
         BaseFilterFunctor* isIdAllowed = nullptr,
-        BaseSearchStopCondition<dist_t>* stop_condition = nullptr) const {
+        StopCondition* stop_condition = nullptr) const {
+        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+        SearchStats stats;
+        stats.hops.assign(1, 0);
+        const void *query = prepareQuery(data_point, vl->prepared_query);
+        searchBaseLayerPool<bare_bone_search>(vl, ep_id, query, ef, isIdAllowed, stop_condition,
+                                              collect_metrics ? &stats : nullptr);
+        if (collect_metrics) {
+            SearchCounters::add(stats);
+            addMetrics(stats);
+        }
+
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+            top_candidates(CompareByFirst(), vl->getNeighborPool<dist_t, tableint>().results());
+        visited_list_pool_->releaseVisitedList(vl);
+        return top_candidates;
+    }
+
+
+    /*
+     * Base layer search of searchBaseLayerST. The results are left in the neighbor pool of vl, closer first,
+     * so they are only valid until vl is released.
+     *
+     * The bare bone search keeps the ef closest elements in the sorted pool and expands them in order.
+     * Deletions, filters and stop conditions need elements that are expanded without being results,
+     * so the other searches keep separate candidate and result heaps, both over the pool storage.
+     *
+     * The stop condition is called through its static type: for a final class such as
+     * EpsilonSearchStopCondition the calls are resolved at compile time and inlined.
+     *
+     * The work is added to stats, if given, which has room for the base layer hops.
+     * data_point is the query as prepareQuery() leaves it, as for the other searches below.
+     */
+    template <bool bare_bone_search = true, typename StopCondition = BaseSearchStopCondition<dist_t>>
+    void searchBaseLayerPool(
+        VisitedList *vl,
+        tableint ep_id,
+        const void *data_point,
+        size_t ef,
+        BaseFilterFunctor* isIdAllowed = nullptr,
+        StopCondition* stop_condition = nullptr,
+        SearchStats *stats = nullptr) const {
 
-        HNSWLightProfiler::Timer total_timer("searchBaseLayerST_total");
+        HNSW_PROFILE_SCOPE("searchBaseLayerST_total");
 
-        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
         vl_type *visited_array = vl->mass;
         vl_type visited_array_tag = vl->curV;
+        NeighborPool<dist_t, tableint> &pool = vl->getNeighborPool<dist_t, tableint>();
 
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidate_set;
+        ReusableHeap<std::pair<dist_t, tableint>, CompareByFirst> top_candidates(pool.results());
+        ReusableHeap<std::pair<dist_t, tableint>, CompareByFirst> candidate_set(pool.candidateStorage());
 
         dist_t lowerBound;
-        if (bare_bone_search || 
-            (!isMarkedDeleted(ep_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(ep_id))))) {
+        if (bare_bone_search) {
+            pool.reset(ef);
+            pool.insert(ep_id, fstdistfunc_query_(data_point, getDataByInternalId(ep_id), dist_func_param_));
+            if (stats) stats->distance_computations++;
+        } else if (!isMarkedDeleted(ep_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(ep_id)))) {
             char* ep_data = getDataByInternalId(ep_id);
-            dist_t dist = fstdistfunc_(data_point, ep_data, dist_func_param_);
+            dist_t dist = fstdistfunc_query_(data_point, ep_data, dist_func_param_);
             lowerBound = dist;
             top_candidates.emplace(dist, ep_id);
-            if (!bare_bone_search && stop_condition) {
+            if (stop_condition) {
                 stop_condition->add_point_to_result(getExternalLabel(ep_id), ep_data, dist);
             }
             candidate_set.emplace(-dist, ep_id);
+            if (stats) stats->distance_computations++;
         } else {
             lowerBound = std::numeric_limits<dist_t>::max();
             candidate_set.emplace(-lowerBound, ep_id);
+            if (stats) stats->filtered_out++;
         }
 
         visited_array[ep_id] = visited_array_tag;
+        if (stats) stats->visited++;
 
-        { HNSWLightProfiler::Timer neighbor_expand_timer("searchBaseLayerST_neighbor_expansion");
-        while (!candidate_set.empty()) {
-            std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
-            dist_t candidate_dist = -current_node_pair.first;
+        // adds a scored neighbor to the candidate and result sets if it is close enough
+        auto considerCandidate = [&](tableint candidate_id, char *currObj1, dist_t dist) {
+            if (bare_bone_search) {
+                pool.insert(candidate_id, dist);
+                return;
+            }
 
-            bool flag_stop_search;
+            bool flag_consider_candidate;
+            if (stop_condition) {
+                flag_consider_candidate = stop_condition->should_consider_candidate(dist, lowerBound);
+            } else {
+                flag_consider_candidate = top_candidates.size() < ef || lowerBound > dist;
+            }
+
+            if (flag_consider_candidate) {
+                candidate_set.emplace(-dist, candidate_id);
+#ifdef USE_SSE
+                _mm_prefetch(data_level0_memory_ + candidate_set.top().second * size_data_per_element_ +
+                                offsetLevel0_,  ///////////
+                                _MM_HINT_T0);  ////////////////////////
+#endif
+
+                if (!isMarkedDeleted(candidate_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(candidate_id)))) {
+                    top_candidates.emplace(dist, candidate_id);
+                    if (stop_condition) {
+                        stop_condition->add_point_to_result(getExternalLabel(candidate_id), currObj1, dist);
+                    }
+                } else if (stats) {
+                    stats->filtered_out++;
+                }
+
+                bool flag_remove_extra = false;
+                if (stop_condition) {
+                    flag_remove_extra = stop_condition->should_remove_extra();
+                } else {
+                    flag_remove_extra = top_candidates.size() > ef;
+                }
+                while (flag_remove_extra) {
+                    dist_t removed_dist = top_candidates.top().first;
+                    tableint id = top_candidates.top().second;
+                    top_candidates.pop();
+                    if (stop_condition) {
+                        stop_condition->remove_point_from_result(getExternalLabel(id), getDataByInternalId(id), removed_dist);
+                        flag_remove_extra = stop_condition->should_remove_extra();
+                    } else {
+                        flag_remove_extra = top_candidates.size() > ef;
+                    }
+                }
+
+                if (!top_candidates.empty())
+                    lowerBound = top_candidates.top().first;
+            }
+        };
+
+        {
+        HNSW_PROFILE_SCOPE("searchBaseLayerST_neighbor_expansion");
+        while (bare_bone_search ? pool.hasNext() : !candidate_set.empty()) {
+            tableint current_node_id;
             if (bare_bone_search) {
-                flag_stop_search = candidate_dist > lowerBound;
+                // the search is over once every pooled element was expanded
+                current_node_id = pool.next();
             } else {
+                std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
+                dist_t candidate_dist = -current_node_pair.first;
+
+                bool flag_stop_search;
                 if (stop_condition) {
                     flag_stop_search = stop_condition->should_stop_search(candidate_dist, lowerBound);
                 } else {
                     flag_stop_search = candidate_dist > lowerBound && top_candidates.size() == ef;
                 }
+                if (flag_stop_search) {
+                    break;
+                }
+                candidate_set.pop();
+                current_node_id = current_node_pair.second;
             }
-            if (flag_stop_search) {
-                break;
-            }
-            candidate_set.pop();
 
-            tableint current_node_id = current_node_pair.second;
             int *data = (int *) get_linklist0(current_node_id);
             size_t size = getListCount((linklistsizeint*)data);
 //                bool cur_node_deleted = isMarkedDeleted(current_node_id);
-            if (collect_metrics) {
-                metric_hops++;
-                metric_distance_computations+=size;
-            }
-
+            if (stats) stats->hops[0]++;
 #ifdef USE_SSE
             _mm_prefetch((char *) (visited_array + *(data + 1)), _MM_HINT_T0);
             _mm_prefetch((char *) (visited_array + *(data + 1) + 64), _MM_HINT_T0);
@@ -382,73 +694,245 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             _mm_prefetch((char *) (data + 2), _MM_HINT_T0);
 #endif
 
-            for (size_t j = 1; j <= size; j++) {
-                int candidate_id = *(data + j);
-//                    if (candidate_id == 0) continue;
+            if (fstdistfunc_query_batch_ != nullptr) {
+                // unvisited neighbors are scored in groups, one batch kernel call per group
+                tableint batch_ids[DISTANCE_BATCH_SIZE];
+                const void *batch_data[DISTANCE_BATCH_SIZE];
+                dist_t batch_dists[DISTANCE_BATCH_SIZE];
+                size_t j = 1;
+                while (j <= size) {
+                    size_t batch_size = 0;
+                    for (; j <= size && batch_size < DISTANCE_BATCH_SIZE; j++) {
+                        int candidate_id = *(data + j);
 #ifdef USE_SSE
-                _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
-                _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
-                                _MM_HINT_T0);  ////////////
+                        _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
+                        _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
+                                        _MM_HINT_T0);
 #endif
-                if (!(visited_array[candidate_id] == visited_array_tag)) {
-                    visited_array[candidate_id] = visited_array_tag;
-                    char *currObj1 = (getDataByInternalId(candidate_id));
-                    dist_t dist;
-                    { HNSWLightProfiler::Timer dist_timer("searchBaseLayerST_distance_computation");
-                    
-                        dist = fstdistfunc_(data_point, currObj1, dist_func_param_);
+                        if (!(visited_array[candidate_id] == visited_array_tag)) {
+                            visited_array[candidate_id] = visited_array_tag;
+                            batch_ids[batch_size] = candidate_id;
+                            batch_data[batch_size] = getDataByInternalId(candidate_id);
+                            batch_size++;
+                        }
                     }
-
-                    bool flag_consider_candidate;
-                    if (!bare_bone_search && stop_condition) {
-                        flag_consider_candidate = stop_condition->should_consider_candidate(dist, lowerBound);
-                    } else {
-                        flag_consider_candidate = top_candidates.size() < ef || lowerBound > dist;
+                    if (batch_size == 0)
+                        continue;
+                    {
+                        HNSW_PROFILE_SCOPE("searchBaseLayerST_distance_computation");
+                        fstdistfunc_query_batch_(data_point, batch_data, batch_size, dist_func_param_, batch_dists);
                     }
-
-                    if (flag_consider_candidate) {
-                        candidate_set.emplace(-dist, candidate_id);
+                    if (stats) {
+                        stats->visited += batch_size;
+                        stats->distance_computations += batch_size;
+                    }
+                    for (size_t b = 0; b < batch_size; b++)
+                        considerCandidate(batch_ids[b], (char *) batch_data[b], batch_dists[b]);
+                }
+            } else {
+                for (size_t j = 1; j <= size; j++) {
+                    int candidate_id = *(data + j);
 #ifdef USE_SSE
-                        _mm_prefetch(data_level0_memory_ + candidate_set.top().second * size_data_per_element_ +
-                                        offsetLevel0_,  ///////////
-                                        _MM_HINT_T0);  ////////////////////////
+                    _mm_prefetch((char *) (visited_array + *(data + j + 1)), _MM_HINT_T0);
+                    _mm_prefetch(data_level0_memory_ + (*(data + j + 1)) * size_data_per_element_ + offsetData_,
+                                    _MM_HINT_T0);  ////////////
 #endif
-
-                        if (bare_bone_search || 
-                            (!isMarkedDeleted(candidate_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(candidate_id))))) {
-                            top_candidates.emplace(dist, candidate_id);
-                            if (!bare_bone_search && stop_condition) {
-                                stop_condition->add_point_to_result(getExternalLabel(candidate_id), currObj1, dist);
-                            }
+                    if (!(visited_array[candidate_id] == visited_array_tag)) {
+                        visited_array[candidate_id] = visited_array_tag;
+                        char *currObj1 = (getDataByInternalId(candidate_id));
+                        dist_t dist;
+                        {
+                            HNSW_PROFILE_SCOPE("searchBaseLayerST_distance_computation");
+                            dist = fstdistfunc_query_(data_point, currObj1, dist_func_param_);
                         }
-
-                        bool flag_remove_extra = false;
-                        if (!bare_bone_search && stop_condition) {
-                            flag_remove_extra = stop_condition->should_remove_extra();
-                        } else {
-                            flag_remove_extra = top_candidates.size() > ef;
+                        if (stats) {
+                            stats->visited++;
+                            stats->distance_computations++;
                         }
-                        while (flag_remove_extra) {
-                            tableint id = top_candidates.top().second;
+                        considerCandidate(candidate_id, currObj1, dist);
+                    }
+                }
+            }
+        }
+    }
+
+        if (bare_bone_search)
+            pool.exportResults();
+        else
+            top_candidates.sorted();
+    }
+
+
+    /*
+     * Base layer search for an IdFilter, the results are left in the neighbor pool of vl as by
+     * searchBaseLayerPool. Only allowed elements are scored. The links of a neighbor that the filter
+     * removes are followed instead (two hops), so the search crosses the removed parts of the graph;
+     * an expansion scores at most maxM0_ elements. The work is added to stats, if given.
+     */
+    void searchBaseLayerIdFilter(
+        VisitedList *vl,
+        tableint ep_id,
+        const void *data_point,
+        size_t ef,
+        const IdFilter &id_filter,
+        BaseFilterFunctor* isIdAllowed,
+        SearchStats *stats = nullptr) const {
+        vl_type *visited_array = vl->mass;
+        vl_type visited_array_tag = vl->curV;
+        NeighborPool<dist_t, tableint> &pool = vl->getNeighborPool<dist_t, tableint>();
+        ReusableHeap<std::pair<dist_t, tableint>, CompareByFirst> top_candidates(pool.results());
+        ReusableHeap<std::pair<dist_t, tableint>, CompareByFirst> candidate_set(pool.candidateStorage());
+
+        auto allowed = [&](tableint id) {
+            return id_filter.contains(id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(id)));
+        };
+
+        dist_t lowerBound = std::numeric_limits<dist_t>::max();
+        dist_t ep_dist = fstdistfunc_query_(data_point, getDataByInternalId(ep_id), dist_func_param_);
+        if (allowed(ep_id) && !isMarkedDeleted(ep_id)) {
+            top_candidates.emplace(ep_dist, ep_id);
+            lowerBound = ep_dist;
+        } else if (stats) {
+            stats->filtered_out++;
+        }
+        candidate_set.emplace(-ep_dist, ep_id);
+        visited_array[ep_id] = visited_array_tag;
+        if (stats) {
+            stats->visited++;
+            stats->distance_computations++;
+        }
+
+        tableint batch_ids[DISTANCE_BATCH_SIZE];
+        const void *batch_data[DISTANCE_BATCH_SIZE];
+        dist_t batch_dists[DISTANCE_BATCH_SIZE];
+        size_t batch_size = 0;
+        auto flush = [&]() {
+            scoreBatch(data_point, batch_data, batch_size, batch_dists);
+            if (stats) stats->distance_computations += batch_size;
+            for (size_t b = 0; b < batch_size; b++) {
+                dist_t dist = batch_dists[b];
+                if (top_candidates.size() < ef || lowerBound > dist) {
+                    candidate_set.emplace(-dist, batch_ids[b]);
+                    if (!isMarkedDeleted(batch_ids[b])) {
+                        top_candidates.emplace(dist, batch_ids[b]);
+                        if (top_candidates.size() > ef)
                             top_candidates.pop();
-                            if (!bare_bone_search && stop_condition) {
-                                stop_condition->remove_point_from_result(getExternalLabel(id), getDataByInternalId(id), dist);
-                                flag_remove_extra = stop_condition->should_remove_extra();
-                            } else {
-                                flag_remove_extra = top_candidates.size() > ef;
-                            }
-                        }
+                        lowerBound = top_candidates.top().first;
+                    } else if (stats) {
+                        stats->filtered_out++;
+                    }
+                }
+            }
+            batch_size = 0;
+        };
+        auto score = [&](tableint id) {
+            visited_array[id] = visited_array_tag;
+            if (stats) stats->visited++;
+            batch_ids[batch_size] = id;
+            batch_data[batch_size] = getDataByInternalId(id);
+            if (++batch_size == DISTANCE_BATCH_SIZE)
+                flush();
+        };
 
-                        if (!top_candidates.empty())
-                            lowerBound = top_candidates.top().first;
+        while (!candidate_set.empty()) {
+            std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
+            if (-current_node_pair.first > lowerBound && top_candidates.size() == ef)
+                break;
+            candidate_set.pop();
+            if (stats) stats->hops[0]++;
+
+            linklistsizeint *ll = get_linklist0(current_node_pair.second);
+            size_t size = getListCount(ll);
+            tableint *links = (tableint *) (ll + 1);
+            size_t scored = 0;
+            for (size_t j = 0; j < size && scored < maxM0_; j++) {
+                tableint neighbor = links[j];
+                if (visited_array[neighbor] == visited_array_tag)
+                    continue;
+                if (allowed(neighbor)) {
+                    score(neighbor);
+                    scored++;
+                    continue;
+                }
+                visited_array[neighbor] = visited_array_tag;
+                if (stats) {
+                    stats->visited++;
+                    stats->filtered_out++;
+                }
+                linklistsizeint *ll2 = get_linklist0(neighbor);
+                size_t size2 = getListCount(ll2);
+                tableint *links2 = (tableint *) (ll2 + 1);
+                for (size_t j2 = 0; j2 < size2 && scored < maxM0_; j2++) {
+                    tableint second = links2[j2];
+                    if (visited_array[second] != visited_array_tag && allowed(second)) {
+                        score(second);
+                        scored++;
                     }
                 }
             }
+            if (batch_size > 0)
+                flush();
         }
+        top_candidates.sorted();
     }
 
-        visited_list_pool_->releaseVisitedList(vl);
-        return top_candidates;
+
+    /*
+     * Exact search over the elements of an IdFilter, the ef closest are left in the neighbor pool of vl.
+     * The work is added to stats, if given.
+     */
+    void scanIdFilter(
+        VisitedList *vl,
+        const void *data_point,
+        size_t ef,
+        const IdFilter &id_filter,
+        BaseFilterFunctor* isIdAllowed,
+        SearchStats *stats = nullptr) const {
+        NeighborPool<dist_t, tableint> &pool = vl->getNeighborPool<dist_t, tableint>();
+        ReusableHeap<std::pair<dist_t, tableint>, CompareByFirst> top_candidates(pool.results());
+
+        tableint batch_ids[DISTANCE_BATCH_SIZE];
+        const void *batch_data[DISTANCE_BATCH_SIZE];
+        dist_t batch_dists[DISTANCE_BATCH_SIZE];
+        size_t batch_size = 0;
+        auto flush = [&]() {
+            scoreBatch(data_point, batch_data, batch_size, batch_dists);
+            if (stats) stats->distance_computations += batch_size;
+            for (size_t b = 0; b < batch_size; b++) {
+                if (top_candidates.size() < ef || top_candidates.top().first > batch_dists[b]) {
+                    top_candidates.emplace(batch_dists[b], batch_ids[b]);
+                    if (top_candidates.size() > ef)
+                        top_candidates.pop();
+                }
+            }
+            batch_size = 0;
+        };
+        // unlike the graph, the filter may name elements an insertion has claimed but not initialized
+        size_t num_elements = initialized_count_.load(std::memory_order_acquire);
+        id_filter.forEach([&](tableint id) {
+            if (id >= num_elements || isMarkedDeleted(id) || (isIdAllowed && !(*isIdAllowed)(getExternalLabel(id)))) {
+                if (stats) stats->filtered_out++;
+                return;
+            }
+            batch_ids[batch_size] = id;
+            batch_data[batch_size] = getDataByInternalId(id);
+            if (++batch_size == DISTANCE_BATCH_SIZE)
+                flush();
+        });
+        if (batch_size > 0)
+            flush();
+        top_candidates.sorted();
+    }
+
+
+    // Distances of a prepared query to batch_size stored elements
+    void scoreBatch(const void *data_point, const void *const *batch_data, size_t batch_size, dist_t *batch_dists) const {
+        if (fstdistfunc_query_batch_ != nullptr) {
+            fstdistfunc_query_batch_(data_point, batch_data, batch_size, dist_func_param_, batch_dists);
+        } else {
+            for (size_t b = 0; b < batch_size; b++)
+                batch_dists[b] = fstdistfunc_query_(data_point, batch_data[b], dist_func_param_);
+        }
     }
 
 
@@ -476,7 +960,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
             for (std::pair<dist_t, tableint> second_pair : return_list) {
                 dist_t curdist =
-                        fstdistfunc_(getDataByInternalId(second_pair.second),
+                        fstdistfunc_stored_(getDataByInternalId(second_pair.second),
                                         getDataByInternalId(curent_pair.second),
                                         dist_func_param_);
                 if (curdist < dist_to_query) {
@@ -506,7 +990,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
 
     linklistsizeint *get_linklist(tableint internal_id, int level) const {
-        return (linklistsizeint *) (linkLists_[internal_id] + (level - 1) * size_links_per_element_);
+        return (linklistsizeint *) (link_list_arena_.at(link_list_offsets_[internal_id]) + (level - 1) * size_links_per_element_);
     }
 
 
@@ -515,6 +999,25 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    /*
+     * Copies the list of an element at a level to links, which has room for maxM0_ + 1 ids, and
+     * returns the number of links. Does not take the lock of the element; the copy is retried if
+     * a writer changed the list meanwhile.
+     */
+    size_t readLinks(tableint internal_id, int level, tableint *links) const {
+        const LinkListLock &lock = link_list_locks_[internal_id];
+        linklistsizeint *ll = get_linklist_at_level(internal_id, level);
+        while (true) {
+            uint32_t version = lock.readBegin();
+            size_t size = std::min((size_t) getListCount(ll), maxM0_);  // a torn count is retried below
+            memcpy(links, ll + 1, size * sizeof(tableint));
+            links[size] = links[0];  // prefetches may read one past the end
+            if (lock.readValid(version))
+                return size;
+        }
+    }
+
+
     tableint mutuallyConnectNewElement(
         const void *data_point,
         tableint cur_c,
@@ -522,9 +1025,17 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         int level,
         bool isUpdate) {
 
-        // HNSWLightProfiler::Timer total_timer("mutuallyConnectNewElement_total");
-
         size_t Mcurmax = level ? maxM_ : maxM0_;
+        if (!isUpdate) {
+            // a concurrent insertion that found cur_c on a higher level may have linked to it already
+            std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> others;
+            while (!top_candidates.empty()) {
+                if (top_candidates.top().second != cur_c)
+                    others.push(top_candidates.top());
+                top_candidates.pop();
+            }
+            top_candidates.swap(others);
+        }
         getNeighborsByHeuristic2(top_candidates, M_);
         if (top_candidates.size() > M_)
             throw std::runtime_error("Should be not be more than M_ candidates returned by the heuristic");
@@ -539,41 +1050,40 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         tableint next_closest_entry_point = selectedNeighbors.back();
 
         {
-            // lock only during the update
-            // because during the addition the lock for cur_c is already acquired
-            HNSWLightProfiler::Timer lock_curc_timer("mutuallyConnectNewElement_lock_cur_c");
-            std::unique_lock <std::mutex> lock(link_list_locks_[cur_c], std::defer_lock);
-            if (isUpdate) {
-                lock.lock();
-            }
+            // The lock is held only while the list changes: a new element is visible from the level
+            // above while its lower levels are connected, and other insertions may link to it and
+            // append to its lists meanwhile. Those links are kept while there is room.
+            HNSW_PROFILE_SCOPE("mutuallyConnectNewElement_lock_cur_c");
+            std::unique_lock <LinkListLock> lock(link_list_locks_[cur_c]);
             linklistsizeint *ll_cur;
             if (level == 0)
                 ll_cur = get_linklist0(cur_c);
             else
                 ll_cur = get_linklist(cur_c, level);
-
-            if (*ll_cur && !isUpdate) {
-                throw std::runtime_error("The newly inserted element should have blank link list");
-            }
-            setListCount(ll_cur, selectedNeighbors.size());
             tableint *data = (tableint *) (ll_cur + 1);
+
+            std::vector<tableint> links(selectedNeighbors);
             for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
-                if (data[idx] && !isUpdate)
-                    throw std::runtime_error("Possible memory corruption");
                 if (level > element_levels_[selectedNeighbors[idx]])
                     throw std::runtime_error("Trying to make a link on a non-existent level");
-
-                data[idx] = selectedNeighbors[idx];
             }
+            if (!isUpdate) {
+                size_t size = getListCount(ll_cur);
+                for (size_t j = 0; j < size && links.size() < Mcurmax; j++) {
+                    if (std::find(selectedNeighbors.begin(), selectedNeighbors.end(), data[j]) == selectedNeighbors.end())
+                        links.push_back(data[j]);
+                }
+            }
+
+            elementChanging(cur_c);
+            LinkListLock::WriteSection write(link_list_locks_[cur_c]);
+            setListCount(ll_cur, links.size());
+            for (size_t idx = 0; idx < links.size(); idx++)
+                data[idx] = links[idx];
         }
-        {
-            // HNSWLightProfiler::Timer neighbor_loop_timer("mutuallyConnectNewElement_neighbor_loop");
         for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
-            // HNSWLightProfiler::Timer lock_acquire_timer("full_neighbor_operation");
-            std::unique_lock <std::mutex> lock(link_list_locks_[selectedNeighbors[idx]]);
+            std::unique_lock <LinkListLock> lock(link_list_locks_[selectedNeighbors[idx]]);
 
-            {
-                // HNSWLightProfiler::Timer actual_work_timer("actual_neighbor_processing");
             linklistsizeint *ll_other;
             if (level == 0)
                 ll_other = get_linklist0(selectedNeighbors[idx]);
@@ -604,12 +1114,14 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             // If cur_c is already present in the neighboring connections of `selectedNeighbors[idx]` then no need to modify any connections or run the heuristics.
             if (!is_cur_c_present) {
                 if (sz_link_list_other < Mcurmax) {
+                    elementChanging(selectedNeighbors[idx]);
+                    LinkListLock::WriteSection write(link_list_locks_[selectedNeighbors[idx]]);
                     data[sz_link_list_other] = cur_c;
                     setListCount(ll_other, sz_link_list_other + 1);
                 } else {
-                    HNSWLightProfiler::Timer heuristic_timer("mutuallyConnectNewElement_rebuild");
+                    HNSW_PROFILE_SCOPE("mutuallyConnectNewElement_rebuild");
                     // finding the "weakest" element to replace it with the new one
-                    dist_t d_max = fstdistfunc_(getDataByInternalId(cur_c), getDataByInternalId(selectedNeighbors[idx]),
+                    dist_t d_max = fstdistfunc_stored_(getDataByInternalId(cur_c), getDataByInternalId(selectedNeighbors[idx]),
                                                 dist_func_param_);
                     // Heuristic:
                     std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
@@ -617,13 +1129,15 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
                     for (size_t j = 0; j < sz_link_list_other; j++) {
                         candidates.emplace(
-                                fstdistfunc_(getDataByInternalId(data[j]), getDataByInternalId(selectedNeighbors[idx]),
+                                fstdistfunc_stored_(getDataByInternalId(data[j]), getDataByInternalId(selectedNeighbors[idx]),
                                                 dist_func_param_), data[j]);
                     }
                     {
-                    HNSWLightProfiler::Timer neighbors("mutuallyConnectNewElement_getNeighbors");
-                    getNeighborsByHeuristic2(candidates, Mcurmax);
+                        HNSW_PROFILE_SCOPE("mutuallyConnectNewElement_getNeighbors");
+                        getNeighborsByHeuristic2(candidates, Mcurmax);
                     }
+                    elementChanging(selectedNeighbors[idx]);
+                    LinkListLock::WriteSection write(link_list_locks_[selectedNeighbors[idx]]);
                     int indx = 0;
                     while (candidates.size() > 0) {
                         data[indx] = candidates.top().second;
@@ -646,7 +1160,6 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     } */
                 }
             }
-        }}
         }
         return next_closest_entry_point;
     }
@@ -655,101 +1168,621 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     void resizeIndex(size_t new_max_elements) {
         if (new_max_elements < cur_element_count)
             throw std::runtime_error("Cannot resize, max element is less than the current number of elements");
+        checkWritable();
 
         visited_list_pool_.reset(new VisitedListPool(1, new_max_elements));
 
         element_levels_.resize(new_max_elements);
 
-        std::vector<std::mutex>(new_max_elements).swap(link_list_locks_);
+        std::vector<LinkListLock>(new_max_elements).swap(link_list_locks_);
 
-        // Reallocate base layer
-        char * data_level0_memory_new = (char *) realloc(data_level0_memory_, new_max_elements * size_data_per_element_);
+        // Reallocate base layer, a mapped one is copied to the heap. Memory mapped under a
+        // policy is remapped, the elements are not copied
+        char * data_level0_memory_new;
+        if (isMapped(data_level0_memory_)) {
+            data_level0_memory_new = allocateBaseLayer(new_max_elements);
+            if (data_level0_memory_new != nullptr)
+                memcpy(data_level0_memory_new, data_level0_memory_, cur_element_count * size_data_per_element_);
+        } else {
+            data_level0_memory_new = reallocateMemory(data_level0_memory_, max_elements_ * size_data_per_element_,
+                new_max_elements * size_data_per_element_, cur_element_count * size_data_per_element_, memory_policy_);
+        }
         if (data_level0_memory_new == nullptr)
             throw std::runtime_error("Not enough memory: resizeIndex failed to allocate base layer");
         data_level0_memory_ = data_level0_memory_new;
 
-        // Reallocate all other layers
-        char ** linkLists_new = (char **) realloc(linkLists_, sizeof(void *) * new_max_elements);
-        if (linkLists_new == nullptr)
-            throw std::runtime_error("Not enough memory: resizeIndex failed to allocate other layers");
-        linkLists_ = linkLists_new;
+        // Other layers live in the arena, only the offsets grow
+        link_list_offsets_.resize(new_max_elements, LinkListArena::NO_BLOCK);
+
+        label_lookup_.reserve(new_max_elements);
+        dirty_elements_.resize(new_max_elements);
+
+        if (rerank_data_ != nullptr) {
+            char *rerank_data_new = (char *) realloc(rerank_data_, new_max_elements * rerank_data_size_);
+            if (rerank_data_new == nullptr)
+                throw std::runtime_error("Not enough memory: resizeIndex failed to allocate the re-rank store");
+            rerank_data_ = rerank_data_new;
+        }
 
         max_elements_ = new_max_elements;
     }
 
-    size_t indexFileSize() const {
-        size_t size = 0;
-        size += sizeof(offsetLevel0_);
-        size += sizeof(max_elements_);
-        size += sizeof(cur_element_count);
-        size += sizeof(size_data_per_element_);
-        size += sizeof(label_offset_);
-        size += sizeof(offsetData_);
-        size += sizeof(maxlevel_);
-        size += sizeof(enterpoint_node_);
-        size += sizeof(maxM_);
-
-        size += sizeof(maxM0_);
-        size += sizeof(M_);
-        size += sizeof(mult_);
-        size += sizeof(ef_construction_);
-
-        size += cur_element_count * size_data_per_element_;
 
-        for (size_t i = 0; i < cur_element_count; i++) {
-            unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
-            size += sizeof(linkListSize);
-            size += linkListSize;
+    /*
+     * Removes the elements marked deleted from the graph and from memory, then renumbers the
+     * remaining elements densely in their previous order. Returns the number of removed elements.
+     *
+     * Every list that links to a deleted element is rebuilt with getNeighborsByHeuristic2 from
+     * its other neighbors and the elements reachable through up to two deleted ones. The new
+     * storage is built next to the current one and swapped in at the end, so searches may run
+     * during the whole call and only wait for the swap. Insertions, deletions, updates and
+     * resizeIndex must not run concurrently.
+     */
+    size_t compact() {
+        checkWritable();
+        std::unique_lock <std::mutex> lock_compact(compact_lock_);
+        size_t num_elements = cur_element_count;
+        if (num_deleted_ == 0)
+            return 0;
+
+        for (tableint id = 0; id < num_elements; id++) {
+            if (isMarkedDeleted(id))
+                continue;
+            for (int level = 0; level <= element_levels_[id]; level++)
+                repairLinksAroundDeleted(id, level);
         }
-        return size;
-    }
 
-    void saveIndex(const std::string &location) {
-        std::ofstream output(location, std::ios::binary);
-        std::streampos position;
+        std::vector<tableint> new_to_old;
+        new_to_old.reserve(num_elements - num_deleted_);
+        for (tableint id = 0; id < num_elements; id++) {
+            if (!isMarkedDeleted(id))
+                new_to_old.push_back(id);
+        }
+        permuteElements(new_to_old);
+        return num_elements - new_to_old.size();
+    }
 
-        writeBinaryPOD(output, offsetLevel0_);
-        writeBinaryPOD(output, max_elements_);
-        writeBinaryPOD(output, cur_element_count);
-        writeBinaryPOD(output, size_data_per_element_);
-        writeBinaryPOD(output, label_offset_);
-        writeBinaryPOD(output, offsetData_);
-        writeBinaryPOD(output, maxlevel_);
-        writeBinaryPOD(output, enterpoint_node_);
-        writeBinaryPOD(output, maxM_);
 
-        writeBinaryPOD(output, maxM0_);
-        writeBinaryPOD(output, M_);
-        writeBinaryPOD(output, mult_);
-        writeBinaryPOD(output, ef_construction_);
+    /*
+     * Renumbers the elements so that elements linked in the base layer get nearby internal ids,
+     * and a search touches fewer cache lines and pages of the base layer. The graph, the labels
+     * and the search results do not change. saveIndex writes the elements in the new order, so an
+     * index reordered before saving is loaded reordered. Same concurrency as compact().
+     */
+    void reorder(GraphReorder method = GraphReorder::BFS) {
+        checkWritable();
+        std::unique_lock <std::mutex> lock_compact(compact_lock_);
+        size_t num_elements = cur_element_count;
+        if (num_elements == 0)
+            return;
 
-        output.write(data_level0_memory_, cur_element_count * size_data_per_element_);
+        CSRGraph graph;
+        graph.offsets.reserve(num_elements + 1);
+        graph.adj.reserve(num_elements * maxM0_ / 2);
+        for (tableint id = 0; id < num_elements; id++) {
+            linklistsizeint *ll = get_linklist0(id);
+            tableint *links = (tableint *) (ll + 1);
+            graph.adj.insert(graph.adj.end(), links, links + getListCount(ll));
+            graph.offsets.push_back(graph.adj.size());
+        }
 
-        for (size_t i = 0; i < cur_element_count; i++) {
-            unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
-            writeBinaryPOD(output, linkListSize);
-            if (linkListSize)
-                output.write(linkLists_[i], linkListSize);
+        std::vector<tableint> new_to_old;
+        switch (method) {
+            case GraphReorder::BFS:
+                new_to_old = reorderBFS(graph, enterpoint_node_);
+                break;
+            case GraphReorder::RCM:
+                new_to_old = reorderRCM(graph);
+                break;
+            case GraphReorder::Gorder:
+                new_to_old = reorderGorder(graph);
+                break;
+            default:
+                throw std::runtime_error("Unknown reorder method");
         }
-        output.close();
+        permuteElements(new_to_old);
     }
 
 
-    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0) {
-        std::ifstream input(location, std::ios::binary);
+    /*
+     * Replaces the elements by new_to_old[0], new_to_old[1], ... in this order, dropping the
+     * elements that are not listed and the links to them. The storage is rebuilt aside and
+     * swapped while search_gate_ is closed.
+     */
+    void permuteElements(const std::vector<tableint> &new_to_old) {
+        size_t num_elements = cur_element_count;
+        size_t new_count = new_to_old.size();
+        const tableint NOT_KEPT = (tableint) -1;
+        std::vector<tableint> old_to_new(num_elements, NOT_KEPT);
+        for (size_t i = 0; i < new_count; i++)
+            old_to_new[new_to_old[i]] = (tableint) i;
+
+        // the entry point is the first kept element of the highest level
+        tableint new_enterpoint = NOT_KEPT;
+        int new_maxlevel = -1;
+        if (enterpoint_node_ != NOT_KEPT && old_to_new[enterpoint_node_] != NOT_KEPT) {
+            new_enterpoint = old_to_new[enterpoint_node_];
+            new_maxlevel = maxlevel_;
+        } else {
+            for (size_t i = 0; i < new_count; i++) {
+                if (element_levels_[new_to_old[i]] > new_maxlevel) {
+                    new_maxlevel = element_levels_[new_to_old[i]];
+                    new_enterpoint = (tableint) i;
+                }
+            }
+        }
 
-        if (!input.is_open())
-            throw std::runtime_error("Cannot open file");
+        char *data_level0_memory_new = allocateBaseLayer(max_elements_);
+        if (data_level0_memory_new == nullptr)
+            throw std::runtime_error("Not enough memory: permuteElements failed to allocate base layer");
+        char *rerank_data_new = nullptr;
+        if (rerank_data_ != nullptr) {
+            rerank_data_new = (char *) malloc(max_elements_ * rerank_data_size_);
+            if (rerank_data_new == nullptr) {
+                freeBaseLayer(data_level0_memory_new, max_elements_);
+                throw std::runtime_error("Not enough memory: permuteElements failed to allocate the re-rank store");
+            }
+        }
+        LinkListArena link_list_arena_new;
+        link_list_arena_new.init(size_links_per_element_);
+        std::vector<uint32_t> link_list_offsets_new(max_elements_, LinkListArena::NO_BLOCK);
+        std::vector<int> element_levels_new(max_elements_);
+        ShardedLabelLookup label_lookup_new(max_elements_);
+        std::unordered_set<tableint> deleted_elements_new;
+        size_t num_deleted_new = 0;
+
+        // keeps the links to kept elements, renumbered
+        auto remapList = [&](linklistsizeint *ll) {
+            unsigned short int size = getListCount(ll);
+            tableint *links = (tableint *) (ll + 1);
+            unsigned short int kept = 0;
+            for (unsigned short int j = 0; j < size; j++) {
+                if (old_to_new[links[j]] != NOT_KEPT)
+                    links[kept++] = old_to_new[links[j]];
+            }
+            setListCount(ll, kept);
+        };
+
+        for (size_t i = 0; i < new_count; i++) {
+            tableint old_id = new_to_old[i];
+            char *element = data_level0_memory_new + i * size_data_per_element_;
+            memcpy(element, data_level0_memory_ + old_id * size_data_per_element_, size_data_per_element_);
+            remapList(get_linklist0((tableint) i, data_level0_memory_new));
+
+            int level = element_levels_[old_id];
+            element_levels_new[i] = level;
+            if (level > 0) {
+                link_list_offsets_new[i] = link_list_arena_new.allocate(level);
+                char *lists = link_list_arena_new.at(link_list_offsets_new[i]);
+                memcpy(lists, get_linklist(old_id, 1), level * size_links_per_element_);
+                for (int l = 0; l < level; l++)
+                    remapList((linklistsizeint *) (lists + l * size_links_per_element_));
+            }
+            if (rerank_data_new != nullptr)
+                memcpy(rerank_data_new + i * rerank_data_size_, rerank_data_ + old_id * rerank_data_size_, rerank_data_size_);
 
-        clear();
-        // get file size:
+            if (isMarkedDeleted(old_id)) {
+                num_deleted_new++;
+                if (allow_replace_deleted_)
+                    deleted_elements_new.insert((tableint) i);
+            }
+        }
+
+        label_lookup_new.build(new_count, [&](size_t i) { return getExternalLabel(new_to_old[i]); });
+
+        search_gate_.close();
+        char *data_level0_memory_old = data_level0_memory_;
+        char *rerank_data_old = rerank_data_;
+        data_level0_memory_ = data_level0_memory_new;
+        rerank_data_ = rerank_data_new;
+        link_list_arena_.swap(link_list_arena_new);
+        link_list_offsets_.swap(link_list_offsets_new);
+        element_levels_.swap(element_levels_new);
+        label_lookup_.swap(label_lookup_new);
+        {
+            std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
+            deleted_elements.swap(deleted_elements_new);
+        }
+        num_deleted_ = num_deleted_new;
+        cur_element_count = new_count;
+        initialized_count_ = new_count;
+        enterpoint_node_ = new_enterpoint;
+        maxlevel_ = new_maxlevel;
+        renumbered_since_checkpoint_ = true;
+        renumber_count_++;
+        search_gate_.open();
+
+        // nothing points into a mapped file anymore
+        freeBaseLayer(data_level0_memory_old, max_elements_);
+        free(rerank_data_old);
+        link_list_arena_new.clear();
+        mapped_file_.reset(nullptr);
+    }
+
+
+    /*
+     * Rebuilds the list of a kept element at a level if it links to deleted elements. The
+     * candidates are its kept neighbors and the kept elements linked from its deleted neighbors,
+     * or from their deleted neighbors.
+     */
+    void repairLinksAroundDeleted(tableint id, int level) {
+        std::unique_lock <LinkListLock> lock(link_list_locks_[id]);
+        linklistsizeint *ll = get_linklist_at_level(id, level);
+        unsigned short int size = getListCount(ll);
+        tableint *links = (tableint *) (ll + 1);
+
+        std::unordered_set<tableint> kept, deleted;
+        std::vector<tableint> frontier;
+        for (unsigned short int j = 0; j < size; j++) {
+            if (isMarkedDeleted(links[j])) {
+                if (deleted.insert(links[j]).second)
+                    frontier.push_back(links[j]);
+            } else {
+                kept.insert(links[j]);
+            }
+        }
+        if (frontier.empty())
+            return;
+
+        for (int hop = 0; hop < 2 && !frontier.empty(); hop++) {
+            std::vector<tableint> next_frontier;
+            for (tableint d : frontier) {
+                // lists of deleted elements are not modified by the compaction
+                linklistsizeint *ll_deleted = get_linklist_at_level(d, level);
+                unsigned short int size_deleted = getListCount(ll_deleted);
+                tableint *links_deleted = (tableint *) (ll_deleted + 1);
+                for (unsigned short int j = 0; j < size_deleted; j++) {
+                    tableint cand = links_deleted[j];
+                    if (cand == id)
+                        continue;
+                    if (!isMarkedDeleted(cand))
+                        kept.insert(cand);
+                    else if (deleted.insert(cand).second)
+                        next_frontier.push_back(cand);
+                }
+            }
+            frontier.swap(next_frontier);
+        }
+
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
+        for (tableint cand : kept)
+            candidates.emplace(fstdistfunc_stored_(getDataByInternalId(id), getDataByInternalId(cand), dist_func_param_), cand);
+        size_t Mcurmax = level ? maxM_ : maxM0_;
+        if (candidates.size() > Mcurmax)
+            getNeighborsByHeuristic2(candidates, Mcurmax);
+
+        elementChanging(id);
+        LinkListLock::WriteSection write(link_list_locks_[id]);
+        unsigned short int new_size = 0;
+        while (!candidates.empty()) {
+            links[new_size++] = candidates.top().second;
+            candidates.pop();
+        }
+        setListCount(ll, new_size);
+    }
+
+
+    // Byte offsets of the sections of a v2 index file
+    struct IndexLayoutV2 {
+        uint64_t level0_offset;
+        uint64_t labels_offset;
+        uint64_t deleted_offset;
+        uint64_t upper_offsets_offset;
+        uint64_t upper_offset;
+        uint64_t file_size;
+    };
+
+    static size_t alignUp(size_t x, size_t alignment) {
+        return (x + alignment - 1) / alignment * alignment;
+    }
+
+    static size_t indexHeaderSizeV2() {
+        return sizeof(uint64_t) + 2 * sizeof(uint32_t)
+            + 6 * sizeof(size_t) + sizeof(int) + sizeof(tableint) + 3 * sizeof(size_t)
+            + sizeof(double) + 2 * sizeof(size_t) + sizeof(IndexLayoutV2);
+    }
+
+    IndexLayoutV2 indexLayoutV2(size_t num_deleted) const {
+        return indexLayoutV2(num_deleted, cur_element_count);
+    }
+
+    // The layout of the first num_elements elements
+    IndexLayoutV2 indexLayoutV2(size_t num_deleted, size_t num_elements) const {
+        size_t upper_size = 0;
+        for (size_t i = 0; i < num_elements; i++)
+            upper_size += element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
+
+        IndexLayoutV2 layout;
+        layout.level0_offset = alignUp(indexHeaderSizeV2(), INDEX_PAGE_ALIGNMENT);
+        layout.labels_offset = alignUp(layout.level0_offset + num_elements * size_data_per_element_, INDEX_SECTION_ALIGNMENT);
+        layout.deleted_offset = alignUp(layout.labels_offset + num_elements * sizeof(labeltype), INDEX_SECTION_ALIGNMENT);
+        layout.upper_offsets_offset = alignUp(layout.deleted_offset + num_deleted * sizeof(tableint), INDEX_SECTION_ALIGNMENT);
+        layout.upper_offset = alignUp(layout.upper_offsets_offset + (num_elements + 1) * sizeof(uint64_t), INDEX_PAGE_ALIGNMENT);
+        // trailing padding: searches may read one entry past the last list (see LinkListArena)
+        layout.file_size = layout.upper_offset + upper_size + INDEX_SECTION_ALIGNMENT;
+        return layout;
+    }
+
+    size_t indexFileSize() const {
+        return indexLayoutV2(num_deleted_).file_size;
+    }
+
+    static void writePadding(std::ostream &output, size_t offset) {
+        static const char zeros[INDEX_PAGE_ALIGNMENT] = {0};
+        size_t pos = output.tellp();
+        if (pos < offset)
+            output.write(zeros, offset - pos);
+    }
+
+    void writeIndexHeaderV2(std::ostream &output, uint32_t base_id, size_t num_elements, int maxlevel,
+                            tableint enterpoint_node, size_t num_deleted, const IndexLayoutV2 &layout) const {
+        writeBinaryPOD(output, indexMagicV2());
+        writeBinaryPOD(output, indexFormatVersion());
+        writeBinaryPOD(output, base_id);  // names the snapshot for the deltas, 0 in older files
+
+        writeBinaryPOD(output, offsetLevel0_);
+        writeBinaryPOD(output, max_elements_);
+        writeBinaryPOD(output, num_elements);
+        writeBinaryPOD(output, size_data_per_element_);
+        writeBinaryPOD(output, label_offset_);
+        writeBinaryPOD(output, offsetData_);
+        writeBinaryPOD(output, maxlevel);
+        writeBinaryPOD(output, enterpoint_node);
+        writeBinaryPOD(output, maxM_);
+
+        writeBinaryPOD(output, maxM0_);
+        writeBinaryPOD(output, M_);
+        writeBinaryPOD(output, mult_);
+        writeBinaryPOD(output, ef_construction_);
+        writeBinaryPOD(output, num_deleted);
+        writeBinaryPOD(output, layout);
+    }
+
+    // header | level 0 | for each element, the size of its upper layers and the upper layers
+    void saveIndexV1(std::ofstream &output) {
+        writeBinaryPOD(output, offsetLevel0_);
+        writeBinaryPOD(output, max_elements_);
+        writeBinaryPOD(output, cur_element_count);
+        writeBinaryPOD(output, size_data_per_element_);
+        writeBinaryPOD(output, label_offset_);
+        writeBinaryPOD(output, offsetData_);
+        writeBinaryPOD(output, maxlevel_);
+        writeBinaryPOD(output, enterpoint_node_);
+        writeBinaryPOD(output, maxM_);
+
+        writeBinaryPOD(output, maxM0_);
+        writeBinaryPOD(output, M_);
+        writeBinaryPOD(output, mult_);
+        writeBinaryPOD(output, ef_construction_);
+
+        output.write(data_level0_memory_, cur_element_count * size_data_per_element_);
+
+        for (size_t i = 0; i < cur_element_count; i++) {
+            unsigned int linkListSize = element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
+            writeBinaryPOD(output, linkListSize);
+            if (linkListSize)
+                output.write((char *) get_linklist(i, 1), linkListSize);
+        }
+        output.close();
+        if (!output)
+            throw std::runtime_error("Cannot write file");
+
+        resetCheckpoint(0);
+        if (write_ahead_log_)
+            write_ahead_log_->restart(checkpoint_base_id_, checkpoint_sequence_);
+    }
+
+
+    /*
+     * Writes the index in the v2 format:
+     * header | level 0 | labels | deleted ids | upper layer offsets | upper layers
+     * Level 0 and the upper layers are page aligned so that both can be used in place from a mapping
+     * (see IndexLoadMode). The upper layers of all elements form one contiguous section;
+     * element i owns the bytes [offsets[i], offsets[i + 1]) of it.
+     * Do not save over the file a live index is mapped from.
+     *
+     * The file is a new checkpoint: later deltas of saveIndexDelta and the write-ahead log build on it.
+     */
+    void saveIndex(const std::string &location) {
+        saveIndex(location, IndexFormat::V2);
+    }
+
+
+    // saveIndex in the given format; IndexFormat::V1 files can be read by older releases
+    void saveIndex(const std::string &location, IndexFormat format) {
+        std::ofstream output(location, std::ios::binary);
+        if (!output.is_open())
+            throw std::runtime_error("Cannot open file");
+        if (format == IndexFormat::V1) {
+            saveIndexV1(output);
+            return;
+        }
+        uint32_t base_id = std::random_device()();
+
+        std::vector<tableint> deleted_ids;
+        for (tableint i = 0; i < cur_element_count; i++) {
+            if (isMarkedDeleted(i))
+                deleted_ids.push_back(i);
+        }
+        IndexLayoutV2 layout = indexLayoutV2(deleted_ids.size());
+
+        writeIndexHeaderV2(output, base_id, cur_element_count, maxlevel_, enterpoint_node_, deleted_ids.size(), layout);
+
+        writePadding(output, layout.level0_offset);
+        output.write(data_level0_memory_, cur_element_count * size_data_per_element_);
+
+        writePadding(output, layout.labels_offset);
+        for (tableint i = 0; i < cur_element_count; i++)
+            writeBinaryPOD(output, getExternalLabel(i));
+
+        writePadding(output, layout.deleted_offset);
+        if (!deleted_ids.empty())
+            output.write((char *) deleted_ids.data(), deleted_ids.size() * sizeof(tableint));
+
+        writePadding(output, layout.upper_offsets_offset);
+        uint64_t offset = 0;
+        for (size_t i = 0; i < cur_element_count; i++) {
+            writeBinaryPOD(output, offset);
+            offset += element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i] : 0;
+        }
+        writeBinaryPOD(output, offset);
+
+        writePadding(output, layout.upper_offset);
+        for (size_t i = 0; i < cur_element_count; i++) {
+            if (element_levels_[i] > 0)
+                output.write((char *) get_linklist(i, 1), size_links_per_element_ * element_levels_[i]);
+        }
+        writePadding(output, layout.file_size);
+        output.close();
+        if (!output)
+            throw std::runtime_error("Cannot write file");
+
+        resetCheckpoint(base_id);
+        if (write_ahead_log_)
+            write_ahead_log_->restart(checkpoint_base_id_, checkpoint_sequence_);
+    }
+
+
+    /*
+     * Saves the index like saveIndex while insertions, updates and deletions go on. The file holds
+     * the index as it was when the call began: elements added later are left out, and an element
+     * changed before it is written is copied aside in its former state by the thread changing it.
+     * Elements whose insertion was still running are saved with the links they had; a change racing
+     * with the beginning may or may not be included. The snapshot is not a checkpoint for
+     * saveIndexDelta. compact, reorder, resizeIndex and saveIndex must not run concurrently.
+     */
+    void saveSnapshot(const std::string &location) {
+        std::ofstream output(location, std::ios::binary);
+        if (!output.is_open())
+            throw std::runtime_error("Cannot open file");
+        saveSnapshot(output);
+        output.close();
+        if (!output)
+            throw std::runtime_error("Cannot write file");
+    }
+
+
+    // Hands the snapshot to write(data, size) in pieces, e.g. to upload it as it is made
+    void saveSnapshot(const std::function<void(const char *, size_t)> &write) {
+        CallbackStreamBuf buffer(write);
+        std::ostream output(&buffer);
+        output.exceptions(std::ios::badbit);  // rethrows what write throws
+        saveSnapshot(output);
+        output.flush();
+    }
+
+
+    void saveSnapshot(std::ostream &output) {
+        std::unique_lock <std::mutex> lock_snapshot(snapshot_lock_);
+        size_t num_elements, num_deleted;
+        int maxlevel;
+        tableint enterpoint_node;
+        // no element is being added and no deleted mark changes while the snapshot begins, an
+        // insertion that raises the entry point holds global until it is connected
+        update_gate_.close();
+        try {
+            std::unique_lock <std::mutex> lock_global(global);
+            num_elements = cur_element_count;
+            num_deleted = num_deleted_;
+            maxlevel = maxlevel_;
+            enterpoint_node = enterpoint_node_;
+            element_snapshot_.begin(num_elements);
+        } catch (...) {
+            update_gate_.open();
+            throw;
+        }
+        update_gate_.open();
+
+        try {
+            uint32_t base_id = std::random_device()();
+            IndexLayoutV2 layout = indexLayoutV2(num_deleted, num_elements);
+            writeIndexHeaderV2(output, base_id, num_elements, maxlevel, enterpoint_node, num_deleted, layout);
+
+            // level 0 is written as the elements are taken, the sections after it are collected meanwhile
+            std::vector<labeltype> labels(num_elements);
+            std::vector<tableint> deleted_ids;
+            deleted_ids.reserve(num_deleted);
+            std::vector<char> upper_layers(layout.file_size - INDEX_SECTION_ALIGNMENT - layout.upper_offset);
+            std::vector<char> element;
+            size_t upper_size = 0;
+            writePadding(output, layout.level0_offset);
+            for (tableint id = 0; id < num_elements; id++) {
+                size_t size = elementSize(id);
+                if (element.size() < size)
+                    element.resize(size);
+                element_snapshot_.take(id, size, element.data(), [&](char *dst) { copyElement(id, dst); });
+                output.write(element.data(), size_data_per_element_);
+                memcpy(&labels[id], element.data() + label_offset_, sizeof(labeltype));
+                if (element[offsetLevel0_ + 2] & DELETE_MARK)
+                    deleted_ids.push_back(id);
+                memcpy(upper_layers.data() + upper_size, element.data() + size_data_per_element_, size - size_data_per_element_);
+                upper_size += size - size_data_per_element_;
+            }
+            if (element_snapshot_.failed())
+                throw std::runtime_error("Not enough memory: saveSnapshot failed to copy the changed elements");
+            if (deleted_ids.size() != num_deleted)
+                throw std::runtime_error("The deleted elements changed while the snapshot began");
+
+            writePadding(output, layout.labels_offset);
+            output.write((char *) labels.data(), num_elements * sizeof(labeltype));
+
+            writePadding(output, layout.deleted_offset);
+            if (!deleted_ids.empty())
+                output.write((char *) deleted_ids.data(), deleted_ids.size() * sizeof(tableint));
+
+            writePadding(output, layout.upper_offsets_offset);
+            uint64_t offset = 0;
+            for (size_t i = 0; i < num_elements; i++) {
+                writeBinaryPOD(output, offset);
+                offset += element_levels_[i] * size_links_per_element_;
+            }
+            writeBinaryPOD(output, offset);
+
+            writePadding(output, layout.upper_offset);
+            output.write(upper_layers.data(), upper_size);
+            writePadding(output, layout.file_size);
+        } catch (...) {
+            element_snapshot_.end();
+            throw;
+        }
+        element_snapshot_.end();
+    }
+
+
+    /*
+     * Loads an index saved by saveIndex (or by older versions, in the v1 format).
+     * With a pool, the sections are read in parallel chunks and the label lookup, the element levels
+     * and the deleted elements are rebuilt on its threads.
+     */
+    void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0,
+                   IndexLoadMode mode = IndexLoadMode::Copy, ThreadPool *pool = nullptr) {
+        std::ifstream input(location, std::ios::binary);
+
+        if (!input.is_open())
+            throw std::runtime_error("Cannot open file");
+
+        clear();
+        // get file size:
         input.seekg(0, input.end);
         std::streampos total_filesize = input.tellg();
         input.seekg(0, input.beg);
 
+        uint64_t magic = 0;
+        readBinaryPOD(input, magic);
+        input.seekg(0, input.beg);
+        write_ahead_log_.reset(nullptr);
+        if (magic == indexMagicV2()) {
+            loadIndexV2(input, total_filesize, location, s, max_elements_i, mode, pool);
+            return;
+        }
+        checkpoint_base_id_ = 0;
+        if (mode != IndexLoadMode::Copy)
+            throw std::runtime_error("Memory-mapped loading requires an index saved in the v2 format");
+
         readBinaryPOD(input, offsetLevel0_);
         readBinaryPOD(input, max_elements_);
         readBinaryPOD(input, cur_element_count);
+        initialized_count_ = cur_element_count.load();
 
         size_t max_elements = max_elements_i;
         if (max_elements < cur_element_count)
@@ -767,80 +1800,498 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         readBinaryPOD(input, mult_);
         readBinaryPOD(input, ef_construction_);
 
-        data_size_ = s->get_data_size();
-        fstdistfunc_ = s->get_dist_func();
-        dist_func_param_ = s->get_dist_func_param();
+        setSpace(s);
 
-        auto pos = input.tellg();
+        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
 
-        /// Optional - check if index is ok:
-        input.seekg(cur_element_count * size_data_per_element_, input.cur);
-        for (size_t i = 0; i < cur_element_count; i++) {
-            if (input.tellg() < 0 || input.tellg() >= total_filesize) {
-                throw std::runtime_error("Index seems to be corrupted or unsupported");
-            }
+        uint64_t pos = (uint64_t) input.tellg();
+        input.close();
+        size_t level0_size = cur_element_count * size_data_per_element_;
+        if (pos + level0_size > (uint64_t) total_filesize)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        link_list_offsets_.assign(max_elements, LinkListArena::NO_BLOCK);
+        element_levels_ = std::vector<int>(max_elements);
 
-            unsigned int linkListSize;
-            readBinaryPOD(input, linkListSize);
-            if (linkListSize != 0) {
-                input.seekg(linkListSize, input.cur);
+        // The upper layers follow level 0 as (size, lists) pairs. They are read with one call, then
+        // the lists are moved together in place, which also checks the sizes. All of them form one
+        // buffer, the base segment of the arena.
+        FileReader reader(location);
+        size_t tail_size = (uint64_t) total_filesize - pos - level0_size;
+        char *upper_layers = (char *) malloc(tail_size + INDEX_SECTION_ALIGNMENT);
+        if (upper_layers == nullptr)
+            throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
+        size_t upper_size = 0;
+        try {
+            reader.read(upper_layers, tail_size, pos + level0_size, pool);
+            size_t tail_pos = 0;
+            for (size_t i = 0; i < cur_element_count; i++) {
+                unsigned int linkListSize;
+                if (tail_size - tail_pos < sizeof(linkListSize))
+                    throw std::runtime_error("Index seems to be corrupted or unsupported");
+                memcpy(&linkListSize, upper_layers + tail_pos, sizeof(linkListSize));
+                tail_pos += sizeof(linkListSize);
+                if (linkListSize % size_links_per_element_ != 0 || linkListSize > tail_size - tail_pos)
+                    throw std::runtime_error("Index seems to be corrupted or unsupported");
+                if (linkListSize != 0) {
+                    element_levels_[i] = linkListSize / size_links_per_element_;
+                    link_list_offsets_[i] = upper_size / size_links_per_element_;
+                    memmove(upper_layers + upper_size, upper_layers + tail_pos, linkListSize);
+                    upper_size += linkListSize;
+                    tail_pos += linkListSize;
+                }
             }
+            // throw exception if it either corrupted or old index
+            if (tail_pos != tail_size)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+        } catch (...) {
+            free(upper_layers);
+            throw;
         }
+        char *shrunk = (char *) realloc(upper_layers, upper_size + INDEX_SECTION_ALIGNMENT);
+        if (shrunk != nullptr)
+            upper_layers = shrunk;
+        link_list_arena_.init(size_links_per_element_);
+        link_list_arena_.setBase(upper_layers, upper_size / size_links_per_element_, true);
 
-        // throw exception if it either corrupted or old index
-        if (input.tellg() != total_filesize)
-            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        data_level0_memory_ = allocateBaseLayer(max_elements);
+        if (data_level0_memory_ == nullptr)
+            throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
+        reader.read(data_level0_memory_, level0_size, pos, pool);
 
-        input.clear();
-        /// Optional check end
+        std::vector<LinkListLock>(max_elements).swap(link_list_locks_);
+        std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
 
-        input.seekg(pos, input.beg);
+        visited_list_pool_.reset(new VisitedListPool(1, max_elements));
 
-        data_level0_memory_ = (char *) malloc(max_elements * size_data_per_element_);
-        if (data_level0_memory_ == nullptr)
-            throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
-        input.read(data_level0_memory_, cur_element_count * size_data_per_element_);
+        revSize_ = 1.0 / mult_;
+        ef_ = 10;
+        label_lookup_.reserve(max_elements);
+        buildLabelLookup([&](size_t i) { return getExternalLabel((tableint) i); }, pool);
+
+        // the deleted elements of each thread, merged afterwards
+        std::vector<std::vector<tableint>> deleted(pool != nullptr ? pool->size() : 1);
+        forEachElement(cur_element_count, [&](size_t i, size_t thread_id) {
+            if (isMarkedDeleted(i))
+                deleted[thread_id].push_back(i);
+        }, pool);
+        size_t num_deleted = 0;
+        for (auto &ids : deleted)
+            num_deleted += ids.size();
+        num_deleted_ = num_deleted;
+        if (allow_replace_deleted_) {
+            deleted_elements.reserve(num_deleted);
+            for (auto &ids : deleted)
+                deleted_elements.insert(ids.begin(), ids.end());
+        }
+        resetCheckpoint(checkpoint_base_id_);
+    }
 
-        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
 
+    // Calls fn(i, thread_id) for every element in [0, n), on the threads of the pool if there is one
+    template<typename Function>
+    static void forEachElement(size_t n, Function fn, ThreadPool *pool) {
+        if (pool != nullptr) {
+            pool->parallelFor(0, n, fn);
+        } else {
+            for (size_t i = 0; i < n; i++)
+                fn(i, 0);
+        }
+    }
+
+
+    template<typename LabelAt>
+    void buildLabelLookup(LabelAt label_at, ThreadPool *pool) {
+        if (pool != nullptr)
+            label_lookup_.build(cur_element_count, label_at, *pool);
+        else
+            label_lookup_.build(cur_element_count, label_at);
+    }
+
+
+    void loadIndexV2(std::ifstream &input, std::streampos total_filesize, const std::string &location,
+                     SpaceInterface<dist_t> *s, size_t max_elements_i, IndexLoadMode mode, ThreadPool *pool) {
+        uint64_t magic;
+        uint32_t version;
+        size_t num_deleted;
+        IndexLayoutV2 layout;
+        readBinaryPOD(input, magic);
+        readBinaryPOD(input, version);
+        readBinaryPOD(input, checkpoint_base_id_);
+        if (version != indexFormatVersion())
+            throw std::runtime_error("Unsupported index format version");
+
+        readBinaryPOD(input, offsetLevel0_);
+        readBinaryPOD(input, max_elements_);
+        readBinaryPOD(input, cur_element_count);
+        initialized_count_ = cur_element_count.load();
+        readBinaryPOD(input, size_data_per_element_);
+        readBinaryPOD(input, label_offset_);
+        readBinaryPOD(input, offsetData_);
+        readBinaryPOD(input, maxlevel_);
+        readBinaryPOD(input, enterpoint_node_);
+
+        readBinaryPOD(input, maxM_);
+        readBinaryPOD(input, maxM0_);
+        readBinaryPOD(input, M_);
+        readBinaryPOD(input, mult_);
+        readBinaryPOD(input, ef_construction_);
+        readBinaryPOD(input, num_deleted);
+        readBinaryPOD(input, layout);
+        if (!input || layout.file_size != (uint64_t) total_filesize ||
+            layout.upper_offset + INDEX_SECTION_ALIGNMENT > layout.file_size)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        setSpace(s);
+        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
         size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
-        std::vector<std::mutex>(max_elements).swap(link_list_locks_);
+        if (layout.upper_offset < layout.upper_offsets_offset + (cur_element_count + 1) * sizeof(uint64_t) ||
+            layout.upper_offsets_offset < layout.deleted_offset + num_deleted * sizeof(tableint) ||
+            layout.deleted_offset < layout.labels_offset + cur_element_count * sizeof(labeltype) ||
+            layout.labels_offset < layout.level0_offset + cur_element_count * size_data_per_element_)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+
+        size_t max_elements = max_elements_i;
+        if (max_elements < cur_element_count)
+            max_elements = max_elements_;
+        if (mode != IndexLoadMode::Copy)
+            max_elements = cur_element_count;  // a mapped base layer cannot grow, it is copied by resizeIndex
+        max_elements_ = max_elements;
+
+        std::vector<labeltype> labels_copy;
+        std::vector<tableint> deleted_copy;
+        std::vector<uint64_t> offsets_copy;
+        uint64_t upper_size = layout.file_size - layout.upper_offset - INDEX_SECTION_ALIGNMENT;
+        char *upper_layers;
+        bool upper_layers_owned = false;
+        const labeltype *labels;
+        const tableint *deleted_ids;
+        const uint64_t *offsets;
+        if (mode == IndexLoadMode::Copy) {
+            input.close();
+            FileReader reader(location);
+            data_level0_memory_ = allocateBaseLayer(max_elements);
+            if (data_level0_memory_ == nullptr)
+                throw std::runtime_error("Not enough memory: loadIndex failed to allocate level0");
+            reader.read(data_level0_memory_, cur_element_count * size_data_per_element_, layout.level0_offset, pool);
+
+            labels_copy.resize(cur_element_count);
+            reader.read((char *) labels_copy.data(), cur_element_count * sizeof(labeltype), layout.labels_offset, pool);
+            deleted_copy.resize(num_deleted);
+            reader.read((char *) deleted_copy.data(), num_deleted * sizeof(tableint), layout.deleted_offset, pool);
+            offsets_copy.resize(cur_element_count + 1);
+            reader.read((char *) offsets_copy.data(), (cur_element_count + 1) * sizeof(uint64_t), layout.upper_offsets_offset, pool);
+
+            // read with one call, the whole section becomes the base segment of the arena
+            upper_layers = (char *) malloc(upper_size + INDEX_SECTION_ALIGNMENT);
+            if (upper_layers == nullptr)
+                throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
+            upper_layers_owned = true;
+            try {
+                reader.read(upper_layers, upper_size, layout.upper_offset, pool);
+            } catch (...) {
+                free(upper_layers);
+                throw;
+            }
+            labels = labels_copy.data();
+            deleted_ids = deleted_copy.data();
+            offsets = offsets_copy.data();
+        } else {
+            input.close();
+            mapped_file_.reset(new MappedFile(location, mode == IndexLoadMode::MmapCopyOnWrite));
+            if (mapped_file_->size() != layout.file_size)
+                throw std::runtime_error("Index file changed while loading");
+            char *base = mapped_file_->data();
+            data_level0_memory_ = base + layout.level0_offset;
+            labels = (const labeltype *) (base + layout.labels_offset);
+            deleted_ids = (const tableint *) (base + layout.deleted_offset);
+            offsets = (const uint64_t *) (base + layout.upper_offsets_offset);
+            upper_layers = base + layout.upper_offset;
+            read_only_ = mode == IndexLoadMode::MmapReadOnly;
+        }
+        link_list_arena_.init(size_links_per_element_);
+        link_list_arena_.setBase(upper_layers, upper_size / size_links_per_element_, upper_layers_owned);
+
+        std::vector<LinkListLock>(max_elements).swap(link_list_locks_);
         std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
 
         visited_list_pool_.reset(new VisitedListPool(1, max_elements));
 
-        linkLists_ = (char **) malloc(sizeof(void *) * max_elements);
-        if (linkLists_ == nullptr)
-            throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
+        link_list_offsets_.assign(max_elements, LinkListArena::NO_BLOCK);
         element_levels_ = std::vector<int>(max_elements);
         revSize_ = 1.0 / mult_;
         ef_ = 10;
-        for (size_t i = 0; i < cur_element_count; i++) {
-            label_lookup_[getExternalLabel(i)] = i;
-            unsigned int linkListSize;
-            readBinaryPOD(input, linkListSize);
-            if (linkListSize == 0) {
-                element_levels_[i] = 0;
-                linkLists_[i] = nullptr;
-            } else {
-                element_levels_[i] = linkListSize / size_links_per_element_;
-                linkLists_[i] = (char *) malloc(linkListSize);
-                if (linkLists_[i] == nullptr)
-                    throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
-                input.read(linkLists_[i], linkListSize);
-            }
+
+        if (offsets[0] != 0 || offsets[cur_element_count] != upper_size)
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        label_lookup_.reserve(max_elements);
+        buildLabelLookup([&](size_t i) { return labels[i]; }, pool);
+        forEachElement(cur_element_count, [&](size_t i, size_t) {
+            uint64_t linkListSize = offsets[i + 1] - offsets[i];
+            if (offsets[i + 1] < offsets[i] || linkListSize % size_links_per_element_ != 0)
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            element_levels_[i] = linkListSize / size_links_per_element_;
+            if (linkListSize != 0)
+                link_list_offsets_[i] = offsets[i] / size_links_per_element_;
+        }, pool);
+
+        num_deleted_ = num_deleted;
+        if (allow_replace_deleted_) {
+            deleted_elements.reserve(num_deleted);
+            deleted_elements.insert(deleted_ids, deleted_ids + num_deleted);
         }
 
-        for (size_t i = 0; i < cur_element_count; i++) {
-            if (isMarkedDeleted(i)) {
+        if (mode == IndexLoadMode::MmapCopyOnWrite && max_elements_i > max_elements_)
+            resizeIndex(max_elements_i);
+        resetCheckpoint(checkpoint_base_id_);
+    }
+
+
+    // The index is the snapshot base_id, the next delta holds the changes from here
+    void resetCheckpoint(uint32_t base_id) {
+        has_checkpoint_ = true;
+        checkpoint_base_id_ = base_id;
+        checkpoint_sequence_ = 0;
+        checkpoint_element_count_ = cur_element_count;
+        renumbered_since_checkpoint_ = false;
+        dirty_elements_.resize(max_elements_);
+        dirty_elements_.clear();
+    }
+
+
+    /*
+     * Writes the elements changed since the last checkpoint to a delta file, which becomes the next
+     * checkpoint. The checkpoints are the snapshot of saveIndex followed by the deltas on top of it;
+     * loadIndex and applyIndexDelta bring an index to the last one.
+     * header | records, one per changed element: id | level | level 0 block | upper layer lists
+     * The level 0 block holds the links, the vector, the label and the deleted mark. After compact()
+     * or reorder() the next checkpoint has to be a saveIndex. The re-rank store is not written. An
+     * attached write-ahead log restarts empty. Must not run concurrently with updates.
+     */
+    void saveIndexDelta(const std::string &location) {
+        if (!has_checkpoint_)
+            throw std::runtime_error("saveIndexDelta needs an index that was saved or loaded");
+        if (renumbered_since_checkpoint_)
+            throw std::runtime_error("The elements were renumbered since the last checkpoint, saveIndex is needed");
+        std::ofstream output(location, std::ios::binary);
+        if (!output.is_open())
+            throw std::runtime_error("Cannot open file");
+
+        std::vector<tableint> ids = dirty_elements_.ids(cur_element_count);
+        writeBinaryPOD(output, indexMagicDeltaV2());
+        writeBinaryPOD(output, indexFormatVersion());
+        writeBinaryPOD(output, checkpoint_base_id_);
+        writeBinaryPOD(output, checkpoint_sequence_ + 1);
+        writeBinaryPOD(output, size_data_per_element_);
+        writeBinaryPOD(output, size_links_per_element_);
+        writeBinaryPOD(output, checkpoint_element_count_);
+        writeBinaryPOD(output, (size_t) cur_element_count);
+        writeBinaryPOD(output, maxlevel_);
+        writeBinaryPOD(output, enterpoint_node_);
+        writeBinaryPOD(output, (size_t) ids.size());
+        for (tableint id : ids) {
+            int level = element_levels_[id];
+            writeBinaryPOD(output, id);
+            writeBinaryPOD(output, level);
+            output.write(data_level0_memory_ + id * size_data_per_element_, size_data_per_element_);
+            if (level > 0)
+                output.write((char *) get_linklist(id, 1), level * size_links_per_element_);
+        }
+        output.close();
+        if (!output)
+            throw std::runtime_error("Cannot write file");
+
+        checkpoint_sequence_++;
+        checkpoint_element_count_ = cur_element_count;
+        dirty_elements_.clear();
+        if (write_ahead_log_)
+            write_ahead_log_->restart(checkpoint_base_id_, checkpoint_sequence_);
+    }
+
+
+    /*
+     * Applies the delta of saveIndexDelta that follows the checkpoint of the index; the index must
+     * not have changed since it was loaded. Throws and leaves the index unchanged if the delta
+     * belongs to another checkpoint or is damaged.
+     */
+    void applyIndexDelta(const std::string &location) {
+        checkWritable();
+        std::ifstream input(location, std::ios::binary);
+        if (!input.is_open())
+            throw std::runtime_error("Cannot open file");
+
+        uint64_t magic = 0, sequence = 0;
+        uint32_t version = 0, base_id = 0;
+        size_t size_data_per_element = 0, size_links_per_element = 0;
+        size_t base_count = 0, new_count = 0, num_records = 0;
+        int maxlevel = 0;
+        tableint enterpoint_node = 0;
+        readBinaryPOD(input, magic);
+        readBinaryPOD(input, version);
+        readBinaryPOD(input, base_id);
+        readBinaryPOD(input, sequence);
+        readBinaryPOD(input, size_data_per_element);
+        readBinaryPOD(input, size_links_per_element);
+        readBinaryPOD(input, base_count);
+        readBinaryPOD(input, new_count);
+        readBinaryPOD(input, maxlevel);
+        readBinaryPOD(input, enterpoint_node);
+        readBinaryPOD(input, num_records);
+        if (!input || magic != indexMagicDeltaV2() || version != indexFormatVersion() ||
+            size_data_per_element != size_data_per_element_ || size_links_per_element != size_links_per_element_)
+            throw std::runtime_error("Index delta seems to be corrupted or unsupported");
+        if (!has_checkpoint_ || base_id != checkpoint_base_id_ || sequence != checkpoint_sequence_ + 1 ||
+            base_count != cur_element_count || !dirty_elements_.empty())
+            throw std::runtime_error("The index delta does not follow the checkpoint of the index");
+        if (new_count < base_count || num_records > new_count || new_count > std::numeric_limits<tableint>::max() ||
+            maxlevel < -1 || (new_count != 0 && enterpoint_node >= new_count))
+            throw std::runtime_error("Index delta seems to be corrupted or unsupported");
+
+        // all records are read and checked before the index changes
+        struct DeltaRecord {
+            tableint id;
+            int level;
+            size_t offset;  // of the level 0 block in bytes, the upper layers follow
+        };
+        std::vector<DeltaRecord> records(num_records);
+        std::vector<char> bytes;
+        size_t num_new = 0;
+        for (size_t r = 0; r < num_records; r++) {
+            DeltaRecord &record = records[r];
+            readBinaryPOD(input, record.id);
+            readBinaryPOD(input, record.level);
+            if (!input || record.id >= new_count || (r > 0 && record.id <= records[r - 1].id) ||
+                record.level < 0 || record.level > maxlevel)
+                throw std::runtime_error("Index delta seems to be corrupted or unsupported");
+            record.offset = bytes.size();
+            size_t size = size_data_per_element_ + record.level * size_links_per_element_;
+            bytes.resize(bytes.size() + size);
+            input.read(bytes.data() + record.offset, size);
+            if (!input)
+                throw std::runtime_error("Index delta seems to be corrupted or unsupported");
+            num_new += record.id >= base_count;
+        }
+        if (num_new != new_count - base_count || input.peek() != EOF)
+            throw std::runtime_error("Index delta seems to be corrupted or unsupported");
+
+        if (new_count > max_elements_)
+            resizeIndex(new_count);
+        // first drop the labels and deleted marks the changed elements had: an element may take
+        // over the label another one gives up
+        for (const DeltaRecord &record : records) {
+            if (record.id >= base_count)
+                continue;
+            labeltype old_label = getExternalLabel(record.id);
+            labeltype new_label;
+            memcpy(&new_label, bytes.data() + record.offset + label_offset_, sizeof(labeltype));
+            if (old_label != new_label && label_lookup_.find(old_label) == record.id)
+                label_lookup_.erase(old_label);
+            if (isMarkedDeleted(record.id)) {
+                num_deleted_ -= 1;
+                deleted_elements.erase(record.id);
+            }
+        }
+        for (const DeltaRecord &record : records) {
+            tableint id = record.id;
+            memcpy(data_level0_memory_ + id * size_data_per_element_, bytes.data() + record.offset, size_data_per_element_);
+            if (record.level == 0) {
+                link_list_offsets_[id] = LinkListArena::NO_BLOCK;
+            } else {
+                if (id >= base_count || element_levels_[id] != record.level)
+                    link_list_offsets_[id] = link_list_arena_.allocate(record.level);
+                memcpy(get_linklist(id, 1), bytes.data() + record.offset + size_data_per_element_,
+                       record.level * size_links_per_element_);
+            }
+            element_levels_[id] = record.level;
+            label_lookup_.insert(getExternalLabel(id), id);
+            if (isMarkedDeleted(id)) {
                 num_deleted_ += 1;
-                if (allow_replace_deleted_) deleted_elements.insert(i);
+                if (allow_replace_deleted_)
+                    deleted_elements.insert(id);
             }
         }
+        cur_element_count = new_count;
+        initialized_count_ = new_count;
+        maxlevel_ = maxlevel;
+        enterpoint_node_ = enterpoint_node;
+        checkpoint_sequence_ = sequence;
+        checkpoint_element_count_ = new_count;
+    }
 
-        input.close();
 
-        return;
+    /*
+     * Logs every later addPoint, markDelete and unmarkDelete to the file at location, so that the
+     * updates since the last checkpoint survive a crash. To recover, load the snapshot, apply the
+     * deltas in order and replay the log with replayWriteAheadLog. A log of the current checkpoint
+     * is continued, so replay it before opening it again; any other file at location is replaced.
+     * Must not run concurrently with updates.
+     */
+    void openWriteAheadLog(const std::string &location) {
+        checkWritable();
+        if (!has_checkpoint_)
+            throw std::runtime_error("The write-ahead log needs an index that was saved or loaded");
+        write_ahead_log_.reset(new WriteAheadLog(location, checkpoint_base_id_, checkpoint_sequence_, vector_size_));
+    }
+
+
+    void closeWriteAheadLog() {
+        write_ahead_log_.reset(nullptr);
+    }
+
+
+    // Returns once the logged updates are on the storage, not just handed to the operating system
+    void syncWriteAheadLog() {
+        if (write_ahead_log_)
+            write_ahead_log_->sync();
+    }
+
+
+    /*
+     * Applies the updates of the log at location that follow the checkpoint of the index and returns
+     * their number. A log of an earlier checkpoint of the same snapshot is covered by it and nothing
+     * is applied. The log ends at the first record that was cut short or damaged.
+     */
+    size_t replayWriteAheadLog(const std::string &location) {
+        checkWritable();
+        // the replayed updates are in the log already
+        std::unique_ptr<WriteAheadLog> attached;
+        attached.swap(write_ahead_log_);
+        size_t num_replayed = 0;
+        try {
+            WriteAheadLog::Header header;
+            WriteAheadLog::scan(location, header, [&](const WriteAheadLog::Record &record) {
+                if (header.base_id != checkpoint_base_id_ || header.sequence > checkpoint_sequence_ ||
+                    header.vector_size != vector_size_)
+                    throw std::runtime_error("The write-ahead log does not follow the checkpoint of the index");
+                if (header.sequence < checkpoint_sequence_)
+                    return;
+                switch (record.operation) {
+                case WriteAheadLog::ADD:
+                    addPoint(record.data, record.label, (record.flags & WriteAheadLog::REPLACE_DELETED) != 0);
+                    break;
+                case WriteAheadLog::MARK_DELETE:
+                    markDelete(record.label);
+                    break;
+                case WriteAheadLog::UNMARK_DELETE:
+                    unmarkDelete(record.label);
+                    break;
+                }
+                num_replayed++;
+            });
+        } catch (...) {
+            write_ahead_log_.swap(attached);
+            throw;
+        }
+        write_ahead_log_.swap(attached);
+        return num_replayed;
+    }
+
+
+    // Appends a finished update to the write-ahead log, if one is attached
+    void logUpdate(WriteAheadLog::Operation operation, labeltype label, const void *data_point = nullptr, uint8_t flags = 0) {
+        if (write_ahead_log_)
+            write_ahead_log_->append(operation, label, data_point, flags);
     }
 
 
@@ -848,7 +2299,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     std::vector<data_t> getDataByLabel(labeltype label) const {
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
-        
+        ReaderGate::ReadGuard read_guard(search_gate_);
 
         tableint internalId = label_lookup_.find(label);  // Thread-safe lookup
         if (internalId == -1 || isMarkedDeleted(internalId)) {
@@ -862,6 +2313,17 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         // tableint internalId = search->second;
         // lock_table.unlock();
 
+        if (rerank_data_ != nullptr) {
+            data_t *exact = (data_t *) (rerank_data_ + internalId * rerank_data_size_);
+            return std::vector<data_t>(exact, exact + rerank_data_size_ / sizeof(data_t));
+        }
+        if (vector_size_ != data_size_) {
+            // the space stores an encoding, hand back its decoded (possibly lossy) vector
+            std::vector<data_t> data(vector_size_ / sizeof(data_t));
+            space_->decode(getDataByInternalId(internalId), data.data());
+            return data;
+        }
+
         char* data_ptrv = getDataByInternalId(internalId);
         size_t dim = *((size_t *) dist_func_param_);
         std::vector<data_t> data;
@@ -874,15 +2336,60 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    /*
+     * Keeps a full-precision copy of every vector added from now on and re-ranks the ef
+     * candidates of each searchKnn by their exact distance in exact_space, which must accept the
+     * same vectors as the index space. Meant for spaces storing a lossy encoding (SQ / PQ).
+     * Must be called before points are added; the store is not part of the index file,
+     * see saveRerankStore / loadRerankStore.
+     */
+    void enableRerank(SpaceInterface<dist_t> *exact_space) {
+        if (cur_element_count != 0)
+            throw std::runtime_error("The re-rank store must be enabled before points are added");
+        if (exact_space->get_vector_size() != vector_size_)
+            throw std::runtime_error("The re-rank space does not take the vectors of the index space");
+        allocateRerankStore(exact_space);
+    }
+
+
+    void saveRerankStore(const std::string &location) const {
+        if (rerank_data_ == nullptr)
+            throw std::runtime_error("The re-rank store is not enabled");
+        std::ofstream output(location, std::ios::binary);
+        writeBinaryPOD(output, cur_element_count.load());
+        writeBinaryPOD(output, rerank_data_size_);
+        output.write(rerank_data_, cur_element_count * rerank_data_size_);
+        output.close();
+    }
+
+
+    // Restores the store saved with the index, e.g. after loadIndex
+    void loadRerankStore(const std::string &location, SpaceInterface<dist_t> *exact_space) {
+        std::ifstream input(location, std::ios::binary);
+        if (!input.is_open())
+            throw std::runtime_error("Cannot open file");
+        size_t count, size;
+        readBinaryPOD(input, count);
+        readBinaryPOD(input, size);
+        if (!input || count != cur_element_count || size != exact_space->get_data_size() || size != vector_size_)
+            throw std::runtime_error("The re-rank store does not match the index");
+        allocateRerankStore(exact_space);
+        input.read(rerank_data_, count * size);
+        if (!input)
+            throw std::runtime_error("Re-rank store file is truncated");
+    }
+
+
     /*
     * Marks an element with the given label deleted, does NOT really change the current graph.
     */
     void markDelete(labeltype label) {
+        checkWritable();
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
 
         tableint internalId = label_lookup_.find(label);  // Thread-safe lookup
-        if (internalId == -1 || isMarkedDeleted(internalId)) {
+        if (internalId == ShardedLabelLookup::NOT_FOUND) {
             throw std::runtime_error("Label not found");
         }
         // std::unique_lock <std::mutex> lock_table(label_lookup_lock);
@@ -894,6 +2401,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         // lock_table.unlock();
 
         markDeletedInternal(internalId);
+        logUpdate(WriteAheadLog::MARK_DELETE, label);
     }
 
 
@@ -904,7 +2412,9 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     void markDeletedInternal(tableint internalId) {
         assert(internalId < cur_element_count);
         if (!isMarkedDeleted(internalId)) {
+            ReaderGate::ReadGuard update_guard(update_gate_);  // the mark and the count change together
             unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId))+2;
+            elementChanging(internalId);
             *ll_cur |= DELETE_MARK;
             num_deleted_ += 1;
             if (allow_replace_deleted_) {
@@ -924,11 +2434,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     *  because elements marked as deleted can be completely removed by addPoint
     */
     void unmarkDelete(labeltype label) {
+        checkWritable();
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
 
         tableint internalId = label_lookup_.find(label);  // Thread-safe lookup
-        if (internalId == -1 || isMarkedDeleted(internalId)) {
+        if (internalId == ShardedLabelLookup::NOT_FOUND) {
             throw std::runtime_error("Label not found");
         }
         // std::unique_lock <std::mutex> lock_table(label_lookup_lock);
@@ -940,6 +2451,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         // lock_table.unlock();
 
         unmarkDeletedInternal(internalId);
+        logUpdate(WriteAheadLog::UNMARK_DELETE, label);
     }
 
 
@@ -950,7 +2462,9 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     void unmarkDeletedInternal(tableint internalId) {
         assert(internalId < cur_element_count);
         if (isMarkedDeleted(internalId)) {
+            ReaderGate::ReadGuard update_guard(update_gate_);  // the mark and the count change together
             unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId)) + 2;
+            elementChanging(internalId);
             *ll_cur &= ~DELETE_MARK;
             num_deleted_ -= 1;
             if (allow_replace_deleted_) {
@@ -990,15 +2504,16 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     * If replacement of deleted elements is enabled: replaces previously deleted point if any, updating it with new point
     */
     void addPoint(const void *data_point, labeltype label, bool replace_deleted = false) {
-        // HNSWLightProfiler::Timer t("addPoint:total");
         if ((allow_replace_deleted_ == false) && (replace_deleted == true)) {
             throw std::runtime_error("Replacement of deleted elements is disabled in constructor");
         }
+        checkWritable();
 
         // lock all operations with element by label
         std::unique_lock <std::mutex> lock_label(getLabelOpMutex(label));
         if (!replace_deleted) {
             addPoint(data_point, label, -1);
+            logUpdate(WriteAheadLog::ADD, label, data_point);
             return;
         }
         // check if there is vacant place
@@ -1018,6 +2533,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         } else {
             // we assume that there are no concurrent operations on deleted element
             labeltype label_replaced = getExternalLabel(internal_id_replaced);
+            elementChanging(internal_id_replaced);
             setExternalLabel(internal_id_replaced, label);
 
             // Replace global lock + map operations with sharded version:
@@ -1028,15 +2544,222 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             // label_lookup_[label] = internal_id_replaced;
             // lock_table.unlock();
 
-            unmarkDeletedInternal(internal_id_replaced);
-            updatePoint(data_point, internal_id_replaced, 1.0);
+            unmarkDeletedInternal(internal_id_replaced);
+            updatePoint(data_point, internal_id_replaced, 1.0);
+        }
+        logUpdate(WriteAheadLog::ADD, label, data_point, WriteAheadLog::REPLACE_DELETED);
+    }
+
+
+    /*
+     * Adds n points stored one after another (vector_size_ bytes each) with the given labels,
+     * spread over the threads of the pool. Same as addPoint for each of them.
+     */
+    void addPoints(const void *data, const labeltype *labels, size_t n, ThreadPool &pool, bool replace_deleted = false) {
+        size_t start = 0;
+        if (n > 0 && cur_element_count == 0) {
+            // the first element becomes the entry point the others start from
+            addPoint(data, labels[0], replace_deleted);
+            start = 1;
+        }
+        pool.parallelFor(start, n, [&](size_t row, size_t) {
+            addPoint((const char *) data + row * vector_size_, labels[row], replace_deleted);
+        });
+    }
+
+
+    /*
+     * Adds n points like addPoints, in batches of up to batch_fraction times the number of elements
+     * in the graph. The points of a batch search the graph as it was before the batch and take their
+     * neighbors from it, without locking each other out. The reverse links to them are collected per
+     * neighbor and merged into its list afterwards, by one run of the heuristic for a list that
+     * would overflow, the neighbors spread over the threads. The points of a batch are linked to
+     * each other only through the later batches, so a smaller fraction gives a graph closer to the
+     * one of addPoints. Labels that exist already are updated as by addPoint after the batches.
+     * Searches may run meanwhile, other updates must not.
+     */
+    void addPointsBulk(const void *data, const labeltype *labels, size_t n, ThreadPool &pool, double batch_fraction = 0.1) {
+        checkWritable();
+        std::vector<size_t> updates;  // rows of labels that have an element
+        size_t row = 0;
+        while (row < n && cur_element_count < BULK_MIN_GRAPH_SIZE) {
+            size_t end = std::min(n, row + BULK_MIN_GRAPH_SIZE - cur_element_count);
+            addPoints((const char *) data + row * vector_size_, labels + row, end - row, pool);
+            row = end;
+        }
+        std::vector<tableint> batch;
+        std::vector<size_t> batch_rows;
+        while (row < n) {
+            size_t batch_size = std::max<size_t>(1, (size_t) (batch_fraction * cur_element_count));
+            batch.clear();
+            batch_rows.clear();
+            for (; row < n && batch.size() < batch_size; row++) {
+                if (label_lookup_.find(labels[row]) != ShardedLabelLookup::NOT_FOUND) {
+                    updates.push_back(row);
+                    continue;
+                }
+                if (cur_element_count + batch.size() >= max_elements_) {
+                    addBatch(batch, batch_rows, data, pool);  // the elements claimed so far are added
+                    throw std::runtime_error("The number of elements exceeds the specified limit");
+                }
+                batch.push_back(claimElement(cur_element_count + batch.size(), labels[row]));
+                batch_rows.push_back(row);
+            }
+            addBatch(batch, batch_rows, data, pool);
+        }
+        pool.parallelFor(0, updates.size(), [&](size_t i, size_t) {
+            addPoint((const char *) data + updates[i] * vector_size_, labels[updates[i]]);
+        });
+    }
+
+
+    /*
+     * Gives the element id, not counted yet, to a label for addPointsBulk and picks its level. The
+     * element is initialized and counted by addBatch.
+     */
+    tableint claimElement(size_t id, labeltype label) {
+        tableint cur_c = (tableint) id;
+        element_levels_[cur_c] = getRandomLevel(mult_);
+        memset(data_level0_memory_ + cur_c * size_data_per_element_ + offsetLevel0_, 0, size_data_per_element_);
+        memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
+        label_lookup_.insert(label, cur_c);
+        return cur_c;
+    }
+
+
+    // A reverse link of a batch of addPointsBulk: source links to target at level
+    struct BulkLink {
+        tableint target;
+        tableint source;
+        int level;
+
+        bool operator<(const BulkLink &other) const {
+            return target < other.target || (target == other.target && level < other.level);
+        }
+    };
+
+
+    // Connects the elements [batch.front(), batch.back()] claimed by claimElement for the given rows
+    void addBatch(const std::vector<tableint> &batch, const std::vector<size_t> &rows, const void *data, ThreadPool &pool) {
+        if (batch.empty())
+            return;
+        {
+            // a snapshot sees the batch initialized or not at all
+            ReaderGate::ReadGuard update_guard(update_gate_);
+            pool.parallelFor(0, batch.size(), [&](size_t i, size_t) {
+                tableint cur_c = batch[i];
+                setData(cur_c, (const char *) data + rows[i] * vector_size_);
+                if (element_levels_[cur_c])
+                    link_list_offsets_[cur_c] = link_list_arena_.allocate(element_levels_[cur_c]);
+            });
+            cur_element_count = batch.back() + 1;
+            initialized_count_ = cur_element_count.load();
+        }
+
+        // the graph before the batch: the new elements are unreachable until the reverse links are in
+        int maxlevel = maxlevel_;
+        tableint enterpoint = enterpoint_node_;
+        bool ep_deleted = isMarkedDeleted(enterpoint);
+        size_t num_buckets = pool.size() * 8;
+        std::vector<std::vector<BulkLink>> links(pool.size() * num_buckets);
+        pool.parallelFor(0, batch.size(), [&](size_t i, size_t thread_id) {
+            tableint cur_c = batch[i];
+            const void *data_point = getDataByInternalId(cur_c);
+            int curlevel = element_levels_[cur_c];
+            tableint currObj = enterpoint;
+            if (curlevel < maxlevel)
+                currObj = descendUpperLayers(data_point, currObj, maxlevel, curlevel);
+            for (int level = std::min(curlevel, maxlevel); level >= 0; level--) {
+                std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
+                    top_candidates = searchBaseLayer(currObj, data_point, level);
+                if (ep_deleted) {
+                    top_candidates.emplace(fstdistfunc_(data_point, getDataByInternalId(enterpoint), dist_func_param_), enterpoint);
+                    if (top_candidates.size() > ef_construction_)
+                        top_candidates.pop();
+                }
+                getNeighborsByHeuristic2(top_candidates, M_);
+
+                linklistsizeint *ll_cur = get_linklist_at_level(cur_c, level);
+                tableint *selected = (tableint *) (ll_cur + 1);
+                size_t size = top_candidates.size();
+                elementChanging(cur_c);
+                LinkListLock::WriteSection write(link_list_locks_[cur_c]);
+                for (size_t j = size; j-- > 0; top_candidates.pop()) {
+                    selected[j] = top_candidates.top().second;
+                    links[thread_id * num_buckets + selected[j] % num_buckets].push_back({selected[j], cur_c, level});
+                }
+                setListCount(ll_cur, size);
+                if (size != 0)
+                    currObj = selected[0];
+            }
+        });
+
+        // each bucket of targets is merged by one thread, the targets in turn
+        pool.parallelFor(0, num_buckets, [&](size_t bucket, size_t) {
+            std::vector<BulkLink> bucket_links;
+            for (size_t t = 0; t < pool.size(); t++) {
+                std::vector<BulkLink> &thread_links = links[t * num_buckets + bucket];
+                bucket_links.insert(bucket_links.end(), thread_links.begin(), thread_links.end());
+                std::vector<BulkLink>().swap(thread_links);
+            }
+            std::sort(bucket_links.begin(), bucket_links.end());
+            for (size_t begin = 0, end; begin < bucket_links.size(); begin = end) {
+                for (end = begin + 1; end < bucket_links.size() && !(bucket_links[begin] < bucket_links[end]); end++) {}
+                addReverseLinks(bucket_links.data() + begin, end - begin);
+            }
+        }, 1);
+
+        std::unique_lock <std::mutex> templock(global);
+        for (tableint cur_c : batch) {
+            if (element_levels_[cur_c] > maxlevel_) {
+                maxlevel_ = element_levels_[cur_c];
+                enterpoint_node_ = cur_c;
+            }
+        }
+        templock.unlock();
+        for (size_t i = 0; i < batch.size(); i++)
+            logUpdate(WriteAheadLog::ADD, getExternalLabel(batch[i]), (const char *) data + rows[i] * vector_size_);
+    }
+
+
+    // Adds the sources of num_links links to the same target and level to the list of the target
+    void addReverseLinks(const BulkLink *links, size_t num_links) {
+        tableint target = links[0].target;
+        int level = links[0].level;
+        size_t Mcurmax = level ? maxM_ : maxM0_;
+        std::unique_lock <LinkListLock> lock(link_list_locks_[target]);
+        linklistsizeint *ll = get_linklist_at_level(target, level);
+        tableint *data = (tableint *) (ll + 1);
+        size_t size = getListCount(ll);
+
+        if (size + num_links <= Mcurmax) {
+            elementChanging(target);
+            LinkListLock::WriteSection write(link_list_locks_[target]);
+            for (size_t i = 0; i < num_links; i++)
+                data[size + i] = links[i].source;
+            setListCount(ll, size + num_links);
+            return;
         }
+        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
+        const char *target_data = getDataByInternalId(target);
+        for (size_t j = 0; j < size; j++)
+            candidates.emplace(fstdistfunc_stored_(getDataByInternalId(data[j]), target_data, dist_func_param_), data[j]);
+        for (size_t i = 0; i < num_links; i++)
+            candidates.emplace(fstdistfunc_stored_(getDataByInternalId(links[i].source), target_data, dist_func_param_), links[i].source);
+        getNeighborsByHeuristic2(candidates, Mcurmax);
+
+        elementChanging(target);
+        LinkListLock::WriteSection write(link_list_locks_[target]);
+        size_t indx = 0;
+        for (; !candidates.empty(); candidates.pop())
+            data[indx++] = candidates.top().second;
+        setListCount(ll, indx);
     }
 
 
     void updatePoint(const void *dataPoint, tableint internalId, float updateNeighborProbability) {
         // update the feature vector associated with existing point with new vector
-        memcpy(getDataByInternalId(internalId), dataPoint, data_size_);
+        setData(internalId, dataPoint);
 
         int maxLevelCopy = maxlevel_;
         tableint entryPointCopy = enterpoint_node_;
@@ -1046,70 +2769,194 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         int elemLevel = element_levels_[internalId];
         std::uniform_real_distribution<float> distribution(0.0, 1.0);
+        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+        RepairBuffers<dist_t, tableint> &buffers = vl->getRepairBuffers<dist_t, tableint>();
         for (int layer = 0; layer <= elemLevel; layer++) {
-            std::unordered_set<tableint> sCand;
-            std::unordered_set<tableint> sNeigh;
-            std::vector<tableint> listOneHop = getConnectionsWithLock(internalId, layer);
-            if (listOneHop.size() == 0)
-                continue;
+            vl->reset();
+            buffers.candidates.clear();
+            buffers.neighbors.clear();
+            addNeighborhood(internalId, layer, vl, buffers, [&]() {
+                return distribution(update_probability_generator_) <= updateNeighborProbability;
+            });
+            for (tableint neigh : buffers.neighbors)
+                reselectNeighbors(neigh, layer, buffers);
+        }
+        visited_list_pool_->releaseVisitedList(vl);
+
+        repairConnectionsForUpdate(dataPoint, entryPointCopy, internalId, elemLevel, maxLevelCopy);
+    }
 
-            sCand.insert(internalId);
 
-            for (auto&& elOneHop : listOneHop) {
-                sCand.insert(elOneHop);
+    /*
+     * Adds an updated element, its neighbors at layer and their neighbors to buffers.candidates,
+     * skipping those marked in vl and marking the others. The neighbors for which select() returns
+     * true also go to buffers.neighbors.
+     */
+    template<typename Select>
+    void addNeighborhood(tableint internalId, int layer, VisitedList *vl, RepairBuffers<dist_t, tableint> &buffers, Select select) {
+        buffers.links.resize(maxM0_ + 1);
+        buffers.one_hop.resize(maxM0_ + 1);
+        size_t size = readLinks(internalId, layer, buffers.one_hop.data());
+        if (size == 0)
+            return;
+        auto add = [&](tableint id) {
+            if (vl->mass[id] != vl->curV) {
+                vl->mass[id] = vl->curV;
+                buffers.candidates.push_back(id);
+            }
+        };
+        add(internalId);
+        for (size_t i = 0; i < size; i++) {
+            tableint elOneHop = buffers.one_hop[i];
+            add(elOneHop);
+            if (!select())
+                continue;
+            buffers.neighbors.push_back(elOneHop);
+            size_t size_two_hop = readLinks(elOneHop, layer, buffers.links.data());
+            for (size_t j = 0; j < size_two_hop; j++)
+                add(buffers.links[j]);
+        }
+    }
 
-                if (distribution(update_probability_generator_) > updateNeighborProbability)
-                    continue;
 
-                sNeigh.insert(elOneHop);
+    // Picks the list of neigh at layer from buffers.candidates, as mutuallyConnectNewElement does
+    void reselectNeighbors(tableint neigh, int layer, RepairBuffers<dist_t, tableint> &buffers) {
+        // the ef_construction_ closest candidates, closer first
+        std::vector<std::pair<dist_t, tableint>> &scored = buffers.scored;
+        scored.clear();
+        const char *neigh_data = getDataByInternalId(neigh);
+        for (tableint cand : buffers.candidates) {
+            if (cand != neigh)
+                scored.emplace_back(fstdistfunc_stored_(neigh_data, getDataByInternalId(cand), dist_func_param_), cand);
+        }
+        if (scored.size() > ef_construction_) {
+            std::nth_element(scored.begin(), scored.begin() + ef_construction_, scored.end());
+            scored.resize(ef_construction_);
+        }
+        std::sort(scored.begin(), scored.end());
 
-                std::vector<tableint> listTwoHop = getConnectionsWithLock(elOneHop, layer);
-                for (auto&& elTwoHop : listTwoHop) {
-                    sCand.insert(elTwoHop);
-                }
+        // the heuristic of getNeighborsByHeuristic2
+        size_t Mcurmax = layer == 0 ? maxM0_ : maxM_;
+        std::vector<std::pair<dist_t, tableint>> &selected = buffers.selected;
+        selected.clear();
+        for (size_t i = 0; i < scored.size() && selected.size() < Mcurmax; i++) {
+            bool good = true;
+            for (size_t j = 0; good && j < selected.size() && scored.size() >= Mcurmax; j++) {
+                dist_t curdist = fstdistfunc_stored_(getDataByInternalId(selected[j].second),
+                                                     getDataByInternalId(scored[i].second), dist_func_param_);
+                good = !(curdist < scored[i].first);
             }
+            if (good)
+                selected.push_back(scored[i]);
+        }
 
-            for (auto&& neigh : sNeigh) {
-                // if (neigh == internalId)
-                //     continue;
+        std::unique_lock <LinkListLock> lock(link_list_locks_[neigh]);
+        elementChanging(neigh);
+        LinkListLock::WriteSection write(link_list_locks_[neigh]);
+        linklistsizeint *ll_cur = get_linklist_at_level(neigh, layer);
+        setListCount(ll_cur, selected.size());
+        tableint *data = (tableint *) (ll_cur + 1);
+        for (size_t idx = 0; idx < selected.size(); idx++)
+            data[idx] = selected[idx].second;
+    }
 
-                std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidates;
-                size_t size = sCand.find(neigh) == sCand.end() ? sCand.size() : sCand.size() - 1;  // sCand guaranteed to have size >= 1
-                size_t elementsToKeep = std::min(ef_construction_, size);
-                for (auto&& cand : sCand) {
-                    if (cand == neigh)
-                        continue;
 
-                    dist_t distance = fstdistfunc_(getDataByInternalId(neigh), getDataByInternalId(cand), dist_func_param_);
-                    if (candidates.size() < elementsToKeep) {
-                        candidates.emplace(distance, cand);
-                    } else {
-                        if (distance < candidates.top().first) {
-                            candidates.pop();
-                            candidates.emplace(distance, cand);
-                        }
-                    }
-                }
+    /*
+     * Updates the vectors of the elements with the given labels to the n vectors stored one after
+     * another (vector_size_ bytes each), as addPoint does for each of them; labels without an element
+     * are added, and for a label given twice the last vector counts. The neighbors of all updated
+     * elements are repaired together: an element that is a neighbor of several of them has its list
+     * reselected once, from the union of their neighborhoods. The work is spread over the threads of
+     * the pool. Searches may run meanwhile, other updates must not.
+     *
+     * The elements are relinked with all the new vectors in place, so a batch that moves many of
+     * them into one small region links them mostly among each other; such moves go better in
+     * several smaller batches.
+     */
+    void updatePoints(const void *data, const labeltype *labels, size_t n, ThreadPool &pool) {
+        checkWritable();
+        std::vector<std::pair<tableint, size_t>> updated;  // (id, row)
+        std::vector<size_t> added;
+        for (size_t row = 0; row < n; row++) {
+            tableint id = label_lookup_.find(labels[row]);
+            if (id == ShardedLabelLookup::NOT_FOUND) {
+                added.push_back(row);
+                continue;
+            }
+            if (allow_replace_deleted_ && isMarkedDeleted(id))
+                throw std::runtime_error("Can't use addPoint to update deleted elements if replacement of deleted elements is enabled.");
+            updated.emplace_back(id, row);
+        }
+        std::stable_sort(updated.begin(), updated.end(),
+            [](const std::pair<tableint, size_t> &a, const std::pair<tableint, size_t> &b) { return a.first < b.first; });
+        size_t num_updated = 0;
+        for (size_t i = 0; i < updated.size(); i++) {
+            if (i + 1 < updated.size() && updated[i + 1].first == updated[i].first)
+                continue;
+            updated[num_updated++] = updated[i];
+        }
+        updated.resize(num_updated);
+        auto rowData = [&](size_t row) { return (const char *) data + row * vector_size_; };
 
-                // Retrieve neighbours using heuristic and set connections.
-                getNeighborsByHeuristic2(candidates, layer == 0 ? maxM0_ : maxM_);
+        for (auto &element : updated) {
+            if (isMarkedDeleted(element.first))
+                unmarkDeletedInternal(element.first);
+        }
+        pool.parallelFor(0, updated.size(), [&](size_t i, size_t) {
+            setData(updated[i].first, rowData(updated[i].second));
+        });
 
-                {
-                    std::unique_lock <std::mutex> lock(link_list_locks_[neigh]);
-                    linklistsizeint *ll_cur;
-                    ll_cur = get_linklist_at_level(neigh, layer);
-                    size_t candSize = candidates.size();
-                    setListCount(ll_cur, candSize);
-                    tableint *data = (tableint *) (ll_cur + 1);
-                    for (size_t idx = 0; idx < candSize; idx++) {
-                        data[idx] = candidates.top().second;
-                        candidates.pop();
-                    }
+        if (cur_element_count > 1) {
+            // the updated elements that link to each neighbor at each layer
+            size_t num_buckets = pool.size() * 8;
+            std::vector<std::vector<BulkLink>> links(pool.size() * num_buckets);
+            pool.parallelFor(0, updated.size(), [&](size_t i, size_t thread_id) {
+                tableint id = updated[i].first;
+                VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+                std::vector<tableint> &list = vl->getRepairBuffers<dist_t, tableint>().links;
+                list.resize(maxM0_ + 1);
+                for (int layer = 0; layer <= element_levels_[id]; layer++) {
+                    size_t size = readLinks(id, layer, list.data());
+                    for (size_t j = 0; j < size; j++)
+                        links[thread_id * num_buckets + list[j] % num_buckets].push_back({list[j], id, layer});
                 }
-            }
+                visited_list_pool_->releaseVisitedList(vl);
+            });
+
+            pool.parallelFor(0, num_buckets, [&](size_t bucket, size_t) {
+                std::vector<BulkLink> bucket_links;
+                for (size_t t = 0; t < pool.size(); t++) {
+                    std::vector<BulkLink> &thread_links = links[t * num_buckets + bucket];
+                    bucket_links.insert(bucket_links.end(), thread_links.begin(), thread_links.end());
+                    std::vector<BulkLink>().swap(thread_links);
+                }
+                std::sort(bucket_links.begin(), bucket_links.end());
+                VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+                RepairBuffers<dist_t, tableint> &buffers = vl->getRepairBuffers<dist_t, tableint>();
+                for (size_t begin = 0, end; begin < bucket_links.size(); begin = end) {
+                    vl->reset();
+                    buffers.candidates.clear();
+                    for (end = begin; end < bucket_links.size() && !(bucket_links[begin] < bucket_links[end]); end++)
+                        addNeighborhood(bucket_links[end].source, bucket_links[end].level, vl, buffers, []() { return true; });
+                    buffers.neighbors.clear();
+                    reselectNeighbors(bucket_links[begin].target, bucket_links[begin].level, buffers);
+                }
+                visited_list_pool_->releaseVisitedList(vl);
+            }, 1);
+
+            int maxLevelCopy = maxlevel_;
+            tableint entryPointCopy = enterpoint_node_;
+            pool.parallelFor(0, updated.size(), [&](size_t i, size_t) {
+                tableint id = updated[i].first;
+                repairConnectionsForUpdate(rowData(updated[i].second), entryPointCopy, id, element_levels_[id], maxLevelCopy);
+            });
         }
+        for (auto &element : updated)
+            logUpdate(WriteAheadLog::ADD, labels[element.second], rowData(element.second));
 
-        repairConnectionsForUpdate(dataPoint, entryPointCopy, internalId, elemLevel, maxLevelCopy);
+        pool.parallelFor(0, added.size(), [&](size_t i, size_t) {
+            addPoint(rowData(added[i]), labels[added[i]]);
+        });
     }
 
 
@@ -1122,15 +2969,15 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         tableint currObj = entryPointInternalId;
         if (dataPointLevel < maxLevel) {
             dist_t curdist = fstdistfunc_(dataPoint, getDataByInternalId(currObj), dist_func_param_);
+            VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+            std::vector<tableint> &links = vl->getRepairBuffers<dist_t, tableint>().links;
+            links.resize(maxM0_ + 1);
             for (int level = maxLevel; level > dataPointLevel; level--) {
                 bool changed = true;
                 while (changed) {
                     changed = false;
-                    unsigned int *data;
-                    std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
-                    data = get_linklist_at_level(currObj, level);
-                    int size = getListCount(data);
-                    tableint *datal = (tableint *) (data + 1);
+                    int size = readLinks(currObj, level, links.data());
+                    tableint *datal = links.data();
 #ifdef USE_SSE
                     _mm_prefetch(getDataByInternalId(*datal), _MM_HINT_T0);
 #endif
@@ -1148,6 +2995,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     }
                 }
             }
+            visited_list_pool_->releaseVisitedList(vl);
         }
 
         if (dataPointLevel > maxLevel)
@@ -1182,23 +3030,18 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
 
     std::vector<tableint> getConnectionsWithLock(tableint internalId, int level) {
-        std::unique_lock <std::mutex> lock(link_list_locks_[internalId]);
-        unsigned int *data = get_linklist_at_level(internalId, level);
-        int size = getListCount(data);
-        std::vector<tableint> result(size);
-        tableint *ll = (tableint *) (data + 1);
-        memcpy(result.data(), ll, size * sizeof(tableint));
+        std::vector<tableint> result(maxM0_ + 1);
+        result.resize(readLinks(internalId, level, result.data()));
         return result;
     }
 
 
     tableint addPoint(const void *data_point, labeltype label, int level) {
-        // hnswlib::HNSWLightProfiler::Timer total_timer("addPoint:internal_total");
         tableint cur_c = 0;
         {
             // Checking if the element with the same label already exists
             // if so, updating it *instead* of creating a new element.
-            HNSWLightProfiler::Timer t("addPoint:label_lookup");
+            HNSW_PROFILE_SCOPE("addPoint:label_lookup");
             tableint existingInternalId = label_lookup_.find(label);
     
             if (existingInternalId != -1) {  // Label exists
@@ -1215,175 +3058,70 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
                 return existingInternalId;
             }
-            // std::unique_lock <std::mutex> lock_table(label_lookup_lock);
-            // auto search = label_lookup_.find(label);
-            // if (search != label_lookup_.end()) {
-            //     tableint existingInternalId = search->second;
-            //     if (allow_replace_deleted_) {
-            //         if (isMarkedDeleted(existingInternalId)) {
-            //             throw std::runtime_error("Can't use addPoint to update deleted elements if replacement of deleted elements is enabled.");
-            //         }
-            //     }
-            //     lock_table.unlock();
-
-            //     if (isMarkedDeleted(existingInternalId)) {
-            //         unmarkDeletedInternal(existingInternalId);
-            //     }
-            //     updatePoint(data_point, existingInternalId, 1.0);
-
-            //     return existingInternalId;
-            // }
-
-            if (cur_element_count >= max_elements_) {
-                throw std::runtime_error("The number of elements exceeds the specified limit");
-            }
-
-            cur_c = cur_element_count;
-            cur_element_count++;
-            label_lookup_.insert(label, cur_c);
-            // label_lookup_[label] = cur_c;
         }
         int curlevel;
         {
-        HNSWLightProfiler::Timer t("addPoint:linklist_lock_and_level_assign");
-        std::unique_lock <std::mutex> lock_el(link_list_locks_[cur_c]);
-        int curlevel = getRandomLevel(mult_);
-        if (level > 0)
-            curlevel = level;
-
-        element_levels_[cur_c] = curlevel;
+            // a snapshot sees the new element initialized or not at all
+            ReaderGate::ReadGuard update_guard(update_gate_);
+            // claims the next id, threads adding other labels may claim at the same time
+            size_t count = cur_element_count.load();
+            do {
+                if (count >= max_elements_) {
+                    throw std::runtime_error("The number of elements exceeds the specified limit");
+                }
+            } while (!cur_element_count.compare_exchange_weak(count, count + 1));
+            cur_c = count;
+            try {
+                label_lookup_.insert(label, cur_c);
+
+                curlevel = getRandomLevel(mult_);
+                if (level > 0)
+                    curlevel = level;
+                element_levels_[cur_c] = curlevel;
+                HNSW_PROFILE_SCOPE("addPoint:data_initialization");
+                memset(data_level0_memory_ + cur_c * size_data_per_element_ + offsetLevel0_, 0, size_data_per_element_);
+
+                // Initialisation of the data and label
+                memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
+                setData(cur_c, data_point);
+                if (curlevel) {
+                    link_list_offsets_[cur_c] = link_list_arena_.allocate(curlevel);
+                }
+            } catch (...) {
+                publishInitialized(cur_c);  // the insertions that claimed later ids must not wait forever
+                throw;
+            }
+            publishInitialized(cur_c);
         }
-        int maxlevelcopy;
-        {
-        HNSWLightProfiler::Timer t("addPoint:global_lock_copy");
+
         std::unique_lock <std::mutex> templock(global);
         int maxlevelcopy = maxlevel_;
         if (curlevel <= maxlevelcopy)
             templock.unlock();
-        }
         tableint currObj = enterpoint_node_;
         tableint enterpoint_copy = enterpoint_node_;
-        {
-        HNSWLightProfiler::Timer t("addPoint:data_initialization");
-        memset(data_level0_memory_ + cur_c * size_data_per_element_ + offsetLevel0_, 0, size_data_per_element_);
-
-        // Initialisation of the data and label
-        memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
-        memcpy(getDataByInternalId(cur_c), data_point, data_size_);
-        }
-        if (curlevel) {
-            // HNSWLightProfiler::Timer t("addPoint:allocate_linklist");
-            linkLists_[cur_c] = (char *) malloc(size_links_per_element_ * curlevel + 1);
-            if (linkLists_[cur_c] == nullptr)
-                throw std::runtime_error("Not enough memory: addPoint failed to allocate linklist");
-            memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel + 1);
-        }
 
         if ((signed)currObj != -1) {
-            if (curlevel < maxlevelcopy) {
-                HNSWLightProfiler::Timer t("addPoint:entry_navigation");
-
-                dist_t curdist;
-                {
-                    HNSWLightProfiler::Timer distance_timer("addPoint:distance_computation");
-                    curdist = fstdistfunc_(data_point, getDataByInternalId(currObj), dist_func_param_);
-                }
-                for (int level = maxlevelcopy; level > curlevel; level--) {
-                    bool changed = true;
-                    while (changed) {
-                        changed = false;
-                        unsigned int *data;
-                        int size;
-                        {
-                        HNSWLightProfiler::Timer lock_timer("addPoint:link_list_lock");
-                        std::unique_lock <std::mutex> lock(link_list_locks_[currObj]);
-                        // }
-                        
-                        // {
-                        // HNSWLightProfiler::Timer list_timer("addPoint:get_linklist");
-
-                        std::cout << "=== DEBUG INFO ===" << std::endl;
-                        std::cout << "currObj: " << currObj << std::endl;
-                        std::cout << "level: " << level << std::endl;
-                        std::cout << "maxlevelcopy: " << maxlevelcopy << std::endl;
-                        std::cout << "curlevel: " << curlevel << std::endl;
-                        std::cout << "max_elements_: " << max_elements_ << std::endl;
-                        
-                        // Check if currObj is valid
-                        if (currObj < 0 || currObj >= max_elements_) {
-                            std::cerr << "ERROR: Invalid currObj=" << currObj << std::endl;
-                            throw std::runtime_error("Invalid currObj");
-                        }
-
-                        // Check if level is reasonable
-                        if (level < 0 || level > 16) {  // Assuming max reasonable level is 16
-                            std::cerr << "ERROR: Invalid level=" << level << std::endl;
-                            throw std::runtime_error("Invalid level");
-                        }
-
-                        // Check if linkLists_[currObj] exists and is valid
-                        if (linkLists_[currObj] == nullptr) {
-                            std::cerr << "ERROR: linkLists_[" << currObj << "] is nullptr" << std::endl;
-                            throw std::runtime_error("linkLists is nullptr");
-                        }
-
-                        std::cout << "linkLists_[" << currObj << "] = " << (void*)linkLists_[currObj] << std::endl;
-
-                        data = get_linklist(currObj, level);
-
-                        std::cout << "get_linklist returned: " << (void*)data << std::endl;
-
-                        if (data == nullptr) {
-                            std::cerr << "ERROR: get_linklist returned nullptr for currObj=" 
-                                      << currObj << ", level=" << level << std::endl;
-                            throw std::runtime_error("get_linklist returned nullptr");
-                        }
-                        try {
-                            size = getListCount(data);
-                            std::cout << "getListCount returned: " << size << std::endl;
-                        } catch (...) {
-                            std::cerr << "ERROR: getListCount failed for data pointer=" << data 
-                                      << ", currObj=" << currObj << ", level=" << level << std::endl;
-                            throw;
-                        }
-                        // size = getListCount(data);
-                        }
-
-                        { HNSWLightProfiler::Timer traversal("addPoint:graph_traversal");
-                        tableint *datal = (tableint *) (data + 1);
-                        for (int i = 0; i < size; i++) {
-                            tableint cand = datal[i];
-                            if (cand < 0 || cand > max_elements_)
-                                throw std::runtime_error("cand error");
-                            dist_t d = fstdistfunc_(data_point, getDataByInternalId(cand), dist_func_param_);
-                            if (d < curdist) {
-                                curdist = d;
-                                currObj = cand;
-                                changed = true;
-                            }
-                        }
-                        }
-
-                    }
-                }
-            }
+            if (curlevel < maxlevelcopy)
+                currObj = descendUpperLayers(data_point, currObj, maxlevelcopy, curlevel);
 
             bool epDeleted = isMarkedDeleted(enterpoint_copy);
             for (int level = std::min(curlevel, maxlevelcopy); level >= 0; level--) {
                 if (level > maxlevelcopy || level < 0)  // possible?
                     throw std::runtime_error("Level error");
 
-                std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates = searchBaseLayer(
-                        currObj, data_point, level);
-                if (epDeleted) {
-                    top_candidates.emplace(fstdistfunc_(data_point, getDataByInternalId(enterpoint_copy), dist_func_param_), enterpoint_copy);
-                    if (top_candidates.size() > ef_construction_)
-                        top_candidates.pop();
-                }
+                std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
                 {
-                // HNSWLightProfiler::Timer t("addPoint:mutually_connect_new_element");
-                currObj = mutuallyConnectNewElement(data_point, cur_c, top_candidates, level, false);
+                    HNSW_PROFILE_SCOPE_ID(profile_tags_.id(HNSWProfileTags::INSERT_LAYER_SEARCH, level));
+                    top_candidates = searchBaseLayer(currObj, data_point, level);
+                    if (epDeleted) {
+                        top_candidates.emplace(fstdistfunc_(data_point, getDataByInternalId(enterpoint_copy), dist_func_param_), enterpoint_copy);
+                        if (top_candidates.size() > ef_construction_)
+                            top_candidates.pop();
+                    }
                 }
+                HNSW_PROFILE_SCOPE_ID(profile_tags_.id(HNSWProfileTags::INSERT_CONNECT, level));
+                currObj = mutuallyConnectNewElement(data_point, cur_c, top_candidates, level, false);
             }
         } else {
             // Do nothing for the first element
@@ -1393,7 +3131,6 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         // Releasing lock for the maximum level
         if (curlevel > maxlevelcopy) {
-            // HNSWLightProfiler::Timer t("addPoint:update_entry_point");
             enterpoint_node_ = cur_c;
             maxlevel_ = curlevel;
         }
@@ -1401,130 +3138,407 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
-    std::priority_queue<std::pair<dist_t, labeltype >>
-    searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
-        HNSWLightProfiler::Timer total_timer("searchKnn_total");
-
-        std::priority_queue<std::pair<dist_t, labeltype >> result;
-        if (cur_element_count == 0) return result;
+    // Raises initialized_count_ past id once the insertions that claimed the ids below it have raised it to id
+    void publishInitialized(tableint id) {
+        while (initialized_count_.load(std::memory_order_acquire) != id)
+            std::this_thread::yield();
+        initialized_count_.store(id + 1, std::memory_order_release);
+    }
 
-        tableint currObj = enterpoint_node_;
-        dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
 
-        {
-            HNSWLightProfiler::Timer descent_timer("searchKnn_layer_descent");
-        for (int level = maxlevel_; level > 0; level--) {
+    // Greedy descent of an insertion from currObj through the levels above bottom_level up to top_level
+    tableint descendUpperLayers(const void *data_point, tableint currObj, int top_level, int bottom_level) {
+        dist_t curdist = fstdistfunc_(data_point, getDataByInternalId(currObj), dist_func_param_);
+        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+        tableint *links = vl->getNeighborPool<dist_t, tableint>().links(maxM0_ + 1);
+        for (int level = top_level; level > bottom_level; level--) {
+            HNSW_PROFILE_SCOPE_ID(profile_tags_.id(HNSWProfileTags::INSERT_UPPER_LAYER, level));
             bool changed = true;
             while (changed) {
                 changed = false;
-                unsigned int *data;
-
-                data = (unsigned int *) get_linklist(currObj, level);
-                int size = getListCount(data);
-                metric_hops++;
-                metric_distance_computations+=size;
+                int size = readLinks(currObj, level, links);
 
-                tableint *datal = (tableint *) (data + 1);
-                {
-                HNSWLightProfiler::Timer neighbor_expansion_timer("searchKnn_neighbor_expansion_level_" + std::to_string(level));
+                tableint *datal = links;
                 for (int i = 0; i < size; i++) {
                     tableint cand = datal[i];
-                    if (cand < 0 || cand > max_elements_)
+                    if (cand < 0 || cand > max_elements_) {
+                        visited_list_pool_->releaseVisitedList(vl);
                         throw std::runtime_error("cand error");
-                    dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
-
+                    }
+                    dist_t d = fstdistfunc_(data_point, getDataByInternalId(cand), dist_func_param_);
                     if (d < curdist) {
                         curdist = d;
                         currObj = cand;
                         changed = true;
                     }
                 }
-                }
             }
         }
+        visited_list_pool_->releaseVisitedList(vl);
+        return currObj;
+    }
+
+
+    /*
+     * Greedy descent of a prepared query through the upper layers, returns the entry point for
+     * the base layer search. The work is added to stats, if given, whose hops get room for every layer.
+     */
+    tableint searchUpperLayers(const void *query_data, SearchStats *stats = nullptr) const {
+        tableint currObj = enterpoint_node_;
+        int max_level = maxlevel_;
+        dist_t curdist = fstdistfunc_query_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+        if (stats) {
+            if (stats->hops.size() < (size_t) max_level + 1)
+                stats->hops.resize(max_level + 1, 0);
+            stats->distance_computations++;
         }
 
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        bool bare_bone_search = !num_deleted_ && !isIdAllowed;
-        {
-        HNSWLightProfiler::Timer base_layer_timer("searchKnn_baseLayerSearch");
-        if (bare_bone_search) {
-            top_candidates = searchBaseLayerST<true>(currObj, query_data, std::max(ef_, k), isIdAllowed);
+        const void *batch_data[DISTANCE_BATCH_SIZE];
+        dist_t batch_dists[DISTANCE_BATCH_SIZE];
+        for (int level = max_level; level > 0; level--) {
+            HNSW_PROFILE_SCOPE_ID(profile_tags_.id(HNSWProfileTags::SEARCH_UPPER_LAYER, level));
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                unsigned int *data;
+
+                data = (unsigned int *) get_linklist(currObj, level);
+                int size = getListCount(data);
+                if (stats) {
+                    stats->hops[level]++;
+                    stats->distance_computations += size;
+                }
+
+                tableint *datal = (tableint *) (data + 1);
+                for (int i = 0; i < size; i += DISTANCE_BATCH_SIZE) {
+                    int batch_size = std::min(size - i, (int) DISTANCE_BATCH_SIZE);
+                    for (int b = 0; b < batch_size; b++) {
+                        tableint cand = datal[i + b];
+                        if (cand < 0 || cand > max_elements_)
+                            throw std::runtime_error("cand error");
+                        batch_data[b] = getDataByInternalId(cand);
+                    }
+                    if (fstdistfunc_query_batch_ != nullptr) {
+                        fstdistfunc_query_batch_(query_data, batch_data, batch_size, dist_func_param_, batch_dists);
+                    } else {
+                        for (int b = 0; b < batch_size; b++)
+                            batch_dists[b] = fstdistfunc_query_(query_data, batch_data[b], dist_func_param_);
+                    }
+
+                    for (int b = 0; b < batch_size; b++) {
+                        dist_t d = batch_dists[b];
+                        if (d < curdist) {
+                            curdist = d;
+                            currObj = datal[i + b];
+                            changed = true;
+                        }
+                    }
+                }
+            }
+        }
+        return currObj;
+    }
+
+
+    /*
+     * Leaves the (at most) k nearest neighbors in the neighbor pool of vl, closer first.
+     * With an id filter, a graph search scores about max(ef, k) * maxM0_ / selectivity elements;
+     * filters that allow fewer elements than that are scanned instead.
+     * The work of the search goes to stats, if given, and to the SearchCounters.
+     */
+    std::vector<std::pair<dist_t, tableint>> &
+    searchKnnInternal(VisitedList *vl, const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed,
+                      const IdFilter *id_filter = nullptr, SearchStats *stats = nullptr) const {
+        SearchStatsScope stats_scope(stats);
+        size_t ef = std::max(ef_, k);
+        bool scan = id_filter != nullptr &&
+            (double) id_filter->size() * id_filter->size() <= (double) ef * maxM0_ * cur_element_count;
+        const void *query = prepareQuery(query_data, vl->prepared_query);
+        if (scan) {
+            scanIdFilter(vl, query, ef, *id_filter, isIdAllowed, stats_scope.get());
         } else {
-            top_candidates = searchBaseLayerST<false>(currObj, query_data, std::max(ef_, k), isIdAllowed);
+            tableint currObj = searchUpperLayers(query, stats_scope.get());
+
+            bool bare_bone_search = !num_deleted_ && !isIdAllowed;
+            HNSW_PROFILE_SCOPE_ID(profile_tags_.id(HNSWProfileTags::SEARCH_BASE_LAYER, 0));
+            if (id_filter != nullptr) {
+                searchBaseLayerIdFilter(vl, currObj, query, ef, *id_filter, isIdAllowed, stats_scope.get());
+            } else if (bare_bone_search) {
+                searchBaseLayerPool<true, BaseSearchStopCondition<dist_t>>(vl, currObj, query, ef, isIdAllowed, nullptr, stats_scope.get());
+            } else {
+                searchBaseLayerPool<false, BaseSearchStopCondition<dist_t>>(vl, currObj, query, ef, isIdAllowed, nullptr, stats_scope.get());
+            }
         }
+        std::vector<std::pair<dist_t, tableint>> &top_candidates = vl->getNeighborPool<dist_t, tableint>().results();
+
+        if (rerank_data_ != nullptr) {
+            stats_scope.get()->distance_computations += top_candidates.size();
+            // all ef candidates get their exact distance, then the k closest are kept
+            for (size_t i = 0; i < top_candidates.size(); i++) {
+                tableint id = top_candidates[i].second;
+                top_candidates[i].first = rerank_distfunc_(query_data, rerank_data_ + id * rerank_data_size_, rerank_dist_func_param_);
+            }
+            std::sort(top_candidates.begin(), top_candidates.end(), CompareByFirst());
         }
 
-        {
-        HNSWLightProfiler::Timer postprocess_timer("searchKnn_result_postprocessing");
-        while (top_candidates.size() > k) {
-            top_candidates.pop();
-        }
-        while (top_candidates.size() > 0) {
-            std::pair<dist_t, tableint> rez = top_candidates.top();
-            result.push(std::pair<dist_t, labeltype>(rez.first, getExternalLabel(rez.second)));
-            top_candidates.pop();
+        if (top_candidates.size() > k)
+            top_candidates.resize(k);
+        addMetrics(*stats_scope.get());
+        return top_candidates;
+    }
+
+
+    void addMetrics(const SearchStats &stats) const {
+        metric_hops.fetch_add(stats.totalHops(), std::memory_order_relaxed);
+        metric_distance_computations.fetch_add(stats.distance_computations, std::memory_order_relaxed);
+    }
+
+
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        return searchKnn(query_data, k, isIdAllowed, nullptr);
+    }
+
+
+    /*
+     * An IdFilter that allows the elements with the given labels, labels without an element are
+     * skipped. compact() and reorder() invalidate it.
+     */
+    IdFilter makeIdFilter(const labeltype *labels, size_t n) const {
+        ReaderGate::ReadGuard read_guard(search_gate_);
+        std::vector<tableint> ids;
+        ids.reserve(n);
+        for (size_t i = 0; i < n; i++) {
+            tableint id = label_lookup_.find(labels[i]);
+            if (id != ShardedLabelLookup::NOT_FOUND)
+                ids.push_back(id);
         }
+        return IdFilter(ids.data(), ids.size());
+    }
+
+
+    // searchKnn limited to the elements of id_filter (see IdFilter)
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnn(const void *query_data, size_t k, const IdFilter &id_filter) const {
+        return searchKnn(query_data, k, nullptr, &id_filter);
+    }
+
+
+    // searchKnn that also reports the work of the search to stats
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnn(const void *query_data, size_t k, SearchStats &stats, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        return searchKnn(query_data, k, isIdAllowed, nullptr, &stats);
+    }
+
+
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed, const IdFilter *id_filter,
+              SearchStats *stats = nullptr) const {
+        HNSW_PROFILE_SCOPE("searchKnn_total");
+
+        ReaderGate::ReadGuard read_guard(search_gate_);
+        std::priority_queue<std::pair<dist_t, labeltype >> result;
+        if (cur_element_count == 0) {
+            if (stats) stats->clear();
+            return result;
         }
 
+        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+        std::vector<std::pair<dist_t, tableint>> &top_candidates = searchKnnInternal(vl, query_data, k, isIdAllowed, id_filter, stats);
+
+        HNSW_PROFILE_SCOPE("searchKnn_result_postprocessing");
+        std::vector<std::pair<dist_t, labeltype>> labeled;
+        labeled.reserve(top_candidates.size());
+        for (size_t i = 0; i < top_candidates.size(); i++)
+            labeled.emplace_back(top_candidates[i].first, getExternalLabel(top_candidates[i].second));
+        visited_list_pool_->releaseVisitedList(vl);
+
+        result = std::priority_queue<std::pair<dist_t, labeltype >>(std::less<std::pair<dist_t, labeltype>>(), std::move(labeled));
         return result;
     }
 
-    
 
-    std::vector<std::pair<dist_t, labeltype >>
-    searchStopConditionClosest(
-        const void *query_data,
-        BaseSearchStopCondition<dist_t>& stop_condition,
-        BaseFilterFunctor* isIdAllowed = nullptr) const {
-        std::vector<std::pair<dist_t, labeltype >> result;
-        if (cur_element_count == 0) return result;
+    using AlgorithmInterface<dist_t>::searchKnnCloserFirst;
 
-        tableint currObj = enterpoint_node_;
-        dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+    // searchKnnCloserFirst that also reports the work of the search to stats
+    std::vector<std::pair<dist_t, labeltype>>
+    searchKnnCloserFirst(const void *query_data, size_t k, SearchStats &stats, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        ReaderGate::ReadGuard read_guard(search_gate_);
+        std::vector<std::pair<dist_t, labeltype>> result;
+        if (cur_element_count == 0) {
+            stats.clear();
+            return result;
+        }
 
-        for (int level = maxlevel_; level > 0; level--) {
-            bool changed = true;
-            while (changed) {
-                changed = false;
-                unsigned int *data;
+        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+        std::vector<std::pair<dist_t, tableint>> &top_candidates = searchKnnInternal(vl, query_data, k, isIdAllowed, nullptr, &stats);
+        result.reserve(top_candidates.size());
+        for (size_t i = 0; i < top_candidates.size(); i++)
+            result.emplace_back(top_candidates[i].first, getExternalLabel(top_candidates[i].second));
+        visited_list_pool_->releaseVisitedList(vl);
+        return result;
+    }
 
-                data = (unsigned int *) get_linklist(currObj, level);
-                int size = getListCount(data);
-                metric_hops++;
-                metric_distance_computations+=size;
 
-                tableint *datal = (tableint *) (data + 1);
-                for (int i = 0; i < size; i++) {
-                    tableint cand = datal[i];
-                    if (cand < 0 || cand > max_elements_)
-                        throw std::runtime_error("cand error");
-                    dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
+    /*
+     * Searches nq queries stored one after another (vector_size_ bytes each) and writes the k nearest
+     * neighbors of query i, closer first, to labels[i * k ...] and distances[i * k ...].
+     * Rows with fewer than k results are padded with label (labeltype)-1 and the largest dist_t.
+     * Returns the smallest number of results found for a query.
+     * The results pass both isIdAllowed and id_filter, if given.
+     */
+    size_t searchKnnBatch(
+        const void *queries,
+        size_t nq,
+        size_t k,
+        labeltype *labels,
+        dist_t *distances,
+        BaseFilterFunctor* isIdAllowed = nullptr,
+        const IdFilter *id_filter = nullptr) const {
+        HNSW_PROFILE_SCOPE("searchKnnBatch_total");
 
-                    if (d < curdist) {
-                        curdist = d;
-                        currObj = cand;
-                        changed = true;
-                    }
-                }
+        ReaderGate::ReadGuard read_guard(search_gate_);
+        // one visited list and neighbor pool serve every query of the batch
+        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+        size_t min_found = k;
+        for (size_t q = 0; q < nq; q++) {
+            size_t found = searchKnnRow(vl, q > 0, (const char *) queries + q * vector_size_, k,
+                                        labels + q * k, distances + q * k, isIdAllowed, id_filter);
+            min_found = std::min(min_found, found);
+        }
+        visited_list_pool_->releaseVisitedList(vl);
+        return min_found;
+    }
+
+
+    // searchKnnBatch with the queries spread over the threads of the pool
+    size_t searchKnnBatch(
+        const void *queries,
+        size_t nq,
+        size_t k,
+        labeltype *labels,
+        dist_t *distances,
+        ThreadPool &pool,
+        BaseFilterFunctor* isIdAllowed = nullptr,
+        const IdFilter *id_filter = nullptr) const {
+        HNSW_PROFILE_SCOPE("searchKnnBatch_total");
+
+        // the guard of the caller covers the searches of the workers
+        ReaderGate::ReadGuard read_guard(search_gate_);
+        std::vector<VisitedList *> vls(pool.size(), nullptr);
+        std::atomic<size_t> min_found(k);
+        try {
+            pool.parallelFor(0, nq, [&](size_t q, size_t thread_id) {
+                bool used = vls[thread_id] != nullptr;
+                if (!used)
+                    vls[thread_id] = visited_list_pool_->getFreeVisitedList();
+                size_t found = searchKnnRow(vls[thread_id], used, (const char *) queries + q * vector_size_, k,
+                                            labels + q * k, distances + q * k, isIdAllowed, id_filter);
+                size_t current = min_found.load();
+                while (found < current && !min_found.compare_exchange_weak(current, found)) {}
+            });
+        } catch (...) {
+            for (VisitedList *vl : vls) {
+                if (vl != nullptr)
+                    visited_list_pool_->releaseVisitedList(vl);
             }
+            throw;
         }
+        for (VisitedList *vl : vls) {
+            if (vl != nullptr)
+                visited_list_pool_->releaseVisitedList(vl);
+        }
+        return min_found;
+    }
 
-        std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        top_candidates = searchBaseLayerST<false>(currObj, query_data, 0, isIdAllowed, &stop_condition);
 
-        size_t sz = top_candidates.size();
-        result.resize(sz);
-        while (!top_candidates.empty()) {
-            result[--sz] = top_candidates.top();
-            top_candidates.pop();
+
+    // One query of searchKnnBatch, vl is reset first if used is set
+    size_t searchKnnRow(
+        VisitedList *vl,
+        bool used,
+        const void *query_data,
+        size_t k,
+        labeltype *row_labels,
+        dist_t *row_distances,
+        BaseFilterFunctor* isIdAllowed,
+        const IdFilter *id_filter) const {
+        size_t found = 0;
+        if (cur_element_count != 0) {
+            if (used)
+                vl->reset();
+            std::vector<std::pair<dist_t, tableint>> &top_candidates = searchKnnInternal(vl, query_data, k, isIdAllowed, id_filter);
+            found = top_candidates.size();
+            for (size_t i = 0; i < found; i++) {
+                row_distances[i] = top_candidates[i].first;
+                row_labels[i] = getExternalLabel(top_candidates[i].second);
+            }
         }
+        for (size_t i = found; i < k; i++) {
+            row_labels[i] = (labeltype) -1;
+            row_distances[i] = std::numeric_limits<dist_t>::max();
+        }
+        return found;
+    }
+
+
+    // StopCondition is BaseSearchStopCondition<dist_t> or a class derived from it
+    template<typename StopCondition>
+    std::vector<std::pair<dist_t, labeltype >>
+    searchStopConditionClosest(
+        const void *query_data,
+        StopCondition& stop_condition,
+        BaseFilterFunctor* isIdAllowed = nullptr) const {
+        ReaderGate::ReadGuard read_guard(search_gate_);
+        std::vector<std::pair<dist_t, labeltype >> result;
+        if (cur_element_count == 0) return result;
+
+        SearchStatsScope stats_scope(nullptr);
+        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+        const void *query = prepareQuery(query_data, vl->prepared_query);
+        tableint currObj = searchUpperLayers(query, stats_scope.get());
+        searchBaseLayerPool<false>(vl, currObj, query, 0, isIdAllowed, &stop_condition, stats_scope.get());
+        addMetrics(*stats_scope.get());
+        std::vector<std::pair<dist_t, tableint>> &top_candidates = vl->getNeighborPool<dist_t, tableint>().results();
+        result.reserve(top_candidates.size());
+        for (size_t i = 0; i < top_candidates.size(); i++)
+            result.emplace_back(top_candidates[i].first, getExternalLabel(top_candidates[i].second));
+        visited_list_pool_->releaseVisitedList(vl);
 
         stop_condition.filter_results(result);
 
         return result;
     }
 
+    /*
+     * All elements within radius of the query (dist <= radius), closer first. The search keeps the
+     * ef closest elements besides those within radius and goes on as long as candidates are within
+     * radius or closer than these, so its recall follows ef as for searchKnn.
+     */
+    std::vector<std::pair<dist_t, labeltype>>
+    searchRange(
+        const void *query_data,
+        dist_t radius,
+        BaseFilterFunctor* isIdAllowed = nullptr) const {
+        ReaderGate::ReadGuard read_guard(search_gate_);
+        std::vector<std::pair<dist_t, labeltype>> result;
+        if (cur_element_count == 0) return result;
+
+        SearchStatsScope stats_scope(nullptr);
+        VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+        const void *query = prepareQuery(query_data, vl->prepared_query);
+        tableint currObj = searchUpperLayers(query, stats_scope.get());
+        RangeSearchStopCondition<dist_t> stop_condition(radius, ef_);
+        searchBaseLayerPool<false>(vl, currObj, query, 0, isIdAllowed, &stop_condition, stats_scope.get());
+        addMetrics(*stats_scope.get());
+        std::vector<std::pair<dist_t, tableint>> &top_candidates = vl->getNeighborPool<dist_t, tableint>().results();
+        for (size_t i = 0; i < top_candidates.size() && top_candidates[i].first <= radius; i++)
+            result.emplace_back(top_candidates[i].first, getExternalLabel(top_candidates[i].second));
+        visited_list_pool_->releaseVisitedList(vl);
+        return result;
+    }
+
+
 
     void checkIntegrity() {
         int connections_checked = 0;
@@ -11,12 +11,40 @@
 #ifndef NO_MANUAL_VECTORIZATION
 #if (defined(__SSE__) || _M_IX86_FP > 0 || defined(_M_AMD64) || defined(_M_X64))
 #define USE_SSE
+#if defined(__GNUC__) || defined(_MSC_VER)
+// Every kernel is compiled for its own instruction set (see HNSWLIB_TARGET_*), whatever the
+// -m flags of the build, and the spaces pick the best one the CPU supports at run time.
+#define USE_AVX
+#define USE_AVX2
+#define USE_F16C
+#define USE_AVX512
+#if (defined(__clang__) && __clang_major__ >= 9) || (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 10)
+#define USE_AVX512BF16
+#endif
+#else
 #ifdef __AVX__
 #define USE_AVX
+#ifdef __AVX2__
+#define USE_AVX2
+#ifdef __F16C__
+#define USE_F16C
+#endif
+#endif
 #ifdef __AVX512F__
 #define USE_AVX512
+#ifdef __AVX512BF16__
+#define USE_AVX512BF16
+#endif
+#endif
 #endif
 #endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define USE_NEON
+// SVE kernels need the vector-length agnostic types of arm_sve.h, so they are only
+// built when the whole build targets SVE (e.g. -march=armv8.2-a+sve)
+#if defined(__ARM_FEATURE_SVE)
+#define USE_SVE
+#endif
 #endif
 #endif
 
@@ -48,6 +76,21 @@ static uint64_t xgetbv(unsigned int index) {
 #include <immintrin.h>
 #endif
 
+#if defined(__GNUC__)
+#define HNSWLIB_TARGET_AVX __attribute__((target("avx")))
+#define HNSWLIB_TARGET_AVX2 __attribute__((target("avx2")))
+#define HNSWLIB_TARGET_AVX2_F16C __attribute__((target("avx2,f16c")))
+#define HNSWLIB_TARGET_AVX512 __attribute__((target("avx512f")))
+#define HNSWLIB_TARGET_AVX512BF16 __attribute__((target("avx512f,avx512bf16")))
+#else
+// MSVC accepts the intrinsics of every instruction set without flags
+#define HNSWLIB_TARGET_AVX
+#define HNSWLIB_TARGET_AVX2
+#define HNSWLIB_TARGET_AVX2_F16C
+#define HNSWLIB_TARGET_AVX512
+#define HNSWLIB_TARGET_AVX512BF16
+#endif
+
 #if defined(__GNUC__)
 #define PORTABLE_ALIGN32 __attribute__((aligned(32)))
 #define PORTABLE_ALIGN64 __attribute__((aligned(64)))
@@ -114,6 +157,52 @@ static bool AVX512Capable() {
     }
     return HW_AVX512F && avx512Supported;
 }
+
+static bool AVX2Capable() {
+    if (!AVXCapable()) return false;
+
+    int cpuInfo[4];
+
+    cpuid(cpuInfo, 0, 0);
+    int nIds = cpuInfo[0];
+
+    bool HW_AVX2 = false;
+    if (nIds >= 0x00000007) {
+        cpuid(cpuInfo, 0x00000007, 0);
+        HW_AVX2 = (cpuInfo[1] & ((int)1 << 5)) != 0;
+    }
+    return HW_AVX2;
+}
+
+// Half to single precision conversions (vcvtph2ps)
+static bool F16CCapable() {
+    if (!AVXCapable()) return false;
+
+    int cpuInfo[4];
+    cpuid(cpuInfo, 0x00000001, 0);
+    return (cpuInfo[2] & ((int)1 << 29)) != 0;
+}
+
+// Dot products of bfloat16 pairs accumulated in single precision (vdpbf16ps)
+static bool AVX512BF16Capable() {
+    if (!AVX512Capable()) return false;
+
+    int cpuInfo[4];
+
+    cpuid(cpuInfo, 0x00000007, 0);
+    if (cpuInfo[0] < 1)  // no sub-leaf 1
+        return false;
+    cpuid(cpuInfo, 0x00000007, 1);
+    return (cpuInfo[0] & ((int)1 << 5)) != 0;
+}
+#endif
+
+#if defined(USE_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(USE_SVE)
+#include <arm_sve.h>
 #endif
 
 #include <queue>
@@ -123,6 +212,7 @@ static bool AVX512Capable() {
 
 namespace hnswlib {
 typedef size_t labeltype;
+typedef unsigned int tableint;
 
 // This can be extended to store state for filtering (e.g. from a std::set)
 class BaseFilterFunctor {
@@ -170,6 +260,10 @@ static void readBinaryPOD(std::istream &in, T &podRef) {
 template<typename MTYPE>
 using DISTFUNC = MTYPE(*)(const void *, const void *, const void *);
 
+// Distances from one query to n vectors: out[i] = dist(query, vectors[i])
+template<typename MTYPE>
+using DISTFUNC_BATCH = void(*)(const void *query, const void *const *vectors, size_t n, const void *param, MTYPE *out);
+
 template<typename MTYPE>
 class SpaceInterface {
  public:
@@ -180,6 +274,57 @@ class SpaceInterface {
 
     virtual void *get_dist_func_param() = 0;
 
+    // Optional; must match get_dist_func() up to rounding. nullptr if the space has no batch kernel.
+    virtual DISTFUNC_BATCH<MTYPE> get_dist_func_batch() {
+        return nullptr;
+    }
+
+    /*
+     * Spaces may store an encoding of the vectors instead of the vectors themselves (e.g. the
+     * quantized spaces). Their elements take get_data_size() bytes while the vectors passed to
+     * addPoint and the searches take get_vector_size(). get_dist_func() then compares such a
+     * vector (first argument) with a stored element, and get_stored_dist_func() compares two
+     * stored elements.
+     */
+    virtual size_t get_vector_size() {
+        return get_data_size();
+    }
+
+    virtual void encode(const void *vector, void *data) {
+        memcpy(data, vector, get_data_size());
+    }
+
+    // Inverse of encode, lossy for quantized spaces
+    virtual void decode(const void *data, void *vector) {
+        memcpy(vector, data, get_data_size());
+    }
+
+    virtual DISTFUNC<MTYPE> get_stored_dist_func() {
+        return get_dist_func();
+    }
+
+    /*
+     * Spaces may also prepare a query once per search when that makes its distances to the stored
+     * elements cheaper (e.g. the table of its distances to the centroids of ProductQuantizedSpace).
+     * The prepared query takes get_prepared_query_size() bytes, prepare_query writes it and may be
+     * called from several threads at once, and get_prepared_dist_func() (first argument) and the
+     * optional batch form compare it with a stored element. 0 means the searches use the vector
+     * and get_dist_func().
+     */
+    virtual size_t get_prepared_query_size() {
+        return 0;
+    }
+
+    virtual void prepare_query(const void *vector, void *prepared) {}
+
+    virtual DISTFUNC<MTYPE> get_prepared_dist_func() {
+        return get_dist_func();
+    }
+
+    virtual DISTFUNC_BATCH<MTYPE> get_prepared_dist_func_batch() {
+        return get_dist_func_batch();
+    }
+
     virtual ~SpaceInterface() {}
 };
 
@@ -223,6 +368,12 @@ AlgorithmInterface<dist_t>::searchKnnCloserFirst(const void* query_data, size_t
 
 #include "space_l2.h"
 #include "space_ip.h"
+#include "space_sq.h"
+#include "space_pq.h"
+#include "space_half.h"
 #include "stop_condition.h"
 #include "bruteforce.h"
 #include "hnswalg.h"
+#include "sharded_hnsw.h"
+#include "resumable_search.h"
+#include "disk_index.h"
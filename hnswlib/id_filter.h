@@ -0,0 +1,134 @@
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include "hnswlib.h"
+
+namespace hnswlib {
+
+/*
+ * A set of internal ids that a search may return, checked inline where a BaseFilterFunctor costs
+ * a label lookup and a virtual call per candidate.
+ *
+ * As in a roaring bitmap, the ids are split into blocks of 2^16: a block with up to MAX_ARRAY_SIZE
+ * ids keeps them as a sorted array, a denser block as a bitset (8 KB). A filter thus takes at most
+ * about 2 bytes per allowed id and stays a plain bitset when most ids are allowed.
+ *
+ * The ids belong to one index (see HierarchicalNSW::makeIdFilter). compact() and reorder() renumber
+ * the elements, filters built before have to be built again.
+ */
+class IdFilter {
+    static const int BLOCK_BITS = 16;
+    static const size_t BLOCK_WORDS = ((size_t) 1 << BLOCK_BITS) / 64;
+    static const size_t MAX_ARRAY_SIZE = 4096;
+
+    // bitset is empty while the block is an array
+    struct Block {
+        std::vector<uint16_t> array;
+        std::vector<uint64_t> bitset;
+    };
+
+    std::vector<Block> blocks_;  // block b holds the ids [b << BLOCK_BITS, (b + 1) << BLOCK_BITS)
+    size_t size_{0};
+
+    static size_t lowestBit(uint64_t word) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, word);
+        return index;
+#else
+        return __builtin_ctzll(word);
+#endif
+    }
+
+    static void toBitset(Block &block) {
+        block.bitset.assign(BLOCK_WORDS, 0);
+        for (uint16_t low : block.array)
+            block.bitset[low >> 6] |= (uint64_t) 1 << (low & 63);
+        std::vector<uint16_t>().swap(block.array);
+    }
+
+ public:
+    IdFilter() {}
+
+    // The ids may come in any order and repeat
+    IdFilter(const tableint *ids, size_t n) {
+        std::vector<tableint> sorted(ids, ids + n);
+        std::sort(sorted.begin(), sorted.end());
+        sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+        if (sorted.empty())
+            return;
+        blocks_.resize((sorted.back() >> BLOCK_BITS) + 1);
+        for (size_t begin = 0, end; begin < sorted.size(); begin = end) {
+            size_t b = sorted[begin] >> BLOCK_BITS;
+            for (end = begin; end < sorted.size() && (sorted[end] >> BLOCK_BITS) == b; end++) {}
+            Block &block = blocks_[b];
+            for (size_t i = begin; i < end; i++)
+                block.array.push_back((uint16_t) sorted[i]);
+            if (end - begin > MAX_ARRAY_SIZE)
+                toBitset(block);
+        }
+        size_ = sorted.size();
+    }
+
+    void add(tableint id) {
+        size_t b = id >> BLOCK_BITS;
+        uint16_t low = (uint16_t) id;
+        if (b >= blocks_.size())
+            blocks_.resize(b + 1);
+        Block &block = blocks_[b];
+        if (!block.bitset.empty()) {
+            uint64_t &word = block.bitset[low >> 6];
+            uint64_t bit = (uint64_t) 1 << (low & 63);
+            if ((word & bit) == 0) {
+                word |= bit;
+                size_++;
+            }
+            return;
+        }
+        auto it = std::lower_bound(block.array.begin(), block.array.end(), low);
+        if (it != block.array.end() && *it == low)
+            return;
+        block.array.insert(it, low);
+        size_++;
+        if (block.array.size() > MAX_ARRAY_SIZE)
+            toBitset(block);
+    }
+
+    bool contains(tableint id) const {
+        size_t b = id >> BLOCK_BITS;
+        if (b >= blocks_.size())
+            return false;
+        const Block &block = blocks_[b];
+        uint16_t low = (uint16_t) id;
+        if (!block.bitset.empty())
+            return (block.bitset[low >> 6] >> (low & 63)) & 1;
+        return std::binary_search(block.array.begin(), block.array.end(), low);
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    // Calls fn(id) for every id in increasing order
+    template<typename Function>
+    void forEach(Function fn) const {
+        for (size_t b = 0; b < blocks_.size(); b++) {
+            const Block &block = blocks_[b];
+            tableint base = (tableint) (b << BLOCK_BITS);
+            if (block.bitset.empty()) {
+                for (uint16_t low : block.array)
+                    fn(base + low);
+                continue;
+            }
+            for (size_t w = 0; w < BLOCK_WORDS; w++) {
+                for (uint64_t word = block.bitset[w]; word != 0; word &= word - 1)
+                    fn(base + (tableint) (w * 64 + lowestBit(word)));
+            }
+        }
+    }
+};
+}  // namespace hnswlib
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+
+namespace hnswlib {
+
+/*
+ * Storage for the upper-layer link lists of all elements.
+ *
+ * Memory is handed out in blocks of a fixed size (the size of the lists of one level) and
+ * addressed by a 32-bit block number, so an element only keeps the number of its first block.
+ * Blocks [0, base_blocks) may be a base segment set at load time, e.g. the upper-layer section
+ * of an index file read into one buffer or mapped. Later blocks are bump-allocated from chunks
+ * of 2^chunk_shift blocks.
+ *
+ * Resolving a block never takes a lock: the chunk table is replaced when it grows, never
+ * resized in place, and replaced tables are kept until the arena is cleared.
+ */
+class LinkListArena {
+    // allocations are groups of per-level lists, which are shorter than a chunk of this many blocks
+    static const uint32_t MIN_CHUNK_BLOCKS = 64;
+    // readers may look one list entry past the end of the last block (see the prefetches of searchBaseLayer)
+    static const size_t CHUNK_PADDING = 64;
+
+    size_t block_size_{0};
+    uint32_t chunk_shift_{0};
+    uint32_t chunk_mask_{0};
+
+    char *base_{nullptr};
+    uint32_t base_blocks_{0};
+    bool owns_base_{false};
+
+    std::atomic<char **> chunks_{nullptr};
+    size_t chunks_capacity_{0};
+    size_t num_chunks_{0};
+    uint32_t next_block_{0};  // first free block of the last chunk, relative to the first chunk
+    std::vector<char **> retired_tables_;
+    std::mutex alloc_lock_;
+
+ public:
+    enum : uint32_t { NO_BLOCK = 0xffffffff };  // offset of elements without upper layers
+
+    LinkListArena() {}
+
+    ~LinkListArena() {
+        clear();
+    }
+
+    LinkListArena(const LinkListArena &) = delete;
+    LinkListArena &operator=(const LinkListArena &) = delete;
+
+    // Frees all memory and sets the block size; chunks hold about 1MB of lists.
+    void init(size_t block_size) {
+        clear();
+        block_size_ = block_size;
+        chunk_shift_ = 0;
+        while (((size_t) 1 << chunk_shift_) < MIN_CHUNK_BLOCKS || ((size_t) block_size << chunk_shift_) < (1 << 20))
+            chunk_shift_++;
+        chunk_mask_ = (1u << chunk_shift_) - 1;
+    }
+
+    // Uses num_blocks blocks at base as blocks [0, num_blocks). Must be called before allocate.
+    // If owned, base must come from malloc and is freed by the arena.
+    void setBase(char *base, size_t num_blocks, bool owned) {
+        if (num_chunks_ != 0 || base_ != nullptr)
+            throw std::runtime_error("LinkListArena: base segment set twice");
+        if (num_blocks >= NO_BLOCK)
+            throw std::runtime_error("LinkListArena: too many link list blocks");
+        base_ = base;
+        base_blocks_ = (uint32_t) num_blocks;
+        owns_base_ = owned;
+    }
+
+    // Returns the first of num_blocks consecutive zeroed blocks. Thread-safe.
+    uint32_t allocate(size_t num_blocks) {
+        if (num_blocks > ((size_t) 1 << chunk_shift_))
+            throw std::runtime_error("LinkListArena: allocation exceeds the chunk size");
+
+        std::unique_lock <std::mutex> lock(alloc_lock_);
+        size_t chunk_blocks = (size_t) 1 << chunk_shift_;
+        size_t used = num_chunks_ == 0 ? chunk_blocks : next_block_ - ((num_chunks_ - 1) << chunk_shift_);
+        if (used + num_blocks > chunk_blocks) {
+            // the tail of the last chunk is left unused
+            if ((uint64_t) base_blocks_ + ((uint64_t) (num_chunks_ + 1) << chunk_shift_) >= NO_BLOCK)
+                throw std::runtime_error("LinkListArena: too many link list blocks");
+            addChunk();
+        }
+        uint32_t block = next_block_;
+        next_block_ += (uint32_t) num_blocks;
+        return base_blocks_ + block;
+    }
+
+    char *at(uint32_t block) const {
+        if (block < base_blocks_)
+            return base_ + (size_t) block * block_size_;
+        block -= base_blocks_;
+        return chunks_.load(std::memory_order_acquire)[block >> chunk_shift_] + (size_t) (block & chunk_mask_) * block_size_;
+    }
+
+    bool inBase(uint32_t block) const {
+        return block < base_blocks_;
+    }
+
+    // Bytes allocated by the arena, excluding a base segment it does not own
+    size_t memoryUsage() const {
+        size_t usage = num_chunks_ * (((size_t) block_size_ << chunk_shift_) + CHUNK_PADDING);
+        if (owns_base_)
+            usage += (size_t) base_blocks_ * block_size_;
+        return usage;
+    }
+
+    void clear() {
+        char **chunks = chunks_.load(std::memory_order_relaxed);
+        for (size_t c = 0; c < num_chunks_; c++)
+            free(chunks[c]);
+        delete[] chunks;
+        for (char **table : retired_tables_)
+            delete[] table;
+        retired_tables_.clear();
+        chunks_.store(nullptr, std::memory_order_relaxed);
+        chunks_capacity_ = 0;
+        num_chunks_ = 0;
+        next_block_ = 0;
+
+        if (owns_base_)
+            free(base_);
+        base_ = nullptr;
+        base_blocks_ = 0;
+        owns_base_ = false;
+    }
+
+    // Exchanges the contents of two arenas, which must not be used by other threads meanwhile
+    void swap(LinkListArena &other) {
+        std::swap(block_size_, other.block_size_);
+        std::swap(chunk_shift_, other.chunk_shift_);
+        std::swap(chunk_mask_, other.chunk_mask_);
+        std::swap(base_, other.base_);
+        std::swap(base_blocks_, other.base_blocks_);
+        std::swap(owns_base_, other.owns_base_);
+        char **chunks = chunks_.load(std::memory_order_relaxed);
+        chunks_.store(other.chunks_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        other.chunks_.store(chunks, std::memory_order_relaxed);
+        std::swap(chunks_capacity_, other.chunks_capacity_);
+        std::swap(num_chunks_, other.num_chunks_);
+        std::swap(next_block_, other.next_block_);
+        retired_tables_.swap(other.retired_tables_);
+    }
+
+ private:
+    void addChunk() {
+        size_t chunk_bytes = ((size_t) block_size_ << chunk_shift_) + CHUNK_PADDING;
+        char *chunk = (char *) calloc(1, chunk_bytes);
+        if (chunk == nullptr)
+            throw std::runtime_error("Not enough memory: LinkListArena failed to allocate a chunk");
+
+        char **chunks = chunks_.load(std::memory_order_relaxed);
+        if (num_chunks_ == chunks_capacity_) {
+            size_t new_capacity = chunks_capacity_ == 0 ? 16 : chunks_capacity_ * 2;
+            char **new_chunks = new char *[new_capacity];
+            if (num_chunks_ != 0)
+                memcpy(new_chunks, chunks, num_chunks_ * sizeof(char *));
+            if (chunks != nullptr)
+                retired_tables_.push_back(chunks);  // concurrent readers may still use it
+            chunks = new_chunks;
+            chunks_capacity_ = new_capacity;
+        }
+        chunks[num_chunks_] = chunk;
+        num_chunks_++;
+        next_block_ = (uint32_t) ((num_chunks_ - 1) << chunk_shift_);
+        chunks_.store(chunks, std::memory_order_release);
+    }
+};
+
+}  // namespace hnswlib
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+
+namespace hnswlib {
+
+/*
+ * The lock of the link lists of one element, four bytes instead of a std::mutex.
+ *
+ * Writers take it like a mutex (it is Lockable, for std::unique_lock) and wrap every change of a
+ * list in a WriteSection. The sections advance a version, so readers never take the lock: they
+ * read the version, copy the list and check that the version did not move (a seqlock). Holding
+ * the lock alone does not disturb readers, only the write sections make them retry.
+ *
+ * Bit 0 of the word is the lock, the bits above count the write sections; the count is odd while
+ * a section is open. Writers spin, yielding after a while, since their critical sections are a
+ * few hundred instructions.
+ */
+class LinkListLock {
+    static const uint32_t LOCKED = 1;
+    static const uint32_t VERSION_STEP = 2;
+
+    std::atomic<uint32_t> word_{0};
+
+    static uint32_t version(uint32_t word) {
+        return word & ~LOCKED;
+    }
+
+    static bool inWrite(uint32_t word) {
+        return (word & VERSION_STEP) != 0;
+    }
+
+    static void pause(int &spins) {
+        if (++spins > 64) {
+            std::this_thread::yield();
+            spins = 0;
+        }
+    }
+
+ public:
+    LinkListLock() {}
+
+    // for std::vector, locks are never moved while in use
+    LinkListLock(const LinkListLock &) : word_(0) {}
+
+    bool try_lock() {
+        uint32_t word = word_.load(std::memory_order_relaxed);
+        return !(word & LOCKED) &&
+            word_.compare_exchange_strong(word, word | LOCKED, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void lock() {
+        int spins = 0;
+        while (!try_lock())
+            pause(spins);
+    }
+
+    void unlock() {
+        word_.fetch_and(~LOCKED, std::memory_order_release);
+    }
+
+    // Version to pass to readValid, waits while a writer is changing the list
+    uint32_t readBegin() const {
+        int spins = 0;
+        while (true) {
+            uint32_t word = word_.load(std::memory_order_acquire);
+            if (!inWrite(word))
+                return version(word);
+            pause(spins);
+        }
+    }
+
+    // Whether the list read since readBegin is consistent
+    bool readValid(uint32_t begin_version) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return version(word_.load(std::memory_order_relaxed)) == begin_version;
+    }
+
+    // Marks a change of the lists of a locked element
+    class WriteSection {
+        LinkListLock &lock_;
+
+     public:
+        explicit WriteSection(LinkListLock &lock) : lock_(lock) {
+            lock_.word_.fetch_add(VERSION_STEP, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        ~WriteSection() {
+            lock_.word_.fetch_add(VERSION_STEP, std::memory_order_release);
+        }
+
+        WriteSection(const WriteSection &) = delete;
+        WriteSection &operator=(const WriteSection &) = delete;
+    };
+};
+
+}  // namespace hnswlib
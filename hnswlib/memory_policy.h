@@ -0,0 +1,165 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mmap_file.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+namespace hnswlib {
+
+/*
+ * Where the pages of the base layer come from.
+ *
+ * Default: malloc, 4 KB pages placed on the NUMA node of the thread that first touches them.
+ * HugePages: 2 MB pages reserved for huge pages (MAP_HUGETLB), or transparent huge pages
+ *     (madvise) if none are reserved.
+ * HugePages1GB: the same with 1 GB pages.
+ * Interleave: pages spread round-robin over the NUMA nodes the process may use, so that threads
+ *     on every node see the same average latency instead of a hot node.
+ *
+ * The policies other than Default map the memory directly, which also lets resizeIndex grow the
+ * base layer by remapping its pages instead of copying them. Where the platform lacks a
+ * feature the policy falls back to plain pages; it never changes the results.
+ */
+enum class MemoryPolicy {
+    Default,
+    HugePages,
+    HugePages1GB,
+    Interleave
+};
+
+
+namespace memory_policy_detail {
+
+#if defined(HNSWLIB_HAVE_MMAP)
+inline size_t pageSize(MemoryPolicy policy) {
+    switch (policy) {
+        case MemoryPolicy::HugePages:
+            return (size_t) 1 << 21;
+        case MemoryPolicy::HugePages1GB:
+            return (size_t) 1 << 30;
+        default:
+            return (size_t) sysconf(_SC_PAGESIZE);
+    }
+}
+
+inline size_t roundToPages(size_t bytes, MemoryPolicy policy) {
+    size_t page = pageSize(policy);
+    return (bytes + page - 1) / page * page;
+}
+
+// Sets the policy of pages not yet touched, a no-op where NUMA policies are not available
+inline void interleave(char *p, size_t bytes) {
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_get_mempolicy)
+    const int MPOL_INTERLEAVE_MODE = 3;
+    const unsigned long MPOL_F_MEMS_ALLOWED_FLAG = 1 << 2;
+    const unsigned long MAX_NODES = 1024;
+    unsigned long nodes[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+    if (syscall(SYS_get_mempolicy, nullptr, nodes, MAX_NODES, nullptr, MPOL_F_MEMS_ALLOWED_FLAG) == 0)
+        syscall(SYS_mbind, p, bytes, MPOL_INTERLEAVE_MODE, nodes, MAX_NODES, 0);
+#else
+    (void) p;
+    (void) bytes;
+#endif
+}
+
+// Applies the policy to pages of a mapping that have not been touched yet
+inline void advise(char *p, size_t bytes, MemoryPolicy policy) {
+#if defined(MADV_HUGEPAGE)
+    if (policy == MemoryPolicy::HugePages || policy == MemoryPolicy::HugePages1GB)
+        madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    if (policy == MemoryPolicy::Interleave)
+        interleave(p, bytes);
+}
+
+inline char *mapPages(size_t bytes, MemoryPolicy policy) {
+    void *p = MAP_FAILED;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    if (policy == MemoryPolicy::HugePages || policy == MemoryPolicy::HugePages1GB) {
+        int size_flag = (policy == MemoryPolicy::HugePages ? 21 : 30) << MAP_HUGE_SHIFT;
+        p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | size_flag, -1, 0);
+    }
+#endif
+    if (p == MAP_FAILED) {
+        p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return nullptr;
+        advise((char *) p, bytes, policy);
+    }
+    return (char *) p;
+}
+#endif
+
+}  // namespace memory_policy_detail
+
+
+// Returns nullptr if the memory cannot be allocated
+inline char *allocateMemory(size_t bytes, MemoryPolicy policy) {
+#if defined(HNSWLIB_HAVE_MMAP)
+    if (policy != MemoryPolicy::Default) {
+        if (bytes == 0)
+            bytes = 1;
+        return memory_policy_detail::mapPages(memory_policy_detail::roundToPages(bytes, policy), policy);
+    }
+#endif
+    return (char *) malloc(bytes);
+}
+
+
+// bytes is the size passed to allocateMemory
+inline void freeMemory(char *p, size_t bytes, MemoryPolicy policy) {
+    if (p == nullptr)
+        return;
+#if defined(HNSWLIB_HAVE_MMAP)
+    if (policy != MemoryPolicy::Default) {
+        if (bytes == 0)
+            bytes = 1;
+        munmap(p, memory_policy_detail::roundToPages(bytes, policy));
+        return;
+    }
+#endif
+    free(p);
+}
+
+
+/*
+ * Resizes memory from allocateMemory, keeping its first used_bytes. Returns nullptr, and leaves
+ * the memory as it was, if the new size cannot be allocated. The pages are moved, not copied,
+ * where the platform can remap them.
+ */
+inline char *reallocateMemory(char *p, size_t old_bytes, size_t new_bytes, size_t used_bytes, MemoryPolicy policy) {
+#if defined(HNSWLIB_HAVE_MMAP)
+    if (policy != MemoryPolicy::Default) {
+        using namespace memory_policy_detail;
+        size_t old_size = roundToPages(old_bytes == 0 ? 1 : old_bytes, policy);
+        size_t new_size = roundToPages(new_bytes == 0 ? 1 : new_bytes, policy);
+        if (old_size == new_size)
+            return p;
+#if defined(MREMAP_MAYMOVE)
+        void *moved = mremap(p, old_size, new_size, MREMAP_MAYMOVE);
+        if (moved != MAP_FAILED) {
+            // the added pages are not touched yet and take the policy
+            if (new_size > old_size)
+                advise((char *) moved + old_size, new_size - old_size, policy);
+            return (char *) moved;
+        }
+#endif
+        char *copy = mapPages(new_size, policy);
+        if (copy == nullptr)
+            return nullptr;
+        memcpy(copy, p, used_bytes);
+        munmap(p, old_size);
+        return copy;
+    }
+#endif
+    (void) old_bytes;
+    (void) used_bytes;
+    return (char *) realloc(p, new_bytes);
+}
+
+}  // namespace hnswlib
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define HNSWLIB_HAVE_MMAP
+#endif
+
+namespace hnswlib {
+
+/*
+ * How loadIndex brings the index file into memory.
+ *
+ * Copy: the graph is read into heap memory (works with every file format version).
+ * MmapReadOnly: the base layer and the upper layers point straight into a read-only shared mapping
+ *     of the file; the index can only be searched. Processes mapping the same file share its page cache.
+ * MmapCopyOnWrite: like MmapReadOnly, but the mapping is private and writable, so the index can be
+ *     updated; modified pages are copied on first write and never written back to the file.
+ *
+ * The mmap modes need an index saved in the v2 format and are not available on every platform.
+ */
+enum class IndexLoadMode {
+    Copy,
+    MmapReadOnly,
+    MmapCopyOnWrite
+};
+
+
+/*
+ * The file format saveIndex writes. V1 is the format of the releases before v2, which cannot
+ * read V2 files; a V1 file loads only with IndexLoadMode::Copy and names no snapshot for the
+ * deltas of saveIndexDelta.
+ */
+enum class IndexFormat {
+    V1,
+    V2
+};
+
+
+// A whole file mapped into memory
+class MappedFile {
+    char *data_{nullptr};
+    size_t size_{0};
+
+ public:
+    MappedFile(const std::string &location, bool copy_on_write) {
+#if defined(HNSWLIB_HAVE_MMAP)
+        int fd = open(location.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open file");
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot stat file");
+        }
+        size_ = (size_t) st.st_size;
+        if (size_ > 0) {
+            int prot = copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ;
+            int flags = copy_on_write ? MAP_PRIVATE : MAP_SHARED;
+            void *p = mmap(nullptr, size_, prot, flags, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Cannot map file");
+            }
+            data_ = (char *) p;
+        }
+        // the mapping keeps its own reference to the file
+        close(fd);
+#else
+        throw std::runtime_error("Memory-mapped loading is not supported on this platform");
+#endif
+    }
+
+    ~MappedFile() {
+#if defined(HNSWLIB_HAVE_MMAP)
+        if (data_ != nullptr)
+            munmap(data_, size_);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    char *data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool contains(const void *p) const {
+        return (const char *) p >= data_ && (const char *) p < data_ + size_;
+    }
+};
+
+}  // namespace hnswlib
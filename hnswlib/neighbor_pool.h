@@ -0,0 +1,188 @@
+#pragma once
+
+#include <stddef.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace hnswlib {
+
+/*
+ * A binary heap over storage that outlives it, with the interface of std::priority_queue.
+ * The storage keeps its capacity from one search to the next, so a search allocates only
+ * when it holds more elements than any earlier search with the same storage.
+ */
+template<typename T, typename Compare>
+class ReusableHeap {
+    std::vector<T> &c_;
+    Compare comp_;
+
+ public:
+    explicit ReusableHeap(std::vector<T> &storage) : c_(storage) {
+        c_.clear();
+    }
+
+    bool empty() const {
+        return c_.empty();
+    }
+
+    size_t size() const {
+        return c_.size();
+    }
+
+    const T &top() const {
+        return c_.front();
+    }
+
+    template<typename... Args>
+    void emplace(Args &&... args) {
+        c_.emplace_back(std::forward<Args>(args)...);
+        std::push_heap(c_.begin(), c_.end(), comp_);
+    }
+
+    void pop() {
+        std::pop_heap(c_.begin(), c_.end(), comp_);
+        c_.pop_back();
+    }
+
+    // Sorts the storage by increasing priority, which leaves the heap empty
+    std::vector<T> &sorted() {
+        std::sort_heap(c_.begin(), c_.end(), comp_);
+        return c_;
+    }
+};
+
+
+class NeighborPoolBase {
+ public:
+    virtual ~NeighborPoolBase() {}
+};
+
+/*
+ * Candidate buffers of a best-first search, kept with a VisitedList and reused by every search
+ * that gets the list.
+ *
+ * The pool holds the (at most capacity) closest elements seen so far, sorted by distance, each
+ * flagged once its links were expanded. Without filter, deletions or stop condition it is both the
+ * result set and the candidate set of the search: an insertion is a binary search and a shift of
+ * the farther entries, the next element to expand is the closest unexpanded one, and the search is
+ * over when every entry has been expanded.
+ *
+ * Searches that must expand elements which are not results (deleted or filtered out) use heaps over
+ * the candidate and result storage instead. Either way the results end up in results(), closer first.
+ */
+template<typename dist_t, typename id_t>
+class NeighborPool : public NeighborPoolBase {
+ public:
+    struct Neighbor {
+        dist_t distance;
+        id_t id;
+        bool expanded;
+    };
+
+ private:
+    std::vector<Neighbor> pool_;  // one spare entry for the insertion shift
+    size_t capacity_{0};
+    size_t size_{0};
+    size_t cursor_{0};  // first unexpanded entry
+    std::vector<std::pair<dist_t, id_t>> candidates_;
+    std::vector<std::pair<dist_t, id_t>> results_;
+    std::vector<id_t> links_;
+
+ public:
+    void reset(size_t capacity) {
+        capacity_ = std::max(capacity, (size_t) 1);
+        if (pool_.size() < capacity_ + 1)
+            pool_.resize(capacity_ + 1);
+        size_ = 0;
+        cursor_ = 0;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool full() const {
+        return size_ == capacity_;
+    }
+
+    dist_t farthestDistance() const {
+        return pool_[size_ - 1].distance;
+    }
+
+    // Adds an element unless the pool is full and the element is not closer than all of it
+    bool insert(id_t id, dist_t distance) {
+        if (size_ == capacity_ && !(distance < pool_[size_ - 1].distance))
+            return false;
+        size_t lo = 0, hi = size_;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (distance < pool_[mid].distance)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        std::copy_backward(pool_.begin() + lo, pool_.begin() + size_, pool_.begin() + size_ + 1);
+        pool_[lo].distance = distance;
+        pool_[lo].id = id;
+        pool_[lo].expanded = false;
+        if (size_ < capacity_)
+            size_++;
+        if (lo < cursor_)
+            cursor_ = lo;
+        return true;
+    }
+
+    bool hasNext() const {
+        return cursor_ < size_;
+    }
+
+    // Returns the closest unexpanded element and flags it as expanded
+    id_t next() {
+        pool_[cursor_].expanded = true;
+        id_t id = pool_[cursor_].id;
+        while (cursor_ < size_ && pool_[cursor_].expanded)
+            cursor_++;
+        return id;
+    }
+
+    // Copies the pool to results()
+    void exportResults() {
+        results_.resize(size_);
+        for (size_t i = 0; i < size_; i++)
+            results_[i] = std::make_pair(pool_[i].distance, pool_[i].id);
+    }
+
+    std::vector<std::pair<dist_t, id_t>> &candidateStorage() {
+        return candidates_;
+    }
+
+    std::vector<std::pair<dist_t, id_t>> &results() {
+        return results_;
+    }
+
+    // Room for a link list of up to n ids, read by the search before it expands an element
+    id_t *links(size_t n) {
+        if (links_.size() < n)
+            links_.resize(n);
+        return links_.data();
+    }
+};
+
+
+/*
+ * Buffers of the neighbor repair of HierarchicalNSW::updatePoint and updatePoints, kept with a
+ * VisitedList like the NeighborPool, whose marks deduplicate the candidates.
+ */
+template<typename dist_t, typename id_t>
+class RepairBuffers : public NeighborPoolBase {
+ public:
+    std::vector<id_t> links;       // a list being read, room for maxM0_ + 1 ids
+    std::vector<id_t> one_hop;     // the list of the updated element
+    std::vector<id_t> candidates;  // the distinct elements of the neighborhood
+    std::vector<id_t> neighbors;   // the elements whose lists are reselected
+    std::vector<std::pair<dist_t, id_t>> scored;    // candidates with their distance, closer first
+    std::vector<std::pair<dist_t, id_t>> selected;  // picked by the heuristic
+};
+
+}  // namespace hnswlib
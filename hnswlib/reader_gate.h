@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace hnswlib {
+
+/*
+ * Lets searches run while another thread prepares a replacement of the index storage, and keeps
+ * them out only for the moment the storage is swapped.
+ *
+ * Readers count themselves in one of several stripes picked per thread, so concurrent searches do
+ * not contend on one cache line. A writer closes the gate and waits until every stripe is empty;
+ * readers arriving while it is closed wait until it reopens. Readers must not nest.
+ */
+class ReaderGate {
+    static const size_t NUM_STRIPES = 64;
+
+    // Padded rather than alignas(64): an over-aligned member would make the index over-aligned,
+    // which operator new does not honor before C++17
+    struct Stripe {
+        std::atomic<uint32_t> readers{0};
+        char padding[64 - sizeof(std::atomic<uint32_t>)];
+    };
+
+    mutable Stripe stripes_[NUM_STRIPES];
+    mutable std::atomic<bool> closed_{false};
+    std::mutex writer_lock_;
+
+    static size_t threadStripe() {
+        static std::atomic<size_t> next_stripe{0};
+        static thread_local size_t stripe = next_stripe++ % NUM_STRIPES;
+        return stripe;
+    }
+
+ public:
+    size_t enterRead() const {
+        size_t stripe = threadStripe();
+        while (true) {
+            stripes_[stripe].readers.fetch_add(1);
+            if (!closed_.load())
+                return stripe;
+            stripes_[stripe].readers.fetch_sub(1);
+            while (closed_.load())
+                std::this_thread::yield();
+        }
+    }
+
+    void leaveRead(size_t stripe) const {
+        stripes_[stripe].readers.fetch_sub(1);
+    }
+
+    // Returns once no reader is inside; other writers wait until open()
+    void close() {
+        writer_lock_.lock();
+        closed_.store(true);
+        for (size_t i = 0; i < NUM_STRIPES; i++) {
+            while (stripes_[i].readers.load() != 0)
+                std::this_thread::yield();
+        }
+    }
+
+    void open() {
+        closed_.store(false);
+        writer_lock_.unlock();
+    }
+
+    class ReadGuard {
+        const ReaderGate &gate_;
+        size_t stripe_;
+
+     public:
+        explicit ReadGuard(const ReaderGate &gate) : gate_(gate), stripe_(gate.enterRead()) {}
+
+        ~ReadGuard() {
+            gate_.leaveRead(stripe_);
+        }
+
+        ReadGuard(const ReadGuard &) = delete;
+        ReadGuard &operator=(const ReadGuard &) = delete;
+    };
+};
+
+}  // namespace hnswlib
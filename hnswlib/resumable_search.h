@@ -0,0 +1,412 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "hnswalg.h"
+
+namespace hnswlib {
+
+/*
+ * The elements a ResumableSearch visited: an open addressing set of ids sized to the work of the
+ * search rather than to the index, so that many searches in flight keep their marks in cache.
+ */
+class SearchVisitedSet {
+    static const size_t MIN_CAPACITY = 1024;
+
+    std::vector<tableint> slots_;  // id + 1, 0 marks an empty slot
+    size_t size_{0};
+    size_t mask_{0};
+
+    size_t slotOf(tableint id) const {
+        return (size_t) (((uint64_t) id * 0x9E3779B97F4A7C15ULL) >> 32) & mask_;
+    }
+
+    void grow() {
+        std::vector<tableint> old;
+        old.swap(slots_);
+        slots_.assign(old.size() * 2, 0);
+        mask_ = slots_.size() - 1;
+        for (tableint entry : old) {
+            if (entry == 0)
+                continue;
+            size_t slot = slotOf(entry - 1);
+            while (slots_[slot] != 0)
+                slot = (slot + 1) & mask_;
+            slots_[slot] = entry;
+        }
+    }
+
+ public:
+    void clear() {
+        if (slots_.empty())
+            slots_.resize(MIN_CAPACITY);
+        else
+            std::fill(slots_.begin(), slots_.end(), 0);
+        mask_ = slots_.size() - 1;
+        size_ = 0;
+    }
+
+    // Adds id, returns false if it was in the set already
+    bool insert(tableint id) {
+        size_t slot = slotOf(id);
+        while (slots_[slot] != 0) {
+            if (slots_[slot] == id + 1)
+                return false;
+            slot = (slot + 1) & mask_;
+        }
+        slots_[slot] = id + 1;
+        if (++size_ * 2 > slots_.size())
+            grow();
+        return true;
+    }
+};
+
+
+/*
+ * A k nearest neighbor search of a HierarchicalNSW that runs one step at a time, for servers that
+ * keep many queries in flight on one thread, such as an event loop, and for interleaving queries
+ * to hide the latency of memory reads (see searchKnnInterleaved).
+ *
+ * A step either reads the link list of the element the search expands next, or scores the unvisited
+ * neighbors found in it. Each step ends with prefetches of what the next step of the same search
+ * reads, the vectors of those neighbors or the next link list. While other searches take their
+ * steps, the prefetched lines arrive. Prefetches do not fault in pages, so a step that reads a page
+ * of a mapped index that is not resident still waits for it. The marks of the visited elements are
+ * kept in a SearchVisitedSet, and a search alone is about as fast as searchKnn with a filter.
+ *
+ * The search is the one of searchKnn with a filter: deleted elements and elements that isIdAllowed
+ * rejects are expanded but not returned, and the results equal those of searchKnnCloserFirst with
+ * a filter. The results are reranked as by searchKnn if the index has rerank data.
+ *
+ * A step holds the search gate of the index only while it runs. Between the steps the index may
+ * change as it may during a searchKnn, and resizeIndex() may run if the caller keeps it apart from
+ * the steps; after compact() or reorder() renumbered the elements, the next step throws.
+ * The index and the query must outlive the search, restart() reuses its buffers for another query.
+ */
+template<typename dist_t>
+class ResumableSearch {
+    typedef HierarchicalNSW<dist_t> Index;
+
+    enum Stage {
+        UPPER_LINKS,  // read the list of cur_obj_ on level_
+        UPPER_SCORE,  // score the neighbors in pending_, move to the closest
+        BASE_LINKS,   // expand the closest candidate, collect its unvisited neighbors
+        BASE_SCORE,   // score the neighbors in pending_
+        DONE
+    };
+
+    const Index &index_;
+    const void *query_data_{nullptr};
+    const void *query_{nullptr};  // query_data_ as the index compares it with its elements
+    std::vector<char> prepared_query_;
+    size_t k_;
+    size_t ef_{0};
+    BaseFilterFunctor *isIdAllowed_;
+    uint64_t renumber_count_{0};
+    Stage stage_{DONE};
+
+    int level_{0};
+    tableint cur_obj_{0};
+    dist_t cur_dist_{0};
+
+    SearchVisitedSet visited_;
+    std::vector<std::pair<dist_t, tableint>> top_storage_;
+    std::vector<std::pair<dist_t, tableint>> candidate_storage_;
+    ReusableHeap<std::pair<dist_t, tableint>, typename Index::CompareByFirst> top_candidates_;
+    ReusableHeap<std::pair<dist_t, tableint>, typename Index::CompareByFirst> candidate_set_;  // distances negated
+    dist_t lower_bound_{0};
+    std::vector<tableint> pending_;
+    std::vector<dist_t> pending_dists_;
+
+    std::vector<std::pair<dist_t, labeltype>> result_;
+    SearchStats stats_;
+    std::chrono::steady_clock::time_point start_;
+
+    // Only the first line: prefetching whole vectors of every neighbor evicts more than it brings
+    static void prefetch(const void *p) {
+#ifdef USE_SSE
+        _mm_prefetch((const char *) p, _MM_HINT_T0);
+#endif
+    }
+
+    void prefetchLinks(tableint id, int level) const {
+        prefetch(level == 0 ? index_.get_linklist0(id) : index_.get_linklist(id, level));
+    }
+
+    void prefetchPending() const {
+        for (tableint id : pending_)
+            prefetch(index_.getDataByInternalId(id));
+    }
+
+    // scores pending_ into pending_dists_ in batches, as searchBaseLayerST does
+    void scorePending() {
+        const size_t batch_limit = Index::DISTANCE_BATCH_SIZE;
+        const void *batch_data[batch_limit];
+        pending_dists_.resize(pending_.size());
+        for (size_t i = 0; i < pending_.size(); i += batch_limit) {
+            size_t batch_size = std::min(pending_.size() - i, batch_limit);
+            for (size_t b = 0; b < batch_size; b++)
+                batch_data[b] = index_.getDataByInternalId(pending_[i + b]);
+            index_.scoreBatch(query_, batch_data, batch_size, pending_dists_.data() + i);
+        }
+        stats_.distance_computations += pending_.size();
+    }
+
+    bool allowed(tableint id) const {
+        return !index_.isMarkedDeleted(id) && (!isIdAllowed_ || (*isIdAllowed_)(index_.getExternalLabel(id)));
+    }
+
+    void readUpperLinks() {
+        linklistsizeint *ll = index_.get_linklist(cur_obj_, level_);
+        int size = index_.getListCount(ll);
+        tableint *links = (tableint *) (ll + 1);
+        stats_.hops[level_]++;
+        pending_.clear();
+        for (int i = 0; i < size; i++) {
+            if (links[i] > index_.max_elements_)
+                throw std::runtime_error("cand error");
+            pending_.push_back(links[i]);
+        }
+        prefetchPending();
+        stage_ = UPPER_SCORE;
+    }
+
+    void scoreUpperNeighbors() {
+        scorePending();
+        bool changed = false;
+        for (size_t i = 0; i < pending_.size(); i++) {
+            if (pending_dists_[i] < cur_dist_) {
+                cur_dist_ = pending_dists_[i];
+                cur_obj_ = pending_[i];
+                changed = true;
+            }
+        }
+        if (!changed)
+            level_--;
+        if (level_ > 0) {
+            prefetchLinks(cur_obj_, level_);
+            stage_ = UPPER_LINKS;
+        } else {
+            startBaseLayer();
+        }
+    }
+
+    void startBaseLayer() {
+        if (allowed(cur_obj_)) {
+            top_candidates_.emplace(cur_dist_, cur_obj_);
+            lower_bound_ = cur_dist_;
+            candidate_set_.emplace(-cur_dist_, cur_obj_);
+        } else {
+            candidate_set_.emplace(-std::numeric_limits<dist_t>::max(), cur_obj_);
+            stats_.filtered_out++;
+        }
+        visited_.insert(cur_obj_);
+        stats_.visited++;
+        prefetchLinks(cur_obj_, 0);
+        stage_ = BASE_LINKS;
+    }
+
+    void expandCandidate() {
+        if (candidate_set_.empty() ||
+            (-candidate_set_.top().first > lower_bound_ && top_candidates_.size() == ef_)) {
+            finish();
+            return;
+        }
+        tableint current = candidate_set_.top().second;
+        candidate_set_.pop();
+        stats_.hops[0]++;
+
+        linklistsizeint *ll = index_.get_linklist0(current);
+        size_t size = index_.getListCount(ll);
+        tableint *links = (tableint *) (ll + 1);
+        pending_.clear();
+        for (size_t j = 0; j < size; j++) {
+            if (visited_.insert(links[j]))
+                pending_.push_back(links[j]);
+        }
+        stats_.visited += pending_.size();
+        if (pending_.empty()) {
+            if (!candidate_set_.empty())
+                prefetchLinks(candidate_set_.top().second, 0);
+            return;
+        }
+        prefetchPending();
+        stage_ = BASE_SCORE;
+    }
+
+    void scoreBaseNeighbors() {
+        scorePending();
+        for (size_t i = 0; i < pending_.size(); i++) {
+            dist_t dist = pending_dists_[i];
+            if (top_candidates_.size() >= ef_ && !(lower_bound_ > dist))
+                continue;
+            candidate_set_.emplace(-dist, pending_[i]);
+            if (allowed(pending_[i]))
+                top_candidates_.emplace(dist, pending_[i]);
+            else
+                stats_.filtered_out++;
+            while (top_candidates_.size() > ef_)
+                top_candidates_.pop();
+            if (!top_candidates_.empty())
+                lower_bound_ = top_candidates_.top().first;
+        }
+        if (!candidate_set_.empty())
+            prefetchLinks(candidate_set_.top().second, 0);
+        stage_ = BASE_LINKS;
+    }
+
+    void finish() {
+        std::vector<std::pair<dist_t, tableint>> &found = top_candidates_.sorted();
+        if (index_.rerank_data_ != nullptr) {
+            stats_.distance_computations += found.size();
+            for (size_t i = 0; i < found.size(); i++) {
+                found[i].first = index_.rerank_distfunc_(
+                    query_data_, index_.rerank_data_ + found[i].second * index_.rerank_data_size_,
+                    index_.rerank_dist_func_param_);
+            }
+            std::sort(found.begin(), found.end(), typename Index::CompareByFirst());
+        }
+        for (size_t i = 0; i < found.size() && i < k_; i++)
+            result_.emplace_back(found[i].first, index_.getExternalLabel(found[i].second));
+
+        stats_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+        SearchCounters::add(stats_);
+        index_.addMetrics(stats_);
+        stage_ = DONE;
+    }
+
+ public:
+    ResumableSearch(const Index &index, const void *query_data, size_t k, BaseFilterFunctor *isIdAllowed = nullptr)
+        : index_(index), k_(k), isIdAllowed_(isIdAllowed),
+          top_candidates_(top_storage_), candidate_set_(candidate_storage_) {
+        restart(query_data);
+    }
+
+    // Starts the search for another query, with the ef of the index at this time
+    void restart(const void *query_data) {
+        query_data_ = query_data;
+        start_ = std::chrono::steady_clock::now();
+        stage_ = DONE;
+        result_.clear();
+        stats_.clear();
+        top_storage_.clear();
+        candidate_storage_.clear();
+        lower_bound_ = std::numeric_limits<dist_t>::max();
+
+        ReaderGate::ReadGuard read_guard(index_.search_gate_);
+        renumber_count_ = index_.renumber_count_;
+        ef_ = std::max(index_.ef_, k_);
+        if (index_.cur_element_count == 0 || k_ == 0)
+            return;
+
+        visited_.clear();
+        cur_obj_ = index_.enterpoint_node_;
+        level_ = index_.maxlevel_;
+        stats_.hops.assign(level_ + 1, 0);
+        query_ = index_.prepareQuery(query_data_, prepared_query_);
+        cur_dist_ = index_.fstdistfunc_query_(query_, index_.getDataByInternalId(cur_obj_), index_.dist_func_param_);
+        stats_.distance_computations++;
+        if (level_ > 0) {
+            prefetchLinks(cur_obj_, level_);
+            stage_ = UPPER_LINKS;
+        } else {
+            startBaseLayer();
+        }
+    }
+
+    ResumableSearch(const ResumableSearch &) = delete;
+    ResumableSearch &operator=(const ResumableSearch &) = delete;
+
+    bool done() const {
+        return stage_ == DONE;
+    }
+
+    // Runs the next step; returns true once the search is done
+    bool step() {
+        if (stage_ == DONE)
+            return true;
+        ReaderGate::ReadGuard read_guard(index_.search_gate_);
+        if (index_.renumber_count_ != renumber_count_)
+            throw std::runtime_error("The index was renumbered by compact() or reorder() during the search");
+        switch (stage_) {
+            case UPPER_LINKS: readUpperLinks(); break;
+            case UPPER_SCORE: scoreUpperNeighbors(); break;
+            case BASE_LINKS: expandCandidate(); break;
+            case BASE_SCORE: scoreBaseNeighbors(); break;
+            case DONE: break;
+        }
+        return stage_ == DONE;
+    }
+
+    // The (at most) k nearest neighbors, closer first, once done()
+    const std::vector<std::pair<dist_t, labeltype>> &result() const {
+        return result_;
+    }
+
+    // The work of the search, complete once done()
+    const SearchStats &stats() const {
+        return stats_;
+    }
+};
+
+
+/*
+ * searchKnnBatch on the calling thread with up to in_flight queries interleaved: their
+ * ResumableSearches take steps in turn, so the prefetches of each search overlap with the work
+ * of the others. Same output as searchKnnBatch with isIdAllowed; returns the smallest number of
+ * results found for a query.
+ */
+template<typename dist_t>
+size_t searchKnnInterleaved(
+    const HierarchicalNSW<dist_t> &index,
+    const void *queries,
+    size_t nq,
+    size_t k,
+    labeltype *labels,
+    dist_t *distances,
+    size_t in_flight = 8,
+    BaseFilterFunctor *isIdAllowed = nullptr) {
+    if (nq == 0)
+        return k;
+    in_flight = std::max<size_t>(1, std::min(in_flight, nq));
+    std::vector<std::unique_ptr<ResumableSearch<dist_t>>> searches(in_flight);
+    std::vector<size_t> query_of(in_flight);
+    size_t next_query = 0;
+    for (size_t s = 0; s < in_flight; s++, next_query++) {
+        searches[s].reset(new ResumableSearch<dist_t>(
+            index, (const char *) queries + next_query * index.vector_size_, k, isIdAllowed));
+        query_of[s] = next_query;
+    }
+
+    size_t min_found = k;
+    size_t active = in_flight;
+    while (active > 0) {
+        for (size_t s = 0; s < in_flight; s++) {
+            if (query_of[s] == nq || !searches[s]->step())
+                continue;
+            const std::vector<std::pair<dist_t, labeltype>> &result = searches[s]->result();
+            size_t q = query_of[s];
+            for (size_t i = 0; i < k; i++) {
+                labels[q * k + i] = i < result.size() ? result[i].second : (labeltype) -1;
+                distances[q * k + i] = i < result.size() ? result[i].first : std::numeric_limits<dist_t>::max();
+            }
+            min_found = std::min(min_found, result.size());
+            if (next_query < nq) {
+                searches[s]->restart((const char *) queries + next_query * index.vector_size_);
+                query_of[s] = next_query++;
+            } else {
+                query_of[s] = nq;
+                active--;
+            }
+        }
+    }
+    return min_found;
+}
+
+}  // namespace hnswlib
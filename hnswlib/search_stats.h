@@ -0,0 +1,163 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace hnswlib {
+
+// The work of one search (see HierarchicalNSW::searchKnn)
+struct SearchStats {
+    std::vector<size_t> hops;         // elements expanded on each layer, hops[0] on the base layer
+    size_t distance_computations{0};  // on all layers
+    size_t visited{0};                // elements marked visited on the base layer
+    size_t filtered_out{0};           // elements close enough to be results but deleted or not allowed
+    double seconds{0};                // wall time of the search
+
+    void clear() {
+        hops.clear();
+        distance_computations = 0;
+        visited = 0;
+        filtered_out = 0;
+        seconds = 0;
+    }
+
+    size_t totalHops() const {
+        size_t total = 0;
+        for (size_t h : hops)
+            total += h;
+        return total;
+    }
+};
+
+
+/*
+ * Totals of the searches of all indexes in the process.
+ *
+ * Every thread adds to its own slot with plain loads and stores, as the profiler records its samples,
+ * so counting takes no locked instruction and the threads share no cache line. totals() sums the
+ * slots; a reset() while searches run may miss the searches that end meanwhile.
+ */
+class SearchCounters {
+ public:
+    struct Totals {
+        uint64_t searches{0};
+        uint64_t hops{0};
+        uint64_t distance_computations{0};
+        uint64_t visited{0};
+        uint64_t filtered_out{0};
+    };
+
+    static void add(const SearchStats &stats) {
+        Slot &slot = localSlot();
+        Slot::add(slot.searches, 1);
+        Slot::add(slot.hops, stats.totalHops());
+        Slot::add(slot.distance_computations, stats.distance_computations);
+        Slot::add(slot.visited, stats.visited);
+        Slot::add(slot.filtered_out, stats.filtered_out);
+    }
+
+    static Totals totals() {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        Totals totals;
+        for (Slot *slot : r.slots) {
+            totals.searches += slot->searches.load(std::memory_order_relaxed);
+            totals.hops += slot->hops.load(std::memory_order_relaxed);
+            totals.distance_computations += slot->distance_computations.load(std::memory_order_relaxed);
+            totals.visited += slot->visited.load(std::memory_order_relaxed);
+            totals.filtered_out += slot->filtered_out.load(std::memory_order_relaxed);
+        }
+        return totals;
+    }
+
+    static void reset() {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (Slot *slot : r.slots) {
+            slot->searches.store(0, std::memory_order_relaxed);
+            slot->hops.store(0, std::memory_order_relaxed);
+            slot->distance_computations.store(0, std::memory_order_relaxed);
+            slot->visited.store(0, std::memory_order_relaxed);
+            slot->filtered_out.store(0, std::memory_order_relaxed);
+        }
+    }
+
+ private:
+    // Written only by its owning thread, padded to a cache line
+    struct Slot {
+        std::atomic<uint64_t> searches{0};
+        std::atomic<uint64_t> hops{0};
+        std::atomic<uint64_t> distance_computations{0};
+        std::atomic<uint64_t> visited{0};
+        std::atomic<uint64_t> filtered_out{0};
+        char padding[64 - 5 * sizeof(uint64_t)];
+
+        static void add(std::atomic<uint64_t> &counter, uint64_t value) {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<Slot *> slots;  // slots outlive their threads, so the counts are kept after join()
+    };
+
+    // Intentionally leaked: threads may search during static destruction
+    static Registry &registry() {
+        static Registry *r = new Registry();
+        return *r;
+    }
+
+    static Slot &localSlot() {
+        static thread_local Slot *slot = nullptr;
+        if (slot == nullptr) {
+            slot = new Slot();
+            Registry &r = registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.slots.push_back(slot);
+        }
+        return *slot;
+    }
+};
+
+
+/*
+ * Collects the work of one search into stats, or into a scratch of the thread if stats is null,
+ * and adds it to the SearchCounters when it goes out of scope. Only given stats are timed.
+ */
+class SearchStatsScope {
+    SearchStats &stats_;
+    bool timed_;
+    std::chrono::steady_clock::time_point start_;
+
+    static SearchStats &scratch() {
+        static thread_local SearchStats stats;
+        return stats;
+    }
+
+ public:
+    explicit SearchStatsScope(SearchStats *stats)
+        : stats_(stats != nullptr ? *stats : scratch()), timed_(stats != nullptr) {
+        stats_.clear();
+        stats_.hops.assign(1, 0);
+        if (timed_)
+            start_ = std::chrono::steady_clock::now();
+    }
+
+    ~SearchStatsScope() {
+        if (timed_)
+            stats_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+        SearchCounters::add(stats_);
+    }
+
+    SearchStatsScope(const SearchStatsScope &) = delete;
+    SearchStatsScope &operator=(const SearchStatsScope &) = delete;
+
+    SearchStats *get() const {
+        return &stats_;
+    }
+};
+
+}  // namespace hnswlib
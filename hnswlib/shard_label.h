@@ -1,51 +1,377 @@
 #pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <vector>
-#include <unordered_map>
-#include <shared_mutex>
-#include <functional>  // For std::hash
 #include "hnswlib.h"
+#include "link_list_lock.h"
+#include "thread_pool.h"
 
 
 namespace hnswlib {
-    typedef unsigned int tableint;
     typedef unsigned int linklistsizeint;
+
+/*
+ * Maps labels to internal ids.
+ *
+ * Labels below the reserved number of elements (the usual 0, 1, 2, ... labels) index a plain array
+ * of ids. Other labels go to one of NUM_SHARDS open-addressing tables with linear probing, picked by
+ * the high bits of the label hash. Writers of a shard take its lock; readers take no lock, they probe
+ * the table and retry if a write section of the shard overlapped (the seqlock of LinkListLock).
+ *
+ * A shard table starts small and is replaced by a larger one when it is 3/4 full: eight times the
+ * size until it fits the share of the reserved number of elements, twice the size beyond. The old
+ * tables are kept until reserve(), build() or clear(), since readers may still be probing them.
+ *
+ * insert, find and erase may run concurrently. reserve, build, clear and swap must not run
+ * concurrently with anything else.
+ */
 class ShardedLabelLookup {
-private:
-    static constexpr size_t NUM_SHARDS = 128;  // Adjust based on expected concurrency
+ public:
+    static const tableint NOT_FOUND = (tableint) -1;
+
+ private:
+    static const size_t NUM_SHARDS = 128;
+    static const int SHARD_SHIFT = 57;  // 64 - log2(NUM_SHARDS)
+    static const size_t MIN_TABLE_SLOTS = 16;
+
+    struct Slot {
+        labeltype label;
+        tableint id;  // NOT_FOUND in an empty slot
+    };
+
+    // the slots and their mask never change once a table is published
+    struct Table {
+        size_t mask;
+        std::unique_ptr<Slot[]> slots;
+
+        explicit Table(size_t num_slots) : mask(num_slots - 1), slots(new Slot[num_slots]) {
+            for (size_t i = 0; i < num_slots; i++)
+                slots[i].id = NOT_FOUND;
+        }
+    };
+
     struct Shard {
-        std::unordered_map<labeltype, tableint> map;
-        mutable std::shared_mutex mutex;  // Allows multiple readers or a single writer
+        LinkListLock lock;
+        std::atomic<Table *> table{nullptr};
+        size_t size{0};
+        std::vector<std::unique_ptr<Table>> tables;  // the last one is current, the others are retired
     };
-    std::vector<Shard> shards_;
 
-public:
-    ShardedLabelLookup() : shards_(NUM_SHARDS) {}
+    std::unique_ptr<Shard[]> shards_;
+    std::unique_ptr<std::atomic<tableint>[]> dense_;  // ids of the labels below dense_size_
+    size_t dense_size_{0};
+    size_t table_slots_{MIN_TABLE_SLOTS};  // room for the share of the reserved elements of a shard
+    std::atomic<size_t> size_{0};
 
-    // Get the shard index for a given label (using std::hash)
-    size_t get_shard_index(labeltype label) const {
-        return std::hash<labeltype>{}(label) % NUM_SHARDS;
+    static uint64_t hash(labeltype label) {
+        uint64_t h = (uint64_t) label;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
     }
 
-    // Thread-safe insert
+    static size_t slotsFor(size_t num_labels) {
+        size_t slots = MIN_TABLE_SLOTS;
+        while (slots * 3 < num_labels * 4)
+            slots *= 2;
+        return slots;
+    }
+
+    // The slot holding the label, or the empty slot where its probe ends
+    static size_t findSlot(const Table *table, labeltype label, uint64_t h) {
+        size_t i = h & table->mask;
+        for (size_t n = 0; n <= table->mask; n++, i = (i + 1) & table->mask) {
+            const Slot &slot = table->slots[i];
+            if (slot.id == NOT_FOUND || slot.label == label)
+                return i;
+        }
+        return i;
+    }
+
+    static Table *allocateTable(Shard &shard, size_t num_slots) {
+        shard.tables.push_back(std::unique_ptr<Table>(new Table(num_slots)));
+        return shard.tables.back().get();
+    }
+
+    // Moves the shard to a larger table, under the shard lock
+    Table *grow(Shard &shard) {
+        Table *old_table = shard.table.load(std::memory_order_relaxed);
+        size_t old_slots = old_table->mask + 1;
+        Table *table = allocateTable(shard, old_slots < table_slots_ ? std::min(8 * old_slots, table_slots_) : 2 * old_slots);
+        for (size_t i = 0; i <= old_table->mask; i++) {
+            const Slot &slot = old_table->slots[i];
+            if (slot.id != NOT_FOUND)
+                table->slots[findSlot(table, slot.label, hash(slot.label))] = slot;
+        }
+        shard.table.store(table, std::memory_order_release);
+        return table;
+    }
+
+    /*
+     * Stores the id of a label of the tables, or with keep_larger only an id larger than the stored
+     * one. Returns true if the label was absent; size_ is left to the caller.
+     */
+    bool insertIntoShard(labeltype label, tableint id, bool keep_larger) {
+        uint64_t h = hash(label);
+        Shard &shard = shards_[h >> SHARD_SHIFT];
+        std::unique_lock<LinkListLock> lock(shard.lock);
+        Table *table = shard.table.load(std::memory_order_relaxed);
+        if (table == nullptr) {
+            table = allocateTable(shard, MIN_TABLE_SLOTS);
+            shard.table.store(table, std::memory_order_release);
+        }
+        size_t i = findSlot(table, label, h);
+        if (table->slots[i].id != NOT_FOUND) {
+            if (!keep_larger || table->slots[i].id < id) {
+                LinkListLock::WriteSection write(shard.lock);
+                table->slots[i].id = id;
+            }
+            return false;
+        }
+        if ((shard.size + 1) * 4 > (table->mask + 1) * 3) {
+            table = grow(shard);
+            i = findSlot(table, label, h);
+        }
+        {
+            LinkListLock::WriteSection write(shard.lock);
+            table->slots[i].label = label;
+            table->slots[i].id = id;
+        }
+        shard.size++;
+        return true;
+    }
+
+    bool eraseFromShard(labeltype label) {
+        uint64_t h = hash(label);
+        Shard &shard = shards_[h >> SHARD_SHIFT];
+        std::unique_lock<LinkListLock> lock(shard.lock);
+        Table *table = shard.table.load(std::memory_order_relaxed);
+        if (table == nullptr)
+            return false;
+        size_t i = findSlot(table, label, h);
+        if (table->slots[i].id == NOT_FOUND)
+            return false;
+        {
+            // backward shift: later slots of the probe move into the hole if their probe allows it
+            LinkListLock::WriteSection write(shard.lock);
+            for (size_t j = (i + 1) & table->mask; table->slots[j].id != NOT_FOUND; j = (j + 1) & table->mask) {
+                size_t home = hash(table->slots[j].label) & table->mask;
+                bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+                if (!stays) {
+                    table->slots[i] = table->slots[j];
+                    i = j;
+                }
+            }
+            table->slots[i].id = NOT_FOUND;
+        }
+        shard.size--;
+        size_--;
+        return true;
+    }
+
+    void reset() {
+        shards_.reset(new Shard[NUM_SHARDS]);
+        for (size_t i = 0; i < dense_size_; i++)
+            dense_[i].store(NOT_FOUND, std::memory_order_relaxed);
+        size_ = 0;
+    }
+
+ public:
+    explicit ShardedLabelLookup(size_t max_elements = 0) : shards_(new Shard[NUM_SHARDS]) {
+        reserve(max_elements);
+    }
+
+    /*
+     * Sizes the lookup for max_elements labels: labels below max_elements get array slots and
+     * shard tables grow quickly up to their share. Frees the retired tables.
+     */
+    void reserve(size_t max_elements) {
+        if (max_elements > dense_size_) {
+            std::unique_ptr<std::atomic<tableint>[]> dense(new std::atomic<tableint>[max_elements]);
+            for (size_t i = 0; i < max_elements; i++)
+                dense[i].store(i < dense_size_ ? dense_[i].load() : NOT_FOUND, std::memory_order_relaxed);
+            dense_.swap(dense);
+            size_t old_dense_size = dense_size_;
+            dense_size_ = max_elements;
+
+            // labels that now fall into the array leave their tables
+            std::vector<std::pair<labeltype, tableint>> moved;
+            for (size_t s = 0; s < NUM_SHARDS; s++) {
+                Table *table = shards_[s].table.load(std::memory_order_relaxed);
+                for (size_t i = 0; table != nullptr && i <= table->mask; i++) {
+                    const Slot &slot = table->slots[i];
+                    if (slot.id != NOT_FOUND && slot.label >= old_dense_size && slot.label < dense_size_)
+                        moved.push_back(std::make_pair(slot.label, slot.id));
+                }
+            }
+            for (auto &entry : moved) {
+                eraseFromShard(entry.first);
+                dense_[entry.first].store(entry.second, std::memory_order_relaxed);
+                size_++;
+            }
+        }
+        table_slots_ = slotsFor(max_elements / NUM_SHARDS + max_elements / NUM_SHARDS / 4 + 1);
+
+        for (size_t s = 0; s < NUM_SHARDS; s++) {
+            Shard &shard = shards_[s];
+            if (shard.tables.size() > 1) {
+                std::unique_ptr<Table> current = std::move(shard.tables.back());
+                shard.tables.clear();
+                shard.tables.push_back(std::move(current));
+            }
+        }
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    // Inserts the label or changes its id
     void insert(labeltype label, tableint id) {
-        size_t idx = get_shard_index(label);
-        std::unique_lock<std::shared_mutex> lock(shards_[idx].mutex);
-        shards_[idx].map[label] = id;
+        if (label < dense_size_) {
+            if (dense_[label].exchange(id, std::memory_order_release) == NOT_FOUND)
+                size_++;
+            return;
+        }
+        if (insertIntoShard(label, id, false))
+            size_++;
     }
 
-    // Thread-safe lookup (returns -1 if not found)
+    // The id of the label, NOT_FOUND if it is absent
     tableint find(labeltype label) const {
-        size_t idx = get_shard_index(label);
-        std::shared_lock<std::shared_mutex> lock(shards_[idx].mutex);
-        auto it = shards_[idx].map.find(label);
-        return (it != shards_[idx].map.end()) ? it->second : -1;
+        if (label < dense_size_)
+            return dense_[label].load(std::memory_order_acquire);
+        uint64_t h = hash(label);
+        const Shard &shard = shards_[h >> SHARD_SHIFT];
+        while (true) {
+            uint32_t version = shard.lock.readBegin();
+            const Table *table = shard.table.load(std::memory_order_acquire);
+            tableint id = NOT_FOUND;
+            if (table != nullptr) {
+                const Slot &slot = table->slots[findSlot(table, label, h)];
+                if (slot.id != NOT_FOUND && slot.label == label)
+                    id = slot.id;
+            }
+            if (shard.lock.readValid(version))
+                return id;
+        }
     }
 
-    // Thread-safe erase
+    // Removes the label, returns false if it is absent
     bool erase(labeltype label) {
-        size_t idx = get_shard_index(label);
-        std::unique_lock<std::shared_mutex> lock(shards_[idx].mutex);
-        return shards_[idx].map.erase(label) > 0;
+        if (label < dense_size_) {
+            if (dense_[label].exchange(NOT_FOUND, std::memory_order_release) == NOT_FOUND)
+                return false;
+            size_--;
+            return true;
+        }
+        return eraseFromShard(label);
+    }
+
+    /*
+     * Replaces the contents by label_at(i) -> i for i in [0, n), a later duplicate of a label wins.
+     * Shard tables are sized from the labels, so none of them grows.
+     */
+    template<typename LabelAt>
+    void build(size_t n, LabelAt label_at) {
+        reset();
+        std::vector<size_t> shard_sizes(NUM_SHARDS, 0);
+        for (size_t i = 0; i < n; i++) {
+            labeltype label = label_at(i);
+            if (label >= dense_size_)
+                shard_sizes[hash(label) >> SHARD_SHIFT]++;
+        }
+        for (size_t s = 0; s < NUM_SHARDS; s++) {
+            if (shard_sizes[s] != 0)
+                shards_[s].table.store(allocateTable(shards_[s], slotsFor(shard_sizes[s])), std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < n; i++)
+            insert(label_at(i), (tableint) i);
+    }
+
+    /*
+     * build() on the threads of a pool. Duplicates end the same way: the largest i of a label wins.
+     */
+    template<typename LabelAt>
+    void build(size_t n, LabelAt label_at, ThreadPool &pool) {
+        reset();
+        // one row of counters per thread, the rows are far enough apart not to share cache lines
+        size_t num_threads = pool.size();
+        std::vector<size_t> counts(num_threads * NUM_SHARDS, 0);
+        pool.parallelFor(0, n, [&](size_t i, size_t thread_id) {
+            labeltype label = label_at(i);
+            if (label >= dense_size_)
+                counts[thread_id * NUM_SHARDS + (hash(label) >> SHARD_SHIFT)]++;
+        });
+        for (size_t s = 0; s < NUM_SHARDS; s++) {
+            size_t shard_size = 0;
+            for (size_t t = 0; t < num_threads; t++)
+                shard_size += counts[t * NUM_SHARDS + s];
+            if (shard_size != 0)
+                shards_[s].table.store(allocateTable(shards_[s], slotsFor(shard_size)), std::memory_order_relaxed);
+        }
+
+        // now the first counter of a row counts the labels its thread added
+        std::fill(counts.begin(), counts.end(), 0);
+        pool.parallelFor(0, n, [&](size_t i, size_t thread_id) {
+            labeltype label = label_at(i);
+            tableint id = (tableint) i;
+            bool added = false;
+            if (label < dense_size_) {
+                tableint current = dense_[label].load(std::memory_order_relaxed);
+                while (current == NOT_FOUND || current < id) {
+                    if (dense_[label].compare_exchange_weak(current, id, std::memory_order_release, std::memory_order_relaxed)) {
+                        added = current == NOT_FOUND;
+                        break;
+                    }
+                }
+            } else {
+                added = insertIntoShard(label, id, true);
+            }
+            if (added)
+                counts[thread_id * NUM_SHARDS]++;
+        });
+        size_t size = 0;
+        for (size_t t = 0; t < num_threads; t++)
+            size += counts[t * NUM_SHARDS];
+        size_ = size;
+    }
+
+    void clear() {
+        reset();
+    }
+
+    // Calls fn(label, id) for every label, in no particular order
+    template<typename Function>
+    void forEach(Function fn) const {
+        for (size_t label = 0; label < dense_size_; label++) {
+            tableint id = dense_[label].load(std::memory_order_relaxed);
+            if (id != NOT_FOUND)
+                fn((labeltype) label, id);
+        }
+        for (size_t s = 0; s < NUM_SHARDS; s++) {
+            const Table *table = shards_[s].table.load(std::memory_order_relaxed);
+            for (size_t i = 0; table != nullptr && i <= table->mask; i++) {
+                if (table->slots[i].id != NOT_FOUND)
+                    fn(table->slots[i].label, table->slots[i].id);
+            }
+        }
+    }
+
+    void swap(ShardedLabelLookup &other) {
+        shards_.swap(other.shards_);
+        dense_.swap(other.dense_);
+        std::swap(dense_size_, other.dense_size_);
+        std::swap(table_slots_, other.table_slots_);
+        size_t size = size_;
+        size_ = other.size_.load();
+        other.size_ = size;
     }
 };
-} // namespace hnsw
\ No newline at end of file
+} // namespace hnswlib
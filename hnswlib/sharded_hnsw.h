@@ -0,0 +1,301 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include "hnswalg.h"
+#include "thread_pool.h"
+
+namespace hnswlib {
+
+/*
+ * A set of HierarchicalNSW shards behind one index, for more elements than the 32-bit internal ids
+ * of a single index address or than one index should hold.
+ *
+ * A label lives in the shard picked by its hash, so adding, updating and deleting go to one shard
+ * and may run concurrently as for a single index. A search runs in every shard on the thread pool
+ * and merges the nearest results. The shard searches share the smallest distance of the ef-th
+ * result any shard has reached so far (see SharedBoundSearchStopCondition), so that a shard without
+ * near elements stops early, and the merge reads no result beyond it.
+ *
+ * saveIndex writes a small file with the number of shards at location and each shard in the usual
+ * format to shardLocation(location, i); the shards can be loaded and inspected one by one as well.
+ */
+template<typename dist_t>
+class ShardedHierarchicalNSW : public AlgorithmInterface<dist_t> {
+ public:
+    static uint64_t shardsMagic() { return 0x3144485357534e48ULL; }  // "HNSWSHD1" in file byte order
+
+    std::vector<std::unique_ptr<HierarchicalNSW<dist_t>>> shards_;
+    ThreadPool *pool_{nullptr};
+    std::unique_ptr<ThreadPool> own_pool_;
+    size_t vector_size_{0};
+    size_t ef_{10};
+
+
+    /*
+     * num_shards empty shards with room for max_elements_per_shard elements each. The searches run
+     * on pool, or on a pool of every hardware thread owned by the index if none is given.
+     */
+    ShardedHierarchicalNSW(
+        SpaceInterface<dist_t> *s,
+        size_t num_shards,
+        size_t max_elements_per_shard,
+        size_t M = 16,
+        size_t ef_construction = 200,
+        size_t random_seed = 100,
+        bool allow_replace_deleted = false,
+        ThreadPool *pool = nullptr) {
+        if (num_shards == 0)
+            throw std::runtime_error("A sharded index needs at least one shard");
+        setPool(pool);
+        vector_size_ = s->get_vector_size();
+        for (size_t i = 0; i < num_shards; i++) {
+            shards_.emplace_back(new HierarchicalNSW<dist_t>(
+                s, max_elements_per_shard, M, ef_construction, random_seed + i, allow_replace_deleted));
+        }
+    }
+
+
+    // Loads an index saved by saveIndex, max_elements_per_shard 0 keeps the sizes of the shards
+    ShardedHierarchicalNSW(
+        SpaceInterface<dist_t> *s,
+        const std::string &location,
+        size_t max_elements_per_shard = 0,
+        bool allow_replace_deleted = false,
+        IndexLoadMode load_mode = IndexLoadMode::Copy,
+        ThreadPool *pool = nullptr) {
+        setPool(pool);
+        vector_size_ = s->get_vector_size();
+        std::ifstream input(location, std::ios::binary);
+        if (!input.is_open())
+            throw std::runtime_error("Cannot open file");
+        uint64_t magic = 0, num_shards = 0;
+        readBinaryPOD(input, magic);
+        readBinaryPOD(input, num_shards);
+        if (!input || magic != shardsMagic() || num_shards == 0)
+            throw std::runtime_error("Not a sharded index file");
+        input.close();
+
+        // each load spreads its sections over the pool
+        for (size_t i = 0; i < num_shards; i++) {
+            shards_.emplace_back(new HierarchicalNSW<dist_t>(
+                s, shardLocation(location, i), false, max_elements_per_shard, allow_replace_deleted, load_mode, pool_));
+        }
+    }
+
+
+    static std::string shardLocation(const std::string &location, size_t shard) {
+        return location + ".shard" + std::to_string(shard);
+    }
+
+
+    size_t numShards() const {
+        return shards_.size();
+    }
+
+
+    // The shard of a label, the same for every index with as many shards
+    size_t shardOf(labeltype label) const {
+        uint64_t h = (uint64_t) label;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return (size_t) (h % shards_.size());
+    }
+
+
+    HierarchicalNSW<dist_t> &shard(size_t i) const {
+        return *shards_[i];
+    }
+
+
+    // ef of the search in each shard
+    void setEf(size_t ef) {
+        ef_ = ef;
+        for (auto &shard : shards_)
+            shard->setEf(ef);
+    }
+
+
+    size_t getCurrentElementCount() const {
+        size_t count = 0;
+        for (auto &shard : shards_)
+            count += shard->getCurrentElementCount();
+        return count;
+    }
+
+
+    size_t getDeletedCount() const {
+        size_t count = 0;
+        for (auto &shard : shards_)
+            count += shard->getDeletedCount();
+        return count;
+    }
+
+
+    // Every shard gets room for max_elements_per_shard elements
+    void resizeIndex(size_t max_elements_per_shard) {
+        for (auto &shard : shards_)
+            shard->resizeIndex(max_elements_per_shard);
+    }
+
+
+    void addPoint(const void *datapoint, labeltype label, bool replace_deleted = false) {
+        shards_[shardOf(label)]->addPoint(datapoint, label, replace_deleted);
+    }
+
+
+    /*
+     * Adds n points stored one after another (vector_size bytes each) with the given labels, spread
+     * over the threads of the pool. Same as addPoint for each of them.
+     */
+    void addPoints(const void *data, const labeltype *labels, size_t n, bool replace_deleted = false) {
+        // the first element of an empty shard becomes the entry point the others start from
+        std::vector<char> added(n, 0);
+        std::vector<char> started(shards_.size(), 0);
+        for (size_t row = 0; row < n; row++) {
+            size_t s = shardOf(labels[row]);
+            if (!started[s] && shards_[s]->getCurrentElementCount() == 0) {
+                shards_[s]->addPoint((const char *) data + row * vector_size_, labels[row], replace_deleted);
+                added[row] = 1;
+            }
+            started[s] = 1;
+        }
+        pool_->parallelFor(0, n, [&](size_t row, size_t) {
+            if (!added[row])
+                addPoint((const char *) data + row * vector_size_, labels[row], replace_deleted);
+        });
+    }
+
+
+    void markDelete(labeltype label) {
+        shards_[shardOf(label)]->markDelete(label);
+    }
+
+
+    void unmarkDelete(labeltype label) {
+        shards_[shardOf(label)]->unmarkDelete(label);
+    }
+
+
+    template<typename data_t>
+    std::vector<data_t> getDataByLabel(labeltype label) const {
+        return shards_[shardOf(label)]->template getDataByLabel<data_t>(label);
+    }
+
+
+    std::priority_queue<std::pair<dist_t, labeltype>>
+    searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        std::vector<std::pair<dist_t, labeltype>> closest = searchKnnCloserFirst(query_data, k, isIdAllowed);
+        return std::priority_queue<std::pair<dist_t, labeltype>>(
+            std::less<std::pair<dist_t, labeltype>>(), std::move(closest));
+    }
+
+
+    std::vector<std::pair<dist_t, labeltype>>
+    searchKnnCloserFirst(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        std::vector<std::vector<std::pair<dist_t, labeltype>>> shard_results(shards_.size());
+        std::atomic<dist_t> bound(std::numeric_limits<dist_t>::max());
+        pool_->parallelFor(0, shards_.size(), [&](size_t s, size_t) {
+            searchShard(s, query_data, k, isIdAllowed, bound, shard_results[s]);
+        }, 1);
+        return merge(shard_results, k, bound.load());
+    }
+
+
+    /*
+     * Searches nq queries stored one after another (vector_size bytes each) and writes the k nearest
+     * neighbors of query i, closer first, to labels[i * k ...] and distances[i * k ...], padded as by
+     * HierarchicalNSW::searchKnnBatch. The queries are spread over the pool, the shards of a query
+     * are searched in turn. Returns the smallest number of results found for a query.
+     */
+    size_t searchKnnBatch(
+        const void *queries,
+        size_t nq,
+        size_t k,
+        labeltype *labels,
+        dist_t *distances,
+        BaseFilterFunctor* isIdAllowed = nullptr) const {
+        std::atomic<size_t> min_found(k);
+        pool_->parallelFor(0, nq, [&](size_t q, size_t) {
+            const void *query_data = (const char *) queries + q * vector_size_;
+            std::vector<std::vector<std::pair<dist_t, labeltype>>> shard_results(shards_.size());
+            std::atomic<dist_t> bound(std::numeric_limits<dist_t>::max());
+            for (size_t s = 0; s < shards_.size(); s++)
+                searchShard(s, query_data, k, isIdAllowed, bound, shard_results[s]);
+            std::vector<std::pair<dist_t, labeltype>> result = merge(shard_results, k, bound.load());
+            for (size_t i = 0; i < k; i++) {
+                labels[q * k + i] = i < result.size() ? result[i].second : (labeltype) -1;
+                distances[q * k + i] = i < result.size() ? result[i].first : std::numeric_limits<dist_t>::max();
+            }
+            size_t current = min_found.load();
+            while (result.size() < current && !min_found.compare_exchange_weak(current, result.size())) {}
+        });
+        return min_found;
+    }
+
+
+    void saveIndex(const std::string &location) {
+        for (size_t i = 0; i < shards_.size(); i++)
+            shards_[i]->saveIndex(shardLocation(location, i));
+
+        std::ofstream output(location, std::ios::binary);
+        if (!output.is_open())
+            throw std::runtime_error("Cannot open file");
+        writeBinaryPOD(output, shardsMagic());
+        writeBinaryPOD(output, (uint64_t) shards_.size());
+        output.close();
+        if (!output)
+            throw std::runtime_error("Cannot write file");
+    }
+
+ private:
+    void setPool(ThreadPool *pool) {
+        if (pool == nullptr) {
+            own_pool_.reset(new ThreadPool());
+            pool = own_pool_.get();
+        }
+        pool_ = pool;
+    }
+
+
+    void searchShard(size_t s, const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed,
+                     std::atomic<dist_t> &bound, std::vector<std::pair<dist_t, labeltype>> &result) const {
+        SharedBoundSearchStopCondition<dist_t> stop_condition(bound, k, std::max(ef_, k));
+        result = shards_[s]->searchStopConditionClosest(query_data, stop_condition, isIdAllowed);
+    }
+
+
+    // The k nearest of the closer-first results of the shards, none of them is farther than bound
+    static std::vector<std::pair<dist_t, labeltype>>
+    merge(const std::vector<std::vector<std::pair<dist_t, labeltype>>> &shard_results, size_t k, dist_t bound) {
+        // (distance, shard) of the next result of each shard, the nearest on top
+        typedef std::pair<dist_t, size_t> Head;
+        std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+        std::vector<size_t> next(shard_results.size(), 0);
+        for (size_t s = 0; s < shard_results.size(); s++) {
+            if (!shard_results[s].empty())
+                heads.emplace(shard_results[s][0].first, s);
+        }
+        std::vector<std::pair<dist_t, labeltype>> result;
+        result.reserve(k);
+        while (result.size() < k && !heads.empty() && heads.top().first <= bound) {
+            size_t s = heads.top().second;
+            heads.pop();
+            result.push_back(shard_results[s][next[s]++]);
+            if (next[s] < shard_results[s].size())
+                heads.emplace(shard_results[s][next[s]].first, s);
+        }
+        return result;
+    }
+};
+
+}  // namespace hnswlib
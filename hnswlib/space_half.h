@@ -0,0 +1,359 @@
+#pragma once
+#include "hnswlib.h"
+#include <cmath>
+#include <stdint.h>
+
+namespace hnswlib {
+
+/*
+ * Half precision storage: every dimension is stored as an IEEE 754 binary16 (FP16) or a
+ * bfloat16 (BF16, the upper half of a float) value, so an element takes 2 * dim bytes.
+ *
+ * Like the quantized spaces, the spaces take float vectors, which are rounded to nearest even
+ * when stored; searches compare the float query with the stored values. Products and sums are
+ * computed in single precision.
+ */
+static inline float
+FP16ToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0x1f) {  // inf or nan
+        bits = sign | 0x7f800000 | (mant << 13);
+    } else if (exp != 0) {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    } else if (mant == 0) {
+        bits = sign;
+    } else {  // subnormal, normalized as a float
+        exp = 113;
+        while ((mant & 0x400) == 0) {
+            mant <<= 1;
+            exp--;
+        }
+        bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(float));
+    return f;
+}
+
+static inline uint16_t
+FloatToFP16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(float));
+    uint16_t sign = (uint16_t) ((x >> 16) & 0x8000);
+    uint32_t absx = x & 0x7fffffff;
+    if (absx > 0x7f800000)  // nan stays a quiet nan
+        return sign | 0x7e00;
+    if (absx >= 0x477ff000)  // rounds above 65504
+        return sign | 0x7c00;
+    if (absx < 0x38800000) {  // below 2^-14: subnormal, the value is a multiple of 2^-24
+        float a;
+        memcpy(&a, &absx, sizeof(float));
+        return sign | (uint16_t) std::nearbyint(a * 16777216.0f);
+    }
+    absx += 0xfff + ((absx >> 13) & 1);
+    return sign | (uint16_t) ((absx - (112u << 23)) >> 13);
+}
+
+static inline float
+BF16ToFloat(uint16_t h) {
+    uint32_t bits = (uint32_t) h << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(float));
+    return f;
+}
+
+static inline uint16_t
+FloatToBF16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(float));
+    if ((x & 0x7fffffff) > 0x7f800000)  // nan stays a quiet nan
+        return (uint16_t) ((x >> 16) | 0x40);
+    x += 0x7fff + ((x >> 16) & 1);
+    return (uint16_t) (x >> 16);
+}
+
+template<bool bf16>
+static inline float
+HalfToFloat(uint16_t h) {
+    return bf16 ? BF16ToFloat(h) : FP16ToFloat(h);
+}
+
+// Distance between a float query (or, if symmetric, a second stored vector) and a stored vector
+template<bool bf16, bool inner_product, bool symmetric>
+static float
+HalfDistance(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    float res = 0;
+    for (size_t i = 0; i < qty; i++) {
+        float x = HalfToFloat<bf16>(pVect2[i]);
+        float q = symmetric ? HalfToFloat<bf16>(((const uint16_t *) pVect1v)[i]) : ((const float *) pVect1v)[i];
+        if (inner_product) {
+            res += q * x;
+        } else {
+            float t = q - x;
+            res += t * t;
+        }
+    }
+    return inner_product ? 1.0f - res : res;
+}
+
+#if defined(USE_AVX512)
+
+template<bool bf16>
+HNSWLIB_TARGET_AVX512 static inline __m512
+HalfLoad16AVX512(const uint16_t *p) {
+    __m256i h = _mm256_loadu_si256((const __m256i *) p);
+    if (bf16)
+        return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16));
+    return _mm512_cvtph_ps(h);
+}
+
+template<bool bf16, bool inner_product, bool symmetric>
+HNSWLIB_TARGET_AVX512 static float
+HalfDistanceAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+
+    __m512 sum = _mm512_set1_ps(0);
+    for (size_t i = 0; i < qty16; i += 16) {
+        __m512 x = HalfLoad16AVX512<bf16>(pVect2 + i);
+        __m512 q = symmetric ?
+            HalfLoad16AVX512<bf16>((const uint16_t *) pVect1v + i) :
+            _mm512_loadu_ps((const float *) pVect1v + i);
+        if (inner_product) {
+            sum = _mm512_fmadd_ps(q, x, sum);
+        } else {
+            __m512 diff = _mm512_sub_ps(q, x);
+            sum = _mm512_fmadd_ps(diff, diff, sum);
+        }
+    }
+    float res = _mm512_reduce_add_ps(sum);
+
+    for (size_t i = qty16; i < qty; i++) {
+        float x = HalfToFloat<bf16>(pVect2[i]);
+        float q = symmetric ? HalfToFloat<bf16>(((const uint16_t *) pVect1v)[i]) : ((const float *) pVect1v)[i];
+        if (inner_product) {
+            res += q * x;
+        } else {
+            float t = q - x;
+            res += t * t;
+        }
+    }
+    return inner_product ? 1.0f - res : res;
+}
+
+#endif
+
+#if defined(USE_AVX512BF16)
+
+// Inner product distance of two stored BF16 vectors, 32 pairs per instruction
+HNSWLIB_TARGET_AVX512BF16 static float
+BF16InnerProductDistanceAVX512BF16(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect1 = (const uint16_t *) pVect1v;
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty32 = qty >> 5 << 5;
+
+    __m512 sum = _mm512_set1_ps(0);
+    for (size_t i = 0; i < qty32; i += 32) {
+        __m512i a = _mm512_loadu_si512((const void *) (pVect1 + i));
+        __m512i b = _mm512_loadu_si512((const void *) (pVect2 + i));
+        sum = _mm512_dpbf16_ps(sum, (__m512bh) a, (__m512bh) b);
+    }
+    float res = _mm512_reduce_add_ps(sum);
+
+    for (size_t i = qty32; i < qty; i++)
+        res += BF16ToFloat(pVect1[i]) * BF16ToFloat(pVect2[i]);
+    return 1.0f - res;
+}
+
+#endif
+
+#if defined(USE_F16C)
+
+template<bool bf16>
+HNSWLIB_TARGET_AVX2_F16C static inline __m256
+HalfLoad8AVX2(const uint16_t *p) {
+    __m128i h = _mm_loadu_si128((const __m128i *) p);
+    if (bf16)
+        return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+    return _mm256_cvtph_ps(h);
+}
+
+template<bool bf16, bool inner_product, bool symmetric>
+HNSWLIB_TARGET_AVX2_F16C static float
+HalfDistanceAVX2(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty8 = qty >> 3 << 3;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    __m256 sum = _mm256_set1_ps(0);
+    for (size_t i = 0; i < qty8; i += 8) {
+        __m256 x = HalfLoad8AVX2<bf16>(pVect2 + i);
+        __m256 q = symmetric ?
+            HalfLoad8AVX2<bf16>((const uint16_t *) pVect1v + i) :
+            _mm256_loadu_ps((const float *) pVect1v + i);
+        if (inner_product) {
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(q, x));
+        } else {
+            __m256 diff = _mm256_sub_ps(q, x);
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+        }
+    }
+    _mm256_store_ps(TmpRes, sum);
+    float res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+
+    for (size_t i = qty8; i < qty; i++) {
+        float x = HalfToFloat<bf16>(pVect2[i]);
+        float q = symmetric ? HalfToFloat<bf16>(((const uint16_t *) pVect1v)[i]) : ((const float *) pVect1v)[i];
+        if (inner_product) {
+            res += q * x;
+        } else {
+            float t = q - x;
+            res += t * t;
+        }
+    }
+    return inner_product ? 1.0f - res : res;
+}
+
+#endif
+
+#if defined(USE_NEON)
+
+template<bool bf16>
+static inline float32x4_t
+HalfLoad4NEON(const uint16_t *p) {
+    uint16x4_t h = vld1_u16(p);
+    if (bf16)
+        return vreinterpretq_f32_u32(vshll_n_u16(h, 16));
+    return vcvt_f32_f16(vreinterpret_f16_u16(h));
+}
+
+template<bool bf16, bool inner_product, bool symmetric>
+static float
+HalfDistanceNEON(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const uint16_t *pVect2 = (const uint16_t *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2 << 2;
+
+    float32x4_t sum = vdupq_n_f32(0);
+    for (size_t i = 0; i < qty4; i += 4) {
+        float32x4_t x = HalfLoad4NEON<bf16>(pVect2 + i);
+        float32x4_t q = symmetric ?
+            HalfLoad4NEON<bf16>((const uint16_t *) pVect1v + i) :
+            vld1q_f32((const float *) pVect1v + i);
+        if (inner_product) {
+            sum = vfmaq_f32(sum, q, x);
+        } else {
+            float32x4_t diff = vsubq_f32(q, x);
+            sum = vfmaq_f32(sum, diff, diff);
+        }
+    }
+    float res = vaddvq_f32(sum);
+
+    for (size_t i = qty4; i < qty; i++) {
+        float x = HalfToFloat<bf16>(pVect2[i]);
+        float q = symmetric ? HalfToFloat<bf16>(((const uint16_t *) pVect1v)[i]) : ((const float *) pVect1v)[i];
+        if (inner_product) {
+            res += q * x;
+        } else {
+            float t = q - x;
+            res += t * t;
+        }
+    }
+    return inner_product ? 1.0f - res : res;
+}
+
+#endif
+
+
+/*
+ * Space storing float vectors in half precision (FP16 if bf16 is false, BF16 otherwise).
+ * Distances are squared L2, or 1 - inner product if inner_product is set.
+ * Use the L2SpaceFP16, InnerProductSpaceFP16, L2SpaceBF16 and InnerProductSpaceBF16 names.
+ */
+template<bool bf16, bool inner_product>
+class HalfPrecisionSpace : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    DISTFUNC<float> fststoreddistfunc_;
+    size_t data_size_;
+    size_t dim_;
+
+ public:
+    HalfPrecisionSpace(size_t dim) : dim_(dim) {
+        data_size_ = dim * sizeof(uint16_t);
+        fstdistfunc_ = HalfDistance<bf16, inner_product, false>;
+        fststoreddistfunc_ = HalfDistance<bf16, inner_product, true>;
+#if defined(USE_AVX512)
+        if (AVX512Capable()) {
+            fstdistfunc_ = HalfDistanceAVX512<bf16, inner_product, false>;
+            fststoreddistfunc_ = HalfDistanceAVX512<bf16, inner_product, true>;
+    #if defined(USE_AVX512BF16)
+            if (bf16 && inner_product && AVX512BF16Capable())
+                fststoreddistfunc_ = BF16InnerProductDistanceAVX512BF16;
+    #endif
+            return;
+        }
+#endif
+#if defined(USE_F16C)
+        if (AVX2Capable() && F16CCapable()) {
+            fstdistfunc_ = HalfDistanceAVX2<bf16, inner_product, false>;
+            fststoreddistfunc_ = HalfDistanceAVX2<bf16, inner_product, true>;
+        }
+#endif
+#if defined(USE_NEON)
+        fstdistfunc_ = HalfDistanceNEON<bf16, inner_product, false>;
+        fststoreddistfunc_ = HalfDistanceNEON<bf16, inner_product, true>;
+#endif
+    }
+
+    size_t get_data_size() {
+        return data_size_;
+    }
+
+    size_t get_vector_size() {
+        return dim_ * sizeof(float);
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    DISTFUNC<float> get_stored_dist_func() {
+        return fststoreddistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &dim_;
+    }
+
+    void encode(const void *vector, void *data) {
+        const float *x = (const float *) vector;
+        uint16_t *h = (uint16_t *) data;
+        for (size_t i = 0; i < dim_; i++)
+            h[i] = bf16 ? FloatToBF16(x[i]) : FloatToFP16(x[i]);
+    }
+
+    void decode(const void *data, void *vector) {
+        const uint16_t *h = (const uint16_t *) data;
+        float *x = (float *) vector;
+        for (size_t i = 0; i < dim_; i++)
+            x[i] = HalfToFloat<bf16>(h[i]);
+    }
+
+    ~HalfPrecisionSpace() {}
+};
+
+typedef HalfPrecisionSpace<false, false> L2SpaceFP16;
+typedef HalfPrecisionSpace<false, true> InnerProductSpaceFP16;
+typedef HalfPrecisionSpace<true, false> L2SpaceBF16;
+typedef HalfPrecisionSpace<true, true> InnerProductSpaceBF16;
+
+}  // namespace hnswlib
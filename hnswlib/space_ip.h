@@ -21,7 +21,7 @@ InnerProductDistance(const void *pVect1, const void *pVect2, const void *qty_ptr
 #if defined(USE_AVX)
 
 // Favor using AVX if available.
-static float
+HNSWLIB_TARGET_AVX static float
 InnerProductSIMD4ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float PORTABLE_ALIGN32 TmpRes[8];
     float *pVect1 = (float *) pVect1v;
@@ -68,7 +68,7 @@ InnerProductSIMD4ExtAVX(const void *pVect1v, const void *pVect2v, const void *qt
     return sum;
 }
 
-static float
+HNSWLIB_TARGET_AVX static float
 InnerProductDistanceSIMD4ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     return 1.0f - InnerProductSIMD4ExtAVX(pVect1v, pVect2v, qty_ptr);
 }
@@ -143,7 +143,7 @@ InnerProductDistanceSIMD4ExtSSE(const void *pVect1v, const void *pVect2v, const
 
 #if defined(USE_AVX512)
 
-static float
+HNSWLIB_TARGET_AVX512 static float
 InnerProductSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float PORTABLE_ALIGN64 TmpRes[16];
     float *pVect1 = (float *) pVect1v;
@@ -198,7 +198,7 @@ InnerProductSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void
     return sum;
 }
 
-static float
+HNSWLIB_TARGET_AVX512 static float
 InnerProductDistanceSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     return 1.0f - InnerProductSIMD16ExtAVX512(pVect1v, pVect2v, qty_ptr);
 }
@@ -207,7 +207,7 @@ InnerProductDistanceSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, co
 
 #if defined(USE_AVX)
 
-static float
+HNSWLIB_TARGET_AVX static float
 InnerProductSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float PORTABLE_ALIGN32 TmpRes[8];
     float *pVect1 = (float *) pVect1v;
@@ -243,7 +243,7 @@ InnerProductSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *q
     return sum;
 }
 
-static float
+HNSWLIB_TARGET_AVX static float
 InnerProductDistanceSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     return 1.0f - InnerProductSIMD16ExtAVX(pVect1v, pVect2v, qty_ptr);
 }
@@ -304,11 +304,104 @@ InnerProductDistanceSIMD16ExtSSE(const void *pVect1v, const void *pVect2v, const
 
 #endif
 
-#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
+#if defined(USE_NEON)
+
+static float
+InnerProductSIMD16ExtNEON(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    float *pVect1 = (float *) pVect1v;
+    float *pVect2 = (float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    size_t qty16 = qty / 16;
+
+    const float *pEnd1 = pVect1 + 16 * qty16;
+
+    float32x4_t sum0 = vdupq_n_f32(0);
+    float32x4_t sum1 = vdupq_n_f32(0);
+    float32x4_t sum2 = vdupq_n_f32(0);
+    float32x4_t sum3 = vdupq_n_f32(0);
+
+    while (pVect1 < pEnd1) {
+        sum0 = vfmaq_f32(sum0, vld1q_f32(pVect1), vld1q_f32(pVect2));
+        sum1 = vfmaq_f32(sum1, vld1q_f32(pVect1 + 4), vld1q_f32(pVect2 + 4));
+        sum2 = vfmaq_f32(sum2, vld1q_f32(pVect1 + 8), vld1q_f32(pVect2 + 8));
+        sum3 = vfmaq_f32(sum3, vld1q_f32(pVect1 + 12), vld1q_f32(pVect2 + 12));
+        pVect1 += 16;
+        pVect2 += 16;
+    }
+
+    return vaddvq_f32(vaddq_f32(vaddq_f32(sum0, sum1), vaddq_f32(sum2, sum3)));
+}
+
+static float
+InnerProductDistanceSIMD16ExtNEON(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - InnerProductSIMD16ExtNEON(pVect1v, pVect2v, qty_ptr);
+}
+
+static float
+InnerProductSIMD4ExtNEON(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    float *pVect1 = (float *) pVect1v;
+    float *pVect2 = (float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+
+    size_t qty4 = qty / 4;
+
+    const float *pEnd1 = pVect1 + 4 * qty4;
+
+    float32x4_t sum = vdupq_n_f32(0);
+
+    while (pVect1 < pEnd1) {
+        sum = vfmaq_f32(sum, vld1q_f32(pVect1), vld1q_f32(pVect2));
+        pVect1 += 4;
+        pVect2 += 4;
+    }
+
+    return vaddvq_f32(sum);
+}
+
+static float
+InnerProductDistanceSIMD4ExtNEON(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - InnerProductSIMD4ExtNEON(pVect1v, pVect2v, qty_ptr);
+}
+
+#endif
+
+#if defined(USE_SVE)
+
+// Handles any dimension: the tail is covered by the predicate of the last iteration
+static float
+InnerProductSVE(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    uint64_t qty = *((size_t *) qty_ptr);
+
+    svfloat32_t sum = svdup_n_f32(0);
+    for (uint64_t i = 0; i < qty; i += svcntw()) {
+        svbool_t pg = svwhilelt_b32_u64(i, qty);
+        sum = svmla_f32_m(pg, sum, svld1_f32(pg, pVect1 + i), svld1_f32(pg, pVect2 + i));
+    }
+    return svaddv_f32(svptrue_b32(), sum);
+}
+
+static float
+InnerProductDistanceSVE(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    return 1.0f - InnerProductSVE(pVect1v, pVect2v, qty_ptr);
+}
+
+#endif
+
+#if defined(USE_SSE) || defined(USE_NEON)
+#if defined(USE_SSE)
 static DISTFUNC<float> InnerProductSIMD16Ext = InnerProductSIMD16ExtSSE;
 static DISTFUNC<float> InnerProductSIMD4Ext = InnerProductSIMD4ExtSSE;
 static DISTFUNC<float> InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtSSE;
 static DISTFUNC<float> InnerProductDistanceSIMD4Ext = InnerProductDistanceSIMD4ExtSSE;
+#else
+static DISTFUNC<float> InnerProductSIMD16Ext = InnerProductSIMD16ExtNEON;
+static DISTFUNC<float> InnerProductSIMD4Ext = InnerProductSIMD4ExtNEON;
+static DISTFUNC<float> InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtNEON;
+static DISTFUNC<float> InnerProductDistanceSIMD4Ext = InnerProductDistanceSIMD4ExtNEON;
+#endif
 
 static float
 InnerProductDistanceSIMD16ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
@@ -339,36 +432,285 @@ InnerProductDistanceSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v,
 }
 #endif
 
+/*
+ * Batch kernels score one query against n vectors, e.g. the unvisited neighbors of a node.
+ * Vectors are processed four at a time so each block of the query is loaded once per four
+ * vectors. Every kernel adds up in the same order as the single-vector kernel it mirrors,
+ * so both give the same distance unless the compiler reassociates (e.g. with -Ofast).
+ */
+static void
+InnerProductDistanceBatch(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = InnerProductDistance(query, vectors[i], qty_ptr);
+}
+
+#if defined(USE_AVX512)
+
+HNSWLIB_TARGET_AVX512 static void
+InnerProductBatchSIMD16ExtAVX512(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    const float *q = (const float *) query;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty / 16 * 16;
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float *p0 = (const float *) vectors[i];
+        const float *p1 = (const float *) vectors[i + 1];
+        const float *p2 = (const float *) vectors[i + 2];
+        const float *p3 = (const float *) vectors[i + 3];
+        __m512 sum0 = _mm512_set1_ps(0);
+        __m512 sum1 = _mm512_set1_ps(0);
+        __m512 sum2 = _mm512_set1_ps(0);
+        __m512 sum3 = _mm512_set1_ps(0);
+
+        for (size_t j = 0; j < qty16; j += 16) {
+            __m512 v = _mm512_loadu_ps(q + j);
+            sum0 = _mm512_fmadd_ps(v, _mm512_loadu_ps(p0 + j), sum0);
+            sum1 = _mm512_fmadd_ps(v, _mm512_loadu_ps(p1 + j), sum1);
+            sum2 = _mm512_fmadd_ps(v, _mm512_loadu_ps(p2 + j), sum2);
+            sum3 = _mm512_fmadd_ps(v, _mm512_loadu_ps(p3 + j), sum3);
+        }
+
+        out[i] = _mm512_reduce_add_ps(sum0);
+        out[i + 1] = _mm512_reduce_add_ps(sum1);
+        out[i + 2] = _mm512_reduce_add_ps(sum2);
+        out[i + 3] = _mm512_reduce_add_ps(sum3);
+    }
+    for (; i < n; i++)
+        out[i] = InnerProductSIMD16ExtAVX512(query, vectors[i], qty_ptr);
+}
+
+#endif
+
+#if defined(USE_AVX)
+
+HNSWLIB_TARGET_AVX static void
+InnerProductBatchSIMD16ExtAVX(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    const float *q = (const float *) query;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty / 16 * 16;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float *p0 = (const float *) vectors[i];
+        const float *p1 = (const float *) vectors[i + 1];
+        const float *p2 = (const float *) vectors[i + 2];
+        const float *p3 = (const float *) vectors[i + 3];
+        __m256 sum0 = _mm256_set1_ps(0);
+        __m256 sum1 = _mm256_set1_ps(0);
+        __m256 sum2 = _mm256_set1_ps(0);
+        __m256 sum3 = _mm256_set1_ps(0);
+
+        for (size_t j = 0; j < qty16; j += 8) {
+            __m256 v = _mm256_loadu_ps(q + j);
+            sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(v, _mm256_loadu_ps(p0 + j)));
+            sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(v, _mm256_loadu_ps(p1 + j)));
+            sum2 = _mm256_add_ps(sum2, _mm256_mul_ps(v, _mm256_loadu_ps(p2 + j)));
+            sum3 = _mm256_add_ps(sum3, _mm256_mul_ps(v, _mm256_loadu_ps(p3 + j)));
+        }
+
+        __m256 sums[4] = {sum0, sum1, sum2, sum3};
+        for (int s = 0; s < 4; s++) {
+            _mm256_store_ps(TmpRes, sums[s]);
+            out[i + s] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+        }
+    }
+    for (; i < n; i++)
+        out[i] = InnerProductSIMD16ExtAVX(query, vectors[i], qty_ptr);
+}
+
+HNSWLIB_TARGET_AVX static void
+InnerProductBatchSIMD4ExtAVX(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    const float *q = (const float *) query;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty / 16 * 16;
+    size_t qty4 = qty / 4 * 4;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float *p0 = (const float *) vectors[i];
+        const float *p1 = (const float *) vectors[i + 1];
+        const float *p2 = (const float *) vectors[i + 2];
+        const float *p3 = (const float *) vectors[i + 3];
+        __m256 sum0 = _mm256_set1_ps(0);
+        __m256 sum1 = _mm256_set1_ps(0);
+        __m256 sum2 = _mm256_set1_ps(0);
+        __m256 sum3 = _mm256_set1_ps(0);
+
+        size_t j = 0;
+        for (; j < qty16; j += 8) {
+            __m256 v = _mm256_loadu_ps(q + j);
+            sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(v, _mm256_loadu_ps(p0 + j)));
+            sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(v, _mm256_loadu_ps(p1 + j)));
+            sum2 = _mm256_add_ps(sum2, _mm256_mul_ps(v, _mm256_loadu_ps(p2 + j)));
+            sum3 = _mm256_add_ps(sum3, _mm256_mul_ps(v, _mm256_loadu_ps(p3 + j)));
+        }
+
+        __m128 prod0 = _mm_add_ps(_mm256_extractf128_ps(sum0, 0), _mm256_extractf128_ps(sum0, 1));
+        __m128 prod1 = _mm_add_ps(_mm256_extractf128_ps(sum1, 0), _mm256_extractf128_ps(sum1, 1));
+        __m128 prod2 = _mm_add_ps(_mm256_extractf128_ps(sum2, 0), _mm256_extractf128_ps(sum2, 1));
+        __m128 prod3 = _mm_add_ps(_mm256_extractf128_ps(sum3, 0), _mm256_extractf128_ps(sum3, 1));
+
+        for (; j < qty4; j += 4) {
+            __m128 v = _mm_loadu_ps(q + j);
+            prod0 = _mm_add_ps(prod0, _mm_mul_ps(v, _mm_loadu_ps(p0 + j)));
+            prod1 = _mm_add_ps(prod1, _mm_mul_ps(v, _mm_loadu_ps(p1 + j)));
+            prod2 = _mm_add_ps(prod2, _mm_mul_ps(v, _mm_loadu_ps(p2 + j)));
+            prod3 = _mm_add_ps(prod3, _mm_mul_ps(v, _mm_loadu_ps(p3 + j)));
+        }
+
+        __m128 prods[4] = {prod0, prod1, prod2, prod3};
+        for (int s = 0; s < 4; s++) {
+            _mm_store_ps(TmpRes, prods[s]);
+            out[i + s] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+        }
+    }
+    for (; i < n; i++)
+        out[i] = InnerProductSIMD4ExtAVX(query, vectors[i], qty_ptr);
+}
+
+#endif
+
+#if defined(USE_SSE)
+
+// Serves both the SIMD16 and the SIMD4 case: the SSE kernels add 4-float blocks in order for either
+static void
+InnerProductBatchSIMD4ExtSSE(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    const float *q = (const float *) query;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty / 4 * 4;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float *p0 = (const float *) vectors[i];
+        const float *p1 = (const float *) vectors[i + 1];
+        const float *p2 = (const float *) vectors[i + 2];
+        const float *p3 = (const float *) vectors[i + 3];
+        __m128 sum0 = _mm_set1_ps(0);
+        __m128 sum1 = _mm_set1_ps(0);
+        __m128 sum2 = _mm_set1_ps(0);
+        __m128 sum3 = _mm_set1_ps(0);
+
+        for (size_t j = 0; j < qty4; j += 4) {
+            __m128 v = _mm_loadu_ps(q + j);
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(v, _mm_loadu_ps(p0 + j)));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(v, _mm_loadu_ps(p1 + j)));
+            sum2 = _mm_add_ps(sum2, _mm_mul_ps(v, _mm_loadu_ps(p2 + j)));
+            sum3 = _mm_add_ps(sum3, _mm_mul_ps(v, _mm_loadu_ps(p3 + j)));
+        }
+
+        __m128 sums[4] = {sum0, sum1, sum2, sum3};
+        for (int s = 0; s < 4; s++) {
+            _mm_store_ps(TmpRes, sums[s]);
+            out[i + s] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+        }
+    }
+    for (; i < n; i++)
+        out[i] = InnerProductSIMD4ExtSSE(query, vectors[i], qty_ptr);
+}
+
+#endif
+
+#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
+static DISTFUNC_BATCH<float> InnerProductBatchSIMD16Ext = InnerProductBatchSIMD4ExtSSE;
+static DISTFUNC_BATCH<float> InnerProductBatchSIMD4Ext = InnerProductBatchSIMD4ExtSSE;
+
+static void
+InnerProductDistanceBatchSIMD16Ext(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    InnerProductBatchSIMD16Ext(query, vectors, n, qty_ptr, out);
+    for (size_t i = 0; i < n; i++)
+        out[i] = 1.0f - out[i];
+}
+
+static void
+InnerProductDistanceBatchSIMD4Ext(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    InnerProductBatchSIMD4Ext(query, vectors, n, qty_ptr, out);
+    for (size_t i = 0; i < n; i++)
+        out[i] = 1.0f - out[i];
+}
+
+static void
+InnerProductDistanceBatchSIMD16ExtResiduals(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+    InnerProductBatchSIMD16Ext(query, vectors, n, &qty16, out);
+
+    size_t qty_left = qty - qty16;
+    for (size_t i = 0; i < n; i++) {
+        float res_tail = InnerProduct((float *) query + qty16, (float *) vectors[i] + qty16, &qty_left);
+        out[i] = 1.0f - (out[i] + res_tail);
+    }
+}
+
+static void
+InnerProductDistanceBatchSIMD4ExtResiduals(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2 << 2;
+    InnerProductBatchSIMD4Ext(query, vectors, n, &qty4, out);
+
+    size_t qty_left = qty - qty4;
+    for (size_t i = 0; i < n; i++) {
+        float res_tail = InnerProduct((float *) query + qty4, (float *) vectors[i] + qty4, &qty_left);
+        out[i] = 1.0f - (out[i] + res_tail);
+    }
+}
+#endif
+
 class InnerProductSpace : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    DISTFUNC_BATCH<float> fstdistfunc_batch_;
     size_t data_size_;
     size_t dim_;
 
  public:
     InnerProductSpace(size_t dim) {
         fstdistfunc_ = InnerProductDistance;
+        fstdistfunc_batch_ = InnerProductDistanceBatch;
 #if defined(USE_AVX) || defined(USE_SSE) || defined(USE_AVX512)
     #if defined(USE_AVX512)
         if (AVX512Capable()) {
             InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX512;
             InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX512;
+            InnerProductBatchSIMD16Ext = InnerProductBatchSIMD16ExtAVX512;
         } else if (AVXCapable()) {
             InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX;
             InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX;
+            InnerProductBatchSIMD16Ext = InnerProductBatchSIMD16ExtAVX;
         }
     #elif defined(USE_AVX)
         if (AVXCapable()) {
             InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX;
             InnerProductDistanceSIMD16Ext = InnerProductDistanceSIMD16ExtAVX;
+            InnerProductBatchSIMD16Ext = InnerProductBatchSIMD16ExtAVX;
         }
     #endif
     #if defined(USE_AVX)
         if (AVXCapable()) {
             InnerProductSIMD4Ext = InnerProductSIMD4ExtAVX;
             InnerProductDistanceSIMD4Ext = InnerProductDistanceSIMD4ExtAVX;
+            InnerProductBatchSIMD4Ext = InnerProductBatchSIMD4ExtAVX;
         }
     #endif
 
+        if (dim % 16 == 0) {
+            fstdistfunc_ = InnerProductDistanceSIMD16Ext;
+            fstdistfunc_batch_ = InnerProductDistanceBatchSIMD16Ext;
+        } else if (dim % 4 == 0) {
+            fstdistfunc_ = InnerProductDistanceSIMD4Ext;
+            fstdistfunc_batch_ = InnerProductDistanceBatchSIMD4Ext;
+        } else if (dim > 16) {
+            fstdistfunc_ = InnerProductDistanceSIMD16ExtResiduals;
+            fstdistfunc_batch_ = InnerProductDistanceBatchSIMD16ExtResiduals;
+        } else if (dim > 4) {
+            fstdistfunc_ = InnerProductDistanceSIMD4ExtResiduals;
+            fstdistfunc_batch_ = InnerProductDistanceBatchSIMD4ExtResiduals;
+        }
+#elif defined(USE_NEON)
+        // there are no NEON batch kernels: the neighbors of a node are scored one by one
+        fstdistfunc_batch_ = nullptr;
         if (dim % 16 == 0)
             fstdistfunc_ = InnerProductDistanceSIMD16Ext;
         else if (dim % 4 == 0)
@@ -377,6 +719,9 @@ class InnerProductSpace : public SpaceInterface<float> {
             fstdistfunc_ = InnerProductDistanceSIMD16ExtResiduals;
         else if (dim > 4)
             fstdistfunc_ = InnerProductDistanceSIMD4ExtResiduals;
+#endif
+#if defined(USE_SVE)
+        fstdistfunc_ = InnerProductDistanceSVE;
 #endif
         dim_ = dim;
         data_size_ = dim * sizeof(float);
@@ -390,6 +735,10 @@ class InnerProductSpace : public SpaceInterface<float> {
         return fstdistfunc_;
     }
 
+    DISTFUNC_BATCH<float> get_dist_func_batch() {
+        return fstdistfunc_batch_;
+    }
+
     void *get_dist_func_param() {
         return &dim_;
     }
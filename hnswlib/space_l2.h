@@ -22,7 +22,7 @@ L2Sqr(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
 #if defined(USE_AVX512)
 
 // Favor using AVX512 if available.
-static float
+HNSWLIB_TARGET_AVX512 static float
 L2SqrSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float *pVect1 = (float *) pVect1v;
     float *pVect2 = (float *) pVect2v;
@@ -57,7 +57,7 @@ L2SqrSIMD16ExtAVX512(const void *pVect1v, const void *pVect2v, const void *qty_p
 #if defined(USE_AVX)
 
 // Favor using AVX if available.
-static float
+HNSWLIB_TARGET_AVX static float
 L2SqrSIMD16ExtAVX(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     float *pVect1 = (float *) pVect1v;
     float *pVect2 = (float *) pVect2v;
@@ -143,8 +143,45 @@ L2SqrSIMD16ExtSSE(const void *pVect1v, const void *pVect2v, const void *qty_ptr)
 }
 #endif
 
-#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
+#if defined(USE_NEON)
+static float
+L2SqrSIMD16ExtNEON(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    float *pVect1 = (float *) pVect1v;
+    float *pVect2 = (float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4;
+
+    const float *pEnd1 = pVect1 + (qty16 << 4);
+
+    float32x4_t diff0, diff1, diff2, diff3;
+    float32x4_t sum0 = vdupq_n_f32(0);
+    float32x4_t sum1 = vdupq_n_f32(0);
+    float32x4_t sum2 = vdupq_n_f32(0);
+    float32x4_t sum3 = vdupq_n_f32(0);
+
+    while (pVect1 < pEnd1) {
+        diff0 = vsubq_f32(vld1q_f32(pVect1), vld1q_f32(pVect2));
+        diff1 = vsubq_f32(vld1q_f32(pVect1 + 4), vld1q_f32(pVect2 + 4));
+        diff2 = vsubq_f32(vld1q_f32(pVect1 + 8), vld1q_f32(pVect2 + 8));
+        diff3 = vsubq_f32(vld1q_f32(pVect1 + 12), vld1q_f32(pVect2 + 12));
+        pVect1 += 16;
+        pVect2 += 16;
+        sum0 = vfmaq_f32(sum0, diff0, diff0);
+        sum1 = vfmaq_f32(sum1, diff1, diff1);
+        sum2 = vfmaq_f32(sum2, diff2, diff2);
+        sum3 = vfmaq_f32(sum3, diff3, diff3);
+    }
+
+    return vaddvq_f32(vaddq_f32(vaddq_f32(sum0, sum1), vaddq_f32(sum2, sum3)));
+}
+#endif
+
+#if defined(USE_SSE) || defined(USE_NEON)
+#if defined(USE_SSE)
 static DISTFUNC<float> L2SqrSIMD16Ext = L2SqrSIMD16ExtSSE;
+#else
+static DISTFUNC<float> L2SqrSIMD16Ext = L2SqrSIMD16ExtNEON;
+#endif
 
 static float
 L2SqrSIMD16ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
@@ -188,7 +225,30 @@ L2SqrSIMD4Ext(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     _mm_store_ps(TmpRes, sum);
     return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
 }
+#elif defined(USE_NEON)
+static float
+L2SqrSIMD4Ext(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    float *pVect1 = (float *) pVect1v;
+    float *pVect2 = (float *) pVect2v;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2;
+
+    const float *pEnd1 = pVect1 + (qty4 << 2);
 
+    float32x4_t diff;
+    float32x4_t sum = vdupq_n_f32(0);
+
+    while (pVect1 < pEnd1) {
+        diff = vsubq_f32(vld1q_f32(pVect1), vld1q_f32(pVect2));
+        pVect1 += 4;
+        pVect2 += 4;
+        sum = vfmaq_f32(sum, diff, diff);
+    }
+    return vaddvq_f32(sum);
+}
+#endif
+
+#if defined(USE_SSE) || defined(USE_NEON)
 static float
 L2SqrSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
     size_t qty = *((size_t *) qty_ptr);
@@ -205,25 +265,239 @@ L2SqrSIMD4ExtResiduals(const void *pVect1v, const void *pVect2v, const void *qty
 }
 #endif
 
+#if defined(USE_SVE)
+// Handles any dimension: the tail is covered by the predicate of the last iteration
+static float
+L2SqrSVE(const void *pVect1v, const void *pVect2v, const void *qty_ptr) {
+    const float *pVect1 = (const float *) pVect1v;
+    const float *pVect2 = (const float *) pVect2v;
+    uint64_t qty = *((size_t *) qty_ptr);
+
+    svfloat32_t sum = svdup_n_f32(0);
+    for (uint64_t i = 0; i < qty; i += svcntw()) {
+        svbool_t pg = svwhilelt_b32_u64(i, qty);
+        svfloat32_t diff = svsub_f32_x(pg, svld1_f32(pg, pVect1 + i), svld1_f32(pg, pVect2 + i));
+        sum = svmla_f32_m(pg, sum, diff, diff);
+    }
+    return svaddv_f32(svptrue_b32(), sum);
+}
+#endif
+
+/*
+ * Batch kernels score one query against n vectors, e.g. the unvisited neighbors of a node.
+ * Vectors are processed four at a time so each block of the query is loaded once per four
+ * vectors. Every kernel adds up in the same order as the single-vector kernel it mirrors,
+ * so both give the same distance unless the compiler reassociates (e.g. with -Ofast).
+ */
+static void
+L2SqrBatch(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = L2Sqr(query, vectors[i], qty_ptr);
+}
+
+#if defined(USE_AVX512)
+
+HNSWLIB_TARGET_AVX512 static void
+L2SqrBatchSIMD16ExtAVX512(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    const float *q = (const float *) query;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+    float PORTABLE_ALIGN64 TmpRes[16];
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float *p0 = (const float *) vectors[i];
+        const float *p1 = (const float *) vectors[i + 1];
+        const float *p2 = (const float *) vectors[i + 2];
+        const float *p3 = (const float *) vectors[i + 3];
+        __m512 sum0 = _mm512_set1_ps(0);
+        __m512 sum1 = _mm512_set1_ps(0);
+        __m512 sum2 = _mm512_set1_ps(0);
+        __m512 sum3 = _mm512_set1_ps(0);
+
+        for (size_t j = 0; j < qty16; j += 16) {
+            __m512 v = _mm512_loadu_ps(q + j);
+            __m512 diff;
+            diff = _mm512_sub_ps(v, _mm512_loadu_ps(p0 + j));
+            sum0 = _mm512_add_ps(sum0, _mm512_mul_ps(diff, diff));
+            diff = _mm512_sub_ps(v, _mm512_loadu_ps(p1 + j));
+            sum1 = _mm512_add_ps(sum1, _mm512_mul_ps(diff, diff));
+            diff = _mm512_sub_ps(v, _mm512_loadu_ps(p2 + j));
+            sum2 = _mm512_add_ps(sum2, _mm512_mul_ps(diff, diff));
+            diff = _mm512_sub_ps(v, _mm512_loadu_ps(p3 + j));
+            sum3 = _mm512_add_ps(sum3, _mm512_mul_ps(diff, diff));
+        }
+
+        __m512 sums[4] = {sum0, sum1, sum2, sum3};
+        for (int s = 0; s < 4; s++) {
+            _mm512_store_ps(TmpRes, sums[s]);
+            out[i + s] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] +
+                    TmpRes[7] + TmpRes[8] + TmpRes[9] + TmpRes[10] + TmpRes[11] + TmpRes[12] +
+                    TmpRes[13] + TmpRes[14] + TmpRes[15];
+        }
+    }
+    for (; i < n; i++)
+        out[i] = L2SqrSIMD16ExtAVX512(query, vectors[i], qty_ptr);
+}
+#endif
+
+#if defined(USE_AVX)
+
+HNSWLIB_TARGET_AVX static void
+L2SqrBatchSIMD16ExtAVX(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    const float *q = (const float *) query;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float *p0 = (const float *) vectors[i];
+        const float *p1 = (const float *) vectors[i + 1];
+        const float *p2 = (const float *) vectors[i + 2];
+        const float *p3 = (const float *) vectors[i + 3];
+        __m256 sum0 = _mm256_set1_ps(0);
+        __m256 sum1 = _mm256_set1_ps(0);
+        __m256 sum2 = _mm256_set1_ps(0);
+        __m256 sum3 = _mm256_set1_ps(0);
+
+        for (size_t j = 0; j < qty16; j += 8) {
+            __m256 v = _mm256_loadu_ps(q + j);
+            __m256 diff;
+            diff = _mm256_sub_ps(v, _mm256_loadu_ps(p0 + j));
+            sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(diff, diff));
+            diff = _mm256_sub_ps(v, _mm256_loadu_ps(p1 + j));
+            sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(diff, diff));
+            diff = _mm256_sub_ps(v, _mm256_loadu_ps(p2 + j));
+            sum2 = _mm256_add_ps(sum2, _mm256_mul_ps(diff, diff));
+            diff = _mm256_sub_ps(v, _mm256_loadu_ps(p3 + j));
+            sum3 = _mm256_add_ps(sum3, _mm256_mul_ps(diff, diff));
+        }
+
+        __m256 sums[4] = {sum0, sum1, sum2, sum3};
+        for (int s = 0; s < 4; s++) {
+            _mm256_store_ps(TmpRes, sums[s]);
+            out[i + s] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+        }
+    }
+    for (; i < n; i++)
+        out[i] = L2SqrSIMD16ExtAVX(query, vectors[i], qty_ptr);
+}
+#endif
+
+#if defined(USE_SSE)
+
+// Serves both the SIMD16 and the SIMD4 case: the SSE kernels add 4-float blocks in order for either
+static void
+L2SqrBatchSIMD4ExtSSE(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    const float *q = (const float *) query;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2 << 2;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const float *p0 = (const float *) vectors[i];
+        const float *p1 = (const float *) vectors[i + 1];
+        const float *p2 = (const float *) vectors[i + 2];
+        const float *p3 = (const float *) vectors[i + 3];
+        __m128 sum0 = _mm_set1_ps(0);
+        __m128 sum1 = _mm_set1_ps(0);
+        __m128 sum2 = _mm_set1_ps(0);
+        __m128 sum3 = _mm_set1_ps(0);
+
+        for (size_t j = 0; j < qty4; j += 4) {
+            __m128 v = _mm_loadu_ps(q + j);
+            __m128 diff;
+            diff = _mm_sub_ps(v, _mm_loadu_ps(p0 + j));
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(diff, diff));
+            diff = _mm_sub_ps(v, _mm_loadu_ps(p1 + j));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(diff, diff));
+            diff = _mm_sub_ps(v, _mm_loadu_ps(p2 + j));
+            sum2 = _mm_add_ps(sum2, _mm_mul_ps(diff, diff));
+            diff = _mm_sub_ps(v, _mm_loadu_ps(p3 + j));
+            sum3 = _mm_add_ps(sum3, _mm_mul_ps(diff, diff));
+        }
+
+        __m128 sums[4] = {sum0, sum1, sum2, sum3};
+        for (int s = 0; s < 4; s++) {
+            _mm_store_ps(TmpRes, sums[s]);
+            out[i + s] = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+        }
+    }
+    for (; i < n; i++)
+        out[i] = L2SqrSIMD4Ext(query, vectors[i], qty_ptr);
+}
+#endif
+
+#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
+static DISTFUNC_BATCH<float> L2SqrBatchSIMD16Ext = L2SqrBatchSIMD4ExtSSE;
+
+static void
+L2SqrBatchSIMD16ExtResiduals(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+    L2SqrBatchSIMD16Ext(query, vectors, n, &qty16, out);
+
+    size_t qty_left = qty - qty16;
+    for (size_t i = 0; i < n; i++)
+        out[i] += L2Sqr((float *) query + qty16, (float *) vectors[i] + qty16, &qty_left);
+}
+
+static void
+L2SqrBatchSIMD4ExtResiduals(const void *query, const void *const *vectors, size_t n, const void *qty_ptr, float *out) {
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty4 = qty >> 2 << 2;
+    L2SqrBatchSIMD4ExtSSE(query, vectors, n, &qty4, out);
+
+    size_t qty_left = qty - qty4;
+    for (size_t i = 0; i < n; i++)
+        out[i] += L2Sqr((float *) query + qty4, (float *) vectors[i] + qty4, &qty_left);
+}
+#endif
+
 class L2Space : public SpaceInterface<float> {
     DISTFUNC<float> fstdistfunc_;
+    DISTFUNC_BATCH<float> fstdistfunc_batch_;
     size_t data_size_;
     size_t dim_;
 
  public:
     L2Space(size_t dim) {
         fstdistfunc_ = L2Sqr;
+        fstdistfunc_batch_ = L2SqrBatch;
 #if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
     #if defined(USE_AVX512)
-        if (AVX512Capable())
+        if (AVX512Capable()) {
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX512;
-        else if (AVXCapable())
+            L2SqrBatchSIMD16Ext = L2SqrBatchSIMD16ExtAVX512;
+        } else if (AVXCapable()) {
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX;
+            L2SqrBatchSIMD16Ext = L2SqrBatchSIMD16ExtAVX;
+        }
     #elif defined(USE_AVX)
-        if (AVXCapable())
+        if (AVXCapable()) {
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX;
+            L2SqrBatchSIMD16Ext = L2SqrBatchSIMD16ExtAVX;
+        }
     #endif
 
+        if (dim % 16 == 0) {
+            fstdistfunc_ = L2SqrSIMD16Ext;
+            fstdistfunc_batch_ = L2SqrBatchSIMD16Ext;
+        } else if (dim % 4 == 0) {
+            fstdistfunc_ = L2SqrSIMD4Ext;
+            fstdistfunc_batch_ = L2SqrBatchSIMD4ExtSSE;
+        } else if (dim > 16) {
+            fstdistfunc_ = L2SqrSIMD16ExtResiduals;
+            fstdistfunc_batch_ = L2SqrBatchSIMD16ExtResiduals;
+        } else if (dim > 4) {
+            fstdistfunc_ = L2SqrSIMD4ExtResiduals;
+            fstdistfunc_batch_ = L2SqrBatchSIMD4ExtResiduals;
+        }
+#elif defined(USE_NEON)
+        // there are no NEON batch kernels: the neighbors of a node are scored one by one
+        fstdistfunc_batch_ = nullptr;
         if (dim % 16 == 0)
             fstdistfunc_ = L2SqrSIMD16Ext;
         else if (dim % 4 == 0)
@@ -232,6 +506,9 @@ class L2Space : public SpaceInterface<float> {
             fstdistfunc_ = L2SqrSIMD16ExtResiduals;
         else if (dim > 4)
             fstdistfunc_ = L2SqrSIMD4ExtResiduals;
+#endif
+#if defined(USE_SVE)
+        fstdistfunc_ = L2SqrSVE;
 #endif
         dim_ = dim;
         data_size_ = dim * sizeof(float);
@@ -245,6 +522,10 @@ class L2Space : public SpaceInterface<float> {
         return fstdistfunc_;
     }
 
+    DISTFUNC_BATCH<float> get_dist_func_batch() {
+        return fstdistfunc_batch_;
+    }
+
     void *get_dist_func_param() {
         return &dim_;
     }
@@ -291,6 +572,86 @@ static int L2SqrI(const void* __restrict pVect1, const void* __restrict pVect2,
     return (res);
 }
 
+#if defined(USE_SSE)
+static int
+L2SqrI16ExtSSE(const void *__restrict pVect1, const void *__restrict pVect2, const void *__restrict qty_ptr) {
+    const unsigned char *a = (const unsigned char *) pVect1;
+    const unsigned char *b = (const unsigned char *) pVect2;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+    int PORTABLE_ALIGN32 TmpRes[4];
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i sum = _mm_setzero_si128();
+    for (size_t i = 0; i < qty16; i += 16) {
+        __m128i v1 = _mm_loadu_si128((const __m128i *) (a + i));
+        __m128i v2 = _mm_loadu_si128((const __m128i *) (b + i));
+        __m128i diff_lo = _mm_sub_epi16(_mm_unpacklo_epi8(v1, zero), _mm_unpacklo_epi8(v2, zero));
+        __m128i diff_hi = _mm_sub_epi16(_mm_unpackhi_epi8(v1, zero), _mm_unpackhi_epi8(v2, zero));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(diff_lo, diff_lo));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(diff_hi, diff_hi));
+    }
+    _mm_store_si128((__m128i *) TmpRes, sum);
+    int res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+
+    for (size_t i = qty16; i < qty; i++)
+        res += (a[i] - b[i]) * (a[i] - b[i]);
+    return (res);
+}
+#endif
+
+#if defined(USE_AVX2)
+HNSWLIB_TARGET_AVX2 static int
+L2SqrI16ExtAVX2(const void *__restrict pVect1, const void *__restrict pVect2, const void *__restrict qty_ptr) {
+    const unsigned char *a = (const unsigned char *) pVect1;
+    const unsigned char *b = (const unsigned char *) pVect2;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+    int PORTABLE_ALIGN32 TmpRes[8];
+
+    __m256i sum = _mm256_setzero_si256();
+    for (size_t i = 0; i < qty16; i += 16) {
+        __m256i v1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (a + i)));
+        __m256i v2 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (b + i)));
+        __m256i diff = _mm256_sub_epi16(v1, v2);
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(diff, diff));
+    }
+    _mm256_store_si256((__m256i *) TmpRes, sum);
+    int res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+
+    for (size_t i = qty16; i < qty; i++)
+        res += (a[i] - b[i]) * (a[i] - b[i]);
+    return (res);
+}
+#endif
+
+#if defined(USE_NEON)
+static int
+L2SqrI16ExtNEON(const void *__restrict pVect1, const void *__restrict pVect2, const void *__restrict qty_ptr) {
+    const unsigned char *a = (const unsigned char *) pVect1;
+    const unsigned char *b = (const unsigned char *) pVect2;
+    size_t qty = *((size_t *) qty_ptr);
+    size_t qty16 = qty >> 4 << 4;
+
+    uint32x4_t sum = vdupq_n_u32(0);
+    for (size_t i = 0; i < qty16; i += 16) {
+        uint8x16_t v1 = vld1q_u8(a + i);
+        uint8x16_t v2 = vld1q_u8(b + i);
+        uint16x8_t diff_lo = vabdl_u8(vget_low_u8(v1), vget_low_u8(v2));
+        uint16x8_t diff_hi = vabdl_u8(vget_high_u8(v1), vget_high_u8(v2));
+        sum = vmlal_u16(sum, vget_low_u16(diff_lo), vget_low_u16(diff_lo));
+        sum = vmlal_u16(sum, vget_high_u16(diff_lo), vget_high_u16(diff_lo));
+        sum = vmlal_u16(sum, vget_low_u16(diff_hi), vget_low_u16(diff_hi));
+        sum = vmlal_u16(sum, vget_high_u16(diff_hi), vget_high_u16(diff_hi));
+    }
+    int res = (int) vaddvq_u32(sum);
+
+    for (size_t i = qty16; i < qty; i++)
+        res += (a[i] - b[i]) * (a[i] - b[i]);
+    return (res);
+}
+#endif
+
 class L2SpaceI : public SpaceInterface<int> {
     DISTFUNC<int> fstdistfunc_;
     size_t data_size_;
@@ -303,6 +664,18 @@ class L2SpaceI : public SpaceInterface<int> {
         } else {
             fstdistfunc_ = L2SqrI;
         }
+#if defined(USE_SSE)
+        if (dim >= 16) {
+            fstdistfunc_ = L2SqrI16ExtSSE;
+    #if defined(USE_AVX2)
+            if (AVX2Capable())
+                fstdistfunc_ = L2SqrI16ExtAVX2;
+    #endif
+        }
+#elif defined(USE_NEON)
+        if (dim >= 16)
+            fstdistfunc_ = L2SqrI16ExtNEON;
+#endif
         dim_ = dim;
         data_size_ = dim * sizeof(unsigned char);
     }
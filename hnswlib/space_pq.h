@@ -0,0 +1,274 @@
+#pragma once
+#include "hnswlib.h"
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <memory>
+#include <limits>
+
+namespace hnswlib {
+
+// The parameter of the distance functions; starts with the dimension like the other spaces
+struct ProductQuantizerParam {
+    size_t dim;
+    size_t m;
+    size_t dsub;
+    const float *codebook;     // m x PQ_CENTROIDS x dsub
+    DISTFUNC<float> sub_dist;  // L2 or inner product distance of two dsub-dimensional vectors
+    void *sub_param;
+    bool inner_product;
+};
+
+static const size_t PQ_CENTROIDS = 256;
+
+static inline const float *
+PQCentroid(const ProductQuantizerParam *param, size_t sub, unsigned char c) {
+    return param->codebook + (sub * PQ_CENTROIDS + c) * param->dsub;
+}
+
+// Sums of the sub-space distances; an inner product distance per sub-space is 1 - dot, their
+// sum is brought back to 1 - dot of the whole vectors
+static inline float
+PQCombine(const ProductQuantizerParam *param, float sum) {
+    return param->inner_product ? sum - (float) (param->m - 1) : sum;
+}
+
+// Float query vs code
+static float
+PQDistance(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const ProductQuantizerParam *param = (const ProductQuantizerParam *) param_ptr;
+    const float *q = (const float *) pVect1v;
+    const unsigned char *code = (const unsigned char *) pVect2v;
+
+    float res = 0;
+    for (size_t j = 0; j < param->m; j++)
+        res += param->sub_dist(q + j * param->dsub, PQCentroid(param, j, code[j]), param->sub_param);
+    return PQCombine(param, res);
+}
+
+// Prepared query (the table of ProductQuantizedSpace::prepare_query) vs code, m lookups
+static float
+PQTableDistance(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const ProductQuantizerParam *param = (const ProductQuantizerParam *) param_ptr;
+    const float *table = (const float *) pVect1v;
+    const unsigned char *code = (const unsigned char *) pVect2v;
+
+    float res = 0;
+    for (size_t j = 0; j < param->m; j++)
+        res += table[j * PQ_CENTROIDS + code[j]];
+    return PQCombine(param, res);
+}
+
+// Four codes at a time share the loads of the table rows; the sums are those of PQTableDistance
+static void
+PQTableDistanceBatch(const void *query, const void *const *vectors, size_t n, const void *param_ptr, float *out) {
+    const ProductQuantizerParam *param = (const ProductQuantizerParam *) param_ptr;
+    const float *table = (const float *) query;
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const unsigned char *c0 = (const unsigned char *) vectors[i];
+        const unsigned char *c1 = (const unsigned char *) vectors[i + 1];
+        const unsigned char *c2 = (const unsigned char *) vectors[i + 2];
+        const unsigned char *c3 = (const unsigned char *) vectors[i + 3];
+        float r0 = 0, r1 = 0, r2 = 0, r3 = 0;
+        for (size_t j = 0; j < param->m; j++) {
+            const float *row = table + j * PQ_CENTROIDS;
+            r0 += row[c0[j]];
+            r1 += row[c1[j]];
+            r2 += row[c2[j]];
+            r3 += row[c3[j]];
+        }
+        out[i] = PQCombine(param, r0);
+        out[i + 1] = PQCombine(param, r1);
+        out[i + 2] = PQCombine(param, r2);
+        out[i + 3] = PQCombine(param, r3);
+    }
+    for (; i < n; i++)
+        out[i] = PQTableDistance(query, vectors[i], param_ptr);
+}
+
+// Code vs code
+static float
+PQStoredDistance(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const ProductQuantizerParam *param = (const ProductQuantizerParam *) param_ptr;
+    const unsigned char *code1 = (const unsigned char *) pVect1v;
+    const unsigned char *code2 = (const unsigned char *) pVect2v;
+
+    float res = 0;
+    for (size_t j = 0; j < param->m; j++)
+        res += param->sub_dist(PQCentroid(param, j, code1[j]), PQCentroid(param, j, code2[j]), param->sub_param);
+    return PQCombine(param, res);
+}
+
+
+/*
+ * Space storing product quantization codes of float vectors: the vector is split into m
+ * sub-vectors of dim / m dimensions, and each is stored as the 8-bit index of the closest
+ * of 256 centroids learned for that sub-space, so an element takes m bytes.
+ * Distances are squared L2, or 1 - inner product if inner_product is set.
+ *
+ * Sub-space distances use the SIMD kernels of L2Space / InnerProductSpace for dim / m
+ * dimensions. Searches prepare a query once into the table of its m x 256 sub-space distances
+ * to the centroids (m * 1 KB) and score a code with m lookups into it (asymmetric distance
+ * computation); insertions compare the vector with the centroids directly, m distances per code.
+ * The codebook must be learned with train() before the space is used by an index.
+ * It is not part of the index file: keep it with save() / load().
+ */
+class ProductQuantizedSpace : public SpaceInterface<float> {
+    size_t dim_;
+    size_t m_;
+    size_t dsub_;
+    std::vector<float> codebook_;
+    std::unique_ptr<SpaceInterface<float>> subspace_;
+    std::unique_ptr<L2Space> train_space_;  // k-means always clusters by L2
+    ProductQuantizerParam param_;
+
+    size_t nearestCentroid(size_t sub, const float *x) const {
+        DISTFUNC<float> l2 = train_space_->get_dist_func();
+        void *l2_param = train_space_->get_dist_func_param();
+        size_t best = 0;
+        float best_dist = std::numeric_limits<float>::max();
+        for (size_t c = 0; c < PQ_CENTROIDS; c++) {
+            float d = l2(x, PQCentroid(&param_, sub, (unsigned char) c), l2_param);
+            if (d < best_dist) {
+                best_dist = d;
+                best = c;
+            }
+        }
+        return best;
+    }
+
+ public:
+    ProductQuantizedSpace(size_t dim, size_t m, bool inner_product = false)
+        : dim_(dim), m_(m) {
+        if (m == 0 || dim % m != 0)
+            throw std::runtime_error("The dimension must be a multiple of the number of sub-quantizers");
+        dsub_ = dim / m;
+        codebook_.assign(m * PQ_CENTROIDS * dsub_, 0.0f);
+        if (inner_product)
+            subspace_.reset(new InnerProductSpace(dsub_));
+        else
+            subspace_.reset(new L2Space(dsub_));
+        train_space_.reset(new L2Space(dsub_));
+
+        param_.dim = dim_;
+        param_.m = m_;
+        param_.dsub = dsub_;
+        param_.codebook = codebook_.data();
+        param_.sub_dist = subspace_->get_dist_func();
+        param_.sub_param = subspace_->get_dist_func_param();
+        param_.inner_product = inner_product;
+    }
+
+    size_t get_data_size() {
+        return m_;
+    }
+
+    size_t get_vector_size() {
+        return dim_ * sizeof(float);
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return PQDistance;
+    }
+
+    DISTFUNC<float> get_stored_dist_func() {
+        return PQStoredDistance;
+    }
+
+    size_t get_prepared_query_size() {
+        return m_ * PQ_CENTROIDS * sizeof(float);
+    }
+
+    void prepare_query(const void *vector, void *prepared) {
+        const float *q = (const float *) vector;
+        float *table = (float *) prepared;
+        for (size_t j = 0; j < m_; j++) {
+            for (size_t c = 0; c < PQ_CENTROIDS; c++)
+                table[j * PQ_CENTROIDS + c] = param_.sub_dist(q + j * dsub_, PQCentroid(&param_, j, (unsigned char) c), param_.sub_param);
+        }
+    }
+
+    DISTFUNC<float> get_prepared_dist_func() {
+        return PQTableDistance;
+    }
+
+    DISTFUNC_BATCH<float> get_prepared_dist_func_batch() {
+        return PQTableDistanceBatch;
+    }
+
+    void *get_dist_func_param() {
+        return &param_;
+    }
+
+    // Learns the centroids of every sub-space from n vectors with k-means
+    void train(const float *data, size_t n, size_t iterations = 25, unsigned int random_seed = 100) {
+        if (n == 0)
+            throw std::runtime_error("Cannot train a product quantizer without data");
+        std::default_random_engine generator(random_seed);
+        std::uniform_int_distribution<size_t> pick(0, n - 1);
+        std::vector<size_t> assignment(n);
+        std::vector<size_t> counts(PQ_CENTROIDS);
+
+        for (size_t j = 0; j < m_; j++) {
+            float *centroids = codebook_.data() + j * PQ_CENTROIDS * dsub_;
+            // start from distinct training vectors when there are enough of them
+            std::vector<size_t> order(n);
+            for (size_t i = 0; i < n; i++) order[i] = i;
+            std::shuffle(order.begin(), order.end(), generator);
+            for (size_t c = 0; c < PQ_CENTROIDS; c++)
+                memcpy(centroids + c * dsub_, data + order[c % n] * dim_ + j * dsub_, dsub_ * sizeof(float));
+
+            for (size_t it = 0; it < iterations; it++) {
+                for (size_t i = 0; i < n; i++)
+                    assignment[i] = nearestCentroid(j, data + i * dim_ + j * dsub_);
+
+                std::fill(counts.begin(), counts.end(), 0);
+                std::fill(centroids, centroids + PQ_CENTROIDS * dsub_, 0.0f);
+                for (size_t i = 0; i < n; i++) {
+                    const float *x = data + i * dim_ + j * dsub_;
+                    float *c = centroids + assignment[i] * dsub_;
+                    for (size_t d = 0; d < dsub_; d++) c[d] += x[d];
+                    counts[assignment[i]]++;
+                }
+                for (size_t c = 0; c < PQ_CENTROIDS; c++) {
+                    if (counts[c] == 0) {
+                        // empty cluster: restart it from a random training vector
+                        memcpy(centroids + c * dsub_, data + pick(generator) * dim_ + j * dsub_, dsub_ * sizeof(float));
+                        continue;
+                    }
+                    for (size_t d = 0; d < dsub_; d++) centroids[c * dsub_ + d] /= counts[c];
+                }
+            }
+        }
+    }
+
+    void encode(const void *vector, void *data) {
+        const float *x = (const float *) vector;
+        unsigned char *code = (unsigned char *) data;
+        for (size_t j = 0; j < m_; j++)
+            code[j] = (unsigned char) nearestCentroid(j, x + j * dsub_);
+    }
+
+    void decode(const void *data, void *vector) {
+        const unsigned char *code = (const unsigned char *) data;
+        float *x = (float *) vector;
+        for (size_t j = 0; j < m_; j++)
+            memcpy(x + j * dsub_, PQCentroid(&param_, j, code[j]), dsub_ * sizeof(float));
+    }
+
+    void save(std::ostream &out) const {
+        out.write((const char *) codebook_.data(), codebook_.size() * sizeof(float));
+    }
+
+    void load(std::istream &in) {
+        in.read((char *) codebook_.data(), codebook_.size() * sizeof(float));
+        if (!in)
+            throw std::runtime_error("Cannot read the product quantizer codebook");
+    }
+
+    ~ProductQuantizedSpace() {}
+};
+
+}  // namespace hnswlib
@@ -0,0 +1,327 @@
+#pragma once
+#include "hnswlib.h"
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+namespace hnswlib {
+
+/*
+ * Scalar quantization: every dimension is stored as an 8-bit (SQ8) or a 4-bit (SQ4) code over
+ * the [min, max] range of that dimension seen in training, so an element takes dim or
+ * (dim + 1) / 2 bytes instead of 4 * dim.
+ *
+ * Searches and insertions compare the float vector they are given with the stored codes, which
+ * are decoded on the fly (asymmetric distance); codes are compared with each other only while
+ * linking the graph.
+ */
+enum class ScalarQuantizerType {
+    SQ8,
+    SQ4
+};
+
+// The parameter of the distance functions; starts with the dimension like the other spaces
+struct ScalarQuantizerParam {
+    size_t dim;
+    const float *vmin;
+    const float *scale;
+};
+
+template<bool four_bit>
+static inline unsigned
+SQCode(const unsigned char *code, size_t i) {
+    if (four_bit)
+        return (code[i >> 1] >> ((i & 1) << 2)) & 0x0f;
+    return code[i];
+}
+
+// Distance between a float query (or, if symmetric, a second code) and a code
+template<bool four_bit, bool inner_product, bool symmetric>
+static float
+SQDistance(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const ScalarQuantizerParam *param = (const ScalarQuantizerParam *) param_ptr;
+    const unsigned char *code = (const unsigned char *) pVect2v;
+
+    float res = 0;
+    for (size_t i = 0; i < param->dim; i++) {
+        float x = param->vmin[i] + SQCode<four_bit>(code, i) * param->scale[i];
+        float q = symmetric ?
+            param->vmin[i] + SQCode<four_bit>((const unsigned char *) pVect1v, i) * param->scale[i] :
+            ((const float *) pVect1v)[i];
+        if (inner_product) {
+            res += q * x;
+        } else {
+            float t = q - x;
+            res += t * t;
+        }
+    }
+    return inner_product ? 1.0f - res : res;
+}
+
+#if defined(USE_AVX512)
+
+// Decodes dimensions [i, i + 16)
+template<bool four_bit>
+HNSWLIB_TARGET_AVX512 static inline __m512
+SQDecode16AVX512(const unsigned char *code, const float *vmin, const float *scale, size_t i) {
+    __m128i bytes;
+    if (four_bit) {
+        __m128i packed = _mm_loadl_epi64((const __m128i *) (code + (i >> 1)));
+        __m128i mask = _mm_set1_epi8(0x0f);
+        __m128i lo = _mm_and_si128(packed, mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(packed, 4), mask);
+        bytes = _mm_unpacklo_epi8(lo, hi);
+    } else {
+        bytes = _mm_loadu_si128((const __m128i *) (code + i));
+    }
+    __m512 c = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(bytes));
+    return _mm512_fmadd_ps(c, _mm512_loadu_ps(scale + i), _mm512_loadu_ps(vmin + i));
+}
+
+template<bool four_bit, bool inner_product, bool symmetric>
+HNSWLIB_TARGET_AVX512 static float
+SQDistanceAVX512(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const ScalarQuantizerParam *param = (const ScalarQuantizerParam *) param_ptr;
+    const unsigned char *code = (const unsigned char *) pVect2v;
+    size_t dim16 = param->dim >> 4 << 4;
+
+    __m512 sum = _mm512_set1_ps(0);
+    for (size_t i = 0; i < dim16; i += 16) {
+        __m512 x = SQDecode16AVX512<four_bit>(code, param->vmin, param->scale, i);
+        __m512 q = symmetric ?
+            SQDecode16AVX512<four_bit>((const unsigned char *) pVect1v, param->vmin, param->scale, i) :
+            _mm512_loadu_ps((const float *) pVect1v + i);
+        if (inner_product) {
+            sum = _mm512_fmadd_ps(q, x, sum);
+        } else {
+            __m512 diff = _mm512_sub_ps(q, x);
+            sum = _mm512_fmadd_ps(diff, diff, sum);
+        }
+    }
+    float res = _mm512_reduce_add_ps(sum);
+
+    for (size_t i = dim16; i < param->dim; i++) {
+        float x = param->vmin[i] + SQCode<four_bit>(code, i) * param->scale[i];
+        float q = symmetric ?
+            param->vmin[i] + SQCode<four_bit>((const unsigned char *) pVect1v, i) * param->scale[i] :
+            ((const float *) pVect1v)[i];
+        if (inner_product) {
+            res += q * x;
+        } else {
+            float t = q - x;
+            res += t * t;
+        }
+    }
+    return inner_product ? 1.0f - res : res;
+}
+
+#endif
+
+#if defined(USE_AVX2)
+
+// Decodes dimensions [i, i + 8)
+template<bool four_bit>
+HNSWLIB_TARGET_AVX2 static inline __m256
+SQDecode8AVX2(const unsigned char *code, const float *vmin, const float *scale, size_t i) {
+    __m128i bytes;
+    if (four_bit) {
+        int packed_bits;
+        memcpy(&packed_bits, code + (i >> 1), sizeof(int));
+        __m128i packed = _mm_cvtsi32_si128(packed_bits);
+        __m128i mask = _mm_set1_epi8(0x0f);
+        __m128i lo = _mm_and_si128(packed, mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(packed, 4), mask);
+        bytes = _mm_unpacklo_epi8(lo, hi);
+    } else {
+        bytes = _mm_loadl_epi64((const __m128i *) (code + i));
+    }
+    __m256 c = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+    return _mm256_add_ps(_mm256_mul_ps(c, _mm256_loadu_ps(scale + i)), _mm256_loadu_ps(vmin + i));
+}
+
+template<bool four_bit, bool inner_product, bool symmetric>
+HNSWLIB_TARGET_AVX2 static float
+SQDistanceAVX2(const void *pVect1v, const void *pVect2v, const void *param_ptr) {
+    const ScalarQuantizerParam *param = (const ScalarQuantizerParam *) param_ptr;
+    const unsigned char *code = (const unsigned char *) pVect2v;
+    size_t dim8 = param->dim >> 3 << 3;
+    float PORTABLE_ALIGN32 TmpRes[8];
+
+    __m256 sum = _mm256_set1_ps(0);
+    for (size_t i = 0; i < dim8; i += 8) {
+        __m256 x = SQDecode8AVX2<four_bit>(code, param->vmin, param->scale, i);
+        __m256 q = symmetric ?
+            SQDecode8AVX2<four_bit>((const unsigned char *) pVect1v, param->vmin, param->scale, i) :
+            _mm256_loadu_ps((const float *) pVect1v + i);
+        if (inner_product) {
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(q, x));
+        } else {
+            __m256 diff = _mm256_sub_ps(q, x);
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+        }
+    }
+    _mm256_store_ps(TmpRes, sum);
+    float res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] + TmpRes[5] + TmpRes[6] + TmpRes[7];
+
+    for (size_t i = dim8; i < param->dim; i++) {
+        float x = param->vmin[i] + SQCode<four_bit>(code, i) * param->scale[i];
+        float q = symmetric ?
+            param->vmin[i] + SQCode<four_bit>((const unsigned char *) pVect1v, i) * param->scale[i] :
+            ((const float *) pVect1v)[i];
+        if (inner_product) {
+            res += q * x;
+        } else {
+            float t = q - x;
+            res += t * t;
+        }
+    }
+    return inner_product ? 1.0f - res : res;
+}
+
+#endif
+
+
+/*
+ * Space storing SQ8 / SQ4 codes of float vectors. Distances are squared L2, or
+ * 1 - inner product if inner_product is set.
+ *
+ * The per-dimension ranges must be set with train() or setRange() before the space is used by
+ * an index. They are not part of the index file: keep them with save() / load().
+ */
+class ScalarQuantizedSpace : public SpaceInterface<float> {
+    DISTFUNC<float> fstdistfunc_;
+    DISTFUNC<float> fststoreddistfunc_;
+    size_t data_size_;
+    size_t dim_;
+    ScalarQuantizerType type_;
+    bool inner_product_;
+
+    std::vector<float> vmin_;
+    std::vector<float> scale_;
+    ScalarQuantizerParam param_;
+
+    template<bool four_bit, bool inner_product>
+    void setDistFuncs() {
+        fstdistfunc_ = SQDistance<four_bit, inner_product, false>;
+        fststoreddistfunc_ = SQDistance<four_bit, inner_product, true>;
+#if defined(USE_AVX512)
+        if (AVX512Capable()) {
+            fstdistfunc_ = SQDistanceAVX512<four_bit, inner_product, false>;
+            fststoreddistfunc_ = SQDistanceAVX512<four_bit, inner_product, true>;
+            return;
+        }
+#endif
+#if defined(USE_AVX2)
+        if (AVX2Capable()) {
+            fstdistfunc_ = SQDistanceAVX2<four_bit, inner_product, false>;
+            fststoreddistfunc_ = SQDistanceAVX2<four_bit, inner_product, true>;
+        }
+#endif
+    }
+
+ public:
+    ScalarQuantizedSpace(size_t dim, ScalarQuantizerType type = ScalarQuantizerType::SQ8, bool inner_product = false)
+        : dim_(dim), type_(type), inner_product_(inner_product), vmin_(dim, 0.0f), scale_(dim, 0.0f) {
+        data_size_ = type == ScalarQuantizerType::SQ8 ? dim : (dim + 1) / 2;
+        if (type == ScalarQuantizerType::SQ8) {
+            if (inner_product) setDistFuncs<false, true>(); else setDistFuncs<false, false>();
+        } else {
+            if (inner_product) setDistFuncs<true, true>(); else setDistFuncs<true, false>();
+        }
+        param_.dim = dim_;
+        param_.vmin = vmin_.data();
+        param_.scale = scale_.data();
+    }
+
+    size_t get_data_size() {
+        return data_size_;
+    }
+
+    size_t get_vector_size() {
+        return dim_ * sizeof(float);
+    }
+
+    DISTFUNC<float> get_dist_func() {
+        return fstdistfunc_;
+    }
+
+    DISTFUNC<float> get_stored_dist_func() {
+        return fststoreddistfunc_;
+    }
+
+    void *get_dist_func_param() {
+        return &param_;
+    }
+
+    unsigned levels() const {
+        return type_ == ScalarQuantizerType::SQ8 ? 255 : 15;
+    }
+
+    // Sets the range of every dimension to the values seen in n vectors
+    void train(const float *data, size_t n) {
+        if (n == 0)
+            throw std::runtime_error("Cannot train a scalar quantizer without data");
+        std::vector<float> vmax(dim_, std::numeric_limits<float>::lowest());
+        for (size_t d = 0; d < dim_; d++)
+            vmin_[d] = std::numeric_limits<float>::max();
+        for (size_t i = 0; i < n; i++) {
+            for (size_t d = 0; d < dim_; d++) {
+                float x = data[i * dim_ + d];
+                vmin_[d] = std::min(vmin_[d], x);
+                vmax[d] = std::max(vmax[d], x);
+            }
+        }
+        setRange(vmin_.data(), vmax.data());
+    }
+
+    void setRange(const float *vmin, const float *vmax) {
+        for (size_t d = 0; d < dim_; d++) {
+            vmin_[d] = vmin[d];
+            scale_[d] = (vmax[d] - vmin[d]) / levels();
+        }
+    }
+
+    void encode(const void *vector, void *data) {
+        const float *x = (const float *) vector;
+        unsigned char *code = (unsigned char *) data;
+        memset(code, 0, data_size_);
+        for (size_t d = 0; d < dim_; d++) {
+            float c = scale_[d] > 0 ? std::round((x[d] - vmin_[d]) / scale_[d]) : 0.0f;
+            unsigned q = (unsigned) std::min(std::max(c, 0.0f), (float) levels());
+            if (type_ == ScalarQuantizerType::SQ8)
+                code[d] = (unsigned char) q;
+            else
+                code[d >> 1] |= (unsigned char) (q << ((d & 1) << 2));
+        }
+    }
+
+    void decode(const void *data, void *vector) {
+        const unsigned char *code = (const unsigned char *) data;
+        float *x = (float *) vector;
+        for (size_t d = 0; d < dim_; d++) {
+            unsigned c = type_ == ScalarQuantizerType::SQ8 ? SQCode<false>(code, d) : SQCode<true>(code, d);
+            x[d] = vmin_[d] + c * scale_[d];
+        }
+    }
+
+    void save(std::ostream &out) const {
+        for (size_t d = 0; d < dim_; d++) {
+            writeBinaryPOD(out, vmin_[d]);
+            writeBinaryPOD(out, scale_[d]);
+        }
+    }
+
+    void load(std::istream &in) {
+        for (size_t d = 0; d < dim_; d++) {
+            readBinaryPOD(in, vmin_[d]);
+            readBinaryPOD(in, scale_[d]);
+        }
+        if (!in)
+            throw std::runtime_error("Cannot read the scalar quantizer ranges");
+    }
+
+    ~ScalarQuantizedSpace() {}
+};
+
+}  // namespace hnswlib
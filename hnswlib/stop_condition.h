@@ -2,6 +2,7 @@
 #include "space_l2.h"
 #include "space_ip.h"
 #include <assert.h>
+#include <atomic>
 #include <unordered_map>
 
 namespace hnswlib {
@@ -25,7 +26,7 @@ class MultiVectorL2Space : public BaseMultiVectorSpace<DOCIDTYPE> {
  public:
     MultiVectorL2Space(size_t dim) {
         fstdistfunc_ = L2Sqr;
-#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
+#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512) || defined(USE_NEON)
     #if defined(USE_AVX512)
         if (AVX512Capable())
             L2SqrSIMD16Ext = L2SqrSIMD16ExtAVX512;
@@ -44,6 +45,9 @@ class MultiVectorL2Space : public BaseMultiVectorSpace<DOCIDTYPE> {
             fstdistfunc_ = L2SqrSIMD16ExtResiduals;
         else if (dim > 4)
             fstdistfunc_ = L2SqrSIMD4ExtResiduals;
+#endif
+#if defined(USE_SVE)
+        fstdistfunc_ = L2SqrSVE;
 #endif
         dim_ = dim;
         vector_size_ = dim * sizeof(float);
@@ -84,7 +88,7 @@ class MultiVectorInnerProductSpace : public BaseMultiVectorSpace<DOCIDTYPE> {
  public:
     MultiVectorInnerProductSpace(size_t dim) {
         fstdistfunc_ = InnerProductDistance;
-#if defined(USE_AVX) || defined(USE_SSE) || defined(USE_AVX512)
+#if defined(USE_AVX) || defined(USE_SSE) || defined(USE_AVX512) || defined(USE_NEON)
     #if defined(USE_AVX512)
         if (AVX512Capable()) {
             InnerProductSIMD16Ext = InnerProductSIMD16ExtAVX512;
@@ -114,6 +118,9 @@ class MultiVectorInnerProductSpace : public BaseMultiVectorSpace<DOCIDTYPE> {
             fstdistfunc_ = InnerProductDistanceSIMD16ExtResiduals;
         else if (dim > 4)
             fstdistfunc_ = InnerProductDistanceSIMD4ExtResiduals;
+#endif
+#if defined(USE_SVE)
+        fstdistfunc_ = InnerProductDistanceSVE;
 #endif
         vector_size_ = dim * sizeof(float);
         data_size_ = vector_size_ + sizeof(DOCIDTYPE);
@@ -144,7 +151,7 @@ class MultiVectorInnerProductSpace : public BaseMultiVectorSpace<DOCIDTYPE> {
 
 
 template<typename DOCIDTYPE, typename dist_t>
-class MultiVectorSearchStopCondition : public BaseSearchStopCondition<dist_t> {
+class MultiVectorSearchStopCondition final : public BaseSearchStopCondition<dist_t> {
     size_t curr_num_docs_;
     size_t num_docs_to_search_;
     size_t ef_collection_;
@@ -216,7 +223,7 @@ class MultiVectorSearchStopCondition : public BaseSearchStopCondition<dist_t> {
 
 
 template<typename dist_t>
-class EpsilonSearchStopCondition : public BaseSearchStopCondition<dist_t> {
+class EpsilonSearchStopCondition final : public BaseSearchStopCondition<dist_t> {
     float epsilon_;
     size_t min_num_candidates_;
     size_t max_num_candidates_;
@@ -257,7 +264,7 @@ class EpsilonSearchStopCondition : public BaseSearchStopCondition<dist_t> {
         return flag_consider_candidate;
     }
 
-    bool should_remove_extra() {
+    bool should_remove_extra() override {
         bool flag_remove_extra = curr_num_items_ > max_num_candidates_;
         return flag_remove_extra;
     }
@@ -273,4 +280,179 @@ class EpsilonSearchStopCondition : public BaseSearchStopCondition<dist_t> {
 
     ~EpsilonSearchStopCondition() {}
 };
+
+/*
+ * Used by HierarchicalNSW::searchRange: the results are the elements within radius and, besides
+ * them, the min_num_candidates closest elements, which keep the search going until it reaches
+ * the region within radius.
+ */
+template<typename dist_t>
+class RangeSearchStopCondition final : public BaseSearchStopCondition<dist_t> {
+    dist_t radius_;
+    size_t min_num_candidates_;
+    size_t curr_num_items_;
+    size_t curr_num_in_range_;
+
+ public:
+    RangeSearchStopCondition(dist_t radius, size_t min_num_candidates) {
+        radius_ = radius;
+        min_num_candidates_ = std::max<size_t>(min_num_candidates, 1);
+        curr_num_items_ = 0;
+        curr_num_in_range_ = 0;
+    }
+
+    void add_point_to_result(labeltype label, const void *datapoint, dist_t dist) override {
+        curr_num_items_ += 1;
+        if (dist <= radius_)
+            curr_num_in_range_ += 1;
+    }
+
+    // only results out of range are removed (see should_remove_extra)
+    void remove_point_from_result(labeltype label, const void *datapoint, dist_t dist) override {
+        curr_num_items_ -= 1;
+    }
+
+    bool should_stop_search(dist_t candidate_dist, dist_t lowerBound) override {
+        return candidate_dist > radius_ && candidate_dist > lowerBound && curr_num_items_ >= min_num_candidates_;
+    }
+
+    bool should_consider_candidate(dist_t candidate_dist, dist_t lowerBound) override {
+        return candidate_dist <= radius_ || curr_num_items_ < min_num_candidates_ || lowerBound > candidate_dist;
+    }
+
+    // the farthest result is out of range as long as not every result is within radius
+    bool should_remove_extra() override {
+        return curr_num_items_ > min_num_candidates_ && curr_num_items_ > curr_num_in_range_;
+    }
+
+    void filter_results(std::vector<std::pair<dist_t, labeltype >> &candidates) override {
+        while (!candidates.empty() && candidates.back().first > radius_) {
+            candidates.pop_back();
+        }
+    }
+
+    ~RangeSearchStopCondition() {}
+};
+
+/*
+ * A k nearest neighbor search for searchStopConditionClosest whose ef adapts to the query: it stops
+ * once the k closest results have not changed for patience expansions, or as a search with
+ * ef = max_ef would. Easy queries stop after a few expansions, hard ones get up to max_ef.
+ * At least k results are collected before the search may stop early; k results are returned.
+ */
+template<typename dist_t>
+class AdaptiveSearchStopCondition final : public BaseSearchStopCondition<dist_t> {
+    size_t k_;
+    size_t max_ef_;
+    size_t patience_;
+    size_t curr_num_items_;
+    size_t stale_expansions_;  // expansions since the k closest results last changed
+    std::priority_queue<dist_t> top_k_;  // distances of the k closest results
+
+ public:
+    AdaptiveSearchStopCondition(size_t k, size_t max_ef, size_t patience) {
+        k_ = std::max<size_t>(k, 1);
+        max_ef_ = std::max(max_ef, k_);
+        patience_ = patience;
+        curr_num_items_ = 0;
+        stale_expansions_ = 0;
+    }
+
+    void add_point_to_result(labeltype label, const void *datapoint, dist_t dist) override {
+        curr_num_items_ += 1;
+        if (top_k_.size() < k_) {
+            top_k_.push(dist);
+            stale_expansions_ = 0;
+        } else if (dist < top_k_.top()) {
+            top_k_.pop();
+            top_k_.push(dist);
+            stale_expansions_ = 0;
+        }
+    }
+
+    // the farthest of more than max_ef >= k results is never one of the k closest
+    void remove_point_from_result(labeltype label, const void *datapoint, dist_t dist) override {
+        curr_num_items_ -= 1;
+    }
+
+    bool should_stop_search(dist_t candidate_dist, dist_t lowerBound) override {
+        if (candidate_dist > lowerBound && curr_num_items_ == max_ef_)
+            return true;
+        if (top_k_.size() == k_ && stale_expansions_ >= patience_)
+            return true;
+        stale_expansions_ += 1;
+        return false;
+    }
+
+    bool should_consider_candidate(dist_t candidate_dist, dist_t lowerBound) override {
+        return curr_num_items_ < max_ef_ || lowerBound > candidate_dist;
+    }
+
+    bool should_remove_extra() override {
+        return curr_num_items_ > max_ef_;
+    }
+
+    void filter_results(std::vector<std::pair<dist_t, labeltype >> &candidates) override {
+        if (candidates.size() > k_)
+            candidates.resize(k_);
+    }
+
+    ~AdaptiveSearchStopCondition() {}
+};
+
+/*
+ * Used by ShardedHierarchicalNSW for the search of one shard: a search for the ef nearest elements
+ * of the shard that also stops at candidates farther than bound, the smallest distance of the ef-th
+ * result that a shard of the query reached so far. The search lowers bound to its own ef-th
+ * distance as it improves. With it, the shards together explore about as far from the query as a
+ * single index with the same ef would, and a shard without near elements stops early.
+ */
+template<typename dist_t>
+class SharedBoundSearchStopCondition final : public BaseSearchStopCondition<dist_t> {
+    std::atomic<dist_t> &bound_;
+    size_t k_;
+    size_t ef_;
+    size_t curr_num_items_;
+
+    // the smaller of lowerBound and the shared bound, lowering the shared bound to lowerBound
+    dist_t sharedBound(dist_t lowerBound) {
+        dist_t current = bound_.load(std::memory_order_relaxed);
+        while (lowerBound < current && !bound_.compare_exchange_weak(current, lowerBound, std::memory_order_relaxed)) {}
+        return std::min(current, lowerBound);
+    }
+
+ public:
+    SharedBoundSearchStopCondition(std::atomic<dist_t> &bound, size_t k, size_t ef) : bound_(bound) {
+        k_ = std::max<size_t>(k, 1);
+        ef_ = std::max(ef, k_);
+        curr_num_items_ = 0;
+    }
+
+    void add_point_to_result(labeltype label, const void *datapoint, dist_t dist) override {
+        curr_num_items_ += 1;
+    }
+
+    void remove_point_from_result(labeltype label, const void *datapoint, dist_t dist) override {
+        curr_num_items_ -= 1;
+    }
+
+    bool should_stop_search(dist_t candidate_dist, dist_t lowerBound) override {
+        return curr_num_items_ == ef_ && candidate_dist > sharedBound(lowerBound);
+    }
+
+    bool should_consider_candidate(dist_t candidate_dist, dist_t lowerBound) override {
+        return curr_num_items_ < ef_ || candidate_dist < sharedBound(lowerBound);
+    }
+
+    bool should_remove_extra() override {
+        return curr_num_items_ > ef_;
+    }
+
+    void filter_results(std::vector<std::pair<dist_t, labeltype >> &candidates) override {
+        if (candidates.size() > k_)
+            candidates.resize(k_);
+    }
+
+    ~SharedBoundSearchStopCondition() {}
+};
 }  // namespace hnswlib
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <stddef.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace hnswlib {
+
+/*
+ * Persistent threads for parallel loops over rows, so that small batches do not pay for starting
+ * threads on every call.
+ *
+ * parallelFor splits the rows into one contiguous range per thread. Each thread takes chunks from
+ * the front of its own range and, once it is empty, steals chunks from the ranges of the others.
+ * The calling thread works as thread 0, so a pool of size 1 starts no thread at all.
+ *
+ * Calls from different threads run at the same time: each call is a job of its own, its caller
+ * works on it and the idle threads of the pool join the open jobs, oldest first. A call made from
+ * inside a task of the same pool runs on the calling thread alone.
+ */
+class ThreadPool {
+    // the unclaimed rows of one thread, [next, end), padded to a cache line
+    struct Range {
+        std::atomic<size_t> next{0};
+        size_t end{0};
+        char padding[64 - 2 * sizeof(size_t)];
+    };
+
+    // One parallelFor, owned by its caller
+    struct Job {
+        const std::function<void(size_t, size_t)> *task{nullptr};
+        size_t chunk_size{1};
+        std::unique_ptr<Range[]> ranges;  // one per thread of the pool
+        std::atomic<bool> failed{false};
+        std::exception_ptr exception;  // guarded by lock_
+        size_t workers{0};             // pool threads working on the job, guarded by lock_
+    };
+
+    size_t num_threads_;
+    std::vector<std::thread> threads_;
+
+    std::mutex lock_;
+    std::condition_variable job_ready_;
+    std::condition_variable job_done_;
+    std::deque<Job *> open_jobs_;  // jobs that threads may still join
+    bool stopping_{false};
+
+    static ThreadPool *&currentPool() {
+        static thread_local ThreadPool *pool = nullptr;
+        return pool;
+    }
+
+    // Claims up to chunk_size rows of a range, returns false if it is empty
+    static bool claim(Range &range, size_t chunk_size, size_t &begin, size_t &end) {
+        if (range.next.load(std::memory_order_relaxed) >= range.end)
+            return false;
+        begin = range.next.fetch_add(chunk_size);
+        if (begin >= range.end)
+            return false;
+        end = std::min(begin + chunk_size, range.end);
+        return true;
+    }
+
+    void work(Job &job, size_t thread_id) {
+        const std::function<void(size_t, size_t)> &task = *job.task;
+        size_t begin, end;
+        for (size_t i = 0; i < num_threads_ && !job.failed.load(std::memory_order_relaxed); i++) {
+            Range &range = job.ranges[(thread_id + i) % num_threads_];
+            while (!job.failed.load(std::memory_order_relaxed) && claim(range, job.chunk_size, begin, end)) {
+                try {
+                    for (size_t row = begin; row < end; row++)
+                        task(row, thread_id);
+                } catch (...) {
+                    std::unique_lock<std::mutex> lock(lock_);
+                    if (!job.exception)
+                        job.exception = std::current_exception();
+                    job.failed = true;
+                }
+            }
+        }
+    }
+
+    // Takes the job out of open_jobs_ once its rows are claimed, lock_ held
+    void closeJob(Job *job) {
+        auto it = std::find(open_jobs_.begin(), open_jobs_.end(), job);
+        if (it != open_jobs_.end())
+            open_jobs_.erase(it);
+    }
+
+    void workerLoop(size_t thread_id) {
+        currentPool() = this;
+        std::unique_lock<std::mutex> lock(lock_);
+        while (true) {
+            job_ready_.wait(lock, [&]() { return stopping_ || !open_jobs_.empty(); });
+            if (stopping_)
+                return;
+            Job *job = open_jobs_.front();
+            job->workers++;
+            lock.unlock();
+            work(*job, thread_id);
+            lock.lock();
+            // every row is claimed: no other thread joins it, the caller waits for those on it
+            closeJob(job);
+            if (--job->workers == 0)
+                job_done_.notify_all();
+        }
+    }
+
+    static void pinToCore(std::thread &thread, size_t core) {
+#if defined(__linux__)
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core % std::max(std::thread::hardware_concurrency(), 1u), &cpus);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#else
+        (void) thread;
+        (void) core;
+#endif
+    }
+
+ public:
+    /*
+     * num_threads 0 uses every hardware thread. With pin_threads, thread i runs on core i only
+     * (where the platform allows it); the calling thread is never pinned.
+     */
+    explicit ThreadPool(size_t num_threads = 0, bool pin_threads = false) {
+        if (num_threads == 0)
+            num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        num_threads_ = num_threads;
+        for (size_t i = 1; i < num_threads_; i++) {
+            threads_.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+            if (pin_threads)
+                pinToCore(threads_.back(), i);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            stopping_ = true;
+        }
+        job_ready_.notify_all();
+        for (auto &thread : threads_)
+            thread.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const {
+        return num_threads_;
+    }
+
+    /*
+     * Calls fn(row, thread_id) for every row in [start, end), thread_id in [0, size()). Rows are
+     * claimed chunk_size at a time, 0 picks a size that leaves each thread about 16 chunks.
+     * If fn throws, the rows not started yet are skipped and the first exception is rethrown.
+     */
+    template<class Function>
+    void parallelFor(size_t start, size_t end, Function fn, size_t chunk_size = 0) {
+        if (start >= end)
+            return;
+        size_t n = end - start;
+        if (num_threads_ == 1 || n == 1 || currentPool() == this) {
+            for (size_t row = start; row < end; row++)
+                fn(row, 0);
+            return;
+        }
+
+        std::function<void(size_t, size_t)> task = fn;
+        Job job;
+        job.task = &task;
+        job.chunk_size = chunk_size != 0 ? chunk_size : std::max<size_t>(1, n / (num_threads_ * 16));
+        job.ranges.reset(new Range[num_threads_]);
+        for (size_t i = 0; i < num_threads_; i++) {
+            job.ranges[i].next = start + n * i / num_threads_;
+            job.ranges[i].end = start + n * (i + 1) / num_threads_;
+        }
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            open_jobs_.push_back(&job);
+        }
+        job_ready_.notify_all();
+
+        ThreadPool *outer_pool = currentPool();
+        currentPool() = this;
+        work(job, 0);
+        currentPool() = outer_pool;
+
+        std::unique_lock<std::mutex> lock(lock_);
+        closeJob(&job);
+        job_done_.wait(lock, [&]() { return job.workers == 0; });
+        if (job.exception)
+            std::rethrow_exception(job.exception);
+    }
+};
+
+}  // namespace hnswlib
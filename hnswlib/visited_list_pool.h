@@ -2,16 +2,27 @@
 
 #include <mutex>
 #include <string.h>
-#include <deque>
+#include <stdint.h>
+#include <atomic>
+#include <stdexcept>
+#include <memory>
+#include <vector>
+#include "neighbor_pool.h"
 
 namespace hnswlib {
-typedef unsigned short int vl_type;
+// 32-bit epochs: the array is cleared only once every 2^32 - 1 queries instead of every 65535
+typedef unsigned int vl_type;
 
 class VisitedList {
  public:
     vl_type curV;
     vl_type *mass;
     unsigned int numelements;
+    uint32_t pool_index{0};              // position in the owning pool
+    std::atomic<uint32_t> next_free{0};  // link of the pool free stack (index + 1, 0 is the end)
+    std::unique_ptr<NeighborPoolBase> neighbor_pool;  // candidate buffers of the searches using the list
+    std::unique_ptr<NeighborPoolBase> repair_buffers;  // buffers of the updates using the list
+    std::vector<char> prepared_query;  // the query of the search using the list, as its space prepared it
 
     VisitedList(int numelements1) {
         curV = -1;
@@ -27,52 +38,199 @@ class VisitedList {
         }
     }
 
+    // An index always asks for the same types
+    template<typename dist_t, typename id_t>
+    NeighborPool<dist_t, id_t> &getNeighborPool() {
+        if (!neighbor_pool)
+            neighbor_pool.reset(new NeighborPool<dist_t, id_t>());
+        return *static_cast<NeighborPool<dist_t, id_t> *>(neighbor_pool.get());
+    }
+
+    template<typename dist_t, typename id_t>
+    RepairBuffers<dist_t, id_t> &getRepairBuffers() {
+        if (!repair_buffers)
+            repair_buffers.reset(new RepairBuffers<dist_t, id_t>());
+        return *static_cast<RepairBuffers<dist_t, id_t> *>(repair_buffers.get());
+    }
+
     ~VisitedList() { delete[] mass; }
 };
+/*
+ * Dense numbers of the running threads, from 0 up. A number is handed to a new thread once the
+ * thread that had it exits, so the numbers stay below the largest count of threads alive at once.
+ */
+class ThreadIndex {
+    struct Registry {
+        std::mutex mutex;
+        std::vector<uint32_t> free;
+        uint32_t next{0};
+    };
+
+    // Intentionally leaked: threads may exit after static destruction
+    static Registry &registry() {
+        static Registry *r = new Registry();
+        return *r;
+    }
+
+    struct Holder {
+        uint32_t index;
+
+        Holder() {
+            Registry &r = registry();
+            std::unique_lock <std::mutex> lock(r.mutex);
+            if (r.free.empty()) {
+                index = r.next++;
+            } else {
+                index = r.free.back();
+                r.free.pop_back();
+            }
+        }
+
+        ~Holder() {
+            Registry &r = registry();
+            std::unique_lock <std::mutex> lock(r.mutex);
+            r.free.push_back(index);
+        }
+    };
+
+ public:
+    static uint32_t get() {
+        static thread_local Holder holder;
+        return holder.index;
+    }
+};
+
 ///////////////////////////////////////////////////////////
 //
 // Class for multi-threaded pool-management of VisitedLists
 //
+// Every pool keeps one list for each thread, in a slot indexed by the ThreadIndex, so a thread
+// running queries against an index reuses the same list without synchronization, however many
+// indexes it searches. Lists a thread holds at the same time beyond that one go to a lock-free
+// stack shared by all threads. A list is owned by its pool for the whole lifetime of the pool.
+//
 /////////////////////////////////////////////////////////
 
 class VisitedListPool {
-    std::deque<VisitedList *> pool;
-    std::mutex poolguard;
+    static const uint32_t CHUNK_SIZE = 64;
+    static const uint32_t MAX_CHUNKS = 1024;
+
     int numelements;
 
+    // lists are addressed by index so the free stack head can carry an ABA tag
+    std::atomic<VisitedList **> chunks_[MAX_CHUNKS];
+    uint32_t num_lists_{0};
+    std::mutex alloc_guard_;
+
+    std::atomic<uint64_t> free_head_{0};  // (tag << 32) | (index + 1)
+
+    // Read and written only by the thread with its index, padded to a cache line
+    struct ThreadSlot {
+        VisitedList *list{nullptr};
+        char padding[64 - sizeof(VisitedList *)];
+    };
+
+    std::atomic<ThreadSlot *> slot_chunks_[MAX_CHUNKS];
+
+    ThreadSlot &threadSlot() {
+        uint32_t index = ThreadIndex::get();
+        if (index >= CHUNK_SIZE * MAX_CHUNKS)
+            throw std::runtime_error("Too many threads use the visited lists");
+        std::atomic<ThreadSlot *> &chunk_ptr = slot_chunks_[index / CHUNK_SIZE];
+        ThreadSlot *chunk = chunk_ptr.load(std::memory_order_acquire);
+        if (chunk == nullptr) {
+            std::unique_lock <std::mutex> lock(alloc_guard_);
+            chunk = chunk_ptr.load(std::memory_order_relaxed);
+            if (chunk == nullptr) {
+                chunk = new ThreadSlot[CHUNK_SIZE]();
+                chunk_ptr.store(chunk, std::memory_order_release);
+            }
+        }
+        return chunk[index % CHUNK_SIZE];
+    }
+
+    VisitedList *listAt(uint32_t index) const {
+        return chunks_[index / CHUNK_SIZE].load(std::memory_order_acquire)[index % CHUNK_SIZE];
+    }
+
+    void push(VisitedList *vl) {
+        uint32_t index = vl->pool_index;
+        uint64_t head = free_head_.load(std::memory_order_relaxed);
+        uint64_t new_head;
+        do {
+            vl->next_free.store((uint32_t)head, std::memory_order_relaxed);
+            new_head = ((head >> 32) + 1) << 32 | (index + 1);
+        } while (!free_head_.compare_exchange_weak(head, new_head, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    VisitedList *pop() {
+        uint64_t head = free_head_.load(std::memory_order_acquire);
+        while ((uint32_t)head != 0) {
+            VisitedList *vl = listAt((uint32_t)head - 1);
+            uint64_t new_head = ((head >> 32) + 1) << 32 | vl->next_free.load(std::memory_order_relaxed);
+            if (free_head_.compare_exchange_weak(head, new_head, std::memory_order_acquire, std::memory_order_acquire))
+                return vl;
+        }
+        return nullptr;
+    }
+
+    uint32_t allocate() {
+        std::unique_lock <std::mutex> lock(alloc_guard_);
+        uint32_t index = num_lists_;
+        if (index >= CHUNK_SIZE * MAX_CHUNKS)
+            throw std::runtime_error("Too many visited lists in use");
+        VisitedList **chunk = chunks_[index / CHUNK_SIZE].load(std::memory_order_relaxed);
+        if (chunk == nullptr) {
+            chunk = new VisitedList *[CHUNK_SIZE]();
+        }
+        chunk[index % CHUNK_SIZE] = new VisitedList(numelements);
+        chunk[index % CHUNK_SIZE]->pool_index = index;
+        chunks_[index / CHUNK_SIZE].store(chunk, std::memory_order_release);
+        num_lists_++;
+        return index;
+    }
+
  public:
     VisitedListPool(int initmaxpools, int numelements1) {
         numelements = numelements1;
+        for (uint32_t c = 0; c < MAX_CHUNKS; c++) {
+            chunks_[c].store(nullptr, std::memory_order_relaxed);
+            slot_chunks_[c].store(nullptr, std::memory_order_relaxed);
+        }
         for (int i = 0; i < initmaxpools; i++)
-            pool.push_front(new VisitedList(numelements));
+            push(listAt(allocate()));
     }
 
     VisitedList *getFreeVisitedList() {
-        VisitedList *rez;
-        {
-            std::unique_lock <std::mutex> lock(poolguard);
-            if (pool.size() > 0) {
-                rez = pool.front();
-                pool.pop_front();
-            } else {
-                rez = new VisitedList(numelements);
-            }
-        }
+        ThreadSlot &slot = threadSlot();
+        VisitedList *rez = slot.list;
+        slot.list = nullptr;
+        if (rez == nullptr)
+            rez = pop();
+        if (rez == nullptr)
+            rez = listAt(allocate());
         rez->reset();
         return rez;
     }
 
     void releaseVisitedList(VisitedList *vl) {
-        std::unique_lock <std::mutex> lock(poolguard);
-        pool.push_front(vl);
+        ThreadSlot &slot = threadSlot();
+        if (slot.list == nullptr)
+            slot.list = vl;
+        else
+            push(vl);
     }
 
     ~VisitedListPool() {
-        while (pool.size()) {
-            VisitedList *rez = pool.front();
-            pool.pop_front();
-            delete rez;
+        for (uint32_t c = 0; c < MAX_CHUNKS; c++) {
+            VisitedList **chunk = chunks_[c].load(std::memory_order_relaxed);
+            if (chunk == nullptr) break;
+            for (uint32_t i = 0; i < CHUNK_SIZE; i++)
+                delete chunk[i];
+            delete[] chunk;
         }
+        for (uint32_t c = 0; c < MAX_CHUNKS; c++)
+            delete[] slot_chunks_[c].load(std::memory_order_relaxed);
     }
 };
 }  // namespace hnswlib
@@ -8,72 +8,12 @@
 #include <atomic>
 #include <stdlib.h>
 #include <assert.h>
+#include <map>
+#include <algorithm>
 
 namespace py = pybind11;
 using namespace pybind11::literals;  // needed to bring in _a literal
 
-/*
- * replacement for the openmp '#pragma omp parallel for' directive
- * only handles a subset of functionality (no reductions etc)
- * Process ids from start (inclusive) to end (EXCLUSIVE)
- *
- * The method is borrowed from nmslib
- */
-template<class Function>
-inline void ParallelFor(size_t start, size_t end, size_t numThreads, Function fn) {
-    if (numThreads <= 0) {
-        numThreads = std::thread::hardware_concurrency();
-    }
-
-    if (numThreads == 1) {
-        for (size_t id = start; id < end; id++) {
-            fn(id, 0);
-        }
-    } else {
-        std::vector<std::thread> threads;
-        std::atomic<size_t> current(start);
-
-        // keep track of exceptions in threads
-        // https://stackoverflow.com/a/32428427/1713196
-        std::exception_ptr lastException = nullptr;
-        std::mutex lastExceptMutex;
-
-        for (size_t threadId = 0; threadId < numThreads; ++threadId) {
-            threads.push_back(std::thread([&, threadId] {
-                while (true) {
-                    size_t id = current.fetch_add(1);
-
-                    if (id >= end) {
-                        break;
-                    }
-
-                    try {
-                        fn(id, threadId);
-                    } catch (...) {
-                        std::unique_lock<std::mutex> lastExcepLock(lastExceptMutex);
-                        lastException = std::current_exception();
-                        /*
-                         * This will work even when current is the largest value that
-                         * size_t can fit, because fetch_add returns the previous value
-                         * before the increment (what will result in overflow
-                         * and produce 0 instead of current + 1).
-                         */
-                        current = end;
-                        break;
-                    }
-                }
-            }));
-        }
-        for (auto &thread : threads) {
-            thread.join();
-        }
-        if (lastException) {
-            std::rethrow_exception(lastException);
-        }
-    }
-}
-
-
 inline void assert_true(bool expr, const std::string & msg) {
     if (expr == false) throw std::runtime_error("Unpickle Error: " + msg);
     return;
@@ -159,6 +99,7 @@ class Index {
     hnswlib::labeltype cur_l;
     hnswlib::HierarchicalNSW<dist_t>* appr_alg;
     hnswlib::SpaceInterface<float>* l2space;
+    std::shared_ptr<hnswlib::ThreadPool> thread_pool;  // kept between calls, replaced if num_threads changes
 
 
     Index(const std::string &space_name, const int dim) : space_name(space_name), dim(dim) {
@@ -218,21 +159,46 @@ class Index {
         this->num_threads_default = num_threads;
     }
 
+
+    // Threads for a call, must be called with the GIL held
+    std::shared_ptr<hnswlib::ThreadPool> getThreadPool(size_t num_threads) {
+        if (num_threads == 1)
+            return std::make_shared<hnswlib::ThreadPool>(1);  // starts no thread
+        if (!thread_pool || thread_pool->size() != num_threads)
+            thread_pool = std::make_shared<hnswlib::ThreadPool>(num_threads);
+        return thread_pool;
+    }
+
     size_t indexFileSize() const {
         return appr_alg->indexFileSize();
     }
 
-    void saveIndex(const std::string &path_to_index) {
-        appr_alg->saveIndex(path_to_index);
+    void saveIndex(const std::string &path_to_index, int format_version) {
+        if (format_version != 1 && format_version != 2)
+            throw std::runtime_error("format_version must be 1 or 2");
+        appr_alg->saveIndex(path_to_index, format_version == 1 ? hnswlib::IndexFormat::V1 : hnswlib::IndexFormat::V2);
     }
 
 
-    void loadIndex(const std::string &path_to_index, size_t max_elements, bool allow_replace_deleted) {
+    void loadIndex(const std::string &path_to_index, size_t max_elements, bool allow_replace_deleted, py::object mmap_mode) {
+      // same values as numpy.load: None reads the index into memory, 'r' maps it read-only, 'c' copy-on-write
+      hnswlib::IndexLoadMode load_mode = hnswlib::IndexLoadMode::Copy;
+      if (!mmap_mode.is_none()) {
+          std::string mode = mmap_mode.cast<std::string>();
+          if (mode == "r")
+              load_mode = hnswlib::IndexLoadMode::MmapReadOnly;
+          else if (mode == "c")
+              load_mode = hnswlib::IndexLoadMode::MmapCopyOnWrite;
+          else
+              throw std::runtime_error("mmap_mode must be None, 'r' or 'c'");
+      }
       if (appr_alg) {
           std::cerr << "Warning: Calling load_index for an already inited index. Old index is being deallocated." << std::endl;
           delete appr_alg;
       }
-      appr_alg = new hnswlib::HierarchicalNSW<dist_t>(l2space, path_to_index, false, max_elements, allow_replace_deleted);
+      size_t num_threads = num_threads_default > 0 ? num_threads_default : std::thread::hardware_concurrency();
+      std::shared_ptr<hnswlib::ThreadPool> pool = getThreadPool(num_threads);
+      appr_alg = new hnswlib::HierarchicalNSW<dist_t>(l2space, path_to_index, false, max_elements, allow_replace_deleted, load_mode, pool.get());
       cur_l = appr_alg->cur_element_count;
       index_inited = true;
     }
@@ -282,15 +248,16 @@ class Index {
                 ep_added = true;
             }
 
+            std::shared_ptr<hnswlib::ThreadPool> pool = getThreadPool(num_threads);
             py::gil_scoped_release l;
             if (normalize == false) {
-                ParallelFor(start, rows, num_threads, [&](size_t row, size_t threadId) {
+                pool->parallelFor(start, rows, [&](size_t row, size_t threadId) {
                     size_t id = ids.size() ? ids.at(row) : (cur_l + row);
                     appr_alg->addPoint((void*)items.data(row), (size_t)id, replace_deleted);
                     });
             } else {
                 std::vector<float> norm_array(num_threads * dim);
-                ParallelFor(start, rows, num_threads, [&](size_t row, size_t threadId) {
+                pool->parallelFor(start, rows, [&](size_t row, size_t threadId) {
                     // normalize vector:
                     size_t start_idx = threadId * dim;
                     normalize_vector((float*)items.data(row), (norm_array.data() + start_idx));
@@ -341,9 +308,9 @@ class Index {
     std::vector<hnswlib::labeltype> getIdsList() {
         std::vector<hnswlib::labeltype> ids;
 
-        for (auto kv : appr_alg->label_lookup_) {
-            ids.push_back(kv.first);
-        }
+        appr_alg->label_lookup_.forEach([&](hnswlib::labeltype label, hnswlib::tableint id) {
+            ids.push_back(label);
+        });
         return ids;
     }
 
@@ -373,11 +340,11 @@ class Index {
         memset(label_lookup_val_npy, -1, appr_alg->label_lookup_.size() * sizeof(hnswlib::tableint));
 
         size_t idx = 0;
-        for (auto it = appr_alg->label_lookup_.begin(); it != appr_alg->label_lookup_.end(); ++it) {
-            label_lookup_key_npy[idx] = it->first;
-            label_lookup_val_npy[idx] = it->second;
+        appr_alg->label_lookup_.forEach([&](hnswlib::labeltype label, hnswlib::tableint id) {
+            label_lookup_key_npy[idx] = label;
+            label_lookup_val_npy[idx] = id;
             idx++;
-        }
+        });
 
         memset(link_list_npy, 0, link_npy_size);
 
@@ -387,7 +354,7 @@ class Index {
         for (size_t i = 0; i < appr_alg->cur_element_count; i++) {
             size_t linkListSize = appr_alg->element_levels_[i] > 0 ? appr_alg->size_links_per_element_ * appr_alg->element_levels_[i] : 0;
             if (linkListSize) {
-                memcpy(link_list_npy + link_npy_offsets[i], appr_alg->linkLists_[i], linkListSize);
+                memcpy(link_list_npy + link_npy_offsets[i], appr_alg->get_linklist(i, 1), linkListSize);
             }
         }
 
@@ -447,7 +414,7 @@ class Index {
                 element_levels_npy,  // the data pointer
                 free_when_done_lvl),
 
-            // linkLists_,element_levels_,data_level0_memory_
+            // link lists,element_levels_,data_level0_memory_
             "data_level0"_a = py::array_t<char>(
                 { level0_npy_size },  // shape
                 { sizeof(char) },  // C-style contiguous strides for each index
@@ -530,6 +497,7 @@ class Index {
         assert_true(appr_alg->max_elements_ == d["max_elements"].cast<size_t>(), "Invalid value of max_elements_ ");
 
         appr_alg->cur_element_count = d["cur_element_count"].cast<size_t>();
+        appr_alg->initialized_count_ = appr_alg->cur_element_count.load();
 
         assert_true(appr_alg->size_data_per_element_ == d["size_data_per_element"].cast<size_t>(), "Invalid value of size_data_per_element_ ");
         assert_true(appr_alg->label_offset_ == d["label_offset"].cast<size_t>(), "Invalid value of label_offset_ ");
@@ -558,7 +526,7 @@ class Index {
             if (label_lookup_val_npy.data()[i] < 0) {
                 throw std::runtime_error("Internal id cannot be negative!");
             } else {
-                appr_alg->label_lookup_.insert(std::make_pair(label_lookup_key_npy.data()[i], label_lookup_val_npy.data()[i]));
+                appr_alg->label_lookup_.insert(label_lookup_key_npy.data()[i], label_lookup_val_npy.data()[i]);
             }
         }
 
@@ -578,14 +546,9 @@ class Index {
 
         for (size_t i = 0; i < appr_alg->max_elements_; i++) {
             size_t linkListSize = appr_alg->element_levels_[i] > 0 ? appr_alg->size_links_per_element_ * appr_alg->element_levels_[i] : 0;
-            if (linkListSize == 0) {
-                appr_alg->linkLists_[i] = nullptr;
-            } else {
-                appr_alg->linkLists_[i] = (char*)malloc(linkListSize);
-                if (appr_alg->linkLists_[i] == nullptr)
-                    throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklist");
-
-                memcpy(appr_alg->linkLists_[i], link_list_npy.data() + link_npy_offsets[i], linkListSize);
+            if (linkListSize != 0) {
+                appr_alg->link_list_offsets_[i] = appr_alg->link_list_arena_.allocate(appr_alg->element_levels_[i]);
+                memcpy(appr_alg->get_linklist(i, 1), link_list_npy.data() + link_npy_offsets[i], linkListSize);
             }
         }
 
@@ -613,7 +576,8 @@ class Index {
         py::object input,
         size_t k = 1,
         int num_threads = -1,
-        const std::function<bool(hnswlib::labeltype)>& filter = nullptr) {
+        const std::function<bool(hnswlib::labeltype)>& filter = nullptr,
+        py::object allowed_ids = py::none()) {
         py::array_t < dist_t, py::array::c_style | py::array::forcecast > items(input);
         auto buffer = items.request();
         hnswlib::labeltype* data_numpy_l;
@@ -623,15 +587,23 @@ class Index {
         if (num_threads <= 0)
             num_threads = num_threads_default;
 
-        {
-            py::gil_scoped_release l;
-            get_input_array_shapes(buffer, &rows, &features);
+        // checked inline by the search, without calling back into python
+        std::unique_ptr<hnswlib::IdFilter> id_filter;
+        if (!allowed_ids.is_none()) {
+            py::array_t < size_t, py::array::c_style | py::array::forcecast > labels(allowed_ids);
+            id_filter.reset(new hnswlib::IdFilter(appr_alg->makeIdFilter(labels.data(), labels.size())));
+        }
 
-            // avoid using threads when the number of searches is small:
-            if (rows <= num_threads * 4) {
-                num_threads = 1;
-            }
+        get_input_array_shapes(buffer, &rows, &features);
+
+        // avoid using threads when the number of searches is small:
+        if (rows <= num_threads * 4) {
+            num_threads = 1;
+        }
 
+        {
+            std::shared_ptr<hnswlib::ThreadPool> pool = getThreadPool(num_threads);
+            py::gil_scoped_release l;
             data_numpy_l = new hnswlib::labeltype[rows * k];
             data_numpy_d = new dist_t[rows * k];
 
@@ -640,38 +612,25 @@ class Index {
             CustomFilterFunctor* p_idFilter = filter ? &idFilter : nullptr;
 
             if (normalize == false) {
-                ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
-                    std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = appr_alg->searchKnn(
-                        (void*)items.data(row), k, p_idFilter);
-                    if (result.size() != k)
-                        throw std::runtime_error(
-                            "Cannot return the results in a contiguous 2D array. Probably ef or M is too small");
-                    for (int i = k - 1; i >= 0; i--) {
-                        auto& result_tuple = result.top();
-                        data_numpy_d[row * k + i] = result_tuple.first;
-                        data_numpy_l[row * k + i] = result_tuple.second;
-                        result.pop();
-                    }
-                });
+                size_t found = appr_alg->searchKnnBatch(
+                    (void*)items.data(), rows, k, data_numpy_l, data_numpy_d, *pool, p_idFilter, id_filter.get());
+                if (found != k)
+                    throw std::runtime_error(
+                        "Cannot return the results in a contiguous 2D array. Probably ef or M is too small");
             } else {
                 std::vector<float> norm_array(num_threads * features);
-                ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
+                pool->parallelFor(0, rows, [&](size_t row, size_t threadId) {
                     float* data = (float*)items.data(row);
 
                     size_t start_idx = threadId * dim;
                     normalize_vector((float*)items.data(row), (norm_array.data() + start_idx));
 
-                    std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = appr_alg->searchKnn(
-                        (void*)(norm_array.data() + start_idx), k, p_idFilter);
-                    if (result.size() != k)
+                    size_t found = appr_alg->searchKnnBatch(
+                        (void*)(norm_array.data() + start_idx), 1, k, data_numpy_l + row * k, data_numpy_d + row * k, p_idFilter,
+                        id_filter.get());
+                    if (found != k)
                         throw std::runtime_error(
                             "Cannot return the results in a contiguous 2D array. Probably ef or M is too small");
-                    for (int i = k - 1; i >= 0; i--) {
-                        auto& result_tuple = result.top();
-                        data_numpy_d[row * k + i] = result_tuple.first;
-                        data_numpy_l[row * k + i] = result_tuple.second;
-                        result.pop();
-                    }
                 });
             }
         }
@@ -712,6 +671,44 @@ class Index {
     }
 
 
+    size_t compact() {
+        // queries from other threads keep running meanwhile
+        py::gil_scoped_release l;
+        return appr_alg->compact();
+    }
+
+
+    void reorder(const std::string &method) {
+        hnswlib::GraphReorder order;
+        if (method == "bfs") {
+            order = hnswlib::GraphReorder::BFS;
+        } else if (method == "rcm") {
+            order = hnswlib::GraphReorder::RCM;
+        } else if (method == "gorder") {
+            order = hnswlib::GraphReorder::Gorder;
+        } else {
+            throw std::runtime_error("Unknown reorder method, expected 'bfs', 'rcm' or 'gorder'");
+        }
+        py::gil_scoped_release l;
+        appr_alg->reorder(order);
+    }
+
+
+    void setMemoryPolicy(const std::string &policy) {
+        if (policy == "default") {
+            appr_alg->setMemoryPolicy(hnswlib::MemoryPolicy::Default);
+        } else if (policy == "hugepages") {
+            appr_alg->setMemoryPolicy(hnswlib::MemoryPolicy::HugePages);
+        } else if (policy == "hugepages_1gb") {
+            appr_alg->setMemoryPolicy(hnswlib::MemoryPolicy::HugePages1GB);
+        } else if (policy == "interleave") {
+            appr_alg->setMemoryPolicy(hnswlib::MemoryPolicy::Interleave);
+        } else {
+            throw std::runtime_error("Unknown memory policy, expected 'default', 'hugepages', 'hugepages_1gb' or 'interleave'");
+        }
+    }
+
+
     size_t getMaxElements() const {
         return appr_alg->max_elements_;
     }
@@ -871,16 +868,7 @@ class BFIndex {
             CustomFilterFunctor idFilter(filter);
             CustomFilterFunctor* p_idFilter = filter ? &idFilter : nullptr;
 
-            ParallelFor(0, rows, num_threads, [&](size_t row, size_t threadId) {
-                std::priority_queue<std::pair<dist_t, hnswlib::labeltype >> result = alg->searchKnn(
-                    (void*)items.data(row), k, p_idFilter);
-                for (int i = k - 1; i >= 0; i--) {
-                    auto& result_tuple = result.top();
-                    data_numpy_d[row * k + i] = result_tuple.first;
-                    data_numpy_l[row * k + i] = result_tuple.second;
-                    result.pop();
-                }
-            });
+            alg->searchKnnBatch(items.data(), rows, k, data_numpy_l, data_numpy_d, p_idFilter, num_threads);
         }
 
         py::capsule free_when_done_l(data_numpy_l, [](void *f) {
@@ -907,9 +895,64 @@ class BFIndex {
 };
 
 
+/*
+ * Profiler samples of all indices grouped by phase:
+ * {phase: [{"tag", "level", "calls", "total_ms", "avg_us", "min_us", "max_us", "p50_us", "p99_us"}, ...]}
+ * Entries of a phase are sorted by level; tags that are not per level have level -1.
+ * Empty unless the module was built with HNSWLIB_ENABLE_PROFILER.
+ */
+py::dict getProfile() {
+    std::vector<hnswlib::HNSWLightProfiler::TagSummary> rows = hnswlib::HNSWLightProfiler::summarize();
+    std::stable_sort(rows.begin(), rows.end(),
+        [](const hnswlib::HNSWLightProfiler::TagSummary &a, const hnswlib::HNSWLightProfiler::TagSummary &b) {
+            return a.level < b.level;
+        });
+
+    std::map<std::string, py::list> phases;
+    for (const hnswlib::HNSWLightProfiler::TagSummary &row : rows) {
+        py::dict entry;
+        entry["tag"] = row.tag;
+        entry["level"] = row.level;
+        entry["calls"] = row.calls;
+        entry["total_ms"] = row.total_ns / 1e6;
+        entry["avg_us"] = row.total_ns / 1e3 / row.calls;
+        entry["min_us"] = row.min_ns / 1e3;
+        entry["max_us"] = row.max_ns / 1e3;
+        entry["p50_us"] = row.percentile_ns(0.5) / 1e3;
+        entry["p99_us"] = row.percentile_ns(0.99) / 1e3;
+        phases[row.phase].append(entry);
+    }
+
+    py::dict result;
+    for (auto &phase : phases) {
+        result[py::str(phase.first)] = phase.second;
+    }
+    return result;
+}
+
+
+// The totals of hnswlib::SearchCounters: the searches of all indices and the work they did
+py::dict getSearchCounters() {
+    hnswlib::SearchCounters::Totals totals = hnswlib::SearchCounters::totals();
+    py::dict result;
+    result["searches"] = totals.searches;
+    result["hops"] = totals.hops;
+    result["distance_computations"] = totals.distance_computations;
+    result["visited"] = totals.visited;
+    result["filtered_out"] = totals.filtered_out;
+    return result;
+}
+
+
 PYBIND11_PLUGIN(hnswlib) {
         py::module m("hnswlib");
 
+        m.def("profiler_enabled", &hnswlib::HNSWLightProfiler::enabled);
+        m.def("get_profile", &getProfile);
+        m.def("reset_profile", &hnswlib::HNSWLightProfiler::clear);
+        m.def("get_search_counters", &getSearchCounters);
+        m.def("reset_search_counters", &hnswlib::SearchCounters::reset);
+
         py::class_<Index<float>>(m, "Index")
         .def(py::init(&Index<float>::createFromParams), py::arg("params"))
            /* WARNING: Index::createFromIndex is not thread-safe with Index::addItems */
@@ -927,7 +970,8 @@ PYBIND11_PLUGIN(hnswlib) {
             py::arg("data"),
             py::arg("k") = 1,
             py::arg("num_threads") = -1,
-            py::arg("filter") = py::none())
+            py::arg("filter") = py::none(),
+            py::arg("allowed_ids") = py::none())
         .def("add_items",
             &Index<float>::addItems,
             py::arg("data"),
@@ -939,15 +983,19 @@ PYBIND11_PLUGIN(hnswlib) {
         .def("set_ef", &Index<float>::set_ef, py::arg("ef"))
         .def("set_num_threads", &Index<float>::set_num_threads, py::arg("num_threads"))
         .def("index_file_size", &Index<float>::indexFileSize)
-        .def("save_index", &Index<float>::saveIndex, py::arg("path_to_index"))
+        .def("save_index", &Index<float>::saveIndex, py::arg("path_to_index"), py::arg("format_version") = 2)
         .def("load_index",
             &Index<float>::loadIndex,
             py::arg("path_to_index"),
             py::arg("max_elements") = 0,
-            py::arg("allow_replace_deleted") = false)
+            py::arg("allow_replace_deleted") = false,
+            py::arg("mmap_mode") = py::none())
         .def("mark_deleted", &Index<float>::markDeleted, py::arg("label"))
         .def("unmark_deleted", &Index<float>::unmarkDeleted, py::arg("label"))
         .def("resize_index", &Index<float>::resizeIndex, py::arg("new_size"))
+        .def("compact", &Index<float>::compact)
+        .def("reorder", &Index<float>::reorder, py::arg("method") = "bfs")
+        .def("set_memory_policy", &Index<float>::setMemoryPolicy, py::arg("policy"))
         .def("get_max_elements", &Index<float>::getMaxElements)
         .def("get_current_count", &Index<float>::getCurrentCount)
         .def_readonly("space", &Index<float>::space_name)
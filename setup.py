@@ -86,6 +86,10 @@ class BuildExt(build_ext):
     if os.environ.get("HNSWLIB_NO_NATIVE"):
         c_opts['unix'].remove(compiler_flag_native)
 
+    if os.environ.get("HNSWLIB_ENABLE_PROFILER"):
+        c_opts['unix'].append('-DHNSWLIB_ENABLE_PROFILER')
+        c_opts['msvc'].append('/DHNSWLIB_ENABLE_PROFILER')
+
     if sys.platform == 'darwin':
         c_opts['unix'] += ['-stdlib=libc++', '-mmacosx-version-min=10.7']
         link_opts['unix'] += ['-stdlib=libc++', '-mmacosx-version-min=10.7']
@@ -0,0 +1,128 @@
+// This is a test file for testing AdaptiveSearchStopCondition:
+// with mixed easy and hard queries the adaptive search reaches the recall of a fixed ef with less work,
+// spends less work on the easy queries, never goes past its ef ceiling and skips deleted elements
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <limits>
+#include <vector>
+#include <iostream>
+#include <unordered_set>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class AllowAll : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(idx_t label) {
+        return true;
+    }
+};
+
+struct Work {
+    double recall;
+    double distance_computations;  // per query
+};
+
+void test() {
+    size_t d = 16;
+    size_t n = 20000;
+    size_t nq = 500;
+    size_t k = 10;
+
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    // even queries are easy, next to an element; odd queries are random
+    std::vector<float> query(nq * d);
+    for (size_t q = 0; q < nq; q++) {
+        for (size_t j = 0; j < d; j++)
+            query[q * d + j] = q % 2 ? distrib(rng) : data[q * 7 * d + j] + 0.01 * distrib(rng);
+    }
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100);
+    hnswlib::BruteforceSearch<float> brute(&space, n);
+    for (size_t i = 0; i < n; i++) {
+        index.addPoint(data.data() + i * d, i);
+        brute.addPoint(data.data() + i * d, i);
+    }
+    std::vector<std::unordered_set<idx_t>> gt(nq);
+    for (size_t q = 0; q < nq; q++) {
+        std::priority_queue<std::pair<float, idx_t>> result = brute.searchKnn(query.data() + q * d, k);
+        for (; !result.empty(); result.pop()) gt[q].insert(result.top().second);
+    }
+
+    // searches the queries q = first, first + step, ... and measures the work with the SearchCounters
+    auto run = [&](size_t first, size_t step, size_t max_ef, size_t patience) {
+        hnswlib::SearchCounters::reset();
+        size_t correct = 0, count = 0;
+        for (size_t q = first; q < nq; q += step, count++) {
+            std::vector<std::pair<float, idx_t>> result;
+            if (patience == 0) {
+                index.setEf(max_ef);
+                result = index.searchKnnCloserFirst(query.data() + q * d, k);
+            } else {
+                hnswlib::AdaptiveSearchStopCondition<float> stop_condition(k, max_ef, patience);
+                result = index.searchStopConditionClosest(query.data() + q * d, stop_condition);
+            }
+            assert(result.size() == k);
+            for (size_t i = 0; i < k; i++) {
+                assert(i == 0 || result[i - 1].first <= result[i].first);
+                correct += gt[q].count(result[i].second);
+            }
+        }
+        Work work;
+        work.recall = (double) correct / count / k;
+        work.distance_computations = (double) hnswlib::SearchCounters::totals().distance_computations / count;
+        return work;
+    };
+
+    Work fixed_small = run(0, 1, 40, 0);
+    Work fixed_large = run(0, 1, 80, 0);
+    Work adaptive = run(0, 1, 80, 40);
+    std::cout << "ef 40: recall " << fixed_small.recall << ", " << fixed_small.distance_computations
+              << " distance computations per query" << std::endl;
+    std::cout << "ef 80: recall " << fixed_large.recall << ", " << fixed_large.distance_computations
+              << " distance computations per query" << std::endl;
+    std::cout << "adaptive, max_ef 80 patience 40: recall " << adaptive.recall << ", " << adaptive.distance_computations
+              << " distance computations per query" << std::endl;
+    assert(adaptive.recall >= fixed_small.recall);
+    assert(adaptive.distance_computations < fixed_large.distance_computations);
+
+    // the easy queries stop earlier
+    Work easy = run(0, 2, 80, 40);
+    Work hard = run(1, 2, 80, 40);
+    assert(easy.distance_computations < hard.distance_computations);
+
+    // without patience the search is the one of ef = max_ef
+    index.setEf(80);
+    AllowAll allow_all;
+    for (size_t q = 0; q < 20; q++) {
+        hnswlib::AdaptiveSearchStopCondition<float> stop_condition(k, 80, std::numeric_limits<size_t>::max());
+        assert(index.searchStopConditionClosest(query.data() + q * d, stop_condition, &allow_all) ==
+               index.searchKnnCloserFirst(query.data() + q * d, k, &allow_all));
+    }
+
+    // a patience of one expansion still collects k results, and deleted elements are skipped
+    for (size_t i = 0; i < n; i += 2) index.markDelete(i);
+    for (size_t q = 0; q < nq; q++) {
+        hnswlib::AdaptiveSearchStopCondition<float> stop_condition(k, 80, 1);
+        std::vector<std::pair<float, idx_t>> result = index.searchStopConditionClosest(query.data() + q * d, stop_condition);
+        assert(result.size() == k);
+        for (auto &r : result) assert(r.second % 2 == 1);
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
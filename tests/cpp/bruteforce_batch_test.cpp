@@ -0,0 +1,107 @@
+// This is a test file for testing BruteforceSearch::searchKnnBatch:
+// results match a plain scan for any number of queries and threads
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickDivisibleIds : public hnswlib::BaseFilterFunctor {
+    unsigned int divisor;
+
+ public:
+    explicit PickDivisibleIds(unsigned int divisor) : divisor(divisor) {}
+
+    bool operator()(idx_t label_id) {
+        return label_id % divisor == 0;
+    }
+};
+
+// the k smallest (distance, label) pairs of a row by row scan
+std::vector<std::pair<float, idx_t>> scan(hnswlib::SpaceInterface<float> &space, const std::vector<float> &data,
+                                          const float *query, size_t d, size_t k, hnswlib::BaseFilterFunctor *filter) {
+    std::vector<std::pair<float, idx_t>> all;
+    for (size_t i = 0; i < data.size() / d; i++) {
+        if (filter && !(*filter)(i)) continue;
+        all.emplace_back(space.get_dist_func()(query, data.data() + i * d, space.get_dist_func_param()), i);
+    }
+    std::sort(all.begin(), all.end());
+    all.resize(std::min(all.size(), k));
+    return all;
+}
+
+void check(hnswlib::SpaceInterface<float> &space, size_t d, size_t n, size_t nq, size_t k,
+           size_t num_threads, hnswlib::BaseFilterFunctor *filter) {
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(nq * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (size_t i = 0; i < n; i++) alg_brute.addPoint(data.data() + i * d, i);
+
+    std::vector<idx_t> labels(nq * k);
+    std::vector<float> distances(nq * k);
+    size_t min_found = alg_brute.searchKnnBatch(query.data(), nq, k, labels.data(), distances.data(), filter, num_threads);
+
+    size_t expected_min_found = k;
+    for (size_t q = 0; q < nq; q++) {
+        std::vector<std::pair<float, idx_t>> expected = scan(space, data, query.data() + q * d, d, k, filter);
+        expected_min_found = std::min(expected_min_found, expected.size());
+        for (size_t i = 0; i < k; i++) {
+            if (i < expected.size()) {
+                assert(labels[q * k + i] == expected[i].second);
+                assert(std::abs(distances[q * k + i] - expected[i].first) <= 1e-4f * std::max(1.0f, expected[i].first));
+            } else {
+                assert(labels[q * k + i] == (idx_t) -1);
+                assert(distances[q * k + i] == std::numeric_limits<float>::max());
+            }
+        }
+
+        // searchKnn returns the same results, farthest on top
+        auto res = alg_brute.searchKnn(query.data() + q * d, k, filter);
+        assert(res.size() == expected.size());
+        for (size_t i = expected.size(); i > 0; i--) {
+            assert(res.top().second == labels[q * k + i - 1]);
+            res.pop();
+        }
+    }
+    assert(min_found == expected_min_found);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+
+    size_t d = 20;
+    hnswlib::L2Space l2(d);
+    hnswlib::InnerProductSpace ip(d);
+    PickDivisibleIds pick_every_third(3);
+    PickDivisibleIds pick_few(500);
+
+    for (size_t num_threads : {1, 3, 8}) {
+        // one query per thread or fewer splits the rows, more queries split the tiles
+        for (size_t nq : {1, 5, 40}) {
+            check(l2, d, 5000, nq, 10, num_threads, nullptr);
+            check(ip, d, 5000, nq, 10, num_threads, nullptr);
+            check(l2, d, 5000, nq, 10, num_threads, &pick_every_third);
+        }
+        // fewer allowed rows than k, and fewer rows than threads
+        check(l2, d, 5000, 9, 20, num_threads, &pick_few);
+        check(l2, d, 2, 3, 5, num_threads, nullptr);
+    }
+
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
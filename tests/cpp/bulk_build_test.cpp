@@ -0,0 +1,106 @@
+// This is a test file for testing addPointsBulk:
+// the graph it builds has sound lists and about the recall of one built by addPoints, existing
+// labels are updated, the changed elements go into the next delta, and a full index stays consistent
+
+#include "../../hnswlib/hnswlib.h"
+#include "test_utils.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <unordered_set>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+const size_t d = 16;
+
+void test() {
+    size_t n = 30000;
+    size_t nq = 100;
+    size_t k = 10;
+    std::string base_path = "bulk_build_test_base.bin";
+    std::string delta_path = "bulk_build_test_delta.bin";
+
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(nq * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+    std::vector<idx_t> labels(n);
+    for (size_t i = 0; i < n; i++) labels[i] = i;
+
+    hnswlib::L2Space space(d);
+    hnswlib::ThreadPool pool(4);
+    hnswlib::HierarchicalNSW<float> reference(&space, n, 16, 100);
+    auto start = std::chrono::steady_clock::now();
+    reference.addPoints(data.data(), labels.data(), n, pool);
+    auto middle = std::chrono::steady_clock::now();
+    hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100);
+    index.addPointsBulk(data.data(), labels.data(), n, pool);
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "addPoints " << std::chrono::duration<double>(middle - start).count() << " s, addPointsBulk "
+              << std::chrono::duration<double>(end - middle).count() << " s" << std::endl;
+
+    assert(index.cur_element_count == n);
+    checkLists(index);
+    reference.setEf(50);
+    index.setEf(50);
+    float reference_recall = recall(reference, data, query, d, k);
+    float bulk_recall = recall(index, data, query, d, k);
+    std::cout << "recall addPoints " << reference_recall << " addPointsBulk " << bulk_recall << std::endl;
+    assert(bulk_recall >= 0.95f && bulk_recall >= reference_recall - 0.02f);
+
+    // existing labels are updated, the changes of the batches are in the delta
+    hnswlib::HierarchicalNSW<float> live(&space, n, 16, 100);
+    live.addPointsBulk(data.data(), labels.data(), n / 2, pool);
+    for (size_t i = 0; i < n / 2; i += 7) live.markDelete(i);
+    live.saveIndex(base_path);
+    std::vector<idx_t> more_labels(labels.begin() + n / 2 - 100, labels.end());
+    std::vector<float> more_data(data.begin() + (n / 2 - 100) * d, data.end());
+    for (size_t i = 0; i < 100 * d; i++) more_data[i] = distrib(rng);
+    live.addPointsBulk(more_data.data(), more_labels.data(), more_labels.size(), pool, 0.5);
+    assert(live.cur_element_count == n);
+    checkLists(live);
+    assert(live.getDataByLabel<float>(n / 2 - 1) == std::vector<float>(more_data.begin() + 99 * d, more_data.begin() + 100 * d));
+    live.saveIndexDelta(delta_path);
+    hnswlib::HierarchicalNSW<float> recovered(&space, 0, 16, 100);
+    recovered.loadIndex(base_path, &space);
+    recovered.applyIndexDelta(delta_path);
+    assert(recovered.cur_element_count == n && recovered.maxlevel_ == live.maxlevel_);
+    assert(memcmp(recovered.data_level0_memory_, live.data_level0_memory_, n * live.size_data_per_element_) == 0);
+    for (hnswlib::tableint id = 0; id < n; id++) {
+        for (int level = 1; level <= live.element_levels_[id]; level++)
+            assert(memcmp(recovered.get_linklist(id, level), live.get_linklist(id, level), live.size_links_per_element_) == 0);
+    }
+
+    // the elements that fit are added before the error
+    hnswlib::HierarchicalNSW<float> full(&space, 5000, 16, 100);
+    bool thrown = false;
+    try {
+        full.addPointsBulk(data.data(), labels.data(), 6000, pool);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown && full.cur_element_count == 5000);
+    checkLists(full);
+    assert(full.label_lookup_.find(5000) == hnswlib::ShardedLabelLookup::NOT_FOUND);
+
+    std::remove(base_path.c_str());
+    std::remove(delta_path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
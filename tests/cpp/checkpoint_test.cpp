@@ -0,0 +1,206 @@
+// This is a test file for testing checkpoints:
+// a snapshot plus the deltas of saveIndexDelta is the index at the last checkpoint, replaying the
+// write-ahead log on top brings back the updates since, and a torn log is replayed up to the damage
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <vector>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+const size_t d = 8;
+
+// Random additions (new labels, some into deleted places), updates, deletions and undeletions
+size_t applyUpdates(hnswlib::HierarchicalNSW<float> &index, std::mt19937 &rng, idx_t &next_label, size_t num_updates) {
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> vec(d);
+    for (size_t u = 0; u < num_updates; u++) {
+        for (float &x : vec) x = distrib(rng);
+        int op = rng() % 10;
+        idx_t label = rng() % next_label;
+        hnswlib::tableint id = index.label_lookup_.find(label);
+        bool present = id != hnswlib::ShardedLabelLookup::NOT_FOUND;
+        if (op < 5 || !present) {
+            index.addPoint(vec.data(), next_label++, op % 2 == 0);
+        } else if (op < 7 && !index.isMarkedDeleted(id)) {
+            index.addPoint(vec.data(), label);
+        } else if (!index.isMarkedDeleted(id)) {
+            index.markDelete(label);
+        } else {
+            index.unmarkDelete(label);
+        }
+    }
+    return num_updates;
+}
+
+// The same elements with the same ids, lists and vectors
+void checkSameIndex(hnswlib::HierarchicalNSW<float> &expected, hnswlib::HierarchicalNSW<float> &actual) {
+    size_t n = expected.cur_element_count;
+    assert(actual.cur_element_count == n);
+    assert(actual.maxlevel_ == expected.maxlevel_ && actual.enterpoint_node_ == expected.enterpoint_node_);
+    assert(actual.getDeletedCount() == expected.getDeletedCount());
+    assert(actual.deleted_elements == expected.deleted_elements);
+    assert(actual.label_lookup_.size() == expected.label_lookup_.size());
+    assert(memcmp(actual.data_level0_memory_, expected.data_level0_memory_, n * expected.size_data_per_element_) == 0);
+    for (size_t i = 0; i < n; i++) {
+        assert(actual.element_levels_[i] == expected.element_levels_[i]);
+        assert(actual.label_lookup_.find(expected.getExternalLabel(i)) == i);
+        for (int level = 1; level <= expected.element_levels_[i]; level++)
+            assert(memcmp(actual.get_linklist(i, level), expected.get_linklist(i, level), expected.size_links_per_element_) == 0);
+    }
+}
+
+// The same labels with the same vectors and deleted marks, the graphs may differ
+void checkSameElements(hnswlib::HierarchicalNSW<float> &expected, hnswlib::HierarchicalNSW<float> &actual) {
+    assert(actual.cur_element_count == expected.cur_element_count);
+    assert(actual.getDeletedCount() == expected.getDeletedCount());
+    for (hnswlib::tableint i = 0; i < expected.cur_element_count; i++) {
+        if (expected.isMarkedDeleted(i))
+            continue;
+        idx_t label = expected.getExternalLabel(i);
+        hnswlib::tableint id = actual.label_lookup_.find(label);
+        assert(id != hnswlib::ShardedLabelLookup::NOT_FOUND && !actual.isMarkedDeleted(id));
+        assert(actual.getDataByLabel<float>(label) == expected.getDataByLabel<float>(label));
+    }
+}
+
+bool throws(std::function<void()> fn) {
+    try {
+        fn();
+    } catch (const std::runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+void writeFile(const std::string &path, const std::vector<char> &bytes) {
+    std::ofstream output(path, std::ios::binary);
+    output.write(bytes.data(), bytes.size());
+}
+
+void test() {
+    std::string base_path = "checkpoint_test_base.bin";
+    std::vector<std::string> delta_paths = {"checkpoint_test_delta1.bin", "checkpoint_test_delta2.bin"};
+    std::string wal_path = "checkpoint_test_wal.bin";
+    std::string torn_wal_path = "checkpoint_test_torn_wal.bin";
+
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(1000 * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> live(&space, 2000, 16, 100, 100, true);
+    idx_t next_label = 0;
+    for (size_t i = 0; i < 1000; i++) live.addPoint(data.data() + i * d, next_label++);
+    for (size_t i = 0; i < 1000; i += 9) live.markDelete(i);
+    assert(throws([&] { live.saveIndexDelta(delta_paths[0]); }));
+    live.saveIndex(base_path);
+    live.openWriteAheadLog(wal_path);
+
+    // the index at each checkpoint is loaded from the snapshot and the deltas so far
+    auto recover = [&](size_t num_deltas, hnswlib::HierarchicalNSW<float> &index) {
+        index.loadIndex(base_path, &space);
+        for (size_t i = 0; i < num_deltas; i++)
+            index.applyIndexDelta(delta_paths[i]);
+    };
+    for (size_t c = 0; c < delta_paths.size(); c++) {
+        if (c == 0)
+            live.resizeIndex(4000);  // the elements of the delta do not fit into the snapshot
+        applyUpdates(live, rng, next_label, 600);
+        live.saveIndexDelta(delta_paths[c]);
+        assert(live.dirty_elements_.empty());
+
+        hnswlib::HierarchicalNSW<float> recovered(&space, 0, 16, 100, 100, true);
+        recover(c + 1, recovered);
+        checkSameIndex(live, recovered);
+        assert(recovered.replayWriteAheadLog(wal_path) == 0);
+        // a delta applies only on top of the checkpoint before it
+        assert(throws([&] { recovered.applyIndexDelta(delta_paths[c]); }));
+    }
+    {
+        hnswlib::HierarchicalNSW<float> recovered(&space, 0, 16, 100, 100, true);
+        recovered.loadIndex(base_path, &space);
+        assert(throws([&] { recovered.applyIndexDelta(delta_paths[1]); }));
+        hnswlib::HierarchicalNSW<float> loaded(&space, base_path, false, 0, true);
+        checkSameIndex(loaded, recovered);
+    }
+
+    // the updates after the last checkpoint are in the log only
+    size_t num_logged = applyUpdates(live, rng, next_label, 300);
+    live.syncWriteAheadLog();
+    hnswlib::HierarchicalNSW<float> recovered(&space, 0, 16, 100, 100, true);
+    recover(delta_paths.size(), recovered);
+    assert(recovered.replayWriteAheadLog(wal_path) == num_logged);
+    checkSameElements(live, recovered);
+    std::vector<std::pair<float, idx_t>> live_result = live.searchKnnCloserFirst(data.data(), 10);
+    assert(recovered.searchKnnCloserFirst(data.data(), 10).size() == live_result.size());
+
+    // a torn last record and a damaged record end the log
+    std::ifstream input(wal_path, std::ios::binary);
+    std::vector<char> wal((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    input.close();
+    std::vector<char> torn(wal.begin(), wal.end() - 3);
+    writeFile(torn_wal_path, torn);
+    {
+        hnswlib::HierarchicalNSW<float> partial(&space, 0, 16, 100, 100, true);
+        recover(delta_paths.size(), partial);
+        assert(partial.replayWriteAheadLog(torn_wal_path) == num_logged - 1);
+        // the log is continued after the last whole record
+        partial.openWriteAheadLog(torn_wal_path);
+        applyUpdates(partial, rng, next_label, 50);
+        partial.closeWriteAheadLog();
+        hnswlib::HierarchicalNSW<float> again(&space, 0, 16, 100, 100, true);
+        recover(delta_paths.size(), again);
+        assert(again.replayWriteAheadLog(torn_wal_path) == num_logged - 1 + 50);
+        checkSameElements(partial, again);
+    }
+    std::vector<char> damaged(wal);
+    damaged[wal.size() / 2] ^= 0x10;
+    writeFile(torn_wal_path, damaged);
+    {
+        hnswlib::HierarchicalNSW<float> partial(&space, 0, 16, 100, 100, true);
+        recover(delta_paths.size(), partial);
+        size_t num_replayed = partial.replayWriteAheadLog(torn_wal_path);
+        assert(num_replayed > 0 && num_replayed < num_logged);
+    }
+
+    // a log of another checkpoint is rejected, the log of an earlier one is covered by it
+    hnswlib::HierarchicalNSW<float> base(&space, 0, 16, 100, 100, true);
+    recover(0, base);
+    assert(throws([&] { base.replayWriteAheadLog(wal_path); }));
+
+    // renumbering needs a full snapshot, the deltas continue from it
+    live.compact();
+    assert(throws([&] { live.saveIndexDelta(delta_paths[0]); }));
+    live.saveIndex(base_path);
+    assert(live.replayWriteAheadLog(wal_path) == 0);
+    applyUpdates(live, rng, next_label, 300);
+    assert(throws([&] { recovered.replayWriteAheadLog(wal_path); }));
+    live.saveIndexDelta(delta_paths[0]);
+    live.closeWriteAheadLog();
+    recover(1, recovered);
+    checkSameIndex(live, recovered);
+    assert(throws([&] { recovered.applyIndexDelta(delta_paths[1]); }));
+
+    for (const std::string &path : {base_path, delta_paths[0], delta_paths[1], wal_path, torn_wal_path})
+        std::remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,184 @@
+// This is a test file for testing compact():
+// deleted elements are gone, the graph stays searchable and consistent,
+// and searches may run from other threads during the compaction
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <unordered_set>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+bool isDeletedLabel(idx_t label) {
+    return label % 10 < 3;
+}
+
+void checkLinks(hnswlib::HierarchicalNSW<float> &alg_hnsw) {
+    size_t n = alg_hnsw.getCurrentElementCount();
+    for (hnswlib::tableint i = 0; i < n; i++) {
+        for (int level = 0; level <= alg_hnsw.element_levels_[i]; level++) {
+            hnswlib::linklistsizeint *ll = alg_hnsw.get_linklist_at_level(i, level);
+            hnswlib::tableint *links = (hnswlib::tableint *) (ll + 1);
+            for (int j = 0; j < alg_hnsw.getListCount(ll); j++) {
+                assert(links[j] < n);
+                assert(links[j] != i);
+                assert(alg_hnsw.element_levels_[links[j]] >= level);
+            }
+        }
+    }
+    assert(alg_hnsw.element_levels_[alg_hnsw.enterpoint_node_] == alg_hnsw.maxlevel_);
+}
+
+float recall(hnswlib::HierarchicalNSW<float> &alg_hnsw, hnswlib::SpaceInterface<float> &space,
+             const std::vector<float> &data, const std::vector<float> &query, size_t d, size_t k) {
+    size_t n = data.size() / d;
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (size_t i = 0; i < n; i++) {
+        if (!isDeletedLabel(i)) alg_brute.addPoint(data.data() + i * d, i);
+    }
+
+    size_t nq = query.size() / d;
+    size_t correct = 0;
+    for (size_t j = 0; j < nq; j++) {
+        auto gt = alg_brute.searchKnn(query.data() + j * d, k);
+        std::unordered_set<idx_t> expected;
+        while (!gt.empty()) {
+            expected.insert(gt.top().second);
+            gt.pop();
+        }
+        auto res = alg_hnsw.searchKnn(query.data() + j * d, k);
+        assert(res.size() == k);
+        while (!res.empty()) {
+            assert(!isDeletedLabel(res.top().second));
+            if (expected.count(res.top().second)) correct++;
+            res.pop();
+        }
+    }
+    return (float) correct / (nq * k);
+}
+
+void test() {
+    size_t d = 16;
+    size_t n = 5000;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(100 * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100, 100, true);
+    for (size_t i = 0; i < n; i++) alg_hnsw.addPoint(data.data() + i * d, i);
+    alg_hnsw.setEf(50);
+    size_t num_deleted = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (isDeletedLabel(i)) {
+            alg_hnsw.markDelete(i);
+            num_deleted++;
+        }
+    }
+    // the entry point is among the deleted elements
+    idx_t ep_label = alg_hnsw.getExternalLabel(alg_hnsw.enterpoint_node_);
+    if (!isDeletedLabel(ep_label)) alg_hnsw.markDelete(ep_label);
+    float recall_before = recall(alg_hnsw, space, data, query, d, k);
+
+    // searches keep running during the compaction
+    std::atomic<bool> done(false);
+    std::atomic<size_t> num_searches(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 3; t++) {
+        threads.push_back(std::thread([&, t]() {
+            size_t j = t;
+            while (!done) {
+                auto res = alg_hnsw.searchKnn(query.data() + (j++ % 100) * d, k);
+                while (!res.empty()) {
+                    assert(!isDeletedLabel(res.top().second) || res.top().second == ep_label);
+                    res.pop();
+                }
+                num_searches++;
+            }
+        }));
+    }
+    size_t removed = alg_hnsw.compact();
+    done = true;
+    for (auto &thread : threads) thread.join();
+    std::cout << "searches during compaction: " << num_searches << std::endl;
+
+    if (isDeletedLabel(ep_label)) {
+        assert(removed == num_deleted);
+    } else {
+        assert(removed == num_deleted + 1);
+        alg_hnsw.addPoint(data.data() + ep_label * d, ep_label);
+    }
+    assert(alg_hnsw.getCurrentElementCount() == n - num_deleted);
+    assert(alg_hnsw.getDeletedCount() == 0);
+    assert(alg_hnsw.compact() == 0);
+    checkLinks(alg_hnsw);
+
+    float recall_after = recall(alg_hnsw, space, data, query, d, k);
+    std::cout << "recall before: " << recall_before << ", after: " << recall_after << std::endl;
+    assert(recall_after >= 0.9f);
+
+    // the labels follow their elements, the removed ones are unknown
+    for (size_t i = 0; i < n; i++) {
+        if (isDeletedLabel(i)) {
+            bool thrown = false;
+            try {
+                alg_hnsw.getDataByLabel<float>(i);
+            } catch (const std::runtime_error &) {
+                thrown = true;
+            }
+            assert(thrown);
+        } else {
+            std::vector<float> stored = alg_hnsw.getDataByLabel<float>(i);
+            assert(std::equal(stored.begin(), stored.end(), data.begin() + i * d));
+        }
+    }
+
+    // the freed slots take new elements
+    for (size_t i = 0; i < n; i++) {
+        if (isDeletedLabel(i)) alg_hnsw.addPoint(data.data() + i * d, i, true);
+    }
+    assert(alg_hnsw.getCurrentElementCount() == n);
+    checkLinks(alg_hnsw);
+}
+
+void testAllDeleted() {
+    size_t d = 4;
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, 100);
+    std::vector<float> data(100 * d, 1.0f);
+    for (size_t i = 0; i < 100; i++) {
+        data[i * d] = (float) i;
+        alg_hnsw.addPoint(data.data() + i * d, i);
+    }
+    for (size_t i = 0; i < 100; i++) alg_hnsw.markDelete(i);
+    assert(alg_hnsw.compact() == 100);
+    assert(alg_hnsw.getCurrentElementCount() == 0);
+    assert(alg_hnsw.searchKnn(data.data(), 1).empty());
+
+    alg_hnsw.addPoint(data.data(), 7);
+    auto res = alg_hnsw.searchKnn(data.data(), 1);
+    assert(res.size() == 1 && res.top().second == 7);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    testAllDeleted();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,237 @@
+// This is a test file for testing DiskIndex: an index saved with saveDiskIndex keeps its codes and
+// upper layers in memory, reads the nodes it expands from the file, and returns the exact distances
+// of the elements closest to the query, with the node cache, beam widths and filters
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <unordered_set>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickOddLabels : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(idx_t label) {
+        return label % 2 == 1;
+    }
+};
+
+float l2(const float *a, const float *b, size_t d) {
+    float sum = 0;
+    for (size_t j = 0; j < d; j++) sum += (a[j] - b[j]) * (a[j] - b[j]);
+    return sum;
+}
+
+// the fraction of the exact k nearest neighbors found, skipping those that skip rejects
+float recall(hnswlib::DiskIndex<float> &index, const std::vector<float> &data, const std::vector<float> &query,
+             size_t d, size_t k, hnswlib::BaseFilterFunctor *filter = nullptr) {
+    size_t n = data.size() / d;
+    size_t nq = query.size() / d;
+    size_t found = 0;
+    for (size_t q = 0; q < nq; q++) {
+        const float *p = query.data() + q * d;
+        std::vector<std::pair<float, idx_t>> exact;
+        for (size_t i = 0; i < n; i++) {
+            if (filter == nullptr || (*filter)(i))
+                exact.emplace_back(l2(p, data.data() + i * d, d), i);
+        }
+        std::partial_sort(exact.begin(), exact.begin() + k, exact.end());
+        std::unordered_set<idx_t> truth;
+        for (size_t i = 0; i < k; i++) truth.insert(exact[i].second);
+
+        std::vector<std::pair<float, idx_t>> result = index.searchKnnCloserFirst(p, k, filter);
+        assert(result.size() == k);
+        for (size_t i = 0; i < k; i++) {
+            // the distances are the exact ones, closer first
+            assert(std::abs(result[i].first - l2(p, data.data() + result[i].second * d, d)) < 1e-4f);
+            assert(i == 0 || result[i - 1].first <= result[i].first);
+            found += truth.count(result[i].second);
+        }
+    }
+    return (float) found / (nq * k);
+}
+
+void test() {
+    size_t d = 32;
+    size_t n = 10000;
+    size_t nq = 100;
+    size_t k = 10;
+
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(nq * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+
+    hnswlib::L2Space l2space(d);
+    hnswlib::ScalarQuantizedSpace sq8(d, hnswlib::ScalarQuantizerType::SQ8);
+    sq8.train(data.data(), n);
+    hnswlib::HierarchicalNSW<float> index(&sq8, n, 16, 100);
+    index.enableRerank(&l2space);
+    for (size_t i = 0; i < n; i++) index.addPoint(data.data() + i * d, i);
+
+    std::string path = "disk_index_test.bin";
+    hnswlib::saveDiskIndex(index, path);
+    {
+        hnswlib::DiskIndex<float> disk(&sq8, &l2space, path, 1000);
+        assert(disk.getCurrentElementCount() == n);
+        assert(disk.memoryUsage() < n * d * sizeof(float) / 2);
+        disk.setEf(100);
+
+        hnswlib::SearchCounters::reset();
+        float cold_recall = recall(disk, data, query, d, k);
+        std::cout << "recall: " << cold_recall << ", direct io: " << disk.directIo() << std::endl;
+        assert(cold_recall > 0.95f);
+        assert(hnswlib::SearchCounters::totals().searches == nq);
+        assert(disk.cachedNodes() == 1000);
+
+        // every node expanded was read or found in the cache, the reads of a beam together
+        hnswlib::DiskSearchStats stats;
+        std::vector<std::pair<float, idx_t>> result = disk.searchKnnCloserFirst(query.data(), k, nullptr, &stats);
+        assert(stats.hops.size() == (size_t) index.maxlevel_ + 1);
+        assert(stats.hops[0] > 0 && stats.hops[0] == stats.node_reads + stats.cache_hits);
+        assert(stats.cache_hits > 0 && stats.round_trips > 0 && stats.round_trips <= stats.node_reads);
+        assert(stats.visited > stats.hops[0] && stats.seconds > 0);
+
+        // the next search of the same query is served from the cache
+        hnswlib::DiskSearchStats again;
+        assert(disk.searchKnnCloserFirst(query.data(), k, nullptr, &again) == result);
+        assert(again.node_reads < stats.node_reads && again.cache_hits > stats.cache_hits);
+
+        // a wider beam takes fewer round trips
+        disk.setBeamWidth(1);
+        hnswlib::DiskSearchStats narrow;
+        disk.searchKnnCloserFirst(query.data() + d, k, nullptr, &narrow);
+        assert(narrow.round_trips <= narrow.node_reads);
+        disk.setBeamWidth(16);
+        hnswlib::DiskSearchStats wide;
+        disk.searchKnnCloserFirst(query.data() + d, k, nullptr, &wide);
+        assert(wide.round_trips < narrow.round_trips);
+        assert(recall(disk, data, query, d, k) > 0.95f);
+        bool thrown = false;
+        try {
+            disk.setBeamWidth(hnswlib::DiskIndex<float>::MAX_BEAM_WIDTH + 1);
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        assert(thrown);
+
+        // concurrent searches find what a single thread finds
+        disk.setBeamWidth(4);
+        std::vector<std::vector<std::pair<float, idx_t>>> expected(nq);
+        for (size_t q = 0; q < nq; q++) expected[q] = disk.searchKnnCloserFirst(query.data() + q * d, k);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < 4; t++) {
+            threads.emplace_back([&, t]() {
+                for (size_t q = t; q < nq; q += 4)
+                    assert(disk.searchKnnCloserFirst(query.data() + q * d, k) == expected[q]);
+            });
+        }
+        for (auto &thread : threads) thread.join();
+
+        // without the cache and through the page cache, the results are the same
+        hnswlib::DiskIndex<float> buffered(&sq8, &l2space, path, 0, false);
+        assert(!buffered.directIo() && buffered.cachedNodes() == 0);
+        buffered.setEf(100);
+        for (size_t q = 0; q < nq; q++)
+            assert(buffered.searchKnnCloserFirst(query.data() + q * d, k) == expected[q]);
+        assert(buffered.cachedNodes() == 0);
+    }
+
+    // PQ codes are scored with the table of the query
+    {
+        hnswlib::ProductQuantizedSpace pq(d, 8);
+        pq.train(data.data(), 2000, 10);
+        hnswlib::HierarchicalNSW<float> pq_index(&pq, n, 16, 100);
+        pq_index.enableRerank(&l2space);
+        for (size_t i = 0; i < n; i++) pq_index.addPoint(data.data() + i * d, i);
+        hnswlib::saveDiskIndex(pq_index, path);
+        hnswlib::DiskIndex<float> disk(&pq, &l2space, path, 100);
+        disk.setEf(100);
+        float pq_recall = recall(disk, data, query, d, k);
+        std::cout << "PQ recall: " << pq_recall << std::endl;
+        assert(pq_recall > 0.9f);
+    }
+
+    // deleted and filtered elements are not returned
+    for (size_t i = 0; i < n; i += 3) index.markDelete(i);
+    hnswlib::saveDiskIndex(index, path);
+    {
+        hnswlib::DiskIndex<float> disk(&sq8, &l2space, path, 100);
+        disk.setEf(50);
+        PickOddLabels odd;
+        hnswlib::DiskSearchStats stats;
+        for (size_t q = 0; q < nq; q++) {
+            for (auto &r : disk.searchKnnCloserFirst(query.data() + q * d, k, &odd, &stats))
+                assert(r.second % 2 == 1 && r.second % 3 != 0);
+            assert(stats.filtered_out > 0);
+        }
+    }
+
+    // an index of a space that does not encode its vectors needs no re-rank store, its nodes
+    // take several sectors if they are large
+    size_t big_d = 1200;
+    size_t big_n = 500;
+    std::vector<float> big(big_n * big_d);
+    for (size_t i = 0; i < big.size(); i++) big[i] = distrib(rng);
+    hnswlib::L2Space big_space(big_d);
+    hnswlib::HierarchicalNSW<float> big_index(&big_space, big_n, 16, 100);
+    for (size_t i = 0; i < big_n; i++) big_index.addPoint(big.data() + i * big_d, i);
+    hnswlib::saveDiskIndex(big_index, path);
+    {
+        hnswlib::DiskIndex<float> disk(&big_space, &big_space, path, 10);
+        disk.setEf(50);
+        for (size_t q = 0; q < 10; q++) {
+            const float *p = big.data() + q * big_d;
+            std::vector<std::pair<float, idx_t>> result = disk.searchKnnCloserFirst(p, k);
+            assert(result.size() == k && result[0].second == q && result[0].first == 0.0f);
+        }
+    }
+
+    // an encoding space without the exact vectors cannot be saved, nor opened with another space
+    hnswlib::HierarchicalNSW<float> no_rerank(&sq8, n, 16, 100);
+    no_rerank.addPoint(data.data(), 0);
+    bool thrown = false;
+    try {
+        hnswlib::saveDiskIndex(no_rerank, "disk_index_test2.bin");
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+    thrown = false;
+    try {
+        hnswlib::DiskIndex<float> disk(&sq8, &l2space, path);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // an empty index
+    hnswlib::HierarchicalNSW<float> empty(&l2space, 10);
+    hnswlib::saveDiskIndex(empty, path);
+    {
+        hnswlib::DiskIndex<float> disk(&l2space, &l2space, path);
+        assert(disk.getCurrentElementCount() == 0 && disk.searchKnnCloserFirst(query.data(), k).empty());
+    }
+    std::remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
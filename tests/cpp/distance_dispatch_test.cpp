@@ -0,0 +1,107 @@
+// This is a test file for the run time selection of the distance kernels:
+// every SIMD kernel the CPU supports must match the scalar kernel, whatever the build flags,
+// and the spaces must pick the widest one
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+bool close(float actual, float expected) {
+    return std::fabs(actual - expected) <= 1e-5f * std::max(1.0f, std::fabs(expected));
+}
+
+void checkKernel(hnswlib::DISTFUNC<float> kernel, hnswlib::DISTFUNC<float> reference, size_t d) {
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> a(d), b(d);
+    for (size_t trial = 0; trial < 10; ++trial) {
+        for (size_t i = 0; i < d; ++i) {
+            a[i] = distrib(rng);
+            b[i] = distrib(rng);
+        }
+        assert(close(kernel(a.data(), b.data(), &d), reference(a.data(), b.data(), &d)));
+    }
+}
+
+void testSpaces() {
+    for (size_t d : {1, 3, 4, 7, 8, 16, 20, 32, 33, 36, 100, 128}) {
+        hnswlib::L2Space l2(d);
+        hnswlib::InnerProductSpace ip(d);
+        checkKernel(l2.get_dist_func(), hnswlib::L2Sqr, d);
+        checkKernel(ip.get_dist_func(), hnswlib::InnerProductDistance, d);
+    }
+}
+
+#if defined(USE_SSE)
+// Calls every kernel the CPU can run, not only the selected one
+void testKernels() {
+    for (size_t d : {16, 32, 128}) {
+        checkKernel(hnswlib::L2SqrSIMD16ExtSSE, hnswlib::L2Sqr, d);
+        checkKernel(hnswlib::InnerProductDistanceSIMD16ExtSSE, hnswlib::InnerProductDistance, d);
+#if defined(USE_AVX)
+        if (AVXCapable()) {
+            checkKernel(hnswlib::L2SqrSIMD16ExtAVX, hnswlib::L2Sqr, d);
+            checkKernel(hnswlib::InnerProductDistanceSIMD16ExtAVX, hnswlib::InnerProductDistance, d);
+        }
+#endif
+#if defined(USE_AVX512)
+        if (AVX512Capable()) {
+            checkKernel(hnswlib::L2SqrSIMD16ExtAVX512, hnswlib::L2Sqr, d);
+            checkKernel(hnswlib::InnerProductDistanceSIMD16ExtAVX512, hnswlib::InnerProductDistance, d);
+        }
+#endif
+    }
+    for (size_t d : {4, 8, 36}) {
+        checkKernel(hnswlib::InnerProductDistanceSIMD4ExtSSE, hnswlib::InnerProductDistance, d);
+#if defined(USE_AVX)
+        if (AVXCapable())
+            checkKernel(hnswlib::InnerProductDistanceSIMD4ExtAVX, hnswlib::InnerProductDistance, d);
+#endif
+    }
+}
+
+#if defined(USE_AVX512)
+void testSelection() {
+    size_t d = 128;
+    hnswlib::L2Space l2(d);
+    hnswlib::InnerProductSpace ip(d);
+    if (AVX512Capable()) {
+        assert(l2.get_dist_func() == hnswlib::L2SqrSIMD16ExtAVX512);
+        assert(ip.get_dist_func() == hnswlib::InnerProductDistanceSIMD16ExtAVX512);
+        std::cout << "Selected AVX-512 kernels" << std::endl;
+    } else if (AVXCapable()) {
+        assert(l2.get_dist_func() == hnswlib::L2SqrSIMD16ExtAVX);
+        assert(ip.get_dist_func() == hnswlib::InnerProductDistanceSIMD16ExtAVX);
+        std::cout << "Selected AVX kernels" << std::endl;
+    } else {
+        assert(l2.get_dist_func() == hnswlib::L2SqrSIMD16ExtSSE);
+        assert(ip.get_dist_func() == hnswlib::InnerProductDistanceSIMD16ExtSSE);
+        std::cout << "Selected SSE kernels" << std::endl;
+    }
+}
+#endif
+#endif
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testSpaces();
+#if defined(USE_SSE)
+    testKernels();
+#endif
+#if defined(USE_AVX512)
+    testSelection();
+#endif
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
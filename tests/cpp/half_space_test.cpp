@@ -0,0 +1,202 @@
+// This is a test file for testing the half precision spaces (FP16, BF16),
+// their conversions and kernels, and the SIMD kernels of L2SpaceI
+
+#include "../../hnswlib/hnswlib.h"
+#include "test_utils.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <iostream>
+#include <unordered_set>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void testConversions() {
+    // every finite value and infinity survives a round trip
+    for (uint32_t h = 0; h < 0x10000; h++) {
+        if ((h & 0x7c00) != 0x7c00 || (h & 0x3ff) == 0)
+            assert(hnswlib::FloatToFP16(hnswlib::FP16ToFloat((uint16_t) h)) == h);
+        if ((h & 0x7f80) != 0x7f80 || (h & 0x7f) == 0)
+            assert(hnswlib::FloatToBF16(hnswlib::BF16ToFloat((uint16_t) h)) == h);
+    }
+    assert(hnswlib::FP16ToFloat(0x3c00) == 1.0f);
+    assert(hnswlib::FP16ToFloat(0x7bff) == 65504.0f);
+    assert(hnswlib::FP16ToFloat(0x0001) == std::ldexp(1.0f, -24));
+    assert(hnswlib::BF16ToFloat(0xc020) == -2.5f);
+
+    // round to nearest even
+    assert(hnswlib::FloatToFP16(1.0f + std::ldexp(1.0f, -11)) == 0x3c00);
+    assert(hnswlib::FloatToFP16(1.0f + 3 * std::ldexp(1.0f, -11)) == 0x3c02);
+    assert(hnswlib::FloatToFP16(std::ldexp(1.0f, -25)) == 0x0000);
+    assert(hnswlib::FloatToFP16(3 * std::ldexp(1.0f, -25)) == 0x0002);
+    assert(hnswlib::FloatToFP16(65519.0f) == 0x7bff);
+    assert(hnswlib::FloatToFP16(65520.0f) == 0x7c00);
+    assert(hnswlib::FloatToFP16(-1e10f) == 0xfc00);
+    assert(hnswlib::FloatToBF16(1.0f + std::ldexp(1.0f, -8)) == 0x3f80);
+    assert(hnswlib::FloatToBF16(1.0f + 3 * std::ldexp(1.0f, -8)) == 0x3f82);
+
+    // compared bitwise, -Ofast assumes there are no nans
+    float nan = std::nanf("");
+    assert((hnswlib::FloatToFP16(nan) & 0x7fff) == 0x7e00);
+    assert((hnswlib::FloatToBF16(nan) & 0x7fff) > 0x7f80);
+}
+
+// Every kernel the CPU can run must give the distances of the scalar kernel
+template<bool bf16, bool inner_product>
+void checkKernels(size_t d) {
+    std::vector<float> data = randomData(2, d, 47, -1, 1);
+    std::vector<uint16_t> x(d), y(d);
+    for (size_t i = 0; i < d; i++) {
+        x[i] = bf16 ? hnswlib::FloatToBF16(data[i]) : hnswlib::FloatToFP16(data[i]);
+        y[i] = bf16 ? hnswlib::FloatToBF16(data[d + i]) : hnswlib::FloatToFP16(data[d + i]);
+    }
+    float asymmetric = hnswlib::HalfDistance<bf16, inner_product, false>(data.data(), y.data(), &d);
+    float symmetric = hnswlib::HalfDistance<bf16, inner_product, true>(x.data(), y.data(), &d);
+
+    std::vector<std::pair<hnswlib::DISTFUNC<float>, hnswlib::DISTFUNC<float>>> kernels;
+#if defined(USE_AVX512)
+    if (AVX512Capable())
+        kernels.push_back({hnswlib::HalfDistanceAVX512<bf16, inner_product, false>,
+                           hnswlib::HalfDistanceAVX512<bf16, inner_product, true>});
+#endif
+#if defined(USE_F16C)
+    if (AVX2Capable() && F16CCapable())
+        kernels.push_back({hnswlib::HalfDistanceAVX2<bf16, inner_product, false>,
+                           hnswlib::HalfDistanceAVX2<bf16, inner_product, true>});
+#endif
+#if defined(USE_NEON)
+    kernels.push_back({hnswlib::HalfDistanceNEON<bf16, inner_product, false>,
+                       hnswlib::HalfDistanceNEON<bf16, inner_product, true>});
+#endif
+    for (auto &kernel : kernels) {
+        assert(close(kernel.first(data.data(), y.data(), &d), asymmetric));
+        assert(close(kernel.second(x.data(), y.data(), &d), symmetric));
+    }
+#if defined(USE_AVX512BF16)
+    if (bf16 && inner_product && AVX512BF16Capable())
+        assert(close(hnswlib::BF16InnerProductDistanceAVX512BF16(x.data(), y.data(), &d), symmetric));
+#endif
+}
+
+// distances of a space must be the exact distances of the decoded vectors
+void checkSpace(hnswlib::SpaceInterface<float> &space, hnswlib::SpaceInterface<float> &exact,
+                size_t d, float max_relative_error) {
+    std::vector<float> data = randomData(100, d, 47, -1, 1);
+    size_t n = data.size() / d;
+    std::vector<char> stored1(space.get_data_size()), stored2(space.get_data_size());
+    std::vector<float> decoded1(d), decoded2(d);
+    assert(space.get_data_size() == d * 2);
+
+    for (size_t i = 0; i + 1 < n; i++) {
+        const float *x = data.data() + i * d;
+        const float *y = data.data() + (i + 1) * d;
+        space.encode(x, stored1.data());
+        space.encode(y, stored2.data());
+        space.decode(stored1.data(), decoded1.data());
+        space.decode(stored2.data(), decoded2.data());
+        for (size_t j = 0; j < d; j++) assert(std::abs(decoded1[j] - x[j]) <= max_relative_error * std::abs(x[j]) + 1e-7f);
+
+        float asymmetric = space.get_dist_func()(y, stored1.data(), space.get_dist_func_param());
+        assert(close(asymmetric, exact.get_dist_func()(y, decoded1.data(), exact.get_dist_func_param())));
+        float symmetric = space.get_stored_dist_func()(stored2.data(), stored1.data(), space.get_dist_func_param());
+        assert(close(symmetric, exact.get_dist_func()(decoded2.data(), decoded1.data(), exact.get_dist_func_param())));
+    }
+}
+
+void testSpaces() {
+    size_t dims[] = {1, 7, 8, 16, 20, 33, 64, 100};
+    for (size_t d : dims) {
+        checkKernels<false, false>(d);
+        checkKernels<false, true>(d);
+        checkKernels<true, false>(d);
+        checkKernels<true, true>(d);
+
+        hnswlib::L2Space l2(d);
+        hnswlib::InnerProductSpace ip(d);
+        hnswlib::L2SpaceFP16 l2_fp16(d);
+        hnswlib::InnerProductSpaceFP16 ip_fp16(d);
+        hnswlib::L2SpaceBF16 l2_bf16(d);
+        hnswlib::InnerProductSpaceBF16 ip_bf16(d);
+        checkSpace(l2_fp16, l2, d, std::ldexp(1.0f, -11));
+        checkSpace(ip_fp16, ip, d, std::ldexp(1.0f, -11));
+        checkSpace(l2_bf16, l2, d, std::ldexp(1.0f, -8));
+        checkSpace(ip_bf16, ip, d, std::ldexp(1.0f, -8));
+    }
+}
+
+// the recall of an index built in space
+float spaceRecall(hnswlib::SpaceInterface<float> &space, const std::vector<float> &data,
+                  const std::vector<float> &query, size_t d, size_t k) {
+    size_t n = data.size() / d;
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 200);
+    for (size_t i = 0; i < n; i++) alg_hnsw.addPoint(data.data() + i * d, i);
+    alg_hnsw.setEf(100);
+
+    return recall(alg_hnsw, data, query, d, k);
+}
+
+void testIndex() {
+    size_t d = 32;
+    size_t k = 10;
+    std::vector<float> data = randomData(2000, d, 47, -1, 1);
+    std::vector<float> query = randomData(50, d, 48, -1, 1);
+
+    hnswlib::L2SpaceFP16 fp16(d);
+    float recall_fp16 = spaceRecall(fp16, data, query, d, k);
+    hnswlib::L2SpaceBF16 bf16(d);
+    float recall_bf16 = spaceRecall(bf16, data, query, d, k);
+    std::cout << "FP16 recall: " << recall_fp16 << ", BF16 recall: " << recall_bf16 << std::endl;
+    assert(recall_fp16 >= 0.95f);
+    assert(recall_bf16 >= 0.9f);
+
+    // the stored vectors decode to the rounded input
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&fp16, 10);
+    alg_hnsw.addPoint(data.data(), 0);
+    std::vector<float> stored = alg_hnsw.getDataByLabel<float>(0);
+    for (size_t j = 0; j < d; j++) assert(stored[j] == hnswlib::FP16ToFloat(hnswlib::FloatToFP16(data[j])));
+}
+
+void testInt8() {
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_int_distribution<> distrib(0, 255);
+    size_t dims[] = {4, 15, 16, 17, 32, 100, 768};
+    for (size_t d : dims) {
+        std::vector<unsigned char> a(d), b(d);
+        for (size_t i = 0; i < d; i++) {
+            a[i] = (unsigned char) distrib(rng);
+            b[i] = (unsigned char) distrib(rng);
+        }
+        int expected = hnswlib::L2SqrI(a.data(), b.data(), &d);
+        hnswlib::L2SpaceI space(d);
+        assert(space.get_dist_func()(a.data(), b.data(), space.get_dist_func_param()) == expected);
+#if defined(USE_SSE)
+        assert(hnswlib::L2SqrI16ExtSSE(a.data(), b.data(), &d) == expected);
+#endif
+#if defined(USE_AVX2)
+        if (AVX2Capable())
+            assert(hnswlib::L2SqrI16ExtAVX2(a.data(), b.data(), &d) == expected);
+#endif
+#if defined(USE_NEON)
+        assert(hnswlib::L2SqrI16ExtNEON(a.data(), b.data(), &d) == expected);
+#endif
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testConversions();
+    testSpaces();
+    testIndex();
+    testInt8();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
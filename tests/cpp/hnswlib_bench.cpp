@@ -0,0 +1,401 @@
+// Benchmark of index builds and searches over a grid of parameters, reported as JSON.
+//
+// For every M and ef_construction an index of the base vectors is built, then the queries are
+// searched with every ef and every number of threads. Each search reports recall@k against the exact
+// neighbors (a ground truth file or a BruteforceSearch of the base), queries per second, the
+// p50/p99/p999 latencies of single queries and the hops, distance computations and visited elements
+// per query of the SearchCounters. Each build reports its time and the peak RSS of the process so far.
+//
+// Datasets are .fvecs or .bvecs files (each vector a 32-bit dimension followed by the components),
+// ground truths .ivecs files, or random vectors with --synthetic.
+//
+//   hnswlib_bench --base sift_base.fvecs --query sift_query.fvecs --groundtruth sift_groundtruth.ivecs
+//       --M 16,32 --ef-construction 200 --ef 10,20,40,80 --threads 1,8 --output sift.json
+
+#include "../../hnswlib/hnswlib.h"
+#include "rss.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+struct Options {
+    std::string base_path;
+    std::string query_path;
+    std::string groundtruth_path;
+    std::string output_path;
+    std::string space = "l2";
+    size_t synthetic_n = 0, synthetic_dim = 0, synthetic_nq = 0;
+    size_t max_base = 0;
+    size_t max_queries = 0;
+    size_t k = 10;
+    std::vector<size_t> M = {16};
+    std::vector<size_t> ef_construction = {200};
+    std::vector<size_t> ef = {10, 20, 40, 80, 160};
+    std::vector<size_t> threads = {1};
+    size_t build_threads = 0;
+    size_t seed = 100;
+};
+
+struct Dataset {
+    size_t dim = 0;
+    std::vector<float> base;
+    std::vector<float> queries;
+    std::vector<std::vector<idx_t>> groundtruth;  // the nearest first
+
+    size_t size() const { return base.size() / dim; }
+    size_t numQueries() const { return queries.size() / dim; }
+};
+
+const char *USAGE =
+    "usage: hnswlib_bench (--base FILE --query FILE [--groundtruth FILE] | --synthetic N,DIM,NQ) [options]\n"
+    "  --base, --query        .fvecs or .bvecs files\n"
+    "  --groundtruth          .ivecs file of the nearest neighbors of the queries in the whole base,\n"
+    "                         computed by brute force if not given\n"
+    "  --synthetic N,DIM,NQ   N base and NQ query vectors uniform in [0, 1)^DIM\n"
+    "  --space l2|ip          distance (default l2)\n"
+    "  --k K                  neighbors per query (default 10)\n"
+    "  --M LIST               comma separated values (default 16)\n"
+    "  --ef-construction LIST (default 200)\n"
+    "  --ef LIST              (default 10,20,40,80,160)\n"
+    "  --threads LIST         search threads (default 1)\n"
+    "  --build-threads T      (default every hardware thread)\n"
+    "  --max-base N, --max-queries N  use the first vectors of the files only\n"
+    "  --seed S               of the synthetic data and the index levels (default 100)\n"
+    "  --output FILE          JSON report (default standard output)\n";
+
+std::vector<size_t> parseList(const std::string &value) {
+    std::vector<size_t> list;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item.empty() || item.find_first_not_of("0123456789") != std::string::npos)
+            throw std::runtime_error("Not a list of numbers: " + value);
+        list.push_back(std::stoull(item));
+    }
+    if (list.empty())
+        throw std::runtime_error("Not a list of numbers: " + value);
+    return list;
+}
+
+Options parseOptions(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string name = argv[i];
+        if (name == "--help" || name == "-h") {
+            std::cout << USAGE;
+            exit(0);
+        }
+        if (i + 1 >= argc)
+            throw std::runtime_error("Missing the value of " + name);
+        std::string value = argv[++i];
+        if (name == "--base") {
+            options.base_path = value;
+        } else if (name == "--query") {
+            options.query_path = value;
+        } else if (name == "--groundtruth") {
+            options.groundtruth_path = value;
+        } else if (name == "--output") {
+            options.output_path = value;
+        } else if (name == "--space") {
+            if (value != "l2" && value != "ip")
+                throw std::runtime_error("Unknown space " + value);
+            options.space = value;
+        } else if (name == "--synthetic") {
+            std::vector<size_t> sizes = parseList(value);
+            if (sizes.size() != 3 || sizes[0] == 0 || sizes[1] == 0 || sizes[2] == 0)
+                throw std::runtime_error("--synthetic needs N,DIM,NQ");
+            options.synthetic_n = sizes[0];
+            options.synthetic_dim = sizes[1];
+            options.synthetic_nq = sizes[2];
+        } else if (name == "--k") {
+            options.k = parseList(value)[0];
+        } else if (name == "--M") {
+            options.M = parseList(value);
+        } else if (name == "--ef-construction") {
+            options.ef_construction = parseList(value);
+        } else if (name == "--ef") {
+            options.ef = parseList(value);
+        } else if (name == "--threads") {
+            options.threads = parseList(value);
+        } else if (name == "--build-threads") {
+            options.build_threads = parseList(value)[0];
+        } else if (name == "--max-base") {
+            options.max_base = parseList(value)[0];
+        } else if (name == "--max-queries") {
+            options.max_queries = parseList(value)[0];
+        } else if (name == "--seed") {
+            options.seed = parseList(value)[0];
+        } else {
+            throw std::runtime_error("Unknown option " + name);
+        }
+    }
+    bool files = !options.base_path.empty() && !options.query_path.empty();
+    if (files == (options.synthetic_n != 0))
+        throw std::runtime_error("Give either --base and --query or --synthetic");
+    if (options.k == 0)
+        throw std::runtime_error("k must be positive");
+    for (size_t threads : options.threads) {
+        if (threads == 0)
+            throw std::runtime_error("Thread counts must be positive");
+    }
+    return options;
+}
+
+bool endsWith(const std::string &s, const std::string &suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/*
+ * Reads up to max_vectors (0 for all) vectors of a .fvecs, .bvecs or .ivecs file, converted to
+ * T, and sets dim to their dimension
+ */
+template<typename T>
+std::vector<T> readVecs(const std::string &path, size_t max_vectors, size_t &dim) {
+    size_t component_size;
+    if (endsWith(path, ".fvecs") || endsWith(path, ".ivecs"))
+        component_size = 4;
+    else if (endsWith(path, ".bvecs"))
+        component_size = 1;
+    else
+        throw std::runtime_error("Unknown vector file format: " + path);
+    bool integers = endsWith(path, ".ivecs");
+
+    std::ifstream input(path, std::ios::binary);
+    if (!input.is_open())
+        throw std::runtime_error("Cannot open file " + path);
+    std::vector<T> vectors;
+    std::vector<char> row;
+    dim = 0;
+    for (size_t i = 0; max_vectors == 0 || i < max_vectors; i++) {
+        uint32_t row_dim;
+        if (!input.read((char *) &row_dim, sizeof(row_dim)))
+            break;
+        if (row_dim == 0 || (dim != 0 && row_dim != dim))
+            throw std::runtime_error("Inconsistent dimensions in " + path);
+        dim = row_dim;
+        row.resize(dim * component_size);
+        if (!input.read(row.data(), row.size()))
+            throw std::runtime_error("Truncated file " + path);
+        for (size_t j = 0; j < dim; j++) {
+            if (component_size == 1) {
+                vectors.push_back((T) (uint8_t) row[j]);
+            } else if (integers) {
+                int32_t value;
+                memcpy(&value, row.data() + j * 4, 4);
+                vectors.push_back((T) value);
+            } else {
+                float value;
+                memcpy(&value, row.data() + j * 4, 4);
+                vectors.push_back((T) value);
+            }
+        }
+    }
+    if (vectors.empty())
+        throw std::runtime_error("No vectors in " + path);
+    return vectors;
+}
+
+Dataset loadDataset(const Options &options) {
+    Dataset dataset;
+    if (options.synthetic_n != 0) {
+        dataset.dim = options.synthetic_dim;
+        std::mt19937 rng(options.seed);
+        std::uniform_real_distribution<float> distrib;
+        dataset.base.resize(options.synthetic_n * dataset.dim);
+        for (float &x : dataset.base) x = distrib(rng);
+        dataset.queries.resize(options.synthetic_nq * dataset.dim);
+        for (float &x : dataset.queries) x = distrib(rng);
+        return dataset;
+    }
+    size_t query_dim;
+    dataset.base = readVecs<float>(options.base_path, options.max_base, dataset.dim);
+    dataset.queries = readVecs<float>(options.query_path, options.max_queries, query_dim);
+    if (query_dim != dataset.dim)
+        throw std::runtime_error("The queries and the base have different dimensions");
+    if (!options.groundtruth_path.empty()) {
+        size_t gt_k;
+        std::vector<int32_t> ids = readVecs<int32_t>(options.groundtruth_path, dataset.numQueries(), gt_k);
+        if (gt_k < options.k || ids.size() / gt_k < dataset.numQueries())
+            throw std::runtime_error("The ground truth has fewer neighbors or queries than needed");
+        for (size_t q = 0; q < dataset.numQueries(); q++)
+            dataset.groundtruth.emplace_back(ids.begin() + q * gt_k, ids.begin() + q * gt_k + options.k);
+    }
+    return dataset;
+}
+
+void computeGroundtruth(Dataset &dataset, hnswlib::SpaceInterface<float> &space, size_t k, size_t num_threads) {
+    size_t n = dataset.size(), nq = dataset.numQueries();
+    hnswlib::BruteforceSearch<float> exact(&space, n);
+    for (size_t i = 0; i < n; i++)
+        exact.addPoint(dataset.base.data() + i * dataset.dim, i);
+    std::vector<idx_t> labels(nq * k);
+    std::vector<float> distances(nq * k);
+    exact.searchKnnBatch(dataset.queries.data(), nq, k, labels.data(), distances.data(), nullptr, num_threads);
+    for (size_t q = 0; q < nq; q++)
+        dataset.groundtruth.emplace_back(labels.begin() + q * k, labels.begin() + (q + 1) * k);
+}
+
+// The latency below which a fraction p of the sorted latencies lie
+double percentile(const std::vector<double> &sorted, double p) {
+    size_t rank = (size_t) std::ceil(p * sorted.size());
+    return sorted[std::min(std::max(rank, (size_t) 1), sorted.size()) - 1];
+}
+
+std::string jsonString(const std::string &s) {
+    std::string escaped = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+    return escaped + "\"";
+}
+
+struct SearchResult {
+    size_t ef, threads;
+    double recall, qps, p50, p99, p999;
+    double hops, distance_computations, visited;
+};
+
+SearchResult runSearch(const hnswlib::HierarchicalNSW<float> &index, const Dataset &dataset, size_t k, size_t ef, size_t num_threads) {
+    size_t nq = dataset.numQueries();
+    std::vector<std::vector<std::pair<float, idx_t>>> results(nq);
+    std::vector<double> latencies(nq);
+    hnswlib::ThreadPool pool(num_threads);
+    // warms up the threads and their visited lists
+    pool.parallelFor(0, std::min(nq, (size_t) 100), [&](size_t q, size_t) {
+        index.searchKnnCloserFirst(dataset.queries.data() + q * dataset.dim, k);
+    });
+    hnswlib::SearchCounters::reset();
+
+    auto start = std::chrono::steady_clock::now();
+    pool.parallelFor(0, nq, [&](size_t q, size_t) {
+        auto query_start = std::chrono::steady_clock::now();
+        results[q] = index.searchKnnCloserFirst(dataset.queries.data() + q * dataset.dim, k);
+        latencies[q] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - query_start).count();
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t found = 0;
+    for (size_t q = 0; q < nq; q++) {
+        std::unordered_set<idx_t> expected(dataset.groundtruth[q].begin(), dataset.groundtruth[q].end());
+        for (auto &result : results[q])
+            found += expected.count(result.second);
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    SearchResult result;
+    result.ef = ef;
+    result.threads = num_threads;
+    result.recall = (double) found / (nq * k);
+    result.qps = nq / seconds;
+    result.p50 = percentile(latencies, 0.5);
+    result.p99 = percentile(latencies, 0.99);
+    result.p999 = percentile(latencies, 0.999);
+    hnswlib::SearchCounters::Totals counters = hnswlib::SearchCounters::totals();
+    result.hops = (double) counters.hops / nq;
+    result.distance_computations = (double) counters.distance_computations / nq;
+    result.visited = (double) counters.visited / nq;
+    return result;
+}
+
+void run(const Options &options) {
+    Dataset dataset = loadDataset(options);
+    size_t n = dataset.size(), nq = dataset.numQueries();
+    std::unique_ptr<hnswlib::SpaceInterface<float>> space;
+    if (options.space == "l2")
+        space.reset(new hnswlib::L2Space(dataset.dim));
+    else
+        space.reset(new hnswlib::InnerProductSpace(dataset.dim));
+    size_t build_threads = options.build_threads;
+    if (build_threads == 0)
+        build_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    size_t max_threads = *std::max_element(options.threads.begin(), options.threads.end());
+
+    if (dataset.groundtruth.empty()) {
+        std::cerr << "computing the exact neighbors of " << nq << " queries in " << n << " vectors" << std::endl;
+        computeGroundtruth(dataset, *space, options.k, std::max(build_threads, max_threads));
+    }
+    std::vector<idx_t> labels(n);
+    for (size_t i = 0; i < n; i++) labels[i] = i;
+
+    std::ostringstream json;
+    json << "{\n  \"dataset\": {\"base\": " << jsonString(options.base_path.empty() ? "synthetic" : options.base_path)
+         << ", \"queries\": " << jsonString(options.query_path.empty() ? "synthetic" : options.query_path)
+         << ", \"size\": " << n << ", \"num_queries\": " << nq << ", \"dim\": " << dataset.dim
+         << ", \"space\": " << jsonString(options.space) << ", \"k\": " << options.k << "},\n  \"builds\": [";
+    bool first_build = true;
+    for (size_t M : options.M) {
+        for (size_t ef_construction : options.ef_construction) {
+            std::cerr << "building M " << M << " ef_construction " << ef_construction << std::endl;
+            hnswlib::ThreadPool build_pool(build_threads);
+            auto start = std::chrono::steady_clock::now();
+            hnswlib::HierarchicalNSW<float> index(space.get(), n, M, ef_construction, options.seed);
+            index.addPoints(dataset.base.data(), labels.data(), n, build_pool);
+            double build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            json << (first_build ? "\n" : ",\n") << "    {\"M\": " << M << ", \"ef_construction\": " << ef_construction
+                 << ", \"build_threads\": " << build_threads << ", \"build_seconds\": " << build_seconds
+                 << ", \"peak_rss_bytes\": " << getPeakRSS() << ",\n     \"searches\": [";
+            first_build = false;
+            bool first_search = true;
+            for (size_t ef : options.ef) {
+                index.setEf(ef);
+                for (size_t threads : options.threads) {
+                    SearchResult r = runSearch(index, dataset, options.k, ef, threads);
+                    std::cerr << "  ef " << ef << " threads " << threads << ": recall " << r.recall
+                              << ", " << r.qps << " queries/s, p99 " << r.p99 << " us" << std::endl;
+                    json << (first_search ? "\n" : ",\n") << "      {\"ef\": " << r.ef << ", \"threads\": " << r.threads
+                         << ", \"recall\": " << r.recall << ", \"qps\": " << r.qps
+                         << ", \"latency_us\": {\"p50\": " << r.p50 << ", \"p99\": " << r.p99 << ", \"p999\": " << r.p999 << "}"
+                         << ", \"hops_per_query\": " << r.hops
+                         << ", \"distance_computations_per_query\": " << r.distance_computations
+                         << ", \"visited_per_query\": " << r.visited << "}";
+                    first_search = false;
+                }
+            }
+            json << "\n     ]}";
+        }
+    }
+    json << "\n  ]\n}\n";
+
+    if (options.output_path.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream output(options.output_path);
+        output << json.str();
+        if (!output)
+            throw std::runtime_error("Cannot write " + options.output_path);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    try {
+        run(parseOptions(argc, argv));
+    } catch (const std::exception &e) {
+        std::cerr << "error: " << e.what() << "\n" << USAGE;
+        return 1;
+    }
+    return 0;
+}
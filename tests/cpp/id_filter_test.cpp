@@ -0,0 +1,211 @@
+// This is a test file for testing IdFilter:
+// the set matches std::set, and filtered searches return only allowed elements with good recall
+// for selective filters (scanned), broad filters (graph search) and anything in between
+
+#include "../../hnswlib/hnswlib.h"
+#include "test_utils.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void testSet() {
+    std::mt19937 rng(47);
+    std::vector<hnswlib::tableint> ids;
+    // a dense block, a sparse block and scattered ids
+    for (hnswlib::tableint i = 0; i < 65536; i++)
+        if (rng() % 4 == 0) ids.push_back(i);
+    for (int i = 0; i < 1000; i++)
+        ids.push_back(3 * 65536 + rng() % 65536);
+    for (int i = 0; i < 200; i++)
+        ids.push_back(rng() % 5000000);
+    ids.push_back(ids[0]);
+
+    std::set<hnswlib::tableint> expected(ids.begin(), ids.end());
+    hnswlib::IdFilter filter(ids.data(), ids.size());
+    hnswlib::IdFilter added;
+    for (hnswlib::tableint id : ids)
+        added.add(id);
+    for (const hnswlib::IdFilter *f : {&filter, &added}) {
+        assert(f->size() == expected.size());
+        std::vector<hnswlib::tableint> listed;
+        f->forEach([&](hnswlib::tableint id) { listed.push_back(id); });
+        assert(std::equal(listed.begin(), listed.end(), expected.begin()) && listed.size() == expected.size());
+        for (hnswlib::tableint id = 0; id < 5000000; id += rng() % 100)
+            assert(f->contains(id) == (expected.count(id) == 1));
+        assert(!f->contains(4000000000u));
+    }
+    assert(hnswlib::IdFilter().size() == 0 && !hnswlib::IdFilter().contains(0));
+}
+
+class PickDivisibleIds : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(idx_t label) {
+        return label % 3 == 0;
+    }
+};
+
+// The share of the k exact nearest allowed elements that the search found
+float recall(hnswlib::HierarchicalNSW<float> &index, const std::vector<float> &data, const std::vector<idx_t> &labels,
+             const std::vector<float> &query, size_t d, size_t k, const std::set<idx_t> &allowed,
+             std::vector<std::vector<idx_t>> &results) {
+    size_t correct = 0, total = 0;
+    for (size_t q = 0; q < query.size() / d; q++) {
+        std::vector<std::pair<float, idx_t>> exact = exactNeighbors(query.data() + q * d, data, d,
+            [&](size_t i) { return labels[i]; },
+            [&](size_t i) { return allowed.count(labels[i]) && !index.isMarkedDeleted(index.label_lookup_.find(labels[i])); });
+        exact.resize(std::min(exact.size(), k));
+        for (idx_t label : results[q]) {
+            assert(allowed.count(label) == 1);
+            for (auto &e : exact) correct += e.second == label;
+        }
+        total += exact.size();
+    }
+    return total == 0 ? 1.0f : (float) correct / total;
+}
+
+void testSearch() {
+    size_t d = 16;
+    size_t n = 20000;
+    size_t nq = 50;
+    size_t k = 10;
+
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(nq * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+    std::vector<idx_t> labels(n);
+    for (size_t i = 0; i < n; i++) labels[i] = 2 * i + 5;
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100);
+    for (size_t i = 0; i < n; i++) index.addPoint(data.data() + i * d, labels[i]);
+    for (size_t i = 0; i < n; i += 50) index.markDelete(labels[i]);
+    index.setEf(50);
+    hnswlib::ThreadPool pool(4);
+
+    // 20 and 400 elements are scanned, the others searched in the graph
+    for (double share : {0.001, 0.02, 0.3, 1.0}) {
+        std::set<idx_t> allowed;
+        std::vector<idx_t> allowed_labels;
+        for (size_t i = 0; i < n; i++) {
+            if (distrib(rng) < share) {
+                allowed.insert(labels[i]);
+                allowed_labels.push_back(labels[i]);
+            }
+        }
+        allowed_labels.push_back(1);  // no element has it
+        hnswlib::IdFilter filter = index.makeIdFilter(allowed_labels.data(), allowed_labels.size());
+        assert(filter.size() == allowed.size());
+
+        std::vector<std::vector<idx_t>> results(nq);
+        for (size_t q = 0; q < nq; q++) {
+            auto res = index.searchKnn(query.data() + q * d, k, filter);
+            assert(res.size() <= k);
+            for (; !res.empty(); res.pop()) results[q].push_back(res.top().second);
+            std::reverse(results[q].begin(), results[q].end());
+        }
+        float r = recall(index, data, labels, query, d, k, allowed, results);
+        std::cout << "share " << share << " recall " << r << std::endl;
+        assert(r >= (share < 0.05 ? 0.999f : 0.9f));
+
+        // the batch APIs give the same results
+        std::vector<idx_t> batch_labels(nq * k);
+        std::vector<float> batch_distances(nq * k);
+        index.searchKnnBatch(query.data(), nq, k, batch_labels.data(), batch_distances.data(), pool, nullptr, &filter);
+        for (size_t q = 0; q < nq; q++) {
+            for (size_t i = 0; i < results[q].size(); i++)
+                assert(batch_labels[q * k + i] == results[q][i]);
+        }
+
+        // combined with a functor, the results pass both
+        PickDivisibleIds functor;
+        index.searchKnnBatch(query.data(), nq, k, batch_labels.data(), batch_distances.data(), &functor, &filter);
+        for (idx_t label : batch_labels)
+            assert(label == (idx_t) -1 || (label % 3 == 0 && allowed.count(label)));
+    }
+
+    // the graph search alone keeps working for a selective filter, through the two-hop expansion
+    std::set<idx_t> allowed;
+    std::vector<idx_t> allowed_labels;
+    for (size_t i = 0; i < n; i += 20) {
+        allowed.insert(labels[i + 1]);
+        allowed_labels.push_back(labels[i + 1]);
+    }
+    hnswlib::IdFilter filter = index.makeIdFilter(allowed_labels.data(), allowed_labels.size());
+    std::vector<std::vector<idx_t>> results(nq);
+    for (size_t q = 0; q < nq; q++) {
+        const float *p = query.data() + q * d;
+        hnswlib::VisitedList *vl = index.visited_list_pool_->getFreeVisitedList();
+        index.searchBaseLayerIdFilter(vl, index.searchUpperLayers(p), p, 50, filter, nullptr);
+        auto &top = vl->getNeighborPool<float, hnswlib::tableint>().results();
+        for (size_t i = 0; i < std::min(k, top.size()); i++)
+            results[q].push_back(index.getExternalLabel(top[i].second));
+        index.visited_list_pool_->releaseVisitedList(vl);
+    }
+    float r = recall(index, data, labels, query, d, k, allowed, results);
+    std::cout << "two-hop graph search, share 0.05, recall " << r << std::endl;
+    assert(r >= 0.8f);
+}
+
+// scans racing insertions see the elements they name either fully initialized or not at all
+void testConcurrentInsert() {
+    size_t d = 16;
+    size_t n = 20000;
+    size_t k = 10;
+
+    std::vector<float> data = randomData(n, d, 47);
+    std::vector<float> query = randomData(1, d, 48);
+    hnswlib::L2Space space(d);
+    hnswlib::DISTFUNC<float> dist = space.get_dist_func();
+    hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100);
+    index.setEf(50);
+
+    // ids, not labels, so the filter names elements that are not there yet
+    std::vector<hnswlib::tableint> ids;
+    for (hnswlib::tableint id = 0; id < n; id += 50) ids.push_back(id);
+    hnswlib::IdFilter filter(ids.data(), ids.size());
+
+    std::atomic<size_t> next_row{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 3; t++) {
+        threads.emplace_back([&]() {
+            for (size_t row = next_row++; row < n; row = next_row++)
+                index.addPoint(data.data() + row * d, row);
+        });
+    }
+    size_t searches = 0;
+    while (next_row < n || searches < 100) {
+        auto res = index.searchKnn(query.data(), k, filter);
+        for (; !res.empty(); res.pop()) {
+            idx_t label = res.top().second;
+            assert(label < n);
+            assert(res.top().first == dist(query.data(), data.data() + label * d, space.get_dist_func_param()));
+        }
+        searches++;
+    }
+    for (auto &thread : threads) thread.join();
+    std::cout << searches << " filtered searches during the insertions" << std::endl;
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testSet();
+    testSearch();
+    testConcurrentInsert();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
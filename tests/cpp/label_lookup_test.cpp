@@ -0,0 +1,168 @@
+// This is a test file for testing ShardedLabelLookup:
+// dense and hashed labels behave like a map under random operations, bulk builds (also on a
+// thread pool) and reserve keep the contents, and concurrent readers see every stable label
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+const hnswlib::tableint NOT_FOUND = hnswlib::ShardedLabelLookup::NOT_FOUND;
+
+void checkEqual(const hnswlib::ShardedLabelLookup &lookup, const std::unordered_map<idx_t, hnswlib::tableint> &expected) {
+    assert(lookup.size() == expected.size());
+    for (auto &kv : expected)
+        assert(lookup.find(kv.first) == kv.second);
+    size_t visited = 0;
+    lookup.forEach([&](idx_t label, hnswlib::tableint id) {
+        auto it = expected.find(label);
+        assert(it != expected.end() && it->second == id);
+        visited++;
+    });
+    assert(visited == expected.size());
+}
+
+void testRandomOperations() {
+    std::mt19937_64 rng(47);
+    hnswlib::ShardedLabelLookup lookup(1000);
+    std::unordered_map<idx_t, hnswlib::tableint> expected;
+
+    // small labels use the array, the others the tables; few distinct labels force
+    // collisions, growth and backward shifts
+    auto randomLabel = [&]() -> idx_t {
+        switch (rng() % 3) {
+            case 0: return rng() % 1000;
+            case 1: return 1000 + rng() % 5000;
+            default: return rng();
+        }
+    };
+    std::vector<idx_t> inserted;
+    for (int op = 0; op < 200000; op++) {
+        int kind = rng() % 4;
+        if (kind < 2 || inserted.empty()) {
+            idx_t label = randomLabel();
+            hnswlib::tableint id = rng() % 1000000;
+            lookup.insert(label, id);
+            expected[label] = id;
+            inserted.push_back(label);
+        } else if (kind == 2) {
+            idx_t label = inserted[rng() % inserted.size()];
+            assert(lookup.erase(label) == (expected.erase(label) == 1));
+        } else {
+            idx_t label = rng() % 2 ? inserted[rng() % inserted.size()] : randomLabel();
+            auto it = expected.find(label);
+            assert(lookup.find(label) == (it == expected.end() ? NOT_FOUND : it->second));
+        }
+    }
+    checkEqual(lookup, expected);
+
+    // labels between the old and the new size move to the array
+    lookup.reserve(4000);
+    checkEqual(lookup, expected);
+
+    hnswlib::ShardedLabelLookup other;
+    other.swap(lookup);
+    checkEqual(other, expected);
+    assert(lookup.size() == 0);
+
+    for (auto &kv : expected)
+        assert(other.erase(kv.first));
+    assert(other.size() == 0);
+    assert(!other.erase(1));
+}
+
+void testBuild() {
+    size_t n = 50000;
+    std::mt19937_64 rng(47);
+    std::vector<idx_t> labels(n);
+    for (size_t i = 0; i < n; i++)
+        labels[i] = i % 2 ? i : rng();
+    labels[n - 1] = labels[0];  // a later duplicate wins
+
+    hnswlib::ShardedLabelLookup lookup(n);
+    lookup.insert(7, 7);
+    lookup.insert(rng(), 11);
+    lookup.build(n, [&](size_t i) { return labels[i]; });
+
+    std::unordered_map<idx_t, hnswlib::tableint> expected;
+    for (size_t i = 0; i < n; i++)
+        expected[labels[i]] = i;
+    checkEqual(lookup, expected);
+    assert(lookup.find(labels[0]) == n - 1);
+
+    // the same on a pool, with more duplicates: the larger id still wins
+    hnswlib::ThreadPool pool(4);
+    for (size_t i = 1; i < 100; i++)
+        labels[n - 1 - i] = labels[i];
+    expected.clear();
+    for (size_t i = 0; i < n; i++)
+        expected[labels[i]] = i;
+    hnswlib::ShardedLabelLookup pooled(n);
+    pooled.insert(rng(), 11);
+    pooled.build(n, [&](size_t i) { return labels[i]; }, pool);
+    checkEqual(pooled, expected);
+    assert(pooled.find(labels[0]) == n - 1);
+}
+
+void testConcurrentAccess() {
+    size_t num_stable = 20000;
+    hnswlib::ShardedLabelLookup lookup(1000);
+    std::vector<idx_t> stable(num_stable);
+    std::mt19937_64 rng(47);
+    for (size_t i = 0; i < num_stable; i++) {
+        stable[i] = i < 500 ? i : rng();
+        lookup.insert(stable[i], i);
+    }
+
+    std::atomic<bool> done(false);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; t++) {
+        readers.push_back(std::thread([&]() {
+            while (!done) {
+                for (size_t i = 0; i < num_stable; i++)
+                    assert(lookup.find(stable[i]) == i);
+            }
+        }));
+    }
+    // writers insert and erase other labels, which grows and reshuffles the same tables
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 3; t++) {
+        writers.push_back(std::thread([&, t]() {
+            std::mt19937_64 writer_rng(t);
+            std::vector<idx_t> own;
+            for (int round = 0; round < 5; round++) {
+                for (int i = 0; i < 20000; i++) {
+                    idx_t label = writer_rng();
+                    own.push_back(label);
+                    lookup.insert(label, 1);
+                }
+                for (idx_t label : own)
+                    lookup.erase(label);
+                own.clear();
+            }
+        }));
+    }
+    for (auto &thread : writers) thread.join();
+    done = true;
+    for (auto &thread : readers) thread.join();
+    assert(lookup.size() == num_stable);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testRandomOperations();
+    testBuild();
+    testConcurrentAccess();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,74 @@
+// This is a test file for testing LinkListArena:
+// blocks allocated concurrently never overlap, stay readable while the arena grows
+// and are numbered after the base segment
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <vector>
+#include <thread>
+#include <iostream>
+
+namespace {
+
+void testBase() {
+    size_t block_size = 68;
+    hnswlib::LinkListArena arena;
+    arena.init(block_size);
+    char *base = (char *) malloc(10 * block_size);
+    memset(base, 7, 10 * block_size);
+    arena.setBase(base, 10, true);
+
+    assert(arena.at(0) == base);
+    assert(arena.at(9) == base + 9 * block_size);
+    assert(arena.inBase(9));
+
+    uint32_t block = arena.allocate(3);
+    assert(block == 10);
+    assert(!arena.inBase(block));
+    for (size_t i = 0; i < 3 * block_size; i++) assert(arena.at(block)[i] == 0);
+}
+
+void testThreads() {
+    size_t block_size = 4100;  // a few blocks per chunk, so the chunk table grows
+    int num_threads = 8;
+    int num_allocations = 500;
+    hnswlib::LinkListArena arena;
+    arena.init(block_size);
+
+    std::vector<std::vector<std::pair<uint32_t, int>>> allocations(num_threads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread([&, t]() {
+            for (int i = 0; i < num_allocations; i++) {
+                int level = 1 + (i % 5);
+                uint32_t block = arena.allocate(level);
+                memset(arena.at(block), t + 1, level * block_size);
+                allocations[t].push_back(std::make_pair(block, level));
+                // blocks allocated earlier by this thread are still readable
+                uint32_t first = allocations[t][0].first;
+                assert(arena.at(first)[0] == t + 1);
+            }
+        }));
+    }
+    for (auto &thread : threads) thread.join();
+
+    for (int t = 0; t < num_threads; t++) {
+        for (auto &allocation : allocations[t]) {
+            char *p = arena.at(allocation.first);
+            for (size_t i = 0; i < allocation.second * block_size; i++) assert(p[i] == t + 1);
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testBase();
+    testThreads();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
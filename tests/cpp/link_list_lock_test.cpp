@@ -0,0 +1,150 @@
+// This is a test file for testing LinkListLock:
+// writers exclude each other, readers see whole writes without taking the lock,
+// and an index built from many threads is consistent and searchable
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <unordered_set>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void testLock() {
+    assert(sizeof(hnswlib::LinkListLock) == 4);
+
+    // a list of equal values, so a reader can tell a torn copy
+    const size_t LIST_SIZE = 16;
+    hnswlib::LinkListLock lock;
+    unsigned int list[LIST_SIZE] = {0};
+    std::atomic<bool> done(false);
+    size_t writes_per_thread = 20000;
+
+    std::vector<std::thread> readers;
+    std::atomic<size_t> reads(0);
+    for (int t = 0; t < 2; t++) {
+        readers.push_back(std::thread([&]() {
+            unsigned int copy[LIST_SIZE];
+            while (!done) {
+                uint32_t version;
+                do {
+                    version = lock.readBegin();
+                    memcpy(copy, list, sizeof(copy));
+                } while (!lock.readValid(version));
+                for (size_t i = 1; i < LIST_SIZE; i++) assert(copy[i] == copy[0]);
+                reads++;
+            }
+        }));
+    }
+
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 3; t++) {
+        writers.push_back(std::thread([&]() {
+            for (size_t w = 0; w < writes_per_thread; w++) {
+                std::unique_lock<hnswlib::LinkListLock> guard(lock);
+                hnswlib::LinkListLock::WriteSection write(lock);
+                // read-modify-write, lost updates would show in the final count
+                unsigned int next = list[0] + 1;
+                for (size_t i = 0; i < LIST_SIZE; i++) list[i] = next;
+            }
+        }));
+    }
+    for (auto &thread : writers) thread.join();
+    done = true;
+    for (auto &thread : readers) thread.join();
+    assert(list[0] == 3 * writes_per_thread);
+    std::cout << "consistent reads: " << reads << std::endl;
+
+    // holding the lock alone lets readers through
+    lock.lock();
+    uint32_t version = lock.readBegin();
+    assert(lock.readValid(version));
+    assert(!lock.try_lock());
+    lock.unlock();
+    assert(lock.readValid(version));
+    {
+        std::unique_lock<hnswlib::LinkListLock> guard(lock);
+        hnswlib::LinkListLock::WriteSection write(lock);
+    }
+    assert(!lock.readValid(version));
+}
+
+void testConcurrentBuild() {
+    size_t d = 16;
+    size_t n = 8000;
+    size_t k = 10;
+    size_t num_threads = 8;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(100 * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread([&]() {
+            size_t i;
+            while ((i = next++) < n) {
+                alg_hnsw.addPoint(data.data() + i * d, i);
+                // updates rewrite lists of existing elements
+                if (i % 50 == 49) alg_hnsw.addPoint(data.data() + (i - 1) * d, i - 1);
+            }
+        }));
+    }
+    for (auto &thread : threads) thread.join();
+    assert(alg_hnsw.getCurrentElementCount() == n);
+
+    for (hnswlib::tableint i = 0; i < n; i++) {
+        for (int level = 0; level <= alg_hnsw.element_levels_[i]; level++) {
+            std::vector<hnswlib::tableint> links = alg_hnsw.getConnectionsWithLock(i, level);
+            assert(links.size() <= (level ? alg_hnsw.maxM_ : alg_hnsw.maxM0_));
+            for (hnswlib::tableint link : links) {
+                assert(link < n);
+                assert(alg_hnsw.element_levels_[link] >= level);
+            }
+        }
+    }
+
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (size_t i = 0; i < n; i++) alg_brute.addPoint(data.data() + i * d, i);
+    alg_hnsw.setEf(50);
+    size_t correct = 0;
+    for (size_t j = 0; j < query.size() / d; j++) {
+        auto gt = alg_brute.searchKnn(query.data() + j * d, k);
+        std::unordered_set<idx_t> expected;
+        while (!gt.empty()) {
+            expected.insert(gt.top().second);
+            gt.pop();
+        }
+        auto res = alg_hnsw.searchKnn(query.data() + j * d, k);
+        while (!res.empty()) {
+            if (expected.count(res.top().second)) correct++;
+            res.pop();
+        }
+    }
+    float recall = (float) correct / (query.size() / d * k);
+    std::cout << "recall: " << recall << std::endl;
+    assert(recall >= 0.9f);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testLock();
+    testConcurrentBuild();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,113 @@
+// This is a test file for testing the memory policies of the base layer:
+// every policy keeps the contents through growth and finds what the default one finds
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cstdio>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+const hnswlib::MemoryPolicy POLICIES[] = {
+    hnswlib::MemoryPolicy::Default,
+    hnswlib::MemoryPolicy::HugePages,
+    hnswlib::MemoryPolicy::HugePages1GB,
+    hnswlib::MemoryPolicy::Interleave
+};
+
+void testMemory(hnswlib::MemoryPolicy policy) {
+    size_t size = 3000;
+    char *p = hnswlib::allocateMemory(size, policy);
+    assert(p != nullptr);
+    for (size_t i = 0; i < size; i++) p[i] = (char) i;
+
+    // grows past a page and shrinks, keeping the used part
+    for (size_t new_size : {(size_t) 5 << 20, (size_t) 100000, (size_t) 3000}) {
+        p = hnswlib::reallocateMemory(p, size, new_size, 3000, policy);
+        assert(p != nullptr);
+        for (size_t i = 0; i < 3000; i++) assert(p[i] == (char) i);
+        p[new_size - 1] = 1;
+        size = new_size;
+    }
+    hnswlib::freeMemory(p, size, policy);
+    hnswlib::freeMemory(nullptr, 0, policy);
+}
+
+std::vector<std::pair<float, idx_t>> searchAll(hnswlib::HierarchicalNSW<float> &alg_hnsw,
+                                               const std::vector<float> &query, size_t d, size_t k) {
+    std::vector<std::pair<float, idx_t>> all;
+    for (size_t j = 0; j < query.size() / d; j++) {
+        auto res = alg_hnsw.searchKnnCloserFirst(query.data() + j * d, k);
+        all.insert(all.end(), res.begin(), res.end());
+    }
+    return all;
+}
+
+void testIndex() {
+    size_t d = 16;
+    size_t n = 4000;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(50 * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    std::vector<std::pair<float, idx_t>> expected;
+    for (hnswlib::MemoryPolicy policy : POLICIES) {
+        // set on an empty index, then grown in small steps while adding
+        hnswlib::HierarchicalNSW<float> alg_hnsw(&space, 100, 16, 100, 100, true);
+        alg_hnsw.setMemoryPolicy(policy);
+        assert(alg_hnsw.getMemoryPolicy() == policy);
+        for (size_t i = 0; i < n; i++) {
+            if (i == alg_hnsw.getMaxElements()) alg_hnsw.resizeIndex(i + 700);
+            alg_hnsw.addPoint(data.data() + i * d, i);
+        }
+        alg_hnsw.setEf(50);
+        std::vector<std::pair<float, idx_t>> found = searchAll(alg_hnsw, query, d, k);
+        if (expected.empty())
+            expected = found;
+        assert(found == expected);
+
+        // the storage replaced by compact() and the loaded one follow the policy too
+        for (size_t i = 0; i < n; i += 5) alg_hnsw.markDelete(i);
+        alg_hnsw.compact();
+        alg_hnsw.resizeIndex(n + 500);
+        for (size_t i = 0; i < n; i += 5) alg_hnsw.addPoint(data.data() + i * d, i);
+        assert(alg_hnsw.getCurrentElementCount() == n);
+
+        std::string path = "memory_policy_test.bin";
+        alg_hnsw.saveIndex(path);
+        hnswlib::HierarchicalNSW<float> alg_loaded(&space, path);
+        alg_loaded.setMemoryPolicy(policy);
+        alg_loaded.resizeIndex(2 * n);
+        alg_loaded.setEf(50);
+        alg_hnsw.setEf(50);
+        assert(searchAll(alg_loaded, query, d, k) == searchAll(alg_hnsw, query, d, k));
+        std::remove(path.c_str());
+
+        // switching back copies the elements to the heap
+        alg_loaded.setMemoryPolicy(hnswlib::MemoryPolicy::Default);
+        std::vector<float> stored = alg_loaded.getDataByLabel<float>(7);
+        assert(std::equal(stored.begin(), stored.end(), data.begin() + 7 * d));
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    for (hnswlib::MemoryPolicy policy : POLICIES) testMemory(policy);
+    testIndex();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
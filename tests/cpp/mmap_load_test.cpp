@@ -0,0 +1,154 @@
+// This is a test file for testing saving an index in the v2 format
+// and loading it back by reading it or by mapping it read-only / copy-on-write,
+// and saving it in the v1 format of older releases
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+std::vector<char> readFile(const std::string &path) {
+    std::ifstream input(path, std::ios::binary);
+    return std::vector<char>((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+}
+
+void checkSameResults(hnswlib::HierarchicalNSW<float> &expected, hnswlib::HierarchicalNSW<float> &actual,
+                      const std::vector<float> &query, int d, size_t k) {
+    size_t nq = query.size() / d;
+    for (size_t j = 0; j < nq; ++j) {
+        const void *p = query.data() + j * d;
+        auto res1 = expected.searchKnnCloserFirst(p, k);
+        auto res2 = actual.searchKnnCloserFirst(p, k);
+        assert(res1 == res2);
+    }
+}
+
+void test() {
+    int d = 16;
+    idx_t n = 2000;
+    idx_t nq = 50;
+    size_t k = 10;
+    std::string path = "mmap_load_test.bin";
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    for (idx_t i = 0; i < n * d; ++i) data[i] = distrib(rng);
+    for (idx_t i = 0; i < nq * d; ++i) query[i] = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n + 100, 16, 100, 100, true);
+    for (idx_t i = 0; i < n; ++i) alg_hnsw.addPoint(data.data() + d * i, i);
+    for (idx_t i = 0; i < n; i += 10) alg_hnsw.markDelete(i);
+    alg_hnsw.setEf(50);
+
+    alg_hnsw.saveIndex(path);
+    assert(readFile(path).size() == alg_hnsw.indexFileSize());
+
+    // read into memory
+    {
+        hnswlib::HierarchicalNSW<float> loaded(&space, path, false, n + 100, true);
+        loaded.setEf(50);
+        assert(loaded.cur_element_count == n);
+        assert(loaded.getDeletedCount() == n / 10);
+        assert(loaded.getMaxElements() == n + 100);
+        checkSameResults(alg_hnsw, loaded, query, d, k);
+        assert(loaded.getDataByLabel<float>(1) == alg_hnsw.getDataByLabel<float>(1));
+    }
+
+    // read-only mapping: searchable, not modifiable
+    {
+        hnswlib::HierarchicalNSW<float> mapped(&space, path, false, 0, false, hnswlib::IndexLoadMode::MmapReadOnly);
+        mapped.setEf(50);
+        assert(mapped.cur_element_count == n);
+        assert(mapped.getDeletedCount() == n / 10);
+        checkSameResults(alg_hnsw, mapped, query, d, k);
+
+        bool thrown = false;
+        try {
+            mapped.markDelete(1);
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        assert(thrown);
+        thrown = false;
+        try {
+            mapped.addPoint(data.data(), n);
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    // copy-on-write mapping: modifiable, the file is left untouched
+    std::vector<char> file_before = readFile(path);
+    {
+        hnswlib::HierarchicalNSW<float> mapped(&space, path, false, n + 100, true, hnswlib::IndexLoadMode::MmapCopyOnWrite);
+        mapped.setEf(50);
+        assert(mapped.getMaxElements() == n + 100);
+        checkSameResults(alg_hnsw, mapped, query, d, k);
+
+        mapped.markDelete(1);
+        mapped.addPoint(data.data() + d * 1, n, true);  // reuses a deleted slot
+        mapped.addPoint(data.data() + d * 2, n + 1);
+        auto res = mapped.searchKnn(data.data() + d * 1, 1);
+        assert(res.top().second == n);
+    }
+    assert(readFile(path) == file_before);
+
+    // the v1 format of older releases is still written on request, and only read into memory
+    {
+        std::string path_v1 = "mmap_load_test_v1.bin";
+        alg_hnsw.saveIndex(path_v1, hnswlib::IndexFormat::V1);
+        std::vector<char> file_v1 = readFile(path_v1);
+        size_t offset_level0;
+        memcpy(&offset_level0, file_v1.data(), sizeof(offset_level0));
+        assert(offset_level0 == alg_hnsw.offsetLevel0_);
+        hnswlib::HierarchicalNSW<float> loaded(&space, path_v1, false, n + 100, true);
+        loaded.setEf(50);
+        assert(loaded.getDeletedCount() == n / 10);
+        checkSameResults(alg_hnsw, loaded, query, d, k);
+        bool thrown = false;
+        try {
+            hnswlib::HierarchicalNSW<float> mapped(&space, path_v1, false, 0, false, hnswlib::IndexLoadMode::MmapReadOnly);
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        assert(thrown);
+        std::remove(path_v1.c_str());
+    }
+
+    // a mapped index can be saved again
+    {
+        hnswlib::HierarchicalNSW<float> mapped(&space, path, false, 0, false, hnswlib::IndexLoadMode::MmapReadOnly);
+        std::string path2 = "mmap_load_test2.bin";
+        mapped.saveIndex(path2);
+        hnswlib::HierarchicalNSW<float> loaded(&space, path2);
+        loaded.setEf(50);
+        checkSameResults(alg_hnsw, loaded, query, d, k);
+        std::remove(path2.c_str());
+    }
+    std::remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "../../hnswlib/hnswlib.h"
 #include <thread>
+#include <atomic>
 #include <chrono>
 
 
@@ -56,8 +57,7 @@ int main() {
 
     // insert remaining elements if needed
     for (hnswlib::labeltype label = 0; label < max_elements; label++) {
-        auto search = alg_hnsw->label_lookup_.find(label);
-        if (search == alg_hnsw->label_lookup_.end()) {
+        if (alg_hnsw->label_lookup_.find(label) == hnswlib::ShardedLabelLookup::NOT_FOUND) {
             std::cout << "Adding " << label << std::endl;
             std::vector<float> data(d);
             for (int i = 0; i < d; i++) {
@@ -69,7 +69,7 @@ int main() {
 
     std::cout << "Index is created" << std::endl;
 
-    bool stop_threads = false;
+    std::atomic<bool> stop_threads(false);
     std::vector<std::thread> threads;
 
     // create threads that will do markDeleted and unmarkDeleted of random elements
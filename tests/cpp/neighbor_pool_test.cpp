@@ -0,0 +1,211 @@
+// This is a test file for testing NeighborPool and ReusableHeap,
+// and the searches that keep their candidates in them, with labels other than the internal ids
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <queue>
+#include <vector>
+#include <iostream>
+#include <unordered_set>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void testPool() {
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib(0, 1);
+
+    hnswlib::NeighborPool<float, unsigned int> pool;
+    for (size_t capacity : {1, 2, 10, 100}) {
+        pool.reset(capacity);
+        std::vector<float> inserted;
+        for (unsigned int i = 0; i < 1000; i++) {
+            float d = distrib(rng);
+            bool closer = inserted.size() < capacity || d < pool.farthestDistance();
+            assert(pool.insert(i, d) == closer);
+            inserted.push_back(d);
+            assert(pool.size() == std::min(inserted.size(), capacity));
+        }
+        assert(pool.full());
+
+        // exported closer first, and they are the closest elements
+        pool.exportResults();
+        std::vector<std::pair<float, unsigned int>> &results = pool.results();
+        std::sort(inserted.begin(), inserted.end());
+        assert(results.size() == capacity);
+        for (size_t i = 0; i < capacity; i++) {
+            assert(results[i].first == inserted[i]);
+            if (i > 0) assert(results[i - 1].first <= results[i].first);
+        }
+    }
+
+    // elements are expanded closer first, including the ones inserted before the cursor
+    pool.reset(4);
+    pool.insert(1, 1.0f);
+    pool.insert(3, 3.0f);
+    assert(pool.next() == 1);
+    pool.insert(2, 2.0f);
+    pool.insert(0, 0.5f);
+    assert(pool.next() == 0);
+    assert(pool.next() == 2);
+    assert(pool.full());
+    assert(!pool.insert(4, 4.0f));
+    assert(pool.insert(5, 2.5f));  // drops 3
+    assert(pool.next() == 5);
+    assert(!pool.hasNext());
+}
+
+void testHeap() {
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_int_distribution<> distrib(0, 100);
+
+    std::vector<int> storage;
+    for (int round = 0; round < 3; round++) {
+        hnswlib::ReusableHeap<int, std::less<int>> heap(storage);
+        std::priority_queue<int> expected;
+        for (int i = 0; i < 500; i++) {
+            int v = distrib(rng);
+            heap.emplace(v);
+            expected.push(v);
+            if (v % 3 == 0) {
+                heap.pop();
+                expected.pop();
+            }
+            assert(heap.size() == expected.size());
+            assert(heap.top() == expected.top());
+        }
+        std::vector<int> &sorted = heap.sorted();
+        assert(std::is_sorted(sorted.begin(), sorted.end()));
+    }
+}
+
+class PickEven : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(idx_t label_id) {
+        return label_id % 2 == 0;
+    }
+};
+
+template<typename filter_t>
+float recall(hnswlib::HierarchicalNSW<float> &alg_hnsw, hnswlib::BruteforceSearch<float> &alg_brute,
+             const std::vector<float> &query, size_t d, size_t k, filter_t *filter) {
+    size_t nq = query.size() / d;
+    std::vector<idx_t> labels(nq * k);
+    std::vector<float> distances(nq * k);
+    alg_hnsw.searchKnnBatch(query.data(), nq, k, labels.data(), distances.data(), filter);
+
+    size_t correct = 0;
+    for (size_t j = 0; j < nq; j++) {
+        auto gt = alg_brute.searchKnn(query.data() + j * d, k, filter);
+        std::unordered_set<idx_t> expected;
+        while (!gt.empty()) {
+            expected.insert(gt.top().second);
+            gt.pop();
+        }
+
+        // searchKnn finds what the batch search finds, and pops the farthest first
+        auto res = alg_hnsw.searchKnn(query.data() + j * d, k, filter);
+        assert(res.size() == k);
+        for (size_t i = k; i > 0; i--) {
+            assert(res.top().second == labels[j * k + i - 1]);
+            assert(res.top().first == distances[j * k + i - 1]);
+            if (filter) assert((*filter)(res.top().second));
+            if (expected.count(res.top().second)) correct++;
+            res.pop();
+        }
+    }
+    return (float) correct / (nq * k);
+}
+
+void testSearch() {
+    int d = 16;
+    size_t n = 4000;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < n * d; i++) data[i] = distrib(rng);
+    std::vector<float> query(50 * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100);
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (size_t i = 0; i < n / 2; i++) {
+        alg_hnsw.addPoint(data.data() + i * d, i);
+        alg_brute.addPoint(data.data() + i * d, i);
+    }
+    alg_hnsw.setEf(50);
+
+    // small ef, the pool grows for the larger k without dropping results
+    float r = recall<hnswlib::BaseFilterFunctor>(alg_hnsw, alg_brute, query, d, k, nullptr);
+    std::cout << "recall: " << r << std::endl;
+    assert(r >= 0.9f);
+    alg_hnsw.setEf(5);
+    assert(recall<hnswlib::BaseFilterFunctor>(alg_hnsw, alg_brute, query, d, k, nullptr) >= 0.5f);
+    alg_hnsw.setEf(50);
+
+    PickEven pick_even;
+    r = recall(alg_hnsw, alg_brute, query, d, k, &pick_even);
+    std::cout << "filtered recall: " << r << std::endl;
+    assert(r >= 0.9f);
+
+    // insertions with deleted elements in the graph search with heaps
+    for (size_t i = 0; i < n / 2; i += 10) alg_hnsw.markDelete(i);
+    for (size_t i = n / 2; i < n; i++) alg_hnsw.addPoint(data.data() + i * d, i);
+    hnswlib::BruteforceSearch<float> alg_brute_live(&space, n);
+    for (size_t i = 0; i < n; i++) {
+        if (i >= n / 2 || i % 10 != 0) alg_brute_live.addPoint(data.data() + i * d, i);
+    }
+    r = recall<hnswlib::BaseFilterFunctor>(alg_hnsw, alg_brute_live, query, d, k, nullptr);
+    std::cout << "recall with deletions: " << r << std::endl;
+    assert(r >= 0.9f);
+}
+
+// the searches with a stop condition return labels, not internal ids
+void testStopConditionLabels() {
+    size_t d = 16;
+    size_t n = 2000;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < n * d; i++) data[i] = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100);
+    for (size_t i = 0; i < n; i++) alg_hnsw.addPoint(data.data() + i * d, 1000000 + 7 * (n - i));
+
+    for (size_t q = 0; q < 50; q++) {
+        const float *p = data.data() + q * d;
+        hnswlib::EpsilonSearchStopCondition<float> stop_condition(0.5f, 200, n);
+        std::vector<std::pair<float, idx_t>> result = alg_hnsw.searchStopConditionClosest(p, stop_condition);
+        assert(!result.empty() && result[0].second == 1000000 + 7 * (n - q) && result[0].first == 0.0f);
+        for (auto &r : result) {
+            std::vector<float> v = alg_hnsw.getDataByLabel<float>(r.second);
+            assert(hnswlib::L2Sqr(p, v.data(), &d) == r.first);
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testPool();
+    testHeap();
+    testSearch();
+    testStopConditionLabels();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
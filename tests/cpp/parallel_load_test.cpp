@@ -0,0 +1,123 @@
+// This is a test file for testing loading an index on a thread pool:
+// v1 and v2 files load the same graph, labels and deleted elements with and without a pool,
+// and damaged v1 files are still rejected
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void checkSameIndex(hnswlib::HierarchicalNSW<float> &expected, hnswlib::HierarchicalNSW<float> &actual,
+                    const std::vector<float> &query, size_t d) {
+    size_t n = expected.cur_element_count;
+    assert(actual.cur_element_count == n);
+    assert(actual.getDeletedCount() == expected.getDeletedCount());
+    assert(actual.deleted_elements == expected.deleted_elements);
+    assert(actual.label_lookup_.size() == n);
+    assert(memcmp(actual.data_level0_memory_, expected.data_level0_memory_, n * expected.size_data_per_element_) == 0);
+    for (size_t i = 0; i < n; i++) {
+        assert(actual.element_levels_[i] == expected.element_levels_[i]);
+        assert(actual.label_lookup_.find(expected.getExternalLabel(i)) == i);
+        for (int level = 1; level <= expected.element_levels_[i]; level++)
+            assert(memcmp(actual.get_linklist(i, level), expected.get_linklist(i, level), expected.size_links_per_element_) == 0);
+    }
+
+    expected.setEf(50);
+    actual.setEf(50);
+    for (size_t j = 0; j < query.size() / d; j++) {
+        const void *p = query.data() + j * d;
+        assert(expected.searchKnnCloserFirst(p, 10) == actual.searchKnnCloserFirst(p, 10));
+    }
+}
+
+void test() {
+    size_t d = 8;
+    size_t n = 20000;
+    size_t nq = 50;
+    std::string path_v1 = "parallel_load_test_v1.bin";
+    std::string path_v2 = "parallel_load_test_v2.bin";
+
+    std::mt19937_64 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(nq * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+
+    // array labels and hashed labels
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100, 100, true);
+    for (size_t i = 0; i < n; i++)
+        alg_hnsw.addPoint(data.data() + i * d, i % 2 ? i : rng() >> 1);
+    for (size_t i = 0; i < n; i += 7)
+        alg_hnsw.markDelete(alg_hnsw.getExternalLabel(i));
+    alg_hnsw.saveIndex(path_v2);
+    alg_hnsw.saveIndex(path_v1, hnswlib::IndexFormat::V1);
+
+    hnswlib::ThreadPool single(1);
+    hnswlib::ThreadPool pool(4);
+    for (const std::string &path : {path_v1, path_v2}) {
+        hnswlib::HierarchicalNSW<float> serial(&space, path, false, n, true);
+        checkSameIndex(alg_hnsw, serial, query, d);
+        for (hnswlib::ThreadPool *p : {&single, &pool}) {
+            hnswlib::HierarchicalNSW<float> loaded(&space, path, false, n + 100, true, hnswlib::IndexLoadMode::Copy, p);
+            checkSameIndex(serial, loaded, query, d);
+            assert(loaded.getMaxElements() == n + 100);
+
+            // the loaded index keeps working
+            loaded.addPoint(query.data(), n + 1000000, true);
+            assert(loaded.getDeletedCount() == serial.getDeletedCount() - 1);
+            assert(loaded.searchKnn(query.data(), 1).top().second == n + 1000000);
+        }
+    }
+    hnswlib::HierarchicalNSW<float> mapped(&space, path_v2, false, 0, false, hnswlib::IndexLoadMode::MmapReadOnly, &pool);
+    assert(mapped.deleted_elements.empty());
+    mapped.deleted_elements = alg_hnsw.deleted_elements;
+    checkSameIndex(alg_hnsw, mapped, query, d);
+
+    // a truncated v1 file and a v1 file with a broken list size
+    std::ifstream input(path_v1, std::ios::binary);
+    std::vector<char> file((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    size_t header_size = file.size();
+    for (size_t i = 0; i < n; i++) {
+        unsigned int linkListSize = alg_hnsw.element_levels_[i] > 0 ? alg_hnsw.size_links_per_element_ * alg_hnsw.element_levels_[i] : 0;
+        header_size -= sizeof(linkListSize) + linkListSize;
+    }
+    header_size -= n * alg_hnsw.size_data_per_element_;
+    std::vector<std::vector<char>> damaged(2, file);
+    damaged[0].resize(file.size() - 3);
+    unsigned int bad_size = 5;
+    memcpy(damaged[1].data() + header_size + n * alg_hnsw.size_data_per_element_, &bad_size, sizeof(bad_size));
+    for (auto &bytes : damaged) {
+        std::ofstream output(path_v1, std::ios::binary);
+        output.write(bytes.data(), bytes.size());
+        output.close();
+        bool thrown = false;
+        try {
+            hnswlib::HierarchicalNSW<float> loaded(&space, path_v1, false, 0, false, hnswlib::IndexLoadMode::Copy, &pool);
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    std::remove(path_v1.c_str());
+    std::remove(path_v2.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
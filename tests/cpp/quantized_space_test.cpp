@@ -0,0 +1,229 @@
+// This is a test file for testing the quantized spaces (SQ8, SQ4, PQ)
+// and HierarchicalNSW on top of them, with and without exact re-ranking, and the lookup tables
+// of the PQ searches
+
+#include "../../hnswlib/hnswlib.h"
+#include "test_utils.h"
+
+#include <assert.h>
+
+#include <cmath>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <unordered_set>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class AllowAll : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(idx_t) {
+        return true;
+    }
+};
+
+// distances of a quantized space must be the exact distances of the decoded vectors
+void checkSpace(hnswlib::SpaceInterface<float> &space, hnswlib::SpaceInterface<float> &exact,
+                const std::vector<float> &data, size_t d, float max_error) {
+    size_t n = data.size() / d;
+    std::vector<char> code1(space.get_data_size()), code2(space.get_data_size());
+    std::vector<float> decoded1(d), decoded2(d);
+    hnswlib::DISTFUNC<float> dist = space.get_dist_func();
+    hnswlib::DISTFUNC<float> stored_dist = space.get_stored_dist_func();
+    hnswlib::DISTFUNC<float> exact_dist = exact.get_dist_func();
+
+    for (size_t i = 0; i + 1 < n; i++) {
+        const float *x = data.data() + i * d;
+        const float *y = data.data() + (i + 1) * d;
+        space.encode(x, code1.data());
+        space.encode(y, code2.data());
+        space.decode(code1.data(), decoded1.data());
+        space.decode(code2.data(), decoded2.data());
+        for (size_t j = 0; j < d; j++) assert(std::abs(decoded1[j] - x[j]) <= max_error);
+
+        float asymmetric = dist(y, code1.data(), space.get_dist_func_param());
+        assert(close(asymmetric, exact_dist(y, decoded1.data(), exact.get_dist_func_param())));
+        float symmetric = stored_dist(code2.data(), code1.data(), space.get_dist_func_param());
+        assert(close(symmetric, exact_dist(decoded2.data(), decoded1.data(), exact.get_dist_func_param())));
+    }
+
+    // a prepared query has the distances of the vector, alone and in batches
+    std::vector<char> codes(n * space.get_data_size());
+    std::vector<const void *> code_ptrs(n);
+    for (size_t i = 0; i < n; i++) {
+        space.encode(data.data() + i * d, codes.data() + i * space.get_data_size());
+        code_ptrs[i] = codes.data() + i * space.get_data_size();
+    }
+    const void *query = data.data();
+    std::vector<char> prepared(space.get_prepared_query_size());
+    if (!prepared.empty()) {
+        space.prepare_query(data.data(), prepared.data());
+        query = prepared.data();
+    }
+    hnswlib::DISTFUNC<float> prepared_dist = space.get_prepared_dist_func();
+    hnswlib::DISTFUNC_BATCH<float> prepared_batch = space.get_prepared_dist_func_batch();
+    std::vector<float> batch_dists(n);
+    if (prepared_batch != nullptr)
+        prepared_batch(query, code_ptrs.data(), n, space.get_dist_func_param(), batch_dists.data());
+    for (size_t i = 0; i < n; i++) {
+        float expected = dist(data.data(), code_ptrs[i], space.get_dist_func_param());
+        assert(close(prepared_dist(query, code_ptrs[i], space.get_dist_func_param()), expected));
+        if (prepared_batch != nullptr)
+            assert(close(batch_dists[i], expected));
+    }
+}
+
+void testSpaces() {
+    size_t n = 300;
+    size_t dims[] = {5, 16, 20, 36};
+    for (size_t d : dims) {
+        std::vector<float> data = randomData(n, d, 47);
+        for (int ip = 0; ip < 2; ip++) {
+            hnswlib::L2Space l2(d);
+            hnswlib::InnerProductSpace inner(d);
+            hnswlib::SpaceInterface<float> &exact = ip ?
+                static_cast<hnswlib::SpaceInterface<float> &>(inner) : static_cast<hnswlib::SpaceInterface<float> &>(l2);
+
+            hnswlib::ScalarQuantizedSpace sq8(d, hnswlib::ScalarQuantizerType::SQ8, ip);
+            sq8.train(data.data(), n);
+            assert(sq8.get_data_size() == d);
+            checkSpace(sq8, exact, data, d, 0.5f / 255 + 1e-6f);
+
+            hnswlib::ScalarQuantizedSpace sq4(d, hnswlib::ScalarQuantizerType::SQ4, ip);
+            sq4.train(data.data(), n);
+            assert(sq4.get_data_size() == (d + 1) / 2);
+            checkSpace(sq4, exact, data, d, 0.5f / 15 + 1e-6f);
+
+            if (d % 4 == 0) {
+                hnswlib::ProductQuantizedSpace pq(d, d / 4, ip);
+                pq.train(data.data(), n, 10);
+                assert(pq.get_data_size() == d / 4);
+                checkSpace(pq, exact, data, d, 1.0f);
+            }
+        }
+    }
+}
+
+void testIndex() {
+    size_t d = 32;
+    size_t n = 3000;
+    size_t nq = 50;
+    size_t k = 10;
+    std::vector<float> data = randomData(n, d, 47);
+    std::vector<float> query = randomData(nq, d, 48);
+
+    hnswlib::ScalarQuantizedSpace sq8(d);
+    sq8.train(data.data(), n);
+    hnswlib::L2Space exact(d);
+
+    hnswlib::HierarchicalNSW<float> alg_plain(&sq8, n, 16, 100);
+    hnswlib::HierarchicalNSW<float> alg_rerank(&sq8, n, 16, 100);
+    alg_rerank.enableRerank(&exact);
+    for (size_t i = 0; i < n; i++) {
+        alg_plain.addPoint(data.data() + i * d, i);
+        alg_rerank.addPoint(data.data() + i * d, i);
+    }
+    alg_plain.setEf(100);
+    alg_rerank.setEf(100);
+
+    float recall_plain = recall(alg_plain, data, query, d, k);
+    float recall_rerank = recall(alg_rerank, data, query, d, k);
+    std::cout << "SQ8 recall: " << recall_plain << ", with re-rank: " << recall_rerank << std::endl;
+    assert(recall_plain > 0.8);
+    assert(recall_rerank > 0.95);
+    assert(recall_rerank >= recall_plain);
+
+    // re-ranked distances are exact
+    auto res = alg_rerank.searchKnnCloserFirst(data.data(), 1);
+    assert(res[0].second == 0 && res[0].first == 0);
+    assert(alg_rerank.getDataByLabel<float>(7) == std::vector<float>(data.data() + 7 * d, data.data() + 8 * d));
+    std::vector<float> decoded = alg_plain.getDataByLabel<float>(7);
+    assert(decoded.size() == d);
+    for (size_t j = 0; j < d; j++) assert(std::abs(decoded[j] - data[7 * d + j]) < 0.01f);
+
+    // the index, the store and the quantizer ranges are saved separately
+    std::string index_path = "quantized_space_test.bin";
+    std::string store_path = "quantized_space_test_rerank.bin";
+    std::stringstream ranges;
+    alg_rerank.saveIndex(index_path);
+    alg_rerank.saveRerankStore(store_path);
+    sq8.save(ranges);
+
+    hnswlib::ScalarQuantizedSpace sq8_loaded(d);
+    sq8_loaded.load(ranges);
+    hnswlib::HierarchicalNSW<float> alg_loaded(&sq8_loaded, index_path);
+    alg_loaded.loadRerankStore(store_path, &exact);
+    alg_loaded.setEf(100);
+    for (size_t j = 0; j < nq; j++)
+        assert(alg_loaded.searchKnnCloserFirst(query.data() + j * d, k) ==
+               alg_rerank.searchKnnCloserFirst(query.data() + j * d, k));
+    std::remove(index_path.c_str());
+    std::remove(store_path.c_str());
+}
+
+// the searches of a PQ index score the codes with the query's table, the insertions without it
+void testProductQuantizedIndex() {
+    size_t d = 32;
+    size_t n = 3000;
+    size_t nq = 50;
+    size_t k = 10;
+    std::vector<float> data = randomData(n, d, 47);
+    std::vector<float> query = randomData(nq, d, 48);
+
+    hnswlib::ProductQuantizedSpace pq(d, 8);
+    pq.train(data.data(), n, 10);
+    assert(pq.get_prepared_query_size() == 8 * hnswlib::PQ_CENTROIDS * sizeof(float));
+    hnswlib::L2Space exact(d);
+    hnswlib::HierarchicalNSW<float> alg_plain(&pq, n, 16, 100);
+    hnswlib::HierarchicalNSW<float> alg_rerank(&pq, n, 16, 100);
+    alg_rerank.enableRerank(&exact);
+    for (size_t i = 0; i < n; i++) {
+        alg_plain.addPoint(data.data() + i * d, i);
+        alg_rerank.addPoint(data.data() + i * d, i);
+    }
+    alg_plain.setEf(100);
+    alg_rerank.setEf(100);
+
+    hnswlib::DISTFUNC<float> dist = pq.get_dist_func();
+    for (size_t j = 0; j < nq; j++) {
+        const float *q = query.data() + j * d;
+        std::vector<std::pair<float, idx_t>> res = alg_plain.searchKnnCloserFirst(q, k);
+        assert(res.size() == k);
+        for (auto &r : res) {
+            const char *code = alg_plain.getDataByInternalId(alg_plain.label_lookup_.find(r.second));
+            assert(close(r.first, dist(q, code, pq.get_dist_func_param())));
+        }
+        std::vector<std::pair<float, idx_t>> in_range = alg_plain.searchRange(q, res[k - 1].first);
+        assert(in_range.size() >= k);
+        for (size_t i = 0; i < k; i++) assert(in_range[i].first == res[i].first);
+    }
+
+    // a resumable search prepares its own query
+    AllowAll allow_all;
+    for (size_t j = 0; j < nq; j++) {
+        const float *q = query.data() + j * d;
+        hnswlib::ResumableSearch<float> search(alg_rerank, q, k);
+        while (!search.step()) {}
+        assert(search.result() == alg_rerank.searchKnnCloserFirst(q, k, &allow_all));
+    }
+
+    float recall_plain = recall(alg_plain, data, query, d, k);
+    float recall_rerank = recall(alg_rerank, data, query, d, k);
+    std::cout << "PQ recall: " << recall_plain << ", with re-rank: " << recall_rerank << std::endl;
+    assert(recall_plain > 0.6);
+    assert(recall_rerank > 0.95);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testSpaces();
+    testIndex();
+    testProductQuantizedIndex();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
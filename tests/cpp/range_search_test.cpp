@@ -0,0 +1,102 @@
+// This is a test file for testing searchRange:
+// the results are the elements within radius, closer first, with labels, and the search
+// finds nearly all of them for small and large radii, with deletions and filters
+
+#include "../../hnswlib/hnswlib.h"
+#include "test_utils.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <iostream>
+#include <unordered_set>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickOddLabels : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(idx_t label) {
+        return label % 2 == 1;
+    }
+};
+
+void test() {
+    size_t d = 16;
+    size_t n = 10000;
+    size_t nq = 50;
+
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(nq * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100);
+    for (size_t i = 0; i < n; i++) index.addPoint(data.data() + i * d, i + 1000);
+    index.setEf(50);
+
+    PickOddLabels odd;
+    for (int round = 0; round < 2; round++) {
+        // the second round has deletions and a filter
+        hnswlib::BaseFilterFunctor *filter = round == 0 ? nullptr : &odd;
+        for (size_t k : {1, 20, 500}) {
+            size_t found = 0, expected_total = 0;
+            for (size_t q = 0; q < nq; q++) {
+                const float *p = query.data() + q * d;
+                std::vector<std::pair<float, idx_t>> exact = exactNeighbors(p, data, d,
+                    [](size_t i) { return i + 1000; },
+                    [&](size_t i) { return !index.isMarkedDeleted(i) && (!filter || (*filter)(i + 1000)); });
+                float radius = exact[k - 1].first;
+
+                std::vector<std::pair<float, idx_t>> result = index.searchRange(p, radius, filter);
+                std::unordered_set<idx_t> expected_labels;
+                for (size_t i = 0; i < exact.size() && exact[i].first <= radius; i++)
+                    expected_labels.insert(exact[i].second);
+                for (size_t i = 0; i < result.size(); i++) {
+                    assert(result[i].first <= radius);
+                    assert(i == 0 || result[i - 1].first <= result[i].first);
+                    assert(expected_labels.count(result[i].second) == 1);
+                    assert(result[i].first == hnswlib::L2Sqr(p, data.data() + (result[i].second - 1000) * d, &d));
+                }
+                found += result.size();
+                expected_total += expected_labels.size();
+            }
+            float recall = (float) found / expected_total;
+            std::cout << "round " << round << " k " << k << " recall " << recall << std::endl;
+            assert(recall >= 0.95f);
+        }
+
+        // nothing within a negative radius, everything within an infinite one
+        assert(index.searchRange(query.data(), -1.0f, filter).empty());
+        size_t num_allowed = 0;
+        for (size_t i = 0; i < n; i++)
+            num_allowed += !index.isMarkedDeleted(i) && (!filter || (*filter)(i + 1000));
+        assert(index.searchRange(query.data(), std::numeric_limits<float>::max(), filter).size() == num_allowed);
+
+        if (round == 0)
+            for (size_t i = 0; i < n; i += 10) index.markDelete(i + 1000);
+    }
+
+    // at least the results of the epsilon stop condition with room for every element
+    float radius = index.searchKnn(query.data(), 100).top().first;
+    hnswlib::EpsilonSearchStopCondition<float> stop_condition(radius, 50, n);
+    std::vector<std::pair<float, idx_t>> epsilon_result = index.searchStopConditionClosest(query.data(), stop_condition);
+    std::vector<std::pair<float, idx_t>> range_result = index.searchRange(query.data(), radius);
+    std::cout << "epsilon " << epsilon_result.size() << " range " << range_result.size() << std::endl;
+    assert(epsilon_result.size() > 0 && range_result.size() + 2 >= epsilon_result.size());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
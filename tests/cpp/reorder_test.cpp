@@ -0,0 +1,143 @@
+// This is a test file for testing reorder():
+// every ordering is a permutation that keeps the labels and the search results,
+// brings linked elements closer, and survives saving and loading
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void testOrderings() {
+    // two components, a path 0 - 1 - 2 - 3 and an edge 4 - 5
+    hnswlib::CSRGraph g;
+    std::vector<std::vector<uint32_t>> lists = {{1}, {0, 2}, {1, 3}, {2}, {5}, {4}};
+    for (auto &list : lists) {
+        g.adj.insert(g.adj.end(), list.begin(), list.end());
+        g.offsets.push_back(g.adj.size());
+    }
+    assert(g.size() == 6);
+    assert(g.transposed().adj.size() == g.adj.size());
+
+    for (auto order : {hnswlib::reorderBFS(g, 2), hnswlib::reorderRCM(g), hnswlib::reorderGorder(g, 2)}) {
+        assert(order.size() == 6);
+        std::vector<uint32_t> sorted(order);
+        std::sort(sorted.begin(), sorted.end());
+        for (uint32_t v = 0; v < 6; v++) assert(sorted[v] == v);
+    }
+    std::vector<uint32_t> bfs = hnswlib::reorderBFS(g, 2);
+    assert((bfs == std::vector<uint32_t>{2, 1, 3, 0, 4, 5}));
+    std::vector<uint32_t> rcm = hnswlib::reorderRCM(g);
+    assert((rcm == std::vector<uint32_t>{5, 4, 3, 2, 1, 0}));
+
+    assert(hnswlib::reorderGorder(hnswlib::CSRGraph()).empty());
+}
+
+// fraction of the base layer links to an element at most 64 ids away
+double nearLinkFraction(hnswlib::HierarchicalNSW<float> &alg_hnsw) {
+    size_t near = 0;
+    size_t count = 0;
+    for (hnswlib::tableint i = 0; i < alg_hnsw.getCurrentElementCount(); i++) {
+        hnswlib::linklistsizeint *ll = alg_hnsw.get_linklist0(i);
+        hnswlib::tableint *links = (hnswlib::tableint *) (ll + 1);
+        for (int j = 0; j < alg_hnsw.getListCount(ll); j++) {
+            if (links[j] + 64 >= i && links[j] <= i + 64) near++;
+            count++;
+        }
+    }
+    return (double) near / count;
+}
+
+std::vector<std::pair<float, idx_t>> searchAll(hnswlib::HierarchicalNSW<float> &alg_hnsw,
+                                               const std::vector<float> &query, size_t d, size_t k) {
+    std::vector<std::pair<float, idx_t>> all;
+    for (size_t j = 0; j < query.size() / d; j++) {
+        auto res = alg_hnsw.searchKnnCloserFirst(query.data() + j * d, k);
+        assert(res.size() == k);
+        all.insert(all.end(), res.begin(), res.end());
+    }
+    return all;
+}
+
+void testReorder(hnswlib::GraphReorder method) {
+    size_t d = 16;
+    size_t n = 5000;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(100 * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100);
+    for (size_t i = 0; i < n; i++) alg_hnsw.addPoint(data.data() + i * d, i);
+    alg_hnsw.setEf(50);
+    for (size_t i = 0; i < n; i += 7) alg_hnsw.markDelete(i);
+
+    std::vector<std::pair<float, idx_t>> before = searchAll(alg_hnsw, query, d, k);
+    double near_before = nearLinkFraction(alg_hnsw);
+    int maxlevel = alg_hnsw.maxlevel_;
+    idx_t ep_label = alg_hnsw.getExternalLabel(alg_hnsw.enterpoint_node_);
+
+    alg_hnsw.reorder(method);
+    double near_after = nearLinkFraction(alg_hnsw);
+    std::cout << "near links before: " << near_before << ", after: " << near_after << std::endl;
+    assert(near_after > 1.5 * near_before);
+
+    assert(alg_hnsw.getCurrentElementCount() == n);
+    assert(alg_hnsw.getDeletedCount() == (n + 6) / 7);
+    assert(alg_hnsw.maxlevel_ == maxlevel);
+    assert(alg_hnsw.getExternalLabel(alg_hnsw.enterpoint_node_) == ep_label);
+    for (size_t i = 0; i < n; i++) {
+        if (i % 7 == 0) {
+            bool thrown = false;
+            try {
+                alg_hnsw.getDataByLabel<float>(i);
+            } catch (const std::runtime_error &) {
+                thrown = true;
+            }
+            assert(thrown);
+        } else {
+            std::vector<float> stored = alg_hnsw.getDataByLabel<float>(i);
+            assert(std::equal(stored.begin(), stored.end(), data.begin() + i * d));
+        }
+    }
+    assert(searchAll(alg_hnsw, query, d, k) == before);
+
+    // the order is saved, and the loaded index finds the same
+    std::string path = "reorder_test.bin";
+    alg_hnsw.saveIndex(path);
+    hnswlib::HierarchicalNSW<float> alg_loaded(&space, path);
+    alg_loaded.setEf(50);
+    assert(nearLinkFraction(alg_loaded) == near_after);
+    assert(searchAll(alg_loaded, query, d, k) == before);
+    std::remove(path.c_str());
+
+    // the reordered index takes new elements
+    alg_hnsw.resizeIndex(n + 100);
+    for (size_t i = n; i < n + 100; i++) alg_hnsw.addPoint(data.data() + (i - n) * d + 1, i);
+    assert(alg_hnsw.getCurrentElementCount() == n + 100);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testOrderings();
+    testReorder(hnswlib::GraphReorder::BFS);
+    testReorder(hnswlib::GraphReorder::RCM);
+    testReorder(hnswlib::GraphReorder::Gorder);
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,157 @@
+// This is a test file for testing ResumableSearch and searchKnnInterleaved:
+// a search run step by step finds the results of searchKnnCloserFirst with a filter, interleaved
+// searches fill the rows of a batch, insertions may run between the steps and compact() may not
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <stdexcept>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class AllowAll : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(idx_t label) {
+        return true;
+    }
+};
+
+class PickOddLabels : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(idx_t label) {
+        return label % 2 == 1;
+    }
+};
+
+// runs search to its end, returns the number of steps
+size_t runSearch(hnswlib::ResumableSearch<float> &search) {
+    size_t steps = 1;
+    while (!search.step())
+        steps++;
+    assert(search.done() && search.step());
+    return steps;
+}
+
+void test() {
+    size_t d = 16;
+    size_t n = 10000;
+    size_t nq = 100;
+    size_t k = 10;
+
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(2 * n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(nq * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> index(&space, 2 * n, 16, 100);
+    {
+        hnswlib::ResumableSearch<float> empty(index, query.data(), k);
+        assert(empty.done() && empty.step() && empty.result().empty());
+    }
+    for (size_t i = 0; i < n; i++) index.addPoint(data.data() + i * d, i);
+    index.setEf(50);
+
+    // step by step, the search is the one of searchKnnCloserFirst with a filter
+    AllowAll allow_all;
+    hnswlib::SearchCounters::reset();
+    for (size_t q = 0; q < nq; q++) {
+        hnswlib::ResumableSearch<float> search(index, query.data() + q * d, k);
+        assert(!search.done());
+        assert(runSearch(search) > 2 * (size_t) index.maxlevel_);
+        assert(search.result() == index.searchKnnCloserFirst(query.data() + q * d, k, &allow_all));
+        assert(search.stats().hops.size() == (size_t) index.maxlevel_ + 1 && search.stats().hops[0] > 0);
+        assert(search.stats().distance_computations >= search.stats().visited);
+    }
+    assert(hnswlib::SearchCounters::totals().searches == 2 * nq);
+
+    // restart reuses the search for another query
+    hnswlib::ResumableSearch<float> reused(index, query.data(), k);
+    for (size_t q = 0; q < nq; q++) {
+        reused.restart(query.data() + q * d);
+        runSearch(reused);
+        assert(reused.result() == index.searchKnnCloserFirst(query.data() + q * d, k, &allow_all));
+    }
+
+    // interleaved searches fill the rows of the batch in any order
+    std::vector<idx_t> labels(nq * k);
+    std::vector<float> distances(nq * k);
+    for (size_t in_flight : {1, 7, 1000}) {
+        assert(hnswlib::searchKnnInterleaved(index, query.data(), nq, k, labels.data(), distances.data(), in_flight) == k);
+        for (size_t q = 0; q < nq; q++) {
+            std::vector<std::pair<float, idx_t>> expected = index.searchKnnCloserFirst(query.data() + q * d, k, &allow_all);
+            for (size_t i = 0; i < k; i++)
+                assert(labels[q * k + i] == expected[i].second && distances[q * k + i] == expected[i].first);
+        }
+    }
+
+    // deleted and filtered elements are not returned
+    for (size_t i = 0; i < n; i += 3) index.markDelete(i);
+    PickOddLabels odd;
+    for (size_t q = 0; q < nq; q++) {
+        hnswlib::ResumableSearch<float> search(index, query.data() + q * d, k, &odd);
+        runSearch(search);
+        assert(search.result() == index.searchKnnCloserFirst(query.data() + q * d, k, &odd));
+        for (auto &r : search.result()) assert(r.second % 2 == 1 && r.second % 3 != 0);
+        assert(search.stats().filtered_out > 0);
+    }
+
+    // insertions may run between the steps
+    std::vector<std::unique_ptr<hnswlib::ResumableSearch<float>>> searches;
+    for (size_t q = 0; q < nq; q++)
+        searches.emplace_back(new hnswlib::ResumableSearch<float>(index, query.data() + q * d, k));
+    size_t next = n;
+    for (bool all_done = false; !all_done;) {
+        all_done = true;
+        for (auto &search : searches)
+            all_done = search->step() && all_done;
+        if (next < 2 * n) {
+            index.addPoint(data.data() + next * d, next);
+            next++;
+        }
+    }
+    for (auto &search : searches) {
+        assert(search->result().size() == k);
+        for (size_t i = 1; i < k; i++) assert(search->result()[i - 1].first <= search->result()[i].first);
+    }
+
+    // compact() renumbers the elements, the next step throws
+    hnswlib::ResumableSearch<float> interrupted(index, query.data(), k);
+    interrupted.step();
+    index.compact();
+    bool thrown = false;
+    try {
+        interrupted.step();
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+    interrupted.restart(query.data());
+    runSearch(interrupted);
+    assert(interrupted.result() == index.searchKnnCloserFirst(query.data(), k, &allow_all));
+
+    // rows with fewer than k results are padded
+    hnswlib::HierarchicalNSW<float> small(&space, 5);
+    for (size_t i = 0; i < 5; i++) small.addPoint(data.data() + i * d, i);
+    assert(hnswlib::searchKnnInterleaved(small, query.data(), nq, k, labels.data(), distances.data()) == 5);
+    for (size_t q = 0; q < nq; q++) {
+        for (size_t i = 5; i < k; i++)
+            assert(labels[q * k + i] == (idx_t) -1 && distances[q * k + i] == std::numeric_limits<float>::max());
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
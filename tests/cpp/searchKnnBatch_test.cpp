@@ -0,0 +1,157 @@
+// This is a test file for testing the batch search interface
+//  >>> size_t searchKnnBatch(const void *queries, size_t nq, size_t k,
+//  >>>                       labeltype *labels, dist_t *distances, BaseFilterFunctor* isIdAllowed) const;
+// of class HierarchicalNSW and the batch distance kernels of the float spaces
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <cmath>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickOddIds : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(idx_t label_id) {
+        return label_id % 2 == 1;
+    }
+};
+
+// The batch kernel of a space must give the distances of its single-vector kernel
+void testBatchKernels(hnswlib::SpaceInterface<float> &space, size_t d) {
+    size_t n = 23;
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+
+    std::vector<float> query(d);
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < d; ++i) query[i] = distrib(rng);
+    for (size_t i = 0; i < n * d; ++i) data[i] = distrib(rng);
+
+    hnswlib::DISTFUNC<float> dist_func = space.get_dist_func();
+    hnswlib::DISTFUNC_BATCH<float> dist_func_batch = space.get_dist_func_batch();
+    assert(dist_func_batch != nullptr);
+
+    std::vector<const void *> vectors(n);
+    for (size_t i = 0; i < n; ++i) vectors[i] = data.data() + i * d;
+
+    for (size_t count = 0; count <= n; count++) {
+        std::vector<float> out(n, -1.0f);
+        dist_func_batch(query.data(), vectors.data(), count, space.get_dist_func_param(), out.data());
+        for (size_t i = 0; i < count; i++) {
+            float expected = dist_func(query.data(), vectors[i], space.get_dist_func_param());
+            assert(std::abs(out[i] - expected) <= 1e-5f * std::max(1.0f, std::abs(expected)));
+        }
+        for (size_t i = count; i < n; i++)
+            assert(out[i] == -1.0f);
+    }
+}
+
+void testSearch(bool inner_product) {
+    int d = 20;
+    idx_t n = 1000;
+    idx_t nq = 30;
+    size_t k = 10;
+
+    std::vector<float> data(n * d);
+    std::vector<float> query(nq * d);
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    for (idx_t i = 0; i < n * d; ++i) data[i] = distrib(rng);
+    for (idx_t i = 0; i < nq * d; ++i) query[i] = distrib(rng);
+
+    hnswlib::L2Space l2space(d);
+    hnswlib::InnerProductSpace ipspace(d);
+    hnswlib::SpaceInterface<float> &space = inner_product ?
+        static_cast<hnswlib::SpaceInterface<float> &>(ipspace) : static_cast<hnswlib::SpaceInterface<float> &>(l2space);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100);
+    for (idx_t i = 0; i < n; ++i) alg_hnsw.addPoint(data.data() + d * i, i);
+    alg_hnsw.setEf(50);
+
+    std::vector<idx_t> labels(nq * k);
+    std::vector<float> distances(nq * k);
+
+    // same results as one query at a time
+    size_t found = alg_hnsw.searchKnnBatch(query.data(), nq, k, labels.data(), distances.data());
+    assert(found == k);
+    for (idx_t j = 0; j < nq; ++j) {
+        auto res = alg_hnsw.searchKnnCloserFirst(query.data() + j * d, k);
+        assert(res.size() == k);
+        for (size_t i = 0; i < k; i++) {
+            assert(res[i].first == distances[j * k + i]);
+            assert(res[i].second == labels[j * k + i]);
+        }
+    }
+
+    // with a filter and deleted elements
+    PickOddIds filter;
+    for (idx_t i = 1; i < n; i += 10) alg_hnsw.markDelete(i);
+    found = alg_hnsw.searchKnnBatch(query.data(), nq, k, labels.data(), distances.data(), &filter);
+    assert(found == k);
+    for (idx_t j = 0; j < nq; ++j) {
+        auto res = alg_hnsw.searchKnnCloserFirst(query.data() + j * d, k, &filter);
+        assert(res.size() == k);
+        for (size_t i = 0; i < k; i++) {
+            assert(res[i].second == labels[j * k + i]);
+            assert(labels[j * k + i] % 2 == 1);
+            assert(labels[j * k + i] % 10 != 1);
+        }
+    }
+}
+
+void testShortRows() {
+    int d = 8;
+    idx_t n = 5;
+    size_t k = 8;
+
+    std::vector<float> data(n * d);
+    for (idx_t i = 0; i < n * d; ++i) data[i] = (float) i;
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n);
+
+    // an empty index pads every row
+    std::vector<idx_t> labels(2 * k);
+    std::vector<float> distances(2 * k);
+    assert(alg_hnsw.searchKnnBatch(data.data(), 2, k, labels.data(), distances.data()) == 0);
+    for (size_t i = 0; i < 2 * k; i++) {
+        assert(labels[i] == (idx_t) -1);
+        assert(distances[i] == std::numeric_limits<float>::max());
+    }
+
+    for (idx_t i = 0; i < n; ++i) alg_hnsw.addPoint(data.data() + d * i, i);
+    assert(alg_hnsw.searchKnnBatch(data.data(), 2, k, labels.data(), distances.data()) == n);
+    for (size_t row = 0; row < 2; row++) {
+        assert(labels[row * k] == row);
+        assert(distances[row * k] == 0);
+        for (size_t i = n; i < k; i++)
+            assert(labels[row * k + i] == (idx_t) -1);
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    size_t dims[] = {1, 3, 4, 7, 8, 16, 20, 32, 33, 36, 100, 128};
+    for (size_t d : dims) {
+        hnswlib::L2Space l2space(d);
+        testBatchKernels(l2space, d);
+        hnswlib::InnerProductSpace ipspace(d);
+        testBatchKernels(ipspace, d);
+    }
+    testSearch(false);
+    testSearch(true);
+    testShortRows();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+// This is a test file for testing SearchStats and SearchCounters:
+// a search reports its hops per layer, distance computations, visited and filtered out elements
+// without changing its results, and the counters of the process add up the searches of all threads
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickOddLabels : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(idx_t label) {
+        return label % 2 == 1;
+    }
+};
+
+void checkSearchStats(const hnswlib::HierarchicalNSW<float> &index, const hnswlib::SearchStats &stats) {
+    assert(stats.hops.size() == (size_t) index.maxlevel_ + 1);
+    for (size_t level = 0; level < stats.hops.size(); level++)
+        assert(stats.hops[level] > 0);
+    assert(stats.visited > stats.hops[0]);
+    assert(stats.distance_computations + stats.filtered_out >= stats.visited);
+    assert(stats.seconds > 0);
+}
+
+void test() {
+    size_t d = 16;
+    size_t n = 10000;
+    size_t nq = 200;
+    size_t k = 10;
+
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(nq * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100);
+    hnswlib::SearchStats stats;
+    assert(index.searchKnnCloserFirst(query.data(), k, stats).empty() && stats.hops.empty());
+    for (size_t i = 0; i < n; i++) index.addPoint(data.data() + i * d, i);
+    index.setEf(50);
+    assert(index.maxlevel_ > 0);
+
+    // the stats do not change the results, both searches report the same work
+    for (size_t q = 0; q < 20; q++) {
+        const float *p = query.data() + q * d;
+        std::vector<std::pair<float, idx_t>> result = index.searchKnnCloserFirst(p, k, stats);
+        assert(result == index.searchKnnCloserFirst(p, k));
+        checkSearchStats(index, stats);
+        assert(stats.filtered_out == 0);
+        hnswlib::SearchStats heap_stats;
+        std::priority_queue<std::pair<float, idx_t>> heap = index.searchKnn(p, k, heap_stats);
+        assert(heap.size() == k && heap.top() == result.back());
+        assert(heap_stats.hops == stats.hops && heap_stats.distance_computations == stats.distance_computations);
+        assert(heap_stats.visited == stats.visited);
+    }
+
+    // deleted and filtered elements are counted
+    for (size_t i = 0; i < n; i += 3) index.markDelete(i);
+    PickOddLabels odd;
+    std::vector<std::pair<float, idx_t>> filtered = index.searchKnnCloserFirst(query.data(), k, stats, &odd);
+    assert(filtered.size() == k);
+    for (auto &r : filtered) assert(r.second % 2 == 1 && r.second % 3 != 0);
+    checkSearchStats(index, stats);
+    assert(stats.filtered_out > 0);
+    std::vector<idx_t> allowed;
+    for (size_t i = 0; i < n; i += 2) allowed.push_back(i);
+    hnswlib::IdFilter id_filter = index.makeIdFilter(allowed.data(), allowed.size());
+    index.searchKnn(query.data(), k, nullptr, &id_filter, &stats);
+    checkSearchStats(index, stats);
+    assert(stats.filtered_out > 0);
+
+    // a small id filter is scanned, without hops
+    std::vector<idx_t> few;
+    for (size_t i = 0; i < n; i += 50) few.push_back(i);
+    hnswlib::IdFilter few_filter = index.makeIdFilter(few.data(), few.size());
+    index.searchKnn(query.data(), k, nullptr, &few_filter, &stats);
+    assert(stats.hops.size() == 1 && stats.hops[0] == 0 && stats.visited == 0);
+    assert(stats.distance_computations + stats.filtered_out == few.size());
+    assert(stats.filtered_out == (few.size() + 2) / 3);
+
+    // the counters are the sums of the searches of every thread
+    hnswlib::SearchCounters::reset();
+    index.metric_hops = 0;
+    index.metric_distance_computations = 0;
+    size_t num_threads = 4;
+    std::vector<hnswlib::SearchCounters::Totals> sums(num_threads);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            hnswlib::SearchStats thread_stats;
+            for (size_t q = t; q < nq; q += num_threads) {
+                index.searchKnnCloserFirst(query.data() + q * d, k, thread_stats);
+                sums[t].searches++;
+                sums[t].hops += thread_stats.totalHops();
+                sums[t].distance_computations += thread_stats.distance_computations;
+                sums[t].visited += thread_stats.visited;
+                sums[t].filtered_out += thread_stats.filtered_out;
+            }
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    hnswlib::SearchCounters::Totals totals = hnswlib::SearchCounters::totals();
+    hnswlib::SearchCounters::Totals expected;
+    for (auto &sum : sums) {
+        expected.searches += sum.searches;
+        expected.hops += sum.hops;
+        expected.distance_computations += sum.distance_computations;
+        expected.visited += sum.visited;
+        expected.filtered_out += sum.filtered_out;
+    }
+    assert(totals.searches == nq && expected.searches == nq);
+    assert(totals.hops == expected.hops && totals.distance_computations == expected.distance_computations);
+    assert(totals.visited == expected.visited && totals.filtered_out == expected.filtered_out);
+    // the deprecated per-index metrics follow the counters
+    assert(index.metric_hops == (long) totals.hops);
+    assert(index.metric_distance_computations == (long) totals.distance_computations);
+    std::cout << "per query: " << (double) totals.hops / nq << " hops, " << (double) totals.distance_computations / nq
+              << " distance computations, " << (double) totals.filtered_out / nq << " filtered out" << std::endl;
+
+    // searches without stats are counted as well
+    std::vector<idx_t> labels(nq * k);
+    std::vector<float> distances(nq * k);
+    index.searchKnnBatch(query.data(), nq, k, labels.data(), distances.data());
+    index.searchRange(query.data(), 0.5f);
+    hnswlib::SearchCounters::Totals more = hnswlib::SearchCounters::totals();
+    assert(more.searches == 2 * nq + 1 && more.hops > totals.hops && more.visited > totals.visited);
+
+    hnswlib::SearchCounters::reset();
+    totals = hnswlib::SearchCounters::totals();
+    assert(totals.searches == 0 && totals.hops == 0 && totals.distance_computations == 0);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
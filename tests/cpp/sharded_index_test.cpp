@@ -0,0 +1,162 @@
+// This is a test file for testing ShardedHierarchicalNSW:
+// labels are routed to one shard each, the merged search finds nearly all exact neighbors with
+// deletions and filters, as does the batch search and searches of concurrent callers, and the
+// shards are saved and loaded
+
+#include "../../hnswlib/hnswlib.h"
+#include "test_utils.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <unordered_set>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+class PickOddLabels : public hnswlib::BaseFilterFunctor {
+ public:
+    bool operator()(idx_t label) {
+        return label % 2 == 1;
+    }
+};
+
+void test() {
+    size_t d = 16;
+    size_t n = 20000;
+    size_t nq = 100;
+    size_t k = 10;
+    size_t num_shards = 5;
+    std::string path = "sharded_index_test.bin";
+
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(nq * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+    std::vector<idx_t> labels(n);
+    for (size_t i = 0; i < n; i++) labels[i] = i * 3 + 7;
+
+    hnswlib::L2Space space(d);
+    hnswlib::ThreadPool pool(4);
+    hnswlib::ShardedHierarchicalNSW<float> index(&space, num_shards, n / 2, 16, 100, 100, false, &pool);
+    index.addPoints(data.data(), labels.data(), n / 2);
+    for (size_t i = n / 2; i < n; i++) index.addPoint(data.data() + i * d, labels[i]);
+    index.setEf(50);
+
+    // every label is in its own shard and only there, the shards share the elements
+    assert(index.getCurrentElementCount() == n);
+    for (size_t s = 0; s < num_shards; s++) {
+        size_t count = index.shard(s).getCurrentElementCount();
+        assert(count > n / num_shards / 2 && count < 2 * n / num_shards);
+        for (hnswlib::tableint id = 0; id < count; id++)
+            assert(index.shardOf(index.shard(s).getExternalLabel(id)) == s);
+    }
+    assert(index.getDataByLabel<float>(labels[123]) == std::vector<float>(data.begin() + 123 * d, data.begin() + 124 * d));
+
+    PickOddLabels odd;
+    std::vector<std::unordered_set<idx_t>> expected_sets(nq);
+    for (int round = 0; round < 2; round++) {
+        // the second round has deletions and a filter
+        hnswlib::BaseFilterFunctor *filter = round == 0 ? nullptr : &odd;
+        std::vector<idx_t> batch_labels(nq * k);
+        std::vector<float> batch_distances(nq * k);
+        assert(index.searchKnnBatch(query.data(), nq, k, batch_labels.data(), batch_distances.data(), filter) == k);
+        size_t found = 0, batch_found = 0;
+        for (size_t q = 0; q < nq; q++) {
+            const float *p = query.data() + q * d;
+            std::vector<std::pair<float, idx_t>> exact = exactNeighbors(p, data, d,
+                [&](size_t i) { return labels[i]; },
+                [&](size_t i) { return !(round == 1 && i % 10 == 0) && (!filter || (*filter)(labels[i])); });
+            std::unordered_set<idx_t> expected;
+            for (size_t i = 0; i < k; i++) expected.insert(exact[i].second);
+            expected_sets[q] = expected;
+
+            std::vector<std::pair<float, idx_t>> result = index.searchKnnCloserFirst(p, k, filter);
+            assert(result.size() == k);
+            std::unordered_set<idx_t> seen;
+            for (size_t i = 0; i < result.size(); i++) {
+                assert(i == 0 || result[i - 1].first <= result[i].first);
+                assert(seen.insert(result[i].second).second);
+                assert(!filter || (*filter)(result[i].second));
+                size_t row = (result[i].second - 7) / 3;
+                assert(round == 0 || row % 10 != 0);
+                assert(result[i].first == hnswlib::L2Sqr(p, data.data() + row * d, &d));
+                found += expected.count(result[i].second);
+                batch_found += expected.count(batch_labels[q * k + i]);
+            }
+            // the priority queue holds the results farther first
+            std::priority_queue<std::pair<float, idx_t>> heap = index.searchKnn(p, k, filter);
+            assert(heap.size() == k);
+        }
+        float recall = (float) found / (nq * k);
+        float batch_recall = (float) batch_found / (nq * k);
+        std::cout << "round " << round << " recall " << recall << " batch recall " << batch_recall << std::endl;
+        assert(recall >= 0.95f && batch_recall >= 0.95f);
+
+        if (round == 0)
+            for (size_t i = 0; i < n; i += 10) index.markDelete(labels[i]);
+    }
+    assert(index.getDeletedCount() == n / 10);
+
+    // concurrent callers search at the same time on the shared pool
+    std::vector<std::thread> callers;
+    std::atomic<size_t> concurrent_found(0);
+    for (size_t t = 0; t < 4; t++) {
+        callers.emplace_back([&, t]() {
+            for (size_t q = t; q < nq; q += 4) {
+                std::vector<std::pair<float, idx_t>> result = index.searchKnnCloserFirst(query.data() + q * d, k, &odd);
+                assert(result.size() == k);
+                for (size_t i = 0; i < k; i++) {
+                    assert(i == 0 || result[i - 1].first <= result[i].first);
+                    assert(odd(result[i].second) && (result[i].second - 7) / 3 % 10 != 0);
+                    concurrent_found += expected_sets[q].count(result[i].second);
+                }
+            }
+        });
+    }
+    for (auto &thread : callers) thread.join();
+    float concurrent_recall = (float) concurrent_found / (nq * k);
+    std::cout << "concurrent recall " << concurrent_recall << std::endl;
+    assert(concurrent_recall >= 0.95f);
+
+    // fewer elements than k
+    hnswlib::ShardedHierarchicalNSW<float> small(&space, 3, 10, 16, 100, 100, false, &pool);
+    assert(small.searchKnnCloserFirst(query.data(), k).empty());
+    for (size_t i = 0; i < 4; i++) small.addPoint(data.data() + i * d, i);
+    assert(small.searchKnnCloserFirst(query.data(), k).size() == 4);
+
+    // saved and loaded shard by shard
+    index.saveIndex(path);
+    hnswlib::ShardedHierarchicalNSW<float> loaded(&space, path, 0, false, hnswlib::IndexLoadMode::Copy, &pool);
+    assert(loaded.numShards() == num_shards);
+    assert(loaded.getCurrentElementCount() == n && loaded.getDeletedCount() == n / 10);
+    loaded.setEf(50);
+    // the shards of a query of a batch are searched in turn, so the results are the same
+    std::vector<idx_t> expected_labels(nq * k), loaded_labels(nq * k);
+    std::vector<float> expected_distances(nq * k), loaded_distances(nq * k);
+    index.searchKnnBatch(query.data(), nq, k, expected_labels.data(), expected_distances.data());
+    loaded.searchKnnBatch(query.data(), nq, k, loaded_labels.data(), loaded_distances.data());
+    assert(loaded_labels == expected_labels && loaded_distances == expected_distances);
+    loaded.unmarkDelete(labels[0]);
+    assert(loaded.getDeletedCount() == n / 10 - 1);
+
+    std::remove(path.c_str());
+    for (size_t s = 0; s < num_shards; s++)
+        std::remove(hnswlib::ShardedHierarchicalNSW<float>::shardLocation(path, s).c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,188 @@
+// This is a test file for testing saveSnapshot:
+// without concurrent updates it writes what saveIndex writes, updates made while it runs are not
+// in the file, and snapshots taken during multithreaded insertions load as sound indexes
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+const size_t d = 16;
+const size_t BASE_ID_OFFSET = sizeof(uint64_t) + sizeof(uint32_t);  // the only bytes that differ between saves
+
+std::vector<char> readFile(const std::string &path) {
+    std::ifstream input(path, std::ios::binary);
+    return std::vector<char>((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+}
+
+bool sameIndexBytes(std::vector<char> a, std::vector<char> b) {
+    if (a.size() != b.size())
+        return false;
+    memset(a.data() + BASE_ID_OFFSET, 0, sizeof(uint32_t));
+    memset(b.data() + BASE_ID_OFFSET, 0, sizeof(uint32_t));
+    return a == b;
+}
+
+void testConsistent() {
+    size_t n = 20000;
+    std::string index_path = "snapshot_test_index.bin";
+    std::string snapshot_path = "snapshot_test_snapshot.bin";
+
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(2 * n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> index(&space, 2 * n, 16, 100);
+    for (size_t i = 0; i < n; i++) index.addPoint(data.data() + i * d, i);
+    for (size_t i = 0; i < n; i += 13) index.markDelete(i);
+
+    // without updates the snapshot is the saved index
+    index.saveIndex(index_path);
+    std::vector<char> saved = readFile(index_path);
+    index.saveSnapshot(snapshot_path);
+    assert(sameIndexBytes(saved, readFile(snapshot_path)));
+
+    // updates made while the snapshot is written, before and after the elements they change,
+    // are not in it
+    std::vector<char> streamed;
+    size_t num_calls = 0;
+    index.saveSnapshot([&](const char *bytes, size_t size) {
+        if (num_calls++ == 1) {
+            for (size_t i = 0; i < 2000; i++) index.addPoint(data.data() + (n + i) * d, n + i);
+            for (size_t i = 0; i < n; i += 101) index.addPoint(data.data() + (n + i + 5000) * d, i + 1);
+            for (size_t i = 0; i < n; i += 17) {
+                if (index.isMarkedDeleted(i))
+                    index.unmarkDelete(i);
+                else
+                    index.markDelete(i);
+            }
+        }
+        streamed.insert(streamed.end(), bytes, bytes + size);
+    });
+    assert(num_calls > 2);
+    assert(index.cur_element_count == n + 2000);
+    assert(sameIndexBytes(saved, streamed));
+    assert(index.element_snapshot_.active() == false);
+
+    // the changes are in the next one
+    index.saveSnapshot(snapshot_path);
+    index.saveIndex(index_path);
+    assert(sameIndexBytes(readFile(index_path), readFile(snapshot_path)));
+
+    // an error of the output is passed on
+    bool thrown = false;
+    try {
+        index.saveSnapshot([&](const char *, size_t) { throw std::runtime_error("upload failed"); });
+    } catch (const std::runtime_error &e) {
+        thrown = std::string(e.what()) == "upload failed";
+    }
+    assert(thrown);
+    index.saveSnapshot(snapshot_path);
+    std::remove(index_path.c_str());
+    std::remove(snapshot_path.c_str());
+}
+
+void testConcurrent() {
+    size_t n = 40000;
+    size_t num_threads = 4;
+    std::string snapshot_path = "snapshot_test_concurrent.bin";
+
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100);
+    size_t num_initial = 5000;
+    for (size_t i = 0; i < num_initial; i++) index.addPoint(data.data() + i * d, i);
+
+    std::atomic<size_t> next{num_initial};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&]() {
+            for (size_t i = next++; i < n; i = next++) {
+                index.addPoint(data.data() + i * d, i);
+                // the deleted elements are the ones divisible by 7, among those inserted before the
+                // threads: a label of another thread may not be in the index yet
+                if (i % 50 == 0)
+                    index.markDelete((i / 50 * 7) % (num_initial / 7 * 7));
+                if (i % 70 == 0)
+                    index.addPoint(data.data() + (i / 2) * d, i / 2);
+            }
+        });
+    }
+    for (int round = 0; round < 3; round++) {
+        while (index.cur_element_count < num_initial + (round + 1) * (n - num_initial) / 8)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        size_t count_before = index.cur_element_count;
+        if (round == 1) {
+            std::ofstream output(snapshot_path, std::ios::binary);
+            index.saveSnapshot([&](const char *bytes, size_t size) { output.write(bytes, size); });
+        } else {
+            index.saveSnapshot(snapshot_path);
+        }
+        size_t count_after = index.cur_element_count;
+
+        hnswlib::HierarchicalNSW<float> loaded(&space, snapshot_path);
+        size_t count = loaded.cur_element_count;
+        std::cout << "round " << round << " snapshot of " << count << " elements" << std::endl;
+        assert(count_before <= count && count <= count_after);
+        size_t num_deleted = 0;
+        for (hnswlib::tableint id = 0; id < count; id++) {
+            idx_t label = loaded.getExternalLabel(id);
+            assert(label < n && loaded.label_lookup_.find(label) == id);
+            assert(memcmp(loaded.getDataByInternalId(id), data.data() + label * d, d * sizeof(float)) == 0);
+            if (loaded.isMarkedDeleted(id)) {
+                assert(label % 7 == 0);
+                num_deleted++;
+            }
+            for (int level = 0; level <= loaded.element_levels_[id]; level++) {
+                hnswlib::linklistsizeint *ll = loaded.get_linklist_at_level(id, level);
+                hnswlib::tableint *links = (hnswlib::tableint *) (ll + 1);
+                for (size_t j = 0; j < loaded.getListCount(ll); j++)
+                    assert(links[j] < count && links[j] != id && loaded.element_levels_[links[j]] >= level);
+            }
+        }
+        assert(num_deleted == loaded.getDeletedCount());
+
+        // the graph is searchable: elements inserted before the snapshot find themselves
+        loaded.setEf(50);
+        size_t found = 0, total = 0;
+        for (size_t i = 0; i < count_before; i += 97) {
+            hnswlib::tableint id = loaded.label_lookup_.find(i);
+            if (loaded.isMarkedDeleted(id))
+                continue;
+            total++;
+            found += loaded.searchKnn(data.data() + i * d, 1).top().second == i;
+        }
+        std::cout << "self recall " << (float) found / total << std::endl;
+        assert(found >= 0.95 * total);
+    }
+    for (auto &thread : threads) thread.join();
+    std::remove(snapshot_path.c_str());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testConsistent();
+    testConcurrent();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
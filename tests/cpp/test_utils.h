@@ -0,0 +1,84 @@
+#pragma once
+
+// Helpers shared by the tests: random vectors, exact neighbors, recall and graph checks
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// n vectors of d floats drawn uniformly from [low, high)
+inline std::vector<float> randomData(size_t n, size_t d, unsigned seed, float low = 0, float high = 1) {
+    std::mt19937 rng;
+    rng.seed(seed);
+    std::uniform_real_distribution<> distrib(low, high);
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < n * d; ++i) data[i] = distrib(rng);
+    return data;
+}
+
+// a and b agree up to the rounding of a kernel
+inline bool close(float a, float b) {
+    return std::abs(a - b) <= 1e-4f * std::max(1.0f, std::abs(b));
+}
+
+/*
+ * The L2 distances of query to the rows of data, closer first, with label(row) as the label.
+ * Rows that keep rejects are left out; label and keep default to the row and to every row.
+ */
+inline std::vector<std::pair<float, hnswlib::labeltype>>
+exactNeighbors(const float *query, const std::vector<float> &data, size_t d,
+               const std::function<hnswlib::labeltype(size_t)> &label = nullptr,
+               const std::function<bool(size_t)> &keep = nullptr) {
+    std::vector<std::pair<float, hnswlib::labeltype>> exact;
+    for (size_t i = 0; i < data.size() / d; i++) {
+        if (!keep || keep(i))
+            exact.push_back(std::make_pair(hnswlib::L2Sqr(query, data.data() + i * d, &d), label ? label(i) : i));
+    }
+    std::sort(exact.begin(), exact.end());
+    return exact;
+}
+
+// The share of the k exact nearest neighbors that searchKnnCloserFirst finds, the labels being the rows of data
+inline float recall(hnswlib::HierarchicalNSW<float> &index, const std::vector<float> &data,
+                    const std::vector<float> &query, size_t d, size_t k) {
+    size_t nq = query.size() / d;
+    size_t found = 0;
+    for (size_t q = 0; q < nq; q++) {
+        const float *p = query.data() + q * d;
+        std::vector<std::pair<float, hnswlib::labeltype>> exact = exactNeighbors(p, data, d);
+        std::unordered_set<hnswlib::labeltype> expected;
+        for (size_t i = 0; i < k; i++) expected.insert(exact[i].second);
+        for (auto &result : index.searchKnnCloserFirst(p, k))
+            found += expected.count(result.second);
+    }
+    return (float) found / (nq * k);
+}
+
+// Every list holds distinct existing elements of its level, up to the maximum number
+inline void checkLists(hnswlib::HierarchicalNSW<float> &index) {
+    size_t n = index.cur_element_count;
+    for (hnswlib::tableint id = 0; id < n; id++) {
+        assert(index.label_lookup_.find(index.getExternalLabel(id)) == id);
+        for (int level = 0; level <= index.element_levels_[id]; level++) {
+            hnswlib::linklistsizeint *ll = index.get_linklist_at_level(id, level);
+            size_t size = index.getListCount(ll);
+            assert(size <= (level == 0 ? index.maxM0_ : index.maxM_));
+            assert(level > 0 || size > 0);
+            hnswlib::tableint *links = (hnswlib::tableint *) (ll + 1);
+            std::unordered_set<hnswlib::tableint> seen;
+            for (size_t j = 0; j < size; j++) {
+                assert(links[j] < n && links[j] != id && index.element_levels_[links[j]] >= level);
+                assert(seen.insert(links[j]).second);
+            }
+        }
+    }
+    assert(index.element_levels_[index.enterpoint_node_] == index.maxlevel_);
+}
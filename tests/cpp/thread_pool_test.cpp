@@ -0,0 +1,162 @@
+// This is a test file for testing ThreadPool:
+// every row runs once, exceptions reach the caller, nested and concurrent calls work,
+// and the batch APIs on a pool match the single-threaded ones
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+void testParallelFor(hnswlib::ThreadPool &pool) {
+    for (size_t n : {0, 1, 7, 1000, 100000}) {
+        for (size_t chunk_size : {0, 1, 64}) {
+            std::vector<std::atomic<int>> runs(n);
+            std::atomic<bool> bad_thread(false);
+            pool.parallelFor(10, 10 + n, [&](size_t row, size_t thread_id) {
+                if (thread_id >= pool.size()) bad_thread = true;
+                runs[row - 10]++;
+            }, chunk_size);
+            assert(!bad_thread);
+            for (size_t i = 0; i < n; i++) assert(runs[i] == 1);
+        }
+    }
+
+    // the first exception is rethrown, the pool keeps working
+    for (int round = 0; round < 3; round++) {
+        bool thrown = false;
+        try {
+            pool.parallelFor(0, 1000, [&](size_t row, size_t) {
+                if (row % 100 == 37) throw std::runtime_error("row failed");
+            });
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        assert(thrown);
+        std::atomic<size_t> sum(0);
+        pool.parallelFor(0, 1000, [&](size_t row, size_t) { sum += row; });
+        assert(sum == 999 * 1000 / 2);
+    }
+
+    // a nested call runs on the calling thread
+    std::atomic<size_t> inner(0);
+    pool.parallelFor(0, 50, [&](size_t, size_t) {
+        pool.parallelFor(0, 10, [&](size_t, size_t inner_thread_id) {
+            assert(inner_thread_id == 0);
+            inner++;
+        });
+    });
+    assert(inner == 500);
+
+    // calls from several threads at once
+    std::vector<std::thread> callers;
+    std::atomic<size_t> total(0);
+    for (int t = 0; t < 4; t++) {
+        callers.push_back(std::thread([&]() {
+            for (int i = 0; i < 20; i++)
+                pool.parallelFor(0, 100, [&](size_t, size_t) { total++; });
+        }));
+    }
+    for (auto &thread : callers) thread.join();
+    assert(total == 4 * 20 * 100);
+
+    // the calls of different threads run at the same time: each waits for a row of the other
+    std::atomic<bool> started[2];
+    started[0] = false;
+    started[1] = false;
+    std::atomic<bool> overlapped(true);
+    std::vector<std::thread> overlapping;
+    for (int t = 0; t < 2; t++) {
+        overlapping.push_back(std::thread([&, t]() {
+            pool.parallelFor(0, 2, [&](size_t, size_t) {
+                started[t] = true;
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+                while (!started[1 - t] && std::chrono::steady_clock::now() < deadline)
+                    std::this_thread::yield();
+                if (!started[1 - t]) overlapped = false;
+            });
+        }));
+    }
+    for (auto &thread : overlapping) thread.join();
+    assert(overlapped);
+}
+
+void testIndex() {
+    size_t d = 16;
+    size_t n = 5000;
+    size_t nq = 200;
+    size_t k = 10;
+
+    std::mt19937 rng;
+    rng.seed(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(nq * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+    std::vector<idx_t> ids(n);
+    for (size_t i = 0; i < n; i++) ids[i] = 3 * i;
+
+    hnswlib::ThreadPool pool(4);
+    hnswlib::L2Space space(d);
+    hnswlib::HierarchicalNSW<float> alg_hnsw(&space, n, 16, 100);
+    alg_hnsw.addPoints(data.data(), ids.data(), n, pool);
+    assert(alg_hnsw.getCurrentElementCount() == n);
+    alg_hnsw.setEf(50);
+
+    std::vector<idx_t> labels(nq * k), labels_pool(nq * k);
+    std::vector<float> distances(nq * k), distances_pool(nq * k);
+    size_t found = alg_hnsw.searchKnnBatch(query.data(), nq, k, labels.data(), distances.data());
+    size_t found_pool = alg_hnsw.searchKnnBatch(query.data(), nq, k, labels_pool.data(), distances_pool.data(), pool);
+    assert(found == k && found_pool == k);
+    assert(labels == labels_pool);
+    assert(distances == distances_pool);
+
+    // recall against a scan
+    hnswlib::BruteforceSearch<float> alg_brute(&space, n);
+    for (size_t i = 0; i < n; i++) alg_brute.addPoint(data.data() + i * d, ids[i]);
+    std::vector<idx_t> labels_brute(nq * k);
+    std::vector<float> distances_brute(nq * k);
+    alg_brute.searchKnnBatch(query.data(), nq, k, labels_brute.data(), distances_brute.data());
+    size_t correct = 0;
+    for (size_t q = 0; q < nq; q++) {
+        for (size_t i = 0; i < k; i++) {
+            if (std::find(labels_brute.begin() + q * k, labels_brute.begin() + (q + 1) * k, labels_pool[q * k + i]) !=
+                labels_brute.begin() + (q + 1) * k) correct++;
+        }
+    }
+    float recall = (float) correct / (nq * k);
+    std::cout << "recall: " << recall << std::endl;
+    assert(recall >= 0.9f);
+
+    // adding the same labels again updates instead of adding
+    alg_hnsw.addPoints(query.data(), ids.data(), nq, pool);
+    assert(alg_hnsw.getCurrentElementCount() == n);
+    std::vector<float> stored = alg_hnsw.getDataByLabel<float>(ids[5]);
+    assert(std::equal(stored.begin(), stored.end(), query.begin() + 5 * d));
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    hnswlib::ThreadPool single(1);
+    testParallelFor(single);
+    hnswlib::ThreadPool pool(4);
+    testParallelFor(pool);
+    hnswlib::ThreadPool pinned(3, true);
+    testParallelFor(pinned);
+    testIndex();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,117 @@
+// This is a test file for testing updatePoints:
+// the graph after a batch of updates has sound lists and about the recall of updating the points
+// one by one, deleted elements are restored, the last vector of a label counts and new labels are added
+
+#include "../../hnswlib/hnswlib.h"
+#include "test_utils.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <unordered_set>
+
+namespace {
+
+using idx_t = hnswlib::labeltype;
+
+const size_t d = 16;
+
+void test() {
+    size_t n = 10000;
+    size_t num_updates = 2000;
+    size_t nq = 100;
+    size_t k = 10;
+
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<> distrib;
+    std::vector<float> data(n * d);
+    for (size_t i = 0; i < data.size(); i++) data[i] = distrib(rng);
+    std::vector<float> query(nq * d);
+    for (size_t i = 0; i < query.size(); i++) query[i] = distrib(rng);
+
+    // half of the updated elements move a little, as after a new embedding, the others anywhere
+    std::vector<idx_t> labels;
+    std::vector<float> vectors;
+    for (size_t i = 0; i < num_updates; i++) {
+        idx_t label = (i * 7919) % n;
+        labels.push_back(label);
+        for (size_t j = 0; j < d; j++) {
+            float moved = data[label * d + j] + 0.05f * (float) (distrib(rng) - 0.5);
+            vectors.push_back(i % 2 == 0 ? moved : (float) distrib(rng));
+        }
+    }
+    std::vector<float> updated_data = data;
+    for (size_t i = 0; i < num_updates; i++)
+        std::copy(vectors.begin() + i * d, vectors.begin() + (i + 1) * d, updated_data.begin() + labels[i] * d);
+
+    hnswlib::L2Space space(d);
+    hnswlib::ThreadPool pool(4);
+    hnswlib::HierarchicalNSW<float> reference(&space, n, 16, 100);
+    hnswlib::HierarchicalNSW<float> index(&space, n, 16, 100);
+    for (size_t i = 0; i < n; i++) {
+        reference.addPoint(data.data() + i * d, i);
+        index.addPoint(data.data() + i * d, i);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_updates; i++)
+        reference.addPoint(vectors.data() + i * d, labels[i]);
+    auto middle = std::chrono::steady_clock::now();
+    index.updatePoints(vectors.data(), labels.data(), num_updates, pool);
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "addPoint " << std::chrono::duration<double>(middle - start).count() << " s, updatePoints "
+              << std::chrono::duration<double>(end - middle).count() << " s" << std::endl;
+
+    assert(index.cur_element_count == n);
+    checkLists(index);
+    for (size_t i = 0; i < num_updates; i += 37)
+        assert(index.getDataByLabel<float>(labels[i]) == std::vector<float>(vectors.begin() + i * d, vectors.begin() + (i + 1) * d));
+    reference.setEf(50);
+    index.setEf(50);
+    float reference_recall = recall(reference, updated_data, query, d, k);
+    float batch_recall = recall(index, updated_data, query, d, k);
+    std::cout << "recall addPoint " << reference_recall << " updatePoints " << batch_recall << std::endl;
+    assert(batch_recall >= 0.9f && batch_recall >= reference_recall - 0.02f);
+
+    // a deleted element is restored, the last vector of a label counts, an unknown label is added
+    std::vector<idx_t> more_labels = {1, 2, 2, n};
+    std::vector<float> more_data(more_labels.size() * d);
+    for (size_t i = 0; i < more_data.size(); i++) more_data[i] = distrib(rng);
+    hnswlib::HierarchicalNSW<float> larger(&space, n + 1, 16, 100);
+    for (size_t i = 0; i < n; i++) larger.addPoint(updated_data.data() + i * d, i);
+    larger.markDelete(1);
+    larger.updatePoints(more_data.data(), more_labels.data(), more_labels.size(), pool);
+    assert(larger.cur_element_count == n + 1 && larger.getDeletedCount() == 0);
+    assert(larger.getDataByLabel<float>(1) == std::vector<float>(more_data.begin(), more_data.begin() + d));
+    assert(larger.getDataByLabel<float>(2) == std::vector<float>(more_data.begin() + 2 * d, more_data.begin() + 3 * d));
+    assert(larger.getDataByLabel<float>(n) == std::vector<float>(more_data.begin() + 3 * d, more_data.end()));
+    checkLists(larger);
+    larger.setEf(50);
+    for (size_t i = 0; i < more_labels.size(); i++)
+        assert(larger.searchKnn(more_data.data() + i * d, 1).top().second == more_labels[i] || i == 1);
+
+    // replacing deleted elements forbids updating them
+    hnswlib::HierarchicalNSW<float> replacing(&space, 100, 16, 100, 100, true);
+    for (size_t i = 0; i < 100; i++) replacing.addPoint(data.data() + i * d, i);
+    replacing.markDelete(3);
+    bool thrown = false;
+    try {
+        std::vector<idx_t> deleted = {3};
+        replacing.updatePoints(more_data.data(), deleted.data(), 1, pool);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    test();
+    std::cout << "Test ok" << std::endl;
+    return 0;
+}
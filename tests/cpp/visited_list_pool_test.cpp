@@ -0,0 +1,134 @@
+// This is a test file for testing VisitedListPool:
+// lists held at the same time are distinct, are reset between uses, every pool a thread uses
+// keeps its list for the thread, and lists survive the pool being used from many threads and
+// short-lived threads.
+
+#include "../../hnswlib/hnswlib.h"
+
+#include <assert.h>
+
+#include <memory>
+#include <vector>
+#include <thread>
+#include <iostream>
+
+namespace {
+
+void testNestedAndReset() {
+    int n = 1000;
+    hnswlib::VisitedListPool pool(1, n);
+
+    hnswlib::VisitedList *a = pool.getFreeVisitedList();
+    hnswlib::VisitedList *b = pool.getFreeVisitedList();
+    assert(a != b);
+    for (int i = 0; i < n; i += 3) {
+        a->mass[i] = a->curV;
+    }
+    hnswlib::vl_type tag = a->curV;
+    pool.releaseVisitedList(b);
+    pool.releaseVisitedList(a);
+
+    // the same thread gets a cached list back with a fresh tag
+    hnswlib::VisitedList *c = pool.getFreeVisitedList();
+    for (int i = 0; i < n; i++) {
+        assert(c->mass[i] != c->curV);
+    }
+    if (c == a) assert(c->curV != tag);
+    pool.releaseVisitedList(c);
+}
+
+void testWrap() {
+    int n = 100;
+    hnswlib::VisitedList vl(n);
+    vl.reset();
+    for (int i = 0; i < n; i++) vl.mass[i] = vl.curV;
+    vl.curV = (hnswlib::vl_type)-1;
+    for (int i = 0; i < n; i++) vl.mass[i] = vl.curV;
+    vl.reset();
+    assert(vl.curV == 1);
+    for (int i = 0; i < n; i++) assert(vl.mass[i] != vl.curV);
+}
+
+// as a sharded index does: each thread goes through many pools on every query
+void testManyPools() {
+    int n = 100;
+    int num_pools = 16;
+    std::vector<std::unique_ptr<hnswlib::VisitedListPool>> pools;
+    for (int p = 0; p < num_pools; p++)
+        pools.emplace_back(new hnswlib::VisitedListPool(1, n));
+
+    for (int round = 0; round < 3; round++) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.push_back(std::thread([&]() {
+                std::vector<hnswlib::VisitedList *> first(num_pools, nullptr);
+                for (int it = 0; it < 100; it++) {
+                    for (int p = 0; p < num_pools; p++) {
+                        hnswlib::VisitedList *vl = pools[p]->getFreeVisitedList();
+                        // no pool evicts the list of another, the thread gets the same one back
+                        if (it == 0)
+                            first[p] = vl;
+                        assert(vl == first[p]);
+                        pools[p]->releaseVisitedList(vl);
+                    }
+                }
+            }));
+        }
+        for (auto &thread : threads) thread.join();
+    }
+}
+
+void testThreads() {
+    int n = 500;
+    int num_threads = 8;
+    int num_iterations = 2000;
+    hnswlib::VisitedListPool pool_a(1, n);
+    hnswlib::VisitedListPool *pool_b = new hnswlib::VisitedListPool(1, n);
+
+    for (int round = 0; round < 3; round++) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; t++) {
+            threads.push_back(std::thread([&]() {
+                for (int it = 0; it < num_iterations; it++) {
+                    hnswlib::VisitedList *a = pool_a.getFreeVisitedList();
+                    hnswlib::VisitedList *b = pool_b->getFreeVisitedList();
+                    assert(a != b);
+                    // a list is never handed to two threads at once
+                    for (int i = 0; i < n; i++) {
+                        assert(a->mass[i] != a->curV);
+                        a->mass[i] = a->curV;
+                    }
+                    for (int i = 0; i < n; i++) {
+                        assert(a->mass[i] == a->curV);
+                    }
+                    pool_b->releaseVisitedList(b);
+                    pool_a.releaseVisitedList(a);
+                }
+            }));
+        }
+        for (auto &thread : threads) thread.join();
+
+        // lists cached by the main thread must not outlive the pool they belong to
+        hnswlib::VisitedList *b = pool_b->getFreeVisitedList();
+        pool_b->releaseVisitedList(b);
+        delete pool_b;
+        pool_b = new hnswlib::VisitedListPool(1, n);
+    }
+    delete pool_b;
+
+    hnswlib::VisitedList *a = pool_a.getFreeVisitedList();
+    pool_a.releaseVisitedList(a);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Testing ..." << std::endl;
+    testNestedAndReset();
+    testWrap();
+    testManyPools();
+    testThreads();
+    std::cout << "Test ok" << std::endl;
+
+    return 0;
+}
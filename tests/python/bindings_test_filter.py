@@ -55,3 +55,15 @@ class RandomSelfTestCase(unittest.TestCase):
 
         labels, distances = bf_index.knn_query(data, k=1, filter=filter_function)
         self.assertEqual(np.mean(labels.reshape(-1) == np.arange(len(data))), .5)
+
+        print("Querying only even elements with allowed_ids")
+        even_ids = np.arange(0, num_elements, 2)
+        labels, distances = hnsw_index.knn_query(data, k=1, allowed_ids=even_ids)
+        self.assertAlmostEqual(np.mean(labels.reshape(-1) == np.arange(len(data))), .5, 3)
+        self.assertTrue(np.max(np.mod(labels, 2)) == 0)
+
+        # few allowed elements are scanned, the results are exact
+        few_ids = np.arange(0, num_elements, 500)
+        labels, distances = hnsw_index.knn_query(data, k=1, allowed_ids=few_ids)
+        bf_labels, bf_distances = bf_index.knn_query(data, k=1, filter=lambda id: id % 500 == 0)
+        self.assertTrue(np.array_equal(labels, bf_labels))
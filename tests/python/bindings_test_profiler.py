@@ -0,0 +1,36 @@
+import unittest
+
+import numpy as np
+
+import hnswlib
+
+
+class RandomSelfTestCase(unittest.TestCase):
+    def testProfile(self):
+        dim = 16
+        num_elements = 2000
+
+        data = np.float32(np.random.random((num_elements, dim)))
+
+        hnswlib.reset_profile()
+
+        p = hnswlib.Index(space='l2', dim=dim)
+        p.init_index(max_elements=num_elements, ef_construction=100, M=16)
+        p.add_items(data)
+        p.set_ef(50)
+        p.knn_query(data[:100], k=1)
+
+        profile = hnswlib.get_profile()
+        if not hnswlib.profiler_enabled():
+            self.assertEqual(profile, {})
+            return
+
+        self.assertIn('searchKnn_base_layer', profile)
+        self.assertIn('addPoint_layer_search', profile)
+        self.assertEqual(sum(e['calls'] for e in profile['searchKnn_base_layer']), 100)
+        for entries in profile.values():
+            levels = [e['level'] for e in entries]
+            self.assertEqual(levels, sorted(levels))
+
+        hnswlib.reset_profile()
+        self.assertEqual(hnswlib.get_profile(), {})
@@ -0,0 +1,38 @@
+import unittest
+
+import numpy as np
+
+import hnswlib
+
+
+class RandomSelfTestCase(unittest.TestCase):
+    def testSearchCounters(self):
+        dim = 16
+        num_elements = 2000
+
+        data = np.float32(np.random.random((num_elements, dim)))
+
+        p = hnswlib.Index(space='l2', dim=dim)
+        p.init_index(max_elements=num_elements, ef_construction=100, M=16)
+        p.add_items(data)
+        p.set_ef(50)
+
+        hnswlib.reset_search_counters()
+        p.knn_query(data[:100], k=1)
+
+        counters = hnswlib.get_search_counters()
+        self.assertEqual(counters['searches'], 100)
+        self.assertGreaterEqual(counters['visited'], 100 * 50)
+        self.assertGreaterEqual(counters['distance_computations'], counters['visited'])
+        self.assertGreater(counters['hops'], 100)
+        self.assertEqual(counters['filtered_out'], 0)
+
+        p.mark_deleted(0)
+        p.knn_query(data[:1], k=1)
+        counters = hnswlib.get_search_counters()
+        self.assertEqual(counters['searches'], 101)
+        self.assertGreater(counters['filtered_out'], 0)
+
+        hnswlib.reset_search_counters()
+        self.assertEqual(hnswlib.get_search_counters(),
+                         {'searches': 0, 'hops': 0, 'distance_computations': 0, 'visited': 0, 'filtered_out': 0})